@@ -115,6 +115,14 @@ void trfm_pix_geo(const double *trfm, double col, double row, double *x , double
 
 void sort_int(int * a, int * b);
 
+// -------------------------------------------------------------------
+/**
+ * swaps two doubles if a is greater than b
+ * @param a lower value after the call
+ * @param b upper value after the call
+ */
+void sort_dbl(double * a, double * b);
+
 // -------------------------------------------------------------------
 /**
  * transformation from world to pixel coordinates
@@ -0,0 +1,121 @@
+/* calc.h --- Band math expressions compiled to a vector tape
+ */
+
+#ifndef INCLUDED_CALC_H
+#define INCLUDED_CALC_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+
+// Maximal number of raster variables
+#define GISTK_CALC_MAX_VARS 26
+
+// ---------------------------------------------------------------
+/**
+ * Operations of the tape
+ */
+typedef enum {
+  GISTK_CALC_VAR,
+  GISTK_CALC_CONST,
+  GISTK_CALC_ADD,
+  GISTK_CALC_SUB,
+  GISTK_CALC_MUL,
+  GISTK_CALC_DIV,
+  GISTK_CALC_MOD,
+  GISTK_CALC_POW,
+  GISTK_CALC_NEG,
+  GISTK_CALC_NOT,
+  GISTK_CALC_LT,
+  GISTK_CALC_LE,
+  GISTK_CALC_GT,
+  GISTK_CALC_GE,
+  GISTK_CALC_EQ,
+  GISTK_CALC_NE,
+  GISTK_CALC_AND,
+  GISTK_CALC_OR,
+  GISTK_CALC_SELECT,
+  GISTK_CALC_ABS,
+  GISTK_CALC_SQRT,
+  GISTK_CALC_EXP,
+  GISTK_CALC_LOG,
+  GISTK_CALC_FLOOR,
+  GISTK_CALC_CEIL,
+  GISTK_CALC_MIN,
+  GISTK_CALC_MAX,
+  GISTK_CALC_ISNODATA
+} gistk_calc_op_t;
+
+// ---------------------------------------------------------------
+/**
+ * Instruction, the operands are indices of earlier instructions,
+ * a variable keeps its index in a
+ */
+typedef struct {
+  gistk_calc_op_t op;
+  int a;
+  int b;
+  int c;
+  double value;
+} gistk_calc_instr_t;
+
+// ---------------------------------------------------------------
+/**
+ * Compiled expression. Every instruction runs as one loop over a
+ * whole block, so there is no interpreter work per pixel. Nodata
+ * is NAN and propagates through the arithmetic, the comparisons,
+ * the logic operators and the condition of ?:.
+ */
+typedef struct {
+  gistk_calc_instr_t * tape;
+  int num_instr;
+  int mem_instr;
+  int num_vars;
+  bool uses[GISTK_CALC_MAX_VARS];
+} gistk_calc_t;
+
+// ---------------------------------------------------------------
+/**
+ * Compiles an expression with the operators ?: || && < <= > >= ==
+ * != + - * / % ^ ! the functions abs sqrt exp log floor ceil min
+ * max isnodata and the constant nodata; constant parts are folded
+ * @param expr the expression
+ * @param num_vars number of variables
+ * @param names names of the variables
+ * @param calc the compiled expression
+ */
+void gistk_calc_compile(const char * expr, int num_vars,
+                        const char * const * names, gistk_calc_t * calc);
+
+// ---------------------------------------------------------------
+/**
+ * Number of doubles the evaluation of a block needs as scratch
+ * @param calc the compiled expression
+ * @param n pixels per block
+ * @return the scratch size
+ */
+size_t gistk_calc_work_size(const gistk_calc_t * calc, size_t n);
+
+// ---------------------------------------------------------------
+/**
+ * Evaluates a block
+ * @param calc the compiled expression
+ * @param vars pixel buffers of the variables, nodata as NAN
+ * @param n pixels per block
+ * @param work scratch of gistk_calc_work_size doubles
+ * @param out the result, nodata as NAN
+ */
+void gistk_calc_eval(const gistk_calc_t * calc, const double * const * vars,
+                     size_t n, double * work, double * out);
+
+// ---------------------------------------------------------------
+/**
+ * Releases the tape
+ * @param calc the compiled expression
+ */
+void gistk_calc_free(gistk_calc_t * calc);
+
+#endif /* INCLUDED_CALC_H */
@@ -0,0 +1,90 @@
+/* catalog.h --- Footprint catalog of cut chips
+ */
+
+#ifndef INCLUDED_CATALOG_H
+#define INCLUDED_CATALOG_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gdal.h>
+#include <ogr_api.h>
+#include <ogr_srs_api.h>
+#include "ifgdv/util.h"
+
+// Vector format of the catalog
+#define GISTK_FMT_GPKG "GPKG"
+
+// Name of the catalog layer
+#define GISTK_CATALOG_LAYER "chips"
+
+// Features per transaction
+#define GISTK_CATALOG_BATCH 50000
+
+// ---------------------------------------------------------------
+/**
+ * Catalog of chip footprints with one prepared feature which is
+ * refilled for every chip
+ */
+typedef struct {
+  GDALDatasetH data;
+  OGRLayerH layer;
+  OGRFeatureH feature;
+  OGRGeometryH footprint;
+  int fld_id;
+  int fld_file;
+  int fld_scale;
+  int fld_col;
+  int fld_row;
+  int fld_width;
+  int fld_height;
+  int fld_status;
+  int fld_valid;
+  size_t num_batch;   // features of the open transaction
+  size_t num_chips;
+} gistk_catalog_t;
+
+// ---------------------------------------------------------------
+/**
+ * Creates a GeoPackage catalog without spatial index and opens the
+ * first transaction
+ * @param filename name of the GeoPackage
+ * @param source the raster the chips are cut from
+ * @param catalog the catalog container
+ */
+void gistk_catalog_open(const char * filename,
+                        const gistk_raster_t * source,
+                        gistk_catalog_t * catalog);
+
+// ---------------------------------------------------------------
+/**
+ * Adds the footprint of a chip, a full batch is committed
+ * @param catalog the catalog container
+ * @param source the raster the chips are cut from
+ * @param id identifier of the position
+ * @param file name of the chip file
+ * @param scale source pixels per chip pixel
+ * @param col left column of the source window [pixel]
+ * @param row upper row of the source window [pixel]
+ * @param width width of the source window [pixel]
+ * @param height height of the source window [pixel]
+ * @param status ADD, IGN or SKP
+ * @param valid valid fraction of the window, negative if unknown
+ */
+void gistk_catalog_add(gistk_catalog_t * catalog,
+                       const gistk_raster_t * source,
+                       int id, const char * file, int scale,
+                       long col, long row, int width, int height,
+                       const char * status, double valid);
+
+// ---------------------------------------------------------------
+/**
+ * Commits the last batch, builds the spatial index and closes the
+ * catalog
+ * @param catalog the catalog container
+ */
+void gistk_catalog_close(gistk_catalog_t * catalog);
+
+#endif /* INCLUDED_CATALOG_H */
@@ -0,0 +1,167 @@
+/* conv.h --- Pixel type conversion, scaling and normalization
+ */
+
+#ifndef INCLUDED_CONV_H
+#define INCLUDED_CONV_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <gdal.h>
+
+// GDAL knows half precision floats since 3.11
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,11,0)
+#define GISTK_HAS_FLOAT16 1
+#endif
+
+// Number of pixels the kernels convert in one vectorizable run
+#define GISTK_CONV_CHUNK 1024
+
+// Normalization modes
+typedef enum {
+  GISTK_NORM_NONE  = 0,  // no normalization
+  GISTK_NORM_CHIP  = 1,  // mean/std of every band of the chip
+  GISTK_NORM_FIXED = 2   // mean/std given by the user
+} gistk_norm_t;
+
+// ---------------------------------------------------------------
+/**
+ * Conversion applied to the pixels while they are copied.
+ * The value of a valid pixel v becomes
+ *    v' = clamp( (v - mean) / std * scale + offset )
+ * and is rounded to the nearest integer for integer output types.
+ * Nodata pixels of the source are mapped to out_nodata.
+ */
+typedef struct {
+  GDALDataType out_type;   // GDT_Unknown keeps the source type
+  double scale;
+  double offset;
+  bool   clamp;
+  double clamp_min;
+  double clamp_max;
+  gistk_norm_t norm;
+  double norm_mean;
+  double norm_std;
+  bool   has_out_nodata;
+  double out_nodata;
+} gistk_conv_t;
+
+// ---------------------------------------------------------------
+/**
+ * Initializes a conversion which leaves the pixels untouched
+ * @param conv the conversion container
+ */
+void gistk_conv_init(gistk_conv_t *conv);
+
+// ---------------------------------------------------------------
+/**
+ * Tests if a conversion changes type or values of the pixels
+ * @param conv the conversion container, NULL is allowed
+ * @return true if the pixels can be copied as they are
+ */
+bool gistk_conv_is_identity(const gistk_conv_t *conv);
+
+// ---------------------------------------------------------------
+/**
+ * Parses a data type name for the conversion
+ * @param name GDAL type name Byte, Int16, UInt16, Int32, UInt32,
+ *        Float16, Float32 or Float64
+ * @return the type or GDT_Unknown if the name is invalid
+ */
+GDALDataType gistk_conv_type_by_name(const char *name);
+
+// ---------------------------------------------------------------
+/**
+ * Tests if a value can be stored unchanged in a data type
+ * @param type the data type
+ * @param value the value, a nodata value fex
+ * @return true if the value is in the range of the type and whole
+ *         for the integer types
+ */
+bool gistk_conv_fits(GDALDataType type, double value);
+
+// ---------------------------------------------------------------
+/**
+ * Resolves the output type and the nodata value of the conversion
+ * for one source band
+ * @param conv the conversion container
+ * @param in_type type of the source band
+ * @param has_in_nodata source band has a nodata value
+ * @param out_type resulting output type
+ * @param has_out_nodata output band gets a nodata value, always for
+ *        floating point sources since NaN pixels map to nodata
+ * @param out_nodata the nodata value of the output band
+ */
+void gistk_conv_resolve(const gistk_conv_t *conv,
+                        GDALDataType in_type, bool has_in_nodata,
+                        GDALDataType *out_type,
+                        bool *has_out_nodata, double *out_nodata);
+
+// ---------------------------------------------------------------
+/**
+ * Adds the valid pixels of a buffer to running sums, so the moments
+ * of a window can be collected strip by strip
+ * @param in pixel buffer
+ * @param n number of pixels
+ * @param has_nodata the buffer contains nodata pixels
+ * @param nodata the nodata value
+ * @param sum running sum of the values
+ * @param sqr running sum of the squared values
+ * @param cnt running count of the valid pixels
+ */
+void gistk_conv_sums(const double *in, size_t n,
+                     bool has_nodata, double nodata,
+                     double *sum, double *sqr, size_t *cnt);
+
+// ---------------------------------------------------------------
+/**
+ * Mean and standard deviation from running sums
+ * @param sum sum of the values
+ * @param sqr sum of the squared values
+ * @param cnt count of the valid pixels
+ * @param mean resulting mean, 0 if no pixel is valid
+ * @param std resulting standard deviation, 1 if it would be 0
+ */
+void gistk_conv_moments(double sum, double sqr, size_t cnt,
+                        double *mean, double *std);
+
+// ---------------------------------------------------------------
+/**
+ * Mean and standard deviation of the valid pixels of a buffer
+ * @param in pixel buffer
+ * @param n number of pixels
+ * @param has_nodata the buffer contains nodata pixels
+ * @param nodata the nodata value
+ * @param mean resulting mean, 0 if no pixel is valid
+ * @param std resulting standard deviation, 1 if it would be 0
+ */
+void gistk_conv_stats(const double *in, size_t n,
+                      bool has_nodata, double nodata,
+                      double *mean, double *std);
+
+// ---------------------------------------------------------------
+/**
+ * Converts a pixel buffer
+ * @param conv the conversion container
+ * @param in source pixels
+ * @param n number of pixels
+ * @param has_in_nodata source contains nodata pixels
+ * @param in_nodata source nodata value
+ * @param mean mean used for normalization
+ * @param std standard deviation used for normalization
+ * @param out_type output type from gistk_conv_resolve
+ * @param out_nodata output nodata value from gistk_conv_resolve
+ * @param out output buffer of n pixels of out_type
+ */
+void gistk_conv_apply(const gistk_conv_t *conv,
+                      const double *in, size_t n,
+                      bool has_in_nodata, double in_nodata,
+                      double mean, double std,
+                      GDALDataType out_type, double out_nodata,
+                      void *out);
+
+#endif /* INCLUDED_CONV_H */
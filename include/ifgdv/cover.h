@@ -0,0 +1,97 @@
+/* cover.h --- Coarse coverage mask of a raster source
+ */
+
+#ifndef INCLUDED_COVER_H
+#define INCLUDED_COVER_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ifgdv/util.h"
+
+// Default edge length of a mask cell [pixel]
+#define GISTK_COVER_CELL 32
+
+// Suffix of the persisted coverage mask
+#define GISTK_COVER_EXT ".cover.tif"
+
+// ---------------------------------------------------------------
+/**
+ * Fraction of valid (non nodata) pixels of the first band for
+ * cells of cell x cell source pixels
+ */
+typedef struct {
+  int cell;
+  int num_cols;
+  int num_rows;
+  int src_cols;
+  int src_rows;
+  float * valid;
+} gistk_cover_t;
+
+// ---------------------------------------------------------------
+/**
+ * Loads the coverage mask persisted beside the source or builds
+ * and persists it if it is missing or older than the source
+ * @param filename name of the source file
+ * @param source an open raster container of the source
+ * @param cell edge length of a mask cell [pixel]
+ * @param result the mask container
+ */
+void gistk_cover_open(const char * filename,
+                      const gistk_raster_t * source,
+                      int cell,
+                      gistk_cover_t * result);
+
+// ---------------------------------------------------------------
+/**
+ * Builds the coverage mask from the mask band of the best fitting
+ * overview or from one sequential pass over the full resolution
+ * @param source an open raster container
+ * @param cell edge length of a mask cell [pixel]
+ * @param result the mask container
+ */
+void gistk_cover_build(const gistk_raster_t * source,
+                       int cell,
+                       gistk_cover_t * result);
+
+// ---------------------------------------------------------------
+/**
+ * Bounds of the valid fraction of a pixel window
+ * @param cover the mask
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @param lower lowest possible valid fraction
+ * @param estimate valid fraction if the cells are uniform
+ * @param upper highest possible valid fraction
+ */
+void gistk_cover_bounds(const gistk_cover_t * cover,
+                        int x0, int y0, int width, int height,
+                        double * lower, double * estimate, double * upper);
+
+// ---------------------------------------------------------------
+/**
+ * Exact valid fraction of a pixel window read at full resolution
+ * from the mask band of the first band
+ * @param source an open raster container
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @return the valid fraction
+ */
+double gistk_cover_exact(const gistk_raster_t * source,
+                         int x0, int y0, int width, int height);
+
+// ---------------------------------------------------------------
+/**
+ * Releases the memory of a coverage mask
+ * @param cover the mask container
+ */
+void gistk_cover_free(gistk_cover_t * cover);
+
+#endif /* INCLUDED_COVER_H */
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <setjmp.h>
 
 #define GISTK_ERRS_INVALID_NUMERIC "Invalid numeric value %s: %s\n!"
 
@@ -99,10 +100,214 @@
 #define GISTK_ERRC_CUT_RST_HEIGHT GISTK_ERRC_CUT_RST_BASE+3
 #define GISTK_ERRS_CUT_RST_HEIGHT "Cut window hight is 0 for file %s!"
 
-                                
+#define GISTK_ERRC_CUT_RST_CREATE GISTK_ERRC_CUT_RST_BASE+4
+#define GISTK_ERRS_CUT_RST_CREATE "Cannot create the cut raster file %s!"
+
+#define GISTK_ERRC_CUT_RST_SCALES GISTK_ERRC_CUT_RST_BASE+5
+#define GISTK_ERRS_CUT_RST_SCALES "Multi scale cuts of %s are not streamed!"
+
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_COVER_BASE  10500
+
+#define GISTK_ERRC_COVER_CELL  GISTK_ERRC_COVER_BASE+1
+#define GISTK_ERRS_COVER_CELL  "Invalid cell size %d for the coverage mask!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_PIPE_BASE  10600
+
+#define GISTK_ERRC_PIPE_MEM  GISTK_ERRC_PIPE_BASE+1
+#define GISTK_ERRS_PIPE_MEM  "Cannot allocate a ring buffer of %zu items!"
+
+#define GISTK_ERRC_PIPE_THREAD  GISTK_ERRC_PIPE_BASE+2
+#define GISTK_ERRS_PIPE_THREAD  "Cannot start the pipeline threads!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_SCALE_BASE  10700
+
+#define GISTK_ERRC_SCALE_MEM  GISTK_ERRC_SCALE_BASE+1
+#define GISTK_ERRS_SCALE_MEM  "Cannot allocate the buffers for a scale reduction!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_TILE_BASE  10800
+
+#define GISTK_ERRC_TILE_READ  GISTK_ERRC_TILE_BASE+1
+#define GISTK_ERRS_TILE_READ  "Cannot read block %d/%d of band %d!"
+#define GISTK_ERRS_TILE_WINDOW  "Cannot read the window at %d/%d of band %d!"
+
+#define GISTK_ERRC_TILE_THREAD  GISTK_ERRC_TILE_BASE+2
+#define GISTK_ERRS_TILE_THREAD  "Cannot start the prefetch thread for %s!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_LIB_BASE  10900
+
+#define GISTK_ERRC_LIB_ARGS  GISTK_ERRC_LIB_BASE+1
+#define GISTK_ERRS_LIB_ARGS  "Invalid arguments for %s!"
+
+#define GISTK_ERRC_LIB_OUTSIDE  GISTK_ERRC_LIB_BASE+2
+#define GISTK_ERRS_LIB_OUTSIDE  "Window or point outside of the raster!"
+
+#define GISTK_ERRC_LIB_NODATA  GISTK_ERRC_LIB_BASE+3
+#define GISTK_ERRS_LIB_NODATA  "No data at the point!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_CATALOG_BASE  11000
+
+#define GISTK_ERRC_CATALOG_CREATE  GISTK_ERRC_CATALOG_BASE+1
+#define GISTK_ERRS_CATALOG_CREATE  "Cannot create the catalog %s!"
+
+#define GISTK_ERRC_CATALOG_FIELD  GISTK_ERRC_CATALOG_BASE+2
+#define GISTK_ERRS_CATALOG_FIELD  "Cannot create the catalog field %s!"
+
+#define GISTK_ERRC_CATALOG_FEATURE  GISTK_ERRC_CATALOG_BASE+3
+#define GISTK_ERRS_CATALOG_FEATURE  "Cannot add chip %d %s to the catalog!"
+
+#define GISTK_ERRC_CATALOG_COMMIT  GISTK_ERRC_CATALOG_BASE+4
+#define GISTK_ERRS_CATALOG_COMMIT  "Cannot %s a catalog transaction!"
+
+#define GISTK_ERRC_CATALOG_INDEX  GISTK_ERRC_CATALOG_BASE+5
+#define GISTK_ERRS_CATALOG_INDEX  "Cannot create the spatial index of the catalog %s!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_STATS_BASE  11100
+
+#define GISTK_ERRC_STATS_THREAD  GISTK_ERRC_STATS_BASE+1
+#define GISTK_ERRS_STATS_THREAD  "Cannot start the statistics threads!"
+
+#define GISTK_ERRC_STATS_READ  GISTK_ERRC_STATS_BASE+2
+#define GISTK_ERRS_STATS_READ  "Cannot read %s in a statistics thread!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_FLOOD_BASE  11200
+
+#define GISTK_ERRC_FLOOD_THREAD  GISTK_ERRC_FLOOD_BASE+1
+#define GISTK_ERRS_FLOOD_THREAD  "Cannot start the flood threads!"
+
+#define GISTK_ERRC_FLOOD_READ  GISTK_ERRC_FLOOD_BASE+2
+#define GISTK_ERRS_FLOOD_READ  "Cannot read %s in a flood thread!"
+
+#define GISTK_ERRC_FLOOD_NODES  GISTK_ERRC_FLOOD_BASE+3
+#define GISTK_ERRS_FLOOD_NODES  "Too many tile border cells in %s, "\
+  "use larger tiles!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_CONTOUR_BASE  11300
+
+#define GISTK_ERRC_CONTOUR_THREAD  GISTK_ERRC_CONTOUR_BASE+1
+#define GISTK_ERRS_CONTOUR_THREAD  "Cannot start the contour threads!"
+
+#define GISTK_ERRC_CONTOUR_READ  GISTK_ERRC_CONTOUR_BASE+2
+#define GISTK_ERRS_CONTOUR_READ  "Cannot read %s in a contour thread!"
+
+#define GISTK_ERRC_CONTOUR_CREATE  GISTK_ERRC_CONTOUR_BASE+3
+#define GISTK_ERRS_CONTOUR_CREATE  "Cannot create the contour layer in %s!"
+
+#define GISTK_ERRC_CONTOUR_COMMIT  GISTK_ERRC_CONTOUR_BASE+4
+#define GISTK_ERRS_CONTOUR_COMMIT  "Cannot %s a contour transaction!"
+
+#define GISTK_ERRC_CONTOUR_FEATURE  GISTK_ERRC_CONTOUR_BASE+5
+#define GISTK_ERRS_CONTOUR_FEATURE  "Cannot write a contour line of level %g!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_CALC_BASE  11400
+
+#define GISTK_ERRC_CALC_SYNTAX  GISTK_ERRC_CALC_BASE+1
+#define GISTK_ERRS_CALC_SYNTAX  "Expected %s at character %d of "\
+  "expression %s!"
+
+#define GISTK_ERRC_CALC_GRID  GISTK_ERRC_CALC_BASE+2
+#define GISTK_ERRS_CALC_GRID  "Raster %s is not on the grid of %s!"
+
+#define GISTK_ERRC_CALC_THREAD  GISTK_ERRC_CALC_BASE+3
+#define GISTK_ERRS_CALC_THREAD  "Cannot start the calculation threads!"
+
+#define GISTK_ERRC_CALC_READ  GISTK_ERRC_CALC_BASE+4
+#define GISTK_ERRS_CALC_READ  "Cannot read the inputs in a calculation thread!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_DIFF_BASE  11500
+
+#define GISTK_ERRC_DIFF_GRID  GISTK_ERRC_DIFF_BASE+1
+#define GISTK_ERRS_DIFF_GRID  "Raster %s is not on the grid of %s!"
+
+#define GISTK_ERRC_DIFF_THREAD  GISTK_ERRC_DIFF_BASE+2
+#define GISTK_ERRS_DIFF_THREAD  "Cannot start the comparison threads!"
+
+#define GISTK_ERRC_DIFF_READ  GISTK_ERRC_DIFF_BASE+3
+#define GISTK_ERRS_DIFF_READ  "Cannot compare the blocks of %s and %s!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_REPROJ_BASE  11600
+
+#define GISTK_ERRC_REPROJ_SRS  GISTK_ERRC_REPROJ_BASE+1
+#define GISTK_ERRS_REPROJ_SRS  "Unknown spatial reference system %s!"
+
+#define GISTK_ERRC_REPROJ_TRANS  GISTK_ERRC_REPROJ_BASE+2
+#define GISTK_ERRS_REPROJ_TRANS  "Cannot transform from %s into the "\
+  "reference system of the raster!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_LOSSY_BASE  11700
+
+#define GISTK_ERRC_LOSSY_CODEC  GISTK_ERRC_LOSSY_BASE+1
+#define GISTK_ERRS_LOSSY_CODEC  "The format %s cannot store %s with the "\
+  "compression %s!"
+
+#define GISTK_ERRC_LOSSY_REOPEN  GISTK_ERRC_LOSSY_BASE+2
+#define GISTK_ERRS_LOSSY_REOPEN  "Cannot reopen %s to check the error bound!"
+
+#define GISTK_ERRC_LOSSY_BOUND  GISTK_ERRC_LOSSY_BASE+3
+#define GISTK_ERRS_LOSSY_BOUND  "Band %d of %s has %ld pixels beyond the "\
+  "error bound %g, the worst is %g!"
+
+// --------------------------------------------------------------
+#define GISTK_ERRC_STORE_BASE  11800
+
+#define GISTK_ERRC_STORE_DIR  GISTK_ERRC_STORE_BASE+1
+#define GISTK_ERRS_STORE_DIR  "Cannot create the result store %s!"
+
+#define GISTK_ERRC_STORE_LOCK  GISTK_ERRC_STORE_BASE+2
+#define GISTK_ERRS_STORE_LOCK  "Cannot lock the index of the result store %s!"
+
+#define GISTK_ERRC_STORE_INDEX  GISTK_ERRC_STORE_BASE+3
+#define GISTK_ERRS_STORE_INDEX  "Cannot write the index of the result store %s!"
+
+// Length of a trapped error message
+#define GISTK_ERROR_MSG 512
+
+// --------------------------------------------------------------
+/**
+ * Error trap of a library call. While a trap is set in a thread,
+ * gistk_error_fatal stores code and message in the trap and jumps
+ * back to its setjmp instead of exiting the process.
+ */
+typedef struct gistk_error_trap_s {
+  jmp_buf env;
+  int code;
+  char message[GISTK_ERROR_MSG];
+  struct gistk_error_trap_s * prev;
+} gistk_error_trap_t;
+
+// --------------------------------------------------------------
+/**
+ * Sets a trap for the calling thread, call setjmp(trap->env)
+ * right after it in the same function
+ * @param trap the trap container
+ */
+void gistk_error_trap(gistk_error_trap_t * trap);
+
+// --------------------------------------------------------------
+/**
+ * Releases the trap of the calling thread, the previous trap
+ * becomes active again
+ * @param trap the trap container
+ */
+void gistk_error_untrap(gistk_error_trap_t * trap);
+
 // =================================================================
 /**
- * central error exit point
+ * central error exit point, jumps to the trap of the thread if
+ * one is set
  * @param code    exit code
  * @param message message template sprintf format
  * @param ...     parameter
@@ -0,0 +1,127 @@
+/* gistk.h --- Reentrant batch API of libgistk
+ */
+
+#ifndef INCLUDED_GISTK_H
+#define INCLUDED_GISTK_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <gdal.h>
+#include <ogr_srs_api.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ifgdv/util.h"
+
+// Result of a successful call or request
+#define GISTK_OK 0
+
+// ---------------------------------------------------------------
+/**
+ * Handle of an open source raster. A context can be shared by many
+ * threads, every call borrows its own dataset handle, tile cache and
+ * chip buffers from a pool of the context and returns them after
+ * the call, so the open costs are paid once per thread and not per
+ * request.
+ */
+typedef struct gistk_ctx_s gistk_ctx_t;
+
+// ---------------------------------------------------------------
+/**
+ * One window of a cut batch
+ */
+typedef struct {
+  double x;               // center of the window [world]
+  double y;
+  const char * filename;  // writes a GeoTIFF chip if not NULL
+  void * buffer;          // copies the bands band sequential if not NULL
+  int status;             // GISTK_OK or the error code of the request
+} gistk_cut_req_t;
+
+// ---------------------------------------------------------------
+/**
+ * Opens a source raster for the batch calls
+ * @param filename name of the raster file
+ * @param cache_bytes tile cache budget per thread, 0 reads through GDAL
+ * @param ctx receives the context handle
+ * @return GISTK_OK or an error code, see gistk_last_error
+ */
+int gistk_ctx_open(const char * filename, size_t cache_bytes,
+                   gistk_ctx_t ** ctx);
+
+// ---------------------------------------------------------------
+/**
+ * Gets the size and the geo transformation of the source
+ * @param ctx the context handle
+ * @param num_cols width of the raster
+ * @param num_rows height of the raster
+ * @param num_bands number of bands
+ * @param trfm affine transformation, 6 parameter
+ */
+void gistk_ctx_info(const gistk_ctx_t * ctx,
+                    int * num_cols, int * num_rows, int * num_bands,
+                    double * trfm);
+
+// ---------------------------------------------------------------
+/**
+ * Closes the context, no call may run on it anymore
+ * @param ctx the context handle
+ */
+void gistk_ctx_close(gistk_ctx_t * ctx);
+
+// ---------------------------------------------------------------
+/**
+ * Cuts a batch of windows. A buffer takes the converted source bands
+ * followed by the derived bands, width * height pixels of buf_type
+ * each. Failing windows get their error code in the status and do
+ * not stop the batch.
+ * @param ctx the context handle
+ * @param opts cut options, NULL copies the pixels unchanged, multi
+ *        scale cuts are not available
+ * @param width width of the windows [pixel]
+ * @param height height of the windows [pixel]
+ * @param buf_type pixel type of the buffers
+ * @param reqs the requests
+ * @param num_reqs number of requests
+ * @return GISTK_OK if all windows are cut, else the first error code
+ */
+int gistk_cut_batch(gistk_ctx_t * ctx, const gistk_cut_opts_t * opts,
+                    int width, int height, GDALDataType buf_type,
+                    gistk_cut_req_t * reqs, size_t num_reqs);
+
+// ---------------------------------------------------------------
+/**
+ * Samples a band at a batch of points, the points are read in
+ * block order and the values returned in request order
+ * @param ctx the context handle
+ * @param band number of the band starting with 1
+ * @param x X-coordinates of the points [world]
+ * @param y Y-coordinates of the points [world]
+ * @param num_points number of points
+ * @param values receives the pixel values, NAN if not available
+ * @param status receives GISTK_OK, GISTK_ERRC_LIB_OUTSIDE or
+ *        GISTK_ERRC_LIB_NODATA per point, may be NULL
+ * @return GISTK_OK if the batch ran, else an error code
+ */
+int gistk_sample_batch(gistk_ctx_t * ctx, int band,
+                       const double * x, const double * y,
+                       size_t num_points, double * values, int * status);
+
+// ---------------------------------------------------------------
+/**
+ * Message of the last error of the calling thread
+ */
+const char * gistk_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDED_GISTK_H */
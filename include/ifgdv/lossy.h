@@ -0,0 +1,105 @@
+/* lossy.h --- Error bounded storage of rasters
+ */
+
+#ifndef INCLUDED_LOSSY_H
+#define INCLUDED_LOSSY_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <gdal.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+
+// Error bounded codecs
+typedef enum {
+  GISTK_LOSSY_NONE  = 0,  // lossless
+  GISTK_LOSSY_LERC  = 1,  // LERC_ZSTD with MAX_Z_ERROR
+  GISTK_LOSSY_QUANT = 2   // quantized floats, predictor and ZSTD
+} gistk_lossy_t;
+
+// ---------------------------------------------------------------
+/**
+ * Parses a codec and its maximal absolute error
+ * @param text lerc:ERROR, quant:ERROR or ERROR for lerc
+ * @param mode the codec
+ * @param max_error the maximal absolute error, greater than 0
+ * @return false if the text is invalid
+ */
+bool gistk_lossy_parse(const char * text, gistk_lossy_t * mode,
+                       double * max_error);
+
+// ---------------------------------------------------------------
+/**
+ * Name of a codec
+ * @param mode the codec
+ * @return none, lerc or quant
+ */
+const char * gistk_lossy_name(gistk_lossy_t mode);
+
+// ---------------------------------------------------------------
+/**
+ * Quantization step of a maximal error, the largest power of two
+ * not above twice the error. Multiples of it are exact floats with
+ * zero low mantissa bits, which the float predictor turns into
+ * long runs for ZSTD.
+ * @param max_error the maximal absolute error
+ * @return the step
+ */
+double gistk_lossy_step(double max_error);
+
+// ---------------------------------------------------------------
+/**
+ * Adds the creation options of a codec, the driver has to be
+ * GTiff and to know the compression
+ * @param driver the driver of the target
+ * @param mode the codec
+ * @param max_error the maximal absolute error
+ * @param type the data type of the target
+ * @param options the creation options, destroyed on an error
+ * @return the extended creation options
+ */
+char ** gistk_lossy_options(GDALDriverH driver, gistk_lossy_t mode,
+                            double max_error, GDALDataType type,
+                            char ** options);
+
+// ---------------------------------------------------------------
+/**
+ * Rounds the valid values to the nearest multiple of a step
+ * @param values the values, quantized in place
+ * @param n number of values
+ * @param has_nodata the values contain nodata
+ * @param nodata the nodata value, kept unchanged like NaN
+ * @param step the quantization step
+ */
+void gistk_lossy_quantize(double * values, size_t n,
+                          bool has_nodata, double nodata, double step);
+
+// ---------------------------------------------------------------
+/**
+ * Compares written rows of a band with the values they were
+ * written from. Nodata and NaN have to come back exactly, whatever
+ * the target band declares, and no valid value may turn into them.
+ * Any other value has to be within the maximal error.
+ * @param band the band of the reopened target
+ * @param row first row of the values in the band
+ * @param width width of the values
+ * @param height height of the values
+ * @param ref the values
+ * @param ref_type type of the values
+ * @param has_nodata the values contain nodata
+ * @param nodata the nodata value of the values
+ * @param max_error the maximal absolute error
+ * @param worst the largest absolute error seen, may be NULL
+ * @return number of values outside the bound, -1 on a read error
+ */
+long gistk_lossy_check(GDALRasterBandH band, int row,
+                       int width, int height,
+                       const void * ref, GDALDataType ref_type,
+                       bool has_nodata, double nodata,
+                       double max_error, double * worst);
+
+#endif /* INCLUDED_LOSSY_H */
@@ -0,0 +1,205 @@
+/* pipe.h --- Bounded read/transform/write pipeline and worker pools
+ */
+
+#ifndef INCLUDED_PIPE_H
+#define INCLUDED_PIPE_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <gdal.h>
+
+// Default number of items in flight
+#define GISTK_PIPE_DEPTH 4
+
+// ---------------------------------------------------------------
+/**
+ * Lock free ring buffer of pointers for exactly one producer and
+ * one consumer thread
+ */
+typedef struct {
+  void ** slots;
+  size_t capacity;
+  size_t head;   // next slot to pop, written by the consumer
+  size_t tail;   // next slot to push, written by the producer
+} gistk_ring_t;
+
+// ---------------------------------------------------------------
+/**
+ * Initializes a ring buffer
+ * @param ring the ring container
+ * @param capacity maximal number of items in the ring
+ */
+void gistk_ring_init(gistk_ring_t * ring, size_t capacity);
+
+// ---------------------------------------------------------------
+/**
+ * Appends an item, waits while the ring is full
+ * @param ring the ring container
+ * @param item the item
+ */
+void gistk_ring_push(gistk_ring_t * ring, void * item);
+
+// ---------------------------------------------------------------
+/**
+ * Removes the oldest item, waits while the ring is empty
+ * @param ring the ring container
+ * @return the item
+ */
+void * gistk_ring_pop(gistk_ring_t * ring);
+
+// ---------------------------------------------------------------
+/**
+ * Releases the memory of a ring buffer
+ * @param ring the ring container
+ */
+void gistk_ring_free(gistk_ring_t * ring);
+
+// ---------------------------------------------------------------
+/**
+ * Reader stage, fills the next item
+ * @param ctx the context of the caller
+ * @param item a free pool item
+ * @return false if the input is exhausted
+ */
+typedef bool (*gistk_pipe_read_f)(void * ctx, void * item);
+
+// ---------------------------------------------------------------
+/**
+ * Transform or writer stage working on an item
+ * @param ctx the context of the caller
+ * @param item the item
+ */
+typedef void (*gistk_pipe_work_f)(void * ctx, void * item);
+
+// ---------------------------------------------------------------
+/**
+ * Runs the stages reader -> transform -> writer on a pool of items.
+ * The reader runs in the calling thread, transform and writer get a
+ * thread each. The items are handed from stage to stage through
+ * lock free rings and return to the reader after writing, so at most
+ * depth items are in flight. Items are written in reading order.
+ * @param ctx the context of the caller passed to the stages
+ * @param items the pool of items
+ * @param depth number of items in the pool, 0 runs the stages
+ *        serially in the calling thread with the first item
+ * @param read the reader stage
+ * @param transform the transform stage
+ * @param write the writer stage
+ */
+void gistk_pipe_run(void * ctx, void ** items, int depth,
+                    gistk_pipe_read_f read,
+                    gistk_pipe_work_f transform,
+                    gistk_pipe_work_f write);
+
+// ---------------------------------------------------------------
+/**
+ * Worker of a pool, runs in each pool thread and takes the items
+ * with gistk_pool_next
+ * @param ctx the context of the caller
+ */
+typedef void (*gistk_pool_work_f)(void * ctx);
+
+// ---------------------------------------------------------------
+/**
+ * Pool of worker threads sharing numbered items. The items are taken
+ * with an atomic add, a failed worker stops the others at their next
+ * item. The lock guards what the workers share, their outputs fex.
+ */
+typedef struct {
+  int num_items;
+  int next;       // next item, taken with an atomic add
+  int failed;
+  pthread_mutex_t lock;
+  pthread_t * threads;
+  int num_threads;
+  gistk_pool_work_f work;
+  void * ctx;
+} gistk_pool_t;
+
+// ---------------------------------------------------------------
+/**
+ * Number of pool threads of the option -j THREADS
+ * @param arg the option argument, NULL for all cores
+ * @return the number of threads, at least 1
+ */
+int gistk_pool_threads(const char * arg);
+
+// ---------------------------------------------------------------
+/**
+ * Initializes a pool and its lock
+ * @param pool the pool container
+ */
+void gistk_pool_init(gistk_pool_t * pool);
+
+// ---------------------------------------------------------------
+/**
+ * Starts the workers on the items 0..num_items-1, at most one
+ * thread per item. The failed flag of a previous run is cleared.
+ * @param pool the pool container
+ * @param num_items number of items
+ * @param num_threads number of threads
+ * @param work the worker
+ * @param ctx the context of the caller passed to the worker
+ * @return false if the threads cannot be started, the started ones
+ *         are joined then
+ */
+bool gistk_pool_start(gistk_pool_t * pool, int num_items, int num_threads,
+                      gistk_pool_work_f work, void * ctx);
+
+// ---------------------------------------------------------------
+/**
+ * Waits for the workers of a pool
+ * @param pool the pool container
+ */
+void gistk_pool_join(gistk_pool_t * pool);
+
+// ---------------------------------------------------------------
+/**
+ * Starts the workers and waits for them
+ * @param pool the pool container
+ * @param num_items number of items
+ * @param num_threads number of threads
+ * @param work the worker
+ * @param ctx the context of the caller passed to the worker
+ * @return false if the threads cannot be started
+ */
+bool gistk_pool_run(gistk_pool_t * pool, int num_items, int num_threads,
+                    gistk_pool_work_f work, void * ctx);
+
+// ---------------------------------------------------------------
+/**
+ * Takes the next item in a worker
+ * @param pool the pool container
+ * @return the item, -1 if all are taken or a worker failed
+ */
+int gistk_pool_next(gistk_pool_t * pool);
+
+// ---------------------------------------------------------------
+/**
+ * Marks the run as failed, the workers stop at their next item
+ * @param pool the pool container
+ */
+void gistk_pool_fail(gistk_pool_t * pool);
+
+// ---------------------------------------------------------------
+/**
+ * Opens a dataset read only for one worker, GDAL handles are not
+ * thread safe. A dataset that cannot be opened fails the run.
+ * @param pool the pool container
+ * @param filename the dataset
+ * @return the handle or NULL
+ */
+GDALDatasetH gistk_pool_open(gistk_pool_t * pool, const char * filename);
+
+// ---------------------------------------------------------------
+/**
+ * Releases the lock of a pool
+ * @param pool the pool container
+ */
+void gistk_pool_free(gistk_pool_t * pool);
+
+#endif /* INCLUDED_PIPE_H */
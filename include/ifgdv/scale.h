@@ -0,0 +1,74 @@
+/* scale.h --- Reduction of pixel windows to coarser scales
+ */
+
+#ifndef INCLUDED_SCALE_H
+#define INCLUDED_SCALE_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+
+// Maximal number of scales per cut
+#define GISTK_SCALE_MAX 8
+
+// Reduction filters
+typedef enum {
+  GISTK_REDUCE_BOX   = 0,  // mean of the factor x factor block
+  GISTK_REDUCE_GAUSS = 1   // 5x5 binomial pyramid, factors 2^n
+} gistk_reduce_t;
+
+// ---------------------------------------------------------------
+/**
+ * Parses a comma separated list of integer scale factors
+ * @param list the list, 1,2,4 fex
+ * @param scales array of GISTK_SCALE_MAX factors
+ * @return number of factors, 0 if the list is invalid
+ */
+int gistk_scale_parse(const char *list, int *scales);
+
+// ---------------------------------------------------------------
+/**
+ * Tests if a factor is a power of two
+ * @param factor the factor
+ * @return true for 1, 2, 4, ...
+ */
+bool gistk_scale_is_pow2(int factor);
+
+// ---------------------------------------------------------------
+/**
+ * Box reduction, every output pixel is the mean of the valid
+ * pixels of a factor x factor block
+ * @param in first pixel of the input window
+ * @param stride number of pixels per input row
+ * @param out_w width of the output
+ * @param out_h height of the output
+ * @param factor reduction factor
+ * @param has_nodata the input contains nodata pixels
+ * @param nodata the nodata value, used for blocks without valid pixel
+ * @param out output buffer of out_w*out_h pixels
+ */
+void gistk_scale_box(const double *in, size_t stride,
+                     int out_w, int out_h, int factor,
+                     bool has_nodata, double nodata, double *out);
+
+// ---------------------------------------------------------------
+/**
+ * Gaussian pyramid reduction, the factor must be a power of two
+ * and every level halves the input with a 5x5 binomial kernel
+ * @param in first pixel of the input window
+ * @param stride number of pixels per input row
+ * @param out_w width of the output
+ * @param out_h height of the output
+ * @param factor reduction factor
+ * @param has_nodata the input contains nodata pixels
+ * @param nodata the nodata value
+ * @param out output buffer of out_w*out_h pixels
+ */
+void gistk_scale_gauss(const double *in, size_t stride,
+                       int out_w, int out_h, int factor,
+                       bool has_nodata, double nodata, double *out);
+
+#endif /* INCLUDED_SCALE_H */
@@ -0,0 +1,102 @@
+/* stats.h --- Mergeable band statistics and histograms
+ */
+
+#ifndef INCLUDED_STATS_H
+#define INCLUDED_STATS_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <gdal.h>
+
+// Bins of the histogram
+#define GISTK_STATS_BINS 256
+
+// Percentiles written into the metadata
+#define GISTK_STATS_PERCENTILES { 1, 2, 5, 25, 50, 75, 95, 98, 99 }
+
+// ---------------------------------------------------------------
+/**
+ * Statistics of the valid pixels of a band. The histogram spans
+ * [lo, lo + width) with a power of two width and lo a multiple of
+ * half of it, so it can span zero; it doubles its range when a
+ * value falls outside, so two accumulators merge exactly whatever
+ * they have seen.
+ */
+typedef struct {
+  GUIntBig count;
+  GUIntBig total;    // valid and nodata pixels
+  double min;
+  double max;
+  double mean;
+  double m2;         // sum of the squared deviations from the mean
+  double lo;
+  double width;
+  GUIntBig hist[GISTK_STATS_BINS];
+} gistk_stats_t;
+
+// ---------------------------------------------------------------
+/**
+ * Initializes an empty accumulator
+ * @param stats the accumulator
+ */
+void gistk_stats_init(gistk_stats_t *stats);
+
+// ---------------------------------------------------------------
+/**
+ * Adds a buffer of doubles, NaN and infinite values are counted as
+ * invalid like nodata
+ * @param stats the accumulator
+ * @param in pixel buffer
+ * @param n number of pixels
+ * @param has_nodata the buffer contains nodata pixels
+ * @param nodata the nodata value
+ */
+void gistk_stats_add(gistk_stats_t *stats, const double *in, size_t n,
+                     bool has_nodata, double nodata);
+
+// ---------------------------------------------------------------
+/**
+ * Adds a buffer of any GDAL type
+ * @param stats the accumulator
+ * @param in pixel buffer
+ * @param type type of the buffer
+ * @param n number of pixels
+ * @param has_nodata the buffer contains nodata pixels
+ * @param nodata the nodata value
+ */
+void gistk_stats_add_typed(gistk_stats_t *stats, const void *in,
+                           GDALDataType type, size_t n,
+                           bool has_nodata, double nodata);
+
+// ---------------------------------------------------------------
+/**
+ * Merges an accumulator into another one
+ * @param stats the target accumulator
+ * @param other the accumulator to add
+ */
+void gistk_stats_merge(gistk_stats_t *stats, const gistk_stats_t *other);
+
+// ---------------------------------------------------------------
+/**
+ * Approximate percentile from the histogram
+ * @param stats the accumulator
+ * @param p percentile 0..100
+ * @return the value, NAN without valid pixels
+ */
+double gistk_stats_percentile(const gistk_stats_t *stats, double p);
+
+// ---------------------------------------------------------------
+/**
+ * Writes the statistics, the default histogram and the percentiles
+ * STATISTICS_Pnn into the band metadata, file formats without own
+ * metadata keep them in the .aux.xml
+ * @param band the band
+ * @param stats the accumulator
+ */
+void gistk_stats_write(GDALRasterBandH band, const gistk_stats_t *stats);
+
+#endif /* INCLUDED_STATS_H */
@@ -0,0 +1,139 @@
+/* store.h --- Persistent content addressed store of cut results
+ */
+
+#ifndef INCLUDED_STORE_H
+#define INCLUDED_STORE_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "ifgdv/util.h"
+
+// Default byte budget of a result store
+#define GISTK_STORE_BUDGET (4096L * 1024L * 1024L)
+
+// Names of the index and of the lock file in the store directory
+#define GISTK_STORE_INDEX "index.bin"
+#define GISTK_STORE_LOCK  "index.lock"
+
+// Magic of the index file, followed by the entries
+#define GISTK_STORE_MAGIC "GISTKST1"
+
+// ---------------------------------------------------------------
+/**
+ * One stored result in the index
+ */
+typedef struct {
+  uint64_t key;      // FNV-1a of source, options and window
+  uint64_t size;     // bytes of the stored file
+  int64_t used;      // last use [s since the epoch]
+} gistk_store_entry_t;
+
+// ---------------------------------------------------------------
+/**
+ * Result store of a run. The results live in DIR/xx/KEY and are
+ * published with rename, so readers never see partial files. The
+ * run collects the results it used or added in a journal, which is
+ * merged into the index under an fcntl lock on close; the size cap
+ * is enforced there by removing the least recently used results.
+ */
+typedef struct {
+  char * dir;
+  uint64_t base;                  // hash of source identity and options
+  uint64_t max_bytes;
+  uint64_t num_bytes;             // stored bytes after the close
+  bool hardlink;                  // serve hits by hardlink, else copy
+  gistk_store_entry_t * journal;
+  size_t num_journal;
+  size_t mem_journal;
+  unsigned long seq;              // names of the temporary files
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long stores;
+  unsigned long evictions;
+  pthread_mutex_t lock;
+} gistk_store_t;
+
+// ---------------------------------------------------------------
+/**
+ * Opens or creates a result store for the cuts of a source. The
+ * source is identified by its real path, modification time and
+ * size, so a changed source never hits old results. Results left
+ * outside the index by killed runs are indexed, entries without a
+ * result dropped and stale temporary files removed.
+ * @param dir directory of the store
+ * @param filename name of the source file
+ * @param opts cut options of the run
+ * @param ext file extension of the results
+ * @param max_bytes size cap of the store
+ * @param hardlink serve hits by hardlink instead of a copy, the
+ *        outputs must not be changed in place then
+ * @param store the store container
+ */
+void gistk_store_open(const char * dir, const char * filename,
+                      const gistk_cut_opts_t * opts, const char * ext,
+                      uint64_t max_bytes, bool hardlink,
+                      gistk_store_t * store);
+
+// ---------------------------------------------------------------
+/**
+ * Key of a result
+ * @param store the store
+ * @param x0 left column of the source footprint
+ * @param y0 upper row of the source footprint
+ * @param width width of the source footprint
+ * @param height height of the source footprint
+ * @param out_width width of the result
+ * @param out_height height of the result
+ * @param scale reduction factor of the result, 1 for none
+ * @return the key
+ */
+uint64_t gistk_store_key(const gistk_store_t * store,
+                         long x0, long y0, int width, int height,
+                         int out_width, int out_height, int scale);
+
+// ---------------------------------------------------------------
+/**
+ * Serves a stored result without GDAL. An existing output is
+ * removed first in any case, so a following write never changes a
+ * file shared with the store.
+ * @param store the store
+ * @param key key of the result
+ * @param filename name of the output
+ * @return true on a hit
+ */
+bool gistk_store_get(gistk_store_t * store, uint64_t key,
+                     const char * filename);
+
+// ---------------------------------------------------------------
+/**
+ * Takes a served result back, for positions served only in part:
+ * the output is removed and the hit counts as a miss
+ * @param store the store
+ * @param filename name of the output
+ */
+void gistk_store_unget(gistk_store_t * store, const char * filename);
+
+// ---------------------------------------------------------------
+/**
+ * Adds a written result to the store
+ * @param store the store
+ * @param key key of the result
+ * @param filename name of the written output
+ */
+void gistk_store_put(gistk_store_t * store, uint64_t key,
+                     const char * filename);
+
+// ---------------------------------------------------------------
+/**
+ * Merges the journal into the index, evicts the least recently
+ * used results beyond the size cap and releases the store
+ * @param store the store
+ */
+void gistk_store_close(gistk_store_t * store);
+
+#endif /* INCLUDED_STORE_H */
@@ -0,0 +1,159 @@
+/* terrain.h --- Terrain derivatives of a elevation band
+ */
+
+#ifndef INCLUDED_TERRAIN_H
+#define INCLUDED_TERRAIN_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <gdal.h>
+#include <ogr_srs_api.h>
+#include <cpl_conv.h>
+#include <cpl_string.h>
+
+// Derived bands, the order of the bits is the band order
+#define GISTK_TERRAIN_SLOPE      0x01
+#define GISTK_TERRAIN_ASPECT     0x02
+#define GISTK_TERRAIN_HILLSHADE  0x04
+#define GISTK_TERRAIN_CURVATURE  0x08
+#define GISTK_TERRAIN_NUM        4
+
+// Nodata value of the derived bands
+#define GISTK_TERRAIN_NODATA -9999.0
+
+// ---------------------------------------------------------------
+/**
+ * Terrain derivatives computed from the first band with
+ * 3x3 stencils, Horn for slope, aspect and hillshade and
+ * Zevenbergen-Thorne for the curvature
+ */
+typedef struct {
+  int bands;          // or'ed GISTK_TERRAIN_* flags
+  bool only;          // drop the source bands in the output
+  double z_factor;    // vertical exaggeration
+  double azimuth;     // light source for the hillshade [deg]
+  double altitude;    // light source for the hillshade [deg]
+} gistk_terrain_t;
+
+// ---------------------------------------------------------------
+/**
+ * Initializes a terrain container without derived bands
+ * @param terrain the container
+ */
+void gistk_terrain_init(gistk_terrain_t *terrain);
+
+// ---------------------------------------------------------------
+/**
+ * Parses a comma separated list of slope, aspect, hillshade,
+ * curvature and only
+ * @param list the list
+ * @param terrain the container
+ * @return true if all items are valid
+ */
+bool gistk_terrain_parse(const char *list, gistk_terrain_t *terrain);
+
+// ---------------------------------------------------------------
+/**
+ * Number of derived bands
+ * @param terrain the container, NULL is allowed
+ * @return the number of bands
+ */
+int gistk_terrain_count(const gistk_terrain_t *terrain);
+
+// ---------------------------------------------------------------
+/**
+ * Name of the n-th derived band
+ * @param terrain the container
+ * @param n number of the derived band
+ * @return the name
+ */
+const char * gistk_terrain_name(const gistk_terrain_t *terrain, int n);
+
+// ---------------------------------------------------------------
+/**
+ * Metric cell sizes of a row of pixels. For geographic coordinate
+ * systems the degrees are converted with the radii of curvature of
+ * the ellipsoid at the latitude of the row.
+ * @param srs the spatial reference system of the raster
+ * @param trfm the affine transformation of the raster
+ * @param row the row
+ * @param dx cell size in x direction [m]
+ * @param dy cell size in y direction [m]
+ */
+void gistk_terrain_cellsize(OGRSpatialReferenceH srs, const double *trfm,
+                            double row, double *dx, double *dy);
+
+// ---------------------------------------------------------------
+/**
+ * Clips the halo window of one pixel around a window to the raster
+ * @param num_cols width of the raster
+ * @param num_rows height of the raster
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @param rx0 left column of the clipped halo window
+ * @param ry0 upper row of the clipped halo window
+ * @param rw width of the clipped halo window
+ * @param rh height of the clipped halo window
+ */
+void gistk_terrain_window(int num_cols, int num_rows,
+                          int x0, int y0, int width, int height,
+                          int *rx0, int *ry0, int *rw, int *rh);
+
+// ---------------------------------------------------------------
+/**
+ * Repeats the edge pixels of a clipped halo window into the
+ * missing halo columns and rows
+ * @param halo buffer of (width+2)*(height+2) doubles
+ * @param width width of the window
+ * @param height height of the window
+ * @param ox column of the clipped window in the halo buffer
+ * @param oy row of the clipped window in the halo buffer
+ * @param rw width of the clipped window
+ * @param rh height of the clipped window
+ */
+void gistk_terrain_pad(double *halo, int width, int height,
+                       int ox, int oy, int rw, int rh);
+
+// ---------------------------------------------------------------
+/**
+ * Reads a window of a band with a halo of one pixel, the halo is
+ * repeated from the edge at the border of the raster
+ * @param band the band
+ * @param num_cols width of the raster
+ * @param num_rows height of the raster
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @param halo buffer of (width+2)*(height+2) doubles
+ */
+void gistk_terrain_read(GDALRasterBandH band, int num_cols, int num_rows,
+                        int x0, int y0, int width, int height,
+                        double *halo);
+
+// ---------------------------------------------------------------
+/**
+ * Computes the derived bands of a window
+ * @param terrain the container
+ * @param halo elevations of the window with halo
+ * @param width width of the window
+ * @param height height of the window
+ * @param dx metric cell size in x direction per row of the window
+ * @param dy metric cell size in y direction per row of the window
+ * @param has_nodata the elevations contain nodata pixel
+ * @param nodata the nodata value
+ * @param out gistk_terrain_count buffers of width*height floats
+ */
+void gistk_terrain_apply(const gistk_terrain_t *terrain,
+                         const double *halo, int width, int height,
+                         const double *dx, const double *dy,
+                         bool has_nodata, double nodata,
+                         float **out);
+
+#endif /* INCLUDED_TERRAIN_H */
@@ -0,0 +1,156 @@
+/* tile.h --- Decoded tile cache with prefetch for gistk rasters
+ */
+
+#ifndef INCLUDED_TILE_H
+#define INCLUDED_TILE_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "ifgdv/util.h"
+
+// Default byte budget of a tile cache
+#define GISTK_TILE_BUDGET (256L * 1024L * 1024L)
+
+// Capacity of the prefetch queue [tiles]
+#define GISTK_TILE_QUEUE 4096
+
+// States of a cache slot
+#define GISTK_TILE_EMPTY   0
+#define GISTK_TILE_LOADING 1
+#define GISTK_TILE_VALID   2
+
+// ---------------------------------------------------------------
+/**
+ * One decoded block of a band
+ */
+typedef struct {
+  long key;          // ((band-1) * blocks_y + by) * blocks_x + bx
+  int state;         // GISTK_TILE_*
+  bool referenced;   // CLOCK bit
+  bool prefetched;   // loaded ahead and not used yet
+  int next;          // next slot in the hash chain
+  void * data;
+} gistk_tile_t;
+
+// ---------------------------------------------------------------
+/**
+ * Cache of decoded blocks with a fixed byte budget, CLOCK eviction
+ * and a background thread loading hinted blocks through its own
+ * dataset handle
+ */
+typedef struct gistk_tile_cache_s {
+  GDALDatasetH data;            // handle of the consumer
+  GDALDatasetH prefetch_data;   // handle of the prefetch thread
+  int num_bands;
+  int num_cols;
+  int num_rows;
+  int block_w;
+  int block_h;
+  int blocks_x;
+  int blocks_y;
+  GDALDataType * types;
+  size_t tile_bytes;
+  gistk_tile_t * slots;
+  int num_slots;
+  int hand;
+  int * buckets;
+  int num_buckets;
+  int unused_prefetched;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long prefetches;
+  unsigned long evictions;
+  long * queue;
+  size_t queue_head;
+  size_t queue_tail;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pthread_t thread;
+  bool running;
+  bool stop;
+} gistk_tile_cache_t;
+
+// ---------------------------------------------------------------
+/**
+ * Opens a tile cache for a raster and attaches it, so all reads of
+ * the raster layer go through the cache
+ * @param filename name of the raster file for the prefetch handle
+ * @param raster an open raster container
+ * @param budget byte budget of the decoded tiles
+ * @param prefetch start the prefetch thread
+ * @param cache the cache container
+ */
+void gistk_tile_cache_open(const char * filename,
+                           gistk_raster_t * raster,
+                           size_t budget, bool prefetch,
+                           gistk_tile_cache_t * cache);
+
+// ---------------------------------------------------------------
+/**
+ * Reads a window of a band through the cache
+ * @param cache the cache container
+ * @param band number of the band starting with 1
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @param buffer target buffer
+ * @param buf_type type of the target buffer
+ * @param line_space bytes per line of the buffer, 0 for packed lines
+ */
+void gistk_tile_cache_read(gistk_tile_cache_t * cache, int band,
+                           int x0, int y0, int width, int height,
+                           void * buffer, GDALDataType buf_type,
+                           int line_space);
+
+// ---------------------------------------------------------------
+/**
+ * Hints the blocks of a window which will be read soon, the
+ * prefetch thread decodes them in the background
+ * @param cache the cache container
+ * @param band number of the band starting with 1, 0 for all bands
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ */
+void gistk_tile_cache_hint(gistk_tile_cache_t * cache, int band,
+                           int x0, int y0, int width, int height);
+
+// ---------------------------------------------------------------
+/**
+ * Key of a block for gistk_tile_cache_prefetch
+ * @param cache the cache container
+ * @param band number of the band starting with 1
+ * @param bx block column
+ * @param by block row
+ * @return the key, see gistk_tile_t
+ */
+long gistk_tile_cache_key(const gistk_tile_cache_t * cache,
+                          int band, int bx, int by);
+
+// ---------------------------------------------------------------
+/**
+ * Hints a list of block keys in the order they will be read
+ * @param cache the cache container
+ * @param keys block keys, see gistk_tile_t
+ * @param num_keys number of keys
+ */
+void gistk_tile_cache_prefetch(gistk_tile_cache_t * cache,
+                               const long * keys, size_t num_keys);
+
+// ---------------------------------------------------------------
+/**
+ * Stops the prefetch thread, detaches the cache from the raster and
+ * releases the tiles
+ * @param raster the raster container the cache is attached to
+ * @param cache the cache container
+ */
+void gistk_tile_cache_close(gistk_raster_t * raster,
+                            gistk_tile_cache_t * cache);
+
+#endif /* INCLUDED_TILE_H */
@@ -15,10 +15,18 @@
 #include <ogr_srs_api.h>
 #include <cpl_conv.h>
 #include <cpl_string.h>
+#include "ifgdv/conv.h"
+#include "ifgdv/terrain.h"
+#include "ifgdv/scale.h"
+#include "ifgdv/stats.h"
+#include "ifgdv/lossy.h"
 
 // GISTK Standard raster format GeoTIFF
 #define GISTK_FMT_GTIFF "GTiff"
 
+// Memory budget of a streamed cut [byte]
+#define GISTK_CUT_BUDGET (256L * 1024L * 1024L)
+
 typedef struct {
   GDALDriverH driver;
   char** info;
@@ -27,6 +35,9 @@ typedef struct {
   bool can_copy;
 }  gistk_raster_driver_t;
 
+// Tile cache attached to a raster, see tile.h
+struct gistk_tile_cache_s;
+
 typedef struct {
   GDALDatasetH data;
   OGRSpatialReferenceH srs;
@@ -37,8 +48,63 @@ typedef struct {
   int num_bands;
   bool is_open;
   bool readonly;
+  struct gistk_tile_cache_s * cache;
 } gistk_raster_t;
 
+// Options for cutting a window out of a raster
+typedef struct {
+  gistk_conv_t conv;
+  gistk_terrain_t terrain;
+  int num_scales;                 // 0 cuts at the native scale only
+  int scales[GISTK_SCALE_MAX];    // reduction factors
+  gistk_reduce_t reduce;
+  bool stats;                     // statistics into the target metadata
+  gistk_lossy_t lossy;            // error bounded codec of the target
+  double max_error;               // its maximal absolute error
+} gistk_cut_opts_t;
+
+// Pixels of one band of a chip
+typedef struct {
+  GDALDataType in_type;
+  GDALDataType out_type;
+  bool has_in_nodata;
+  bool has_out_nodata;
+  double in_nodata;
+  double out_nodata;
+  void * in;     // source pixels, doubles if converted
+  void * out;    // converted pixels
+  bool has_stats; // chip normalization by the moments below
+  double mean;
+  double std;
+} gistk_chip_band_t;
+
+// A cut window in memory between reading and writing. The buffers
+// grow on demand and are kept, so a chip can be reused as a pool
+// buffer for many windows.
+typedef struct {
+  int win_x;
+  int win_y;
+  int width;
+  int height;
+  int num_copied;
+  int num_derived;
+  int scale;      // source pixels per chip pixel
+  bool convert;
+  bool doubles;   // the source pixels are read as doubles
+  gistk_chip_band_t * bands;
+  float * derived[GISTK_TERRAIN_NUM];
+  double * halo;
+  double * dx;
+  double * dy;
+  bool with_stats;          // stats holds the transformed bands
+  gistk_stats_t * stats;    // per target band
+  int mem_stats;
+  int mem_bands;
+  int mem_rows;
+  size_t mem_pix;
+  size_t mem_halo;
+} gistk_chip_t;
+
 
 /**
  * Initializes the gdal stuff
@@ -100,6 +166,44 @@ void gistk_open_raster(const char * filename,
  */
 void gistk_close_raster(gistk_raster_t * result);
 
+// ---------------------------------------
+/**
+ * Reads a window of a band, through the tile cache if one is
+ * attached to the raster, a failed read is fatal on both paths
+ * @param source an open raster container
+ * @param band number of the band starting with 1
+ * @param x0 left column of the window
+ * @param y0 upper row of the window
+ * @param width width of the window
+ * @param height height of the window
+ * @param buffer target buffer
+ * @param buf_type type of the target buffer
+ * @param line_space bytes per line of the buffer, 0 for packed lines
+ */
+void gistk_raster_read(const gistk_raster_t * source, int band,
+                       int x0, int y0, int width, int height,
+                       void * buffer, GDALDataType buf_type,
+                       int line_space);
+
+// Points per batch of a coordinate transformation
+#define GISTK_REPROJECT_BATCH 65536
+
+// ---------------------------------------
+/**
+ * Transforms points of another spatial reference system into the
+ * one of a raster with one transformer and array batches, points
+ * the transformation fails for are flagged and keep their values
+ * @param srs reference system of the points, EPSG:4326, WKT or PROJ
+ * @param target an open raster container
+ * @param x x or longitude of the points, transformed in place
+ * @param y y or latitude of the points, transformed in place
+ * @param n number of points
+ * @param failed n flags for the failed points, may be NULL
+ * @return number of failed points
+ */
+size_t gistk_reproject(const char * srs, const gistk_raster_t * target,
+                       double * x, double * y, size_t n, bool * failed);
+
 // ---------------------------------------
 /**
  * Cuts a window out of a existing rasterfile 
@@ -119,4 +223,189 @@ void gistk_cut_raster(const gistk_raster_driver_t tool,
                 int win_max_x, int win_max_y,
                 gistk_raster_t * result);
 
+// ---------------------------------------
+/**
+ * Initializes cut options which copy the pixels unchanged
+ * @param opts the options container
+ */
+void gistk_cut_opts_init(gistk_cut_opts_t * opts);
+
+// ---------------------------------------
+/**
+ * Cuts a window out of a existing rasterfile and converts the
+ * pixels on the fly
+ * @param tool - driver container to create a new raster source
+ * @param source - an open raster file container
+ * @param filename - for the new target object
+ * @param win_min_x - left x coordinate [pixel] of the cut window
+ * @param win_min_y - lower x coordinate [pixel] of the cut window
+ * @param win_max_x - right x coordinate [pixel] of the cut window
+ * @param win_max_y - rupper x coordinate [pixel] of the cut window
+ * @param opts - cut options, NULL copies the pixels unchanged,
+ *        multi scale options are rejected
+ * @param result -  a pointer to a valid a raster container
+ */
+void gistk_cut_raster_opt(const gistk_raster_driver_t tool,
+                const gistk_raster_t source,
+                const char * filename,
+                int win_min_x, int win_min_y,
+                int win_max_x, int win_max_y,
+                const gistk_cut_opts_t * opts,
+                gistk_raster_t * result);
+
+// ---------------------------------------
+/**
+ * Memory the chip buffers of a window take
+ * @param source - an open raster file container
+ * @param opts - cut options, NULL for a plain copy
+ * @param width - width of the window [pixel]
+ * @param height - height of the window [pixel]
+ * @return the bytes
+ */
+size_t gistk_chip_bytes(const gistk_raster_t * source,
+                        const gistk_cut_opts_t * opts,
+                        int width, int height);
+
+// ---------------------------------------
+/**
+ * Cuts a window out of a existing rasterfile in strips aligned to
+ * the source blocks, so any window size fits into the memory budget.
+ * The chip normalization uses the moments of the whole window, an
+ * error bounded target is checked in a second pass over the strips.
+ * A GTiff target of more than one strip is tiled like the source.
+ * @param tool - driver container to create a new raster source
+ * @param source - an open raster file container
+ * @param filename - for the new target object
+ * @param win_min_x - left x coordinate [pixel] of the cut window
+ * @param win_min_y - lower x coordinate [pixel] of the cut window
+ * @param win_max_x - right x coordinate [pixel] of the cut window
+ * @param win_max_y - rupper x coordinate [pixel] of the cut window
+ * @param opts - cut options, NULL copies the pixels unchanged,
+ *        multi scale options are rejected
+ * @param budget - bytes of the strip buffers
+ * @param result -  a pointer to a valid a raster container
+ */
+void gistk_cut_raster_stream(const gistk_raster_driver_t tool,
+                const gistk_raster_t * source,
+                const char * filename,
+                int win_min_x, int win_min_y,
+                int win_max_x, int win_max_y,
+                const gistk_cut_opts_t * opts,
+                size_t budget,
+                gistk_raster_t * result);
+
+// ---------------------------------------
+/**
+ * Initializes an empty chip
+ * @param chip the chip container
+ */
+void gistk_chip_init(gistk_chip_t * chip);
+
+// ---------------------------------------
+/**
+ * Releases the buffers of a chip
+ * @param chip the chip container
+ */
+void gistk_chip_free(gistk_chip_t * chip);
+
+// ---------------------------------------
+/**
+ * First stage of a cut: reads a window of the source into a chip.
+ * This is the only stage which touches the source dataset.
+ * @param source - an open raster file container
+ * @param filename - of the target object for the error messages
+ * @param win_min_x - left x coordinate [pixel] of the cut window
+ * @param win_min_y - lower x coordinate [pixel] of the cut window
+ * @param win_max_x - right x coordinate [pixel] of the cut window
+ * @param win_max_y - rupper x coordinate [pixel] of the cut window
+ * @param opts - cut options, NULL copies the pixels unchanged
+ * @param chip - the chip container, its buffers are reused
+ */
+void gistk_chip_read(const gistk_raster_t * source,
+                     const char * filename,
+                     int win_min_x, int win_min_y,
+                     int win_max_x, int win_max_y,
+                     const gistk_cut_opts_t * opts,
+                     gistk_chip_t * chip);
+
+// ---------------------------------------
+/**
+ * Second stage of a cut: converts the pixels and computes the
+ * derived bands, pure computation without GDAL access
+ * @param opts - cut options used to read the chip
+ * @param chip - the chip container
+ */
+void gistk_chip_transform(const gistk_cut_opts_t * opts,
+                          gistk_chip_t * chip);
+
+// ---------------------------------------
+/**
+ * Reduces the center of a chip read with doubles to a coarser
+ * scale, the result passes gistk_chip_transform and
+ * gistk_chip_write like a chip read from the source
+ * @param opts - cut options used to read the chip
+ * @param chip - the chip at the native scale
+ * @param factor - reduction factor
+ * @param width - width of the result [pixel]
+ * @param height - height of the result [pixel]
+ * @param result - the reduced chip, its buffers are reused
+ */
+void gistk_chip_scale(const gistk_cut_opts_t * opts,
+                      const gistk_chip_t * chip,
+                      int factor, int width, int height,
+                      gistk_chip_t * result);
+
+// ---------------------------------------
+/**
+ * Creates the target file of a cut for the band layout of a chip,
+ * the chip origin is the origin of the target
+ * @param tool - driver container to create a new raster source
+ * @param source - the raster container the chip was read from
+ * @param filename - for the new target object
+ * @param opts - cut options used to read the chip
+ * @param chip - a chip of the cut
+ * @param width - width of the target [pixel]
+ * @param height - height of the target [pixel]
+ * @param result -  a pointer to a valid a raster container
+ */
+void gistk_chip_create(const gistk_raster_driver_t tool,
+                       const gistk_raster_t * source,
+                       const char * filename,
+                       const gistk_cut_opts_t * opts,
+                       const gistk_chip_t * chip,
+                       int width, int height,
+                       gistk_raster_t * result);
+
+// ---------------------------------------
+/**
+ * Writes the pixels of a chip into rows of a created target, float
+ * bands are quantized for the quant codec
+ * @param opts - cut options used to read the chip
+ * @param chip - the chip container
+ * @param row - first row of the chip in the target
+ * @param result - the target created by gistk_chip_create
+ */
+void gistk_chip_put(const gistk_cut_opts_t * opts,
+                    const gistk_chip_t * chip, int row,
+                    gistk_raster_t * result);
+
+// ---------------------------------------
+/**
+ * Last stage of a cut: creates the target file and writes the chip.
+ * An error bounded target is reopened read only and checked against
+ * the chip.
+ * @param tool - driver container to create a new raster source
+ * @param source - the raster container the chip was read from
+ * @param filename - for the new target object
+ * @param opts - cut options used to read the chip
+ * @param chip - the chip container
+ * @param result -  a pointer to a valid a raster container
+ */
+void gistk_chip_write(const gistk_raster_driver_t tool,
+                      const gistk_raster_t * source,
+                      const char * filename,
+                      const gistk_cut_opts_t * opts,
+                      const gistk_chip_t * chip,
+                      gistk_raster_t * result);
+
 #endif /* INCLUDED_UTIL_H */
@@ -100,6 +100,16 @@ void sort_int(int * a, int * b) {
   }
 }
 
+// -------------------------------------------------------------------
+void sort_dbl(double * a, double * b) {
+  if ( *a > *b)
+  {
+     double t = *a;
+     *a = *b;
+     *b = t;
+  }
+}
+
 // -------------------------------------------------------------------
 char *strip_ext(char *txt) {
 	size_t len = strlen(txt);
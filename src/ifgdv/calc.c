@@ -0,0 +1,363 @@
+// =====================================================================
+// Band math expressions compiled to a vector tape
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// A recursive descent parser emits the instructions in post order.
+// Evaluation walks the tape once per block and runs every instruction
+// as a plain loop over the block, which the compiler vectorizes.
+// =====================================================================
+
+#include <ctype.h>
+#include <cpl_conv.h>
+#include "ifgdv/error.h"
+#include "ifgdv/calc.h"
+
+// Parser state
+typedef struct {
+  const char * expr;
+  const char * pos;
+  int num_vars;
+  const char * const * names;
+  gistk_calc_t * calc;
+} gistk_calc_parser_t;
+
+// Functions by name and arity
+static const struct {
+  const char * name;
+  gistk_calc_op_t op;
+  int arity;
+} gistk_calc_funcs[] = {
+  { "abs", GISTK_CALC_ABS, 1 },
+  { "sqrt", GISTK_CALC_SQRT, 1 },
+  { "exp", GISTK_CALC_EXP, 1 },
+  { "log", GISTK_CALC_LOG, 1 },
+  { "floor", GISTK_CALC_FLOOR, 1 },
+  { "ceil", GISTK_CALC_CEIL, 1 },
+  { "min", GISTK_CALC_MIN, 2 },
+  { "max", GISTK_CALC_MAX, 2 },
+  { "isnodata", GISTK_CALC_ISNODATA, 1 }
+};
+
+// ---------------------------------------------------------------
+// Runs one instruction over a block
+static void gistk_calc_op(gistk_calc_op_t op, double value,
+                          double * restrict r, const double * restrict a,
+                          const double * restrict b,
+                          const double * restrict c, size_t n) {
+#define GISTK_CALC_LOOP(expr) \
+    { for (size_t i=0; i < n; i++) r[i] = (expr); } break;
+
+    switch ( op ) {
+    case GISTK_CALC_VAR:    GISTK_CALC_LOOP(a[i])
+    case GISTK_CALC_CONST:  GISTK_CALC_LOOP(value)
+    case GISTK_CALC_ADD:    GISTK_CALC_LOOP(a[i] + b[i])
+    case GISTK_CALC_SUB:    GISTK_CALC_LOOP(a[i] - b[i])
+    case GISTK_CALC_MUL:    GISTK_CALC_LOOP(a[i] * b[i])
+    case GISTK_CALC_DIV:    GISTK_CALC_LOOP(a[i] / b[i])
+    case GISTK_CALC_MOD:    GISTK_CALC_LOOP(fmod(a[i], b[i]))
+    case GISTK_CALC_POW:    GISTK_CALC_LOOP(pow(a[i], b[i]))
+    case GISTK_CALC_NEG:    GISTK_CALC_LOOP(-a[i])
+
+    // A comparison with nodata is nodata, not false
+    case GISTK_CALC_NOT:
+      GISTK_CALC_LOOP(a[i] != a[i] ? NAN : a[i] == 0.0 ? 1.0 : 0.0)
+    case GISTK_CALC_LT:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] < b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_LE:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] <= b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_GT:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] > b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_GE:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] >= b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_EQ:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] == b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_NE:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] != b[i] ? 1.0 : 0.0)
+    case GISTK_CALC_AND:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] != 0.0 && b[i] != 0.0 ? 1.0 : 0.0)
+    case GISTK_CALC_OR:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] != 0.0 || b[i] != 0.0 ? 1.0 : 0.0)
+
+    // A nodata condition selects no branch, isnodata() tests it
+    case GISTK_CALC_SELECT:
+      GISTK_CALC_LOOP(a[i] != a[i] ? NAN : a[i] != 0.0 ? b[i] : c[i])
+    case GISTK_CALC_ABS:    GISTK_CALC_LOOP(fabs(a[i]))
+    case GISTK_CALC_SQRT:   GISTK_CALC_LOOP(sqrt(a[i]))
+    case GISTK_CALC_EXP:    GISTK_CALC_LOOP(exp(a[i]))
+    case GISTK_CALC_LOG:    GISTK_CALC_LOOP(log(a[i]))
+    case GISTK_CALC_FLOOR:  GISTK_CALC_LOOP(floor(a[i]))
+    case GISTK_CALC_CEIL:   GISTK_CALC_LOOP(ceil(a[i]))
+
+    // Nodata wins over a valid value
+    case GISTK_CALC_MIN:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] < b[i] ? a[i] : b[i])
+    case GISTK_CALC_MAX:
+      GISTK_CALC_LOOP(a[i] != a[i] || b[i] != b[i] ? NAN :
+                      a[i] > b[i] ? a[i] : b[i])
+    case GISTK_CALC_ISNODATA: GISTK_CALC_LOOP(a[i] != a[i] ? 1.0 : 0.0)
+    }
+#undef GISTK_CALC_LOOP
+}
+
+// ---------------------------------------------------------------
+static void gistk_calc_fail(gistk_calc_parser_t * parser, const char * what) {
+    gistk_error_fatal(GISTK_ERRC_CALC_SYNTAX, GISTK_ERRS_CALC_SYNTAX,
+                      what, (int) (parser->pos - parser->expr) + 1,
+                      parser->expr);
+}
+
+// ---------------------------------------------------------------
+// Appends an instruction, operations on constants are folded
+static int gistk_calc_emit(gistk_calc_parser_t * parser, gistk_calc_op_t op,
+                           int a, int b, int c, double value) {
+    gistk_calc_t * calc = parser->calc;
+    if ( calc->num_instr == calc->mem_instr ) {
+        calc->mem_instr = calc->mem_instr * 2 + 16;
+        calc->tape = CPLRealloc(calc->tape,
+                                sizeof(gistk_calc_instr_t) * calc->mem_instr);
+    }
+    gistk_calc_instr_t * tape = calc->tape;
+    int k = calc->num_instr++;
+    tape[k].op = op;
+    tape[k].a = a;
+    tape[k].b = b;
+    tape[k].c = c;
+    tape[k].value = value;
+    if ( op == GISTK_CALC_VAR || op == GISTK_CALC_CONST ) return k;
+
+    // Constant operands are single instructions right before
+    int operands[3] = { a, b, c };
+    double values[3] = { NAN, NAN, NAN };
+    int first = k;
+    for (int o=0; o < 3; o++) {
+        if ( operands[o] < 0 ) continue;
+        if ( tape[operands[o]].op != GISTK_CALC_CONST ) return k;
+        values[o] = tape[operands[o]].value;
+        if ( operands[o] < first ) first = operands[o];
+    }
+    double result;
+    gistk_calc_op(op, value, &result, &values[0], &values[1], &values[2], 1);
+    calc->num_instr = first + 1;
+    tape[first].op = GISTK_CALC_CONST;
+    tape[first].a = tape[first].b = tape[first].c = -1;
+    tape[first].value = result;
+    return first;
+}
+
+// ---------------------------------------------------------------
+static void gistk_calc_space(gistk_calc_parser_t * parser) {
+    while ( isspace((unsigned char) *parser->pos) ) parser->pos++;
+}
+
+// ---------------------------------------------------------------
+// Consumes a token if it follows
+static bool gistk_calc_accept(gistk_calc_parser_t * parser, const char * tok) {
+    gistk_calc_space(parser);
+    size_t len = strlen(tok);
+    if ( strncmp(parser->pos, tok, len) != 0 ) return false;
+
+    // Keep < from eating <=
+    if ( len == 1 && strchr("<>=!", tok[0]) != NULL && parser->pos[1] == '=' )
+        return false;
+    parser->pos += len;
+    return true;
+}
+
+// ---------------------------------------------------------------
+static void gistk_calc_expect(gistk_calc_parser_t * parser, const char * tok) {
+    if ( ! gistk_calc_accept(parser, tok) ) gistk_calc_fail(parser, tok);
+}
+
+static int gistk_calc_cond(gistk_calc_parser_t * parser);
+static int gistk_calc_unary(gistk_calc_parser_t * parser);
+
+// ---------------------------------------------------------------
+static int gistk_calc_primary(gistk_calc_parser_t * parser) {
+    gistk_calc_space(parser);
+    const char * pos = parser->pos;
+
+    if ( gistk_calc_accept(parser, "(") ) {
+        int k = gistk_calc_cond(parser);
+        gistk_calc_expect(parser, ")");
+        return k;
+    }
+
+    if ( isdigit((unsigned char) *pos) || *pos == '.' ) {
+        char * end;
+        double value = strtod(pos, &end);
+        if ( end == pos ) gistk_calc_fail(parser, "number");
+        parser->pos = end;
+        return gistk_calc_emit(parser, GISTK_CALC_CONST, -1, -1, -1, value);
+    }
+
+    if ( ! isalpha((unsigned char) *pos) && *pos != '_' )
+        gistk_calc_fail(parser, "operand");
+    size_t len = 0;
+    while ( isalnum((unsigned char) pos[len]) || pos[len] == '_' ) len++;
+    parser->pos += len;
+
+    for (int v=0; v < parser->num_vars; v++)
+        if ( strlen(parser->names[v]) == len &&
+             strncmp(parser->names[v], pos, len) == 0 ) {
+            parser->calc->uses[v] = true;
+            return gistk_calc_emit(parser, GISTK_CALC_VAR, v, -1, -1, 0);
+        }
+    if ( len == 6 && strncmp(pos, "nodata", 6) == 0 )
+        return gistk_calc_emit(parser, GISTK_CALC_CONST, -1, -1, -1, NAN);
+
+    size_t num_funcs = sizeof(gistk_calc_funcs) / sizeof(gistk_calc_funcs[0]);
+    for (size_t f=0; f < num_funcs; f++) {
+        if ( strlen(gistk_calc_funcs[f].name) != len ||
+             strncmp(gistk_calc_funcs[f].name, pos, len) != 0 ) continue;
+        gistk_calc_expect(parser, "(");
+        int a = gistk_calc_cond(parser);
+        int b = -1;
+        if ( gistk_calc_funcs[f].arity == 2 ) {
+            gistk_calc_expect(parser, ",");
+            b = gistk_calc_cond(parser);
+        }
+        gistk_calc_expect(parser, ")");
+        return gistk_calc_emit(parser, gistk_calc_funcs[f].op, a, b, -1, 0);
+    }
+    parser->pos = pos;
+    gistk_calc_fail(parser, "known name");
+    return -1;
+}
+
+// ---------------------------------------------------------------
+static int gistk_calc_power(gistk_calc_parser_t * parser) {
+    int a = gistk_calc_primary(parser);
+    if ( gistk_calc_accept(parser, "^") ) {
+        int b = gistk_calc_unary(parser);
+        return gistk_calc_emit(parser, GISTK_CALC_POW, a, b, -1, 0);
+    }
+    return a;
+}
+
+// ---------------------------------------------------------------
+static int gistk_calc_unary(gistk_calc_parser_t * parser) {
+    if ( gistk_calc_accept(parser, "-") )
+        return gistk_calc_emit(parser, GISTK_CALC_NEG,
+                               gistk_calc_unary(parser), -1, -1, 0);
+    if ( gistk_calc_accept(parser, "!") )
+        return gistk_calc_emit(parser, GISTK_CALC_NOT,
+                               gistk_calc_unary(parser), -1, -1, 0);
+    if ( gistk_calc_accept(parser, "+") ) return gistk_calc_unary(parser);
+    return gistk_calc_power(parser);
+}
+
+// ---------------------------------------------------------------
+// Left associative levels of binary operators
+static int gistk_calc_binary(gistk_calc_parser_t * parser, int level);
+
+static const struct {
+    const char * tok;
+    gistk_calc_op_t op;
+    int level;
+} gistk_calc_binops[] = {
+    { "||", GISTK_CALC_OR, 0 },
+    { "&&", GISTK_CALC_AND, 1 },
+    { "==", GISTK_CALC_EQ, 2 },
+    { "!=", GISTK_CALC_NE, 2 },
+    { "<=", GISTK_CALC_LE, 3 },
+    { ">=", GISTK_CALC_GE, 3 },
+    { "<", GISTK_CALC_LT, 3 },
+    { ">", GISTK_CALC_GT, 3 },
+    { "+", GISTK_CALC_ADD, 4 },
+    { "-", GISTK_CALC_SUB, 4 },
+    { "*", GISTK_CALC_MUL, 5 },
+    { "/", GISTK_CALC_DIV, 5 },
+    { "%", GISTK_CALC_MOD, 5 }
+};
+
+#define GISTK_CALC_LEVELS 6
+
+static int gistk_calc_binary(gistk_calc_parser_t * parser, int level) {
+    if ( level == GISTK_CALC_LEVELS ) return gistk_calc_unary(parser);
+    int a = gistk_calc_binary(parser, level + 1);
+    size_t num_ops = sizeof(gistk_calc_binops) / sizeof(gistk_calc_binops[0]);
+    for (;;) {
+        size_t o;
+        for (o=0; o < num_ops; o++)
+            if ( gistk_calc_binops[o].level == level &&
+                 gistk_calc_accept(parser, gistk_calc_binops[o].tok) ) break;
+        if ( o == num_ops ) return a;
+        int b = gistk_calc_binary(parser, level + 1);
+        a = gistk_calc_emit(parser, gistk_calc_binops[o].op, a, b, -1, 0);
+    }
+}
+
+// ---------------------------------------------------------------
+static int gistk_calc_cond(gistk_calc_parser_t * parser) {
+    int c = gistk_calc_binary(parser, 0);
+    if ( ! gistk_calc_accept(parser, "?") ) return c;
+    int a = gistk_calc_cond(parser);
+    gistk_calc_expect(parser, ":");
+    int b = gistk_calc_cond(parser);
+    return gistk_calc_emit(parser, GISTK_CALC_SELECT, c, a, b, 0);
+}
+
+// ---------------------------------------------------------------
+void gistk_calc_compile(const char * expr, int num_vars,
+                        const char * const * names, gistk_calc_t * calc) {
+    memset(calc, 0, sizeof(gistk_calc_t));
+    calc->num_vars = num_vars;
+    gistk_calc_parser_t parser;
+    parser.expr = expr;
+    parser.pos = expr;
+    parser.num_vars = num_vars;
+    parser.names = names;
+    parser.calc = calc;
+    gistk_calc_cond(&parser);
+    gistk_calc_space(&parser);
+    if ( *parser.pos != '\0' ) gistk_calc_fail(&parser, "end");
+}
+
+// ---------------------------------------------------------------
+size_t gistk_calc_work_size(const gistk_calc_t * calc, size_t n) {
+    return (size_t) calc->num_instr * n;
+}
+
+// ---------------------------------------------------------------
+void gistk_calc_eval(const gistk_calc_t * calc, const double * const * vars,
+                     size_t n, double * work, double * out) {
+    const double * slots[calc->num_instr];
+    int last = calc->num_instr - 1;
+    for (int k=0; k <= last; k++) {
+        const gistk_calc_instr_t * instr = &calc->tape[k];
+
+        // Variables are read in place, the last instruction goes out
+        if ( instr->op == GISTK_CALC_VAR && k < last ) {
+            slots[k] = vars[instr->a];
+            continue;
+        }
+        double * r = k == last ? out : work + (size_t) k * n;
+        const double * a = instr->op == GISTK_CALC_VAR ? vars[instr->a] :
+                           instr->a >= 0 ? slots[instr->a] : NULL;
+        gistk_calc_op(instr->op, instr->value, r, a,
+                      instr->b >= 0 ? slots[instr->b] : NULL,
+                      instr->c >= 0 ? slots[instr->c] : NULL, n);
+        slots[k] = r;
+    }
+}
+
+// ---------------------------------------------------------------
+void gistk_calc_free(gistk_calc_t * calc) {
+    CPLFree(calc->tape);
+    calc->tape = NULL;
+    calc->num_instr = 0;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
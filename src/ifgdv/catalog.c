@@ -0,0 +1,167 @@
+// =====================================================================
+// Footprint catalog of cut chips
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// GeoPackage commits are expensive, so the features go in large
+// transactions and the spatial index is built once at the end
+// instead of being updated per feature.
+// =====================================================================
+
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/catalog.h"
+
+// ----------------------------------------------------------------
+static int gistk_catalog_field(gistk_catalog_t * catalog,
+                               const char * name, OGRFieldType type,
+                               int width) {
+    OGRFieldDefnH field = OGR_Fld_Create(name, type);
+    if ( width > 0 ) OGR_Fld_SetWidth(field, width);
+    if ( OGR_L_CreateField(catalog->layer, field, TRUE) != OGRERR_NONE )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_FIELD,
+                          GISTK_ERRS_CATALOG_FIELD, name);
+    OGR_Fld_Destroy(field);
+    return OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(catalog->layer), name);
+}
+
+// ----------------------------------------------------------------
+static void gistk_catalog_begin(gistk_catalog_t * catalog) {
+    if ( GDALDatasetStartTransaction(catalog->data, FALSE) != OGRERR_NONE )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_COMMIT,
+                          GISTK_ERRS_CATALOG_COMMIT, "start");
+    catalog->num_batch = 0;
+}
+
+// ----------------------------------------------------------------
+static void gistk_catalog_commit(gistk_catalog_t * catalog) {
+    if ( GDALDatasetCommitTransaction(catalog->data) != OGRERR_NONE )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_COMMIT,
+                          GISTK_ERRS_CATALOG_COMMIT, "commit");
+}
+
+// ----------------------------------------------------------------
+void gistk_catalog_open(const char * filename,
+                        const gistk_raster_t * source,
+                        gistk_catalog_t * catalog) {
+
+    GDALDriverH driver = GDALGetDriverByName(GISTK_FMT_GPKG);
+    if ( driver == NULL )
+        gistk_error_fatal(GISTK_ERRC_OPEN_DRV_VALID,
+                          GISTK_ERRS_OPEN_DRV_VALID, GISTK_FMT_GPKG);
+
+    catalog->data = GDALCreate(driver, filename, 0, 0, 0, GDT_Unknown, NULL);
+    if ( catalog->data == NULL )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_CREATE,
+                          GISTK_ERRS_CATALOG_CREATE, filename);
+
+    // The index is created after the bulk insert
+    char ** layer_opts = CSLSetNameValue(NULL, "SPATIAL_INDEX", "NO");
+    catalog->layer = GDALDatasetCreateLayer(catalog->data,
+                                            GISTK_CATALOG_LAYER,
+                                            source->srs, wkbPolygon,
+                                            layer_opts);
+    CSLDestroy(layer_opts);
+    if ( catalog->layer == NULL )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_CREATE,
+                          GISTK_ERRS_CATALOG_CREATE, filename);
+
+    catalog->fld_id     = gistk_catalog_field(catalog, "id", OFTInteger, 0);
+    catalog->fld_file   = gistk_catalog_field(catalog, "file", OFTString, 0);
+    catalog->fld_scale  = gistk_catalog_field(catalog, "scale", OFTInteger, 0);
+    catalog->fld_col    = gistk_catalog_field(catalog, "col", OFTInteger64, 0);
+    catalog->fld_row    = gistk_catalog_field(catalog, "row", OFTInteger64, 0);
+    catalog->fld_width  = gistk_catalog_field(catalog, "width", OFTInteger, 0);
+    catalog->fld_height = gistk_catalog_field(catalog, "height", OFTInteger, 0);
+    catalog->fld_status = gistk_catalog_field(catalog, "status", OFTString, 3);
+    catalog->fld_valid  = gistk_catalog_field(catalog, "valid", OFTReal, 0);
+
+    // One feature and footprint refilled for every chip
+    catalog->feature = OGR_F_Create(OGR_L_GetLayerDefn(catalog->layer));
+    catalog->footprint = OGR_G_CreateGeometry(wkbPolygon);
+    OGRGeometryH ring = OGR_G_CreateGeometry(wkbLinearRing);
+    for (int p=0; p < 5; p++) OGR_G_AddPoint_2D(ring, 0.0, 0.0);
+    OGR_G_AddGeometryDirectly(catalog->footprint, ring);
+
+    catalog->num_chips = 0;
+    gistk_catalog_begin(catalog);
+}
+
+// ----------------------------------------------------------------
+void gistk_catalog_add(gistk_catalog_t * catalog,
+                       const gistk_raster_t * source,
+                       int id, const char * file, int scale,
+                       long col, long row, int width, int height,
+                       const char * status, double valid) {
+
+    // Corners of the source window, closed ring
+    static const int cx[5] = { 0, 1, 1, 0, 0 };
+    static const int cy[5] = { 0, 0, 1, 1, 0 };
+    OGRGeometryH ring = OGR_G_GetGeometryRef(catalog->footprint, 0);
+    for (int p=0; p < 5; p++) {
+        double x, y;
+        trfm_pix_geo(source->trfm, col + cx[p] * width, row + cy[p] * height,
+                     &x, &y);
+        OGR_G_SetPoint_2D(ring, p, x, y);
+    }
+
+    OGRFeatureH feature = catalog->feature;
+    OGR_F_SetFID(feature, OGRNullFID);
+    OGR_F_SetFieldInteger(feature, catalog->fld_id, id);
+    OGR_F_SetFieldString(feature, catalog->fld_file, file);
+    OGR_F_SetFieldInteger(feature, catalog->fld_scale, scale);
+    OGR_F_SetFieldInteger64(feature, catalog->fld_col, col);
+    OGR_F_SetFieldInteger64(feature, catalog->fld_row, row);
+    OGR_F_SetFieldInteger(feature, catalog->fld_width, width);
+    OGR_F_SetFieldInteger(feature, catalog->fld_height, height);
+    OGR_F_SetFieldString(feature, catalog->fld_status, status);
+    if ( valid >= 0.0 )
+        OGR_F_SetFieldDouble(feature, catalog->fld_valid, valid);
+    else
+        OGR_F_SetFieldNull(feature, catalog->fld_valid);
+    OGR_F_SetGeometry(feature, catalog->footprint);
+
+    if ( OGR_L_CreateFeature(catalog->layer, feature) != OGRERR_NONE )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_FEATURE,
+                          GISTK_ERRS_CATALOG_FEATURE, id, file);
+
+    catalog->num_chips++;
+    if ( ++catalog->num_batch >= GISTK_CATALOG_BATCH ) {
+        gistk_catalog_commit(catalog);
+        gistk_catalog_begin(catalog);
+    }
+}
+
+// ----------------------------------------------------------------
+void gistk_catalog_close(gistk_catalog_t * catalog) {
+
+    gistk_catalog_commit(catalog);
+
+    // Build the R-tree in one go
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT CreateSpatialIndex('%s', '%s')",
+             GISTK_CATALOG_LAYER, OGR_L_GetGeometryColumn(catalog->layer));
+    OGRLayerH result = GDALDatasetExecuteSQL(catalog->data, sql, NULL, NULL);
+    int created = 0;
+    if ( result != NULL ) {
+        OGRFeatureH row = OGR_L_GetNextFeature(result);
+        if ( row != NULL ) {
+            created = OGR_F_GetFieldAsInteger(row, 0);
+            OGR_F_Destroy(row);
+        }
+        GDALDatasetReleaseResultSet(catalog->data, result);
+    }
+    if ( created != 1 )
+        gistk_error_fatal(GISTK_ERRC_CATALOG_INDEX,
+                          GISTK_ERRS_CATALOG_INDEX,
+                          GDALGetDescription(catalog->data));
+
+    OGR_F_Destroy(catalog->feature);
+    OGR_G_DestroyGeometry(catalog->footprint);
+    GDALClose(catalog->data);
+    catalog->data = NULL;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
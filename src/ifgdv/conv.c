@@ -0,0 +1,272 @@
+// =====================================================================
+// Pixel type conversion, scaling and normalization
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// The kernels work on chunks of GISTK_CONV_CHUNK pixels with restrict
+// qualified pointers and without branches in the loop bodies, so the
+// compiler turns them into SIMD code (see COPT in the Makefile).
+// =====================================================================
+
+#include <float.h>
+#include "ifgdv/conv.h"
+
+// ---------------------------------------------------------------
+void gistk_conv_init(gistk_conv_t *conv) {
+    conv->out_type = GDT_Unknown;
+    conv->scale = 1.0;
+    conv->offset = 0.0;
+    conv->clamp = false;
+    conv->clamp_min = 0.0;
+    conv->clamp_max = 0.0;
+    conv->norm = GISTK_NORM_NONE;
+    conv->norm_mean = 0.0;
+    conv->norm_std = 1.0;
+    conv->has_out_nodata = false;
+    conv->out_nodata = 0.0;
+}
+
+// ---------------------------------------------------------------
+bool gistk_conv_is_identity(const gistk_conv_t *conv) {
+    if ( conv == NULL ) return true;
+    return conv->out_type == GDT_Unknown &&
+           conv->scale == 1.0 && conv->offset == 0.0 &&
+           ! conv->clamp && conv->norm == GISTK_NORM_NONE &&
+           ! conv->has_out_nodata;
+}
+
+// ---------------------------------------------------------------
+GDALDataType gistk_conv_type_by_name(const char *name) {
+    static const GDALDataType types[] = {
+        GDT_Byte, GDT_Int16, GDT_UInt16, GDT_Int32, GDT_UInt32,
+        GDT_Float32, GDT_Float64,
+#ifdef GISTK_HAS_FLOAT16
+        GDT_Float16,
+#endif
+    };
+    for (size_t t=0; t < sizeof(types)/sizeof(types[0]); t++)
+        if ( EQUAL(name, GDALGetDataTypeName(types[t])) )
+            return types[t];
+    return GDT_Unknown;
+}
+
+// ---------------------------------------------------------------
+// value range of an output type
+static void gistk_conv_range(GDALDataType type, double *lo, double *hi) {
+    switch ( type ) {
+    case GDT_Byte:    *lo = 0;          *hi = 255;        break;
+    case GDT_Int16:   *lo = -32768;     *hi = 32767;      break;
+    case GDT_UInt16:  *lo = 0;          *hi = 65535;      break;
+    case GDT_Int32:   *lo = -2147483648.0; *hi = 2147483647.0; break;
+    case GDT_UInt32:  *lo = 0;          *hi = 4294967295.0; break;
+#ifdef GISTK_HAS_FLOAT16
+    case GDT_Float16: *lo = -65504;     *hi = 65504;      break;
+#endif
+    case GDT_Float32: *lo = -FLT_MAX;   *hi = FLT_MAX;    break;
+    default:          *lo = -DBL_MAX;   *hi = DBL_MAX;    break;
+    }
+}
+
+// ---------------------------------------------------------------
+bool gistk_conv_fits(GDALDataType type, double value) {
+    double lo, hi;
+    gistk_conv_range(type, &lo, &hi);
+    bool whole = type == GDT_Float32 || type == GDT_Float64 ||
+#ifdef GISTK_HAS_FLOAT16
+                 type == GDT_Float16 ||
+#endif
+                 value == floor(value);
+    return value >= lo && value <= hi && whole;
+}
+
+// ---------------------------------------------------------------
+void gistk_conv_resolve(const gistk_conv_t *conv,
+                        GDALDataType in_type, bool has_in_nodata,
+                        GDALDataType *out_type,
+                        bool *has_out_nodata, double *out_nodata) {
+
+    *out_type = conv->out_type == GDT_Unknown ? in_type : conv->out_type;
+    // NaN pixels of a floating point source are mapped to the
+    // nodata value, so the target needs one even without source nodata
+    *has_out_nodata = has_in_nodata || conv->has_out_nodata ||
+                      ! GDALDataTypeIsInteger(in_type);
+
+    if ( conv->has_out_nodata ) {
+        *out_nodata = conv->out_nodata;
+        return;
+    }
+
+    // Default nodata: NaN for floats, the lower bound for signed
+    // and the upper bound for unsigned integers
+    double lo, hi;
+    gistk_conv_range(*out_type, &lo, &hi);
+    if ( ! GDALDataTypeIsInteger(*out_type) ) *out_nodata = NAN;
+    else if ( lo < 0 ) *out_nodata = lo;
+    else *out_nodata = hi;
+}
+
+// ---------------------------------------------------------------
+void gistk_conv_sums(const double *in, size_t n,
+                     bool has_nodata, double nodata,
+                     double *sum, double *sqr, size_t *cnt) {
+    double s = 0.0; double q = 0.0; size_t c = 0;
+    for (size_t i=0; i < n; i++) {
+        double v = in[i];
+        if ( v != v || ( has_nodata && v == nodata ) ) continue;
+        s += v; q += v * v; c++;
+    }
+    *sum += s; *sqr += q; *cnt += c;
+}
+
+// ---------------------------------------------------------------
+void gistk_conv_moments(double sum, double sqr, size_t cnt,
+                        double *mean, double *std) {
+    *mean = cnt > 0 ? sum / cnt : 0.0;
+    double var = cnt > 0 ? sqr / cnt - (*mean) * (*mean) : 0.0;
+    *std = var > 0.0 ? sqrt(var) : 1.0;
+}
+
+// ---------------------------------------------------------------
+void gistk_conv_stats(const double *in, size_t n,
+                      bool has_nodata, double nodata,
+                      double *mean, double *std) {
+    double sum = 0.0; double sqr = 0.0; size_t cnt = 0;
+    gistk_conv_sums(in, n, has_nodata, nodata, &sum, &sqr, &cnt);
+    gistk_conv_moments(sum, sqr, cnt, mean, std);
+}
+
+// ---------------------------------------------------------------
+// IEEE half precision bits of a float, round to nearest even
+static inline uint16_t gistk_conv_half(float value) {
+    union { uint32_t u; float f; } v, magic;
+    magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+    v.f = value;
+    uint32_t sign = v.u & 0x80000000u;
+    v.u ^= sign;
+    uint32_t res;
+    if ( v.u >= (127u + 16u) << 23 ) {
+        // overflow to infinity, keep NaN
+        res = v.u > 255u << 23 ? 0x7e00 : 0x7c00;
+    } else if ( v.u < 113u << 23 ) {
+        // subnormal half
+        v.f += magic.f;
+        res = v.u - magic.u;
+    } else {
+        uint32_t odd = (v.u >> 13) & 1;
+        v.u += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        res = v.u >> 13;
+    }
+    return (uint16_t)(res | (sign >> 16));
+}
+
+// ---------------------------------------------------------------
+// scale, clamp, round and mask one chunk into a double buffer
+static void gistk_conv_chunk(const double * restrict in, size_t n,
+                             double a, double b, double lo, double hi,
+                             bool round_int,
+                             bool has_in_nodata, double in_nodata,
+                             double out_nodata,
+                             double * restrict tmp) {
+    for (size_t i=0; i < n; i++) {
+        double v = in[i] * a + b;
+        v = v < lo ? lo : v;
+        v = v > hi ? hi : v;
+        tmp[i] = v;
+    }
+    if ( round_int )
+        for (size_t i=0; i < n; i++)
+            tmp[i] = floor(tmp[i] + 0.5);
+    if ( has_in_nodata ) {
+        for (size_t i=0; i < n; i++) {
+            double x = in[i];
+            tmp[i] = ( x == in_nodata || x != x ) ? out_nodata : tmp[i];
+        }
+    } else {
+        for (size_t i=0; i < n; i++) {
+            double x = in[i];
+            tmp[i] = x != x ? out_nodata : tmp[i];
+        }
+    }
+}
+
+// ---------------------------------------------------------------
+void gistk_conv_apply(const gistk_conv_t *conv,
+                      const double *in, size_t n,
+                      bool has_in_nodata, double in_nodata,
+                      double mean, double std,
+                      GDALDataType out_type, double out_nodata,
+                      void *out) {
+
+    if ( conv->norm == GISTK_NORM_FIXED ) {
+        mean = conv->norm_mean; std = conv->norm_std;
+    } else if ( conv->norm == GISTK_NORM_NONE ) {
+        mean = 0.0; std = 1.0;
+    }
+    if ( std == 0.0 ) std = 1.0;
+
+    // (v - mean) / std * scale + offset  ==  v * a + b
+    double a = conv->scale / std;
+    double b = conv->offset - mean * a;
+
+    // Clamp to the type range and the user range, keep the
+    // nodata value free for the nodata pixels
+    double lo, hi;
+    gistk_conv_range(out_type, &lo, &hi);
+    if ( conv->clamp ) {
+        if ( conv->clamp_min > lo ) lo = conv->clamp_min;
+        if ( conv->clamp_max < hi ) hi = conv->clamp_max;
+    }
+    bool is_int = GDALDataTypeIsInteger(out_type);
+    if ( is_int ) {
+        if ( out_nodata == lo ) lo += 1;
+        if ( out_nodata == hi ) hi -= 1;
+    }
+
+    double tmp[GISTK_CONV_CHUNK];
+    for (size_t s=0; s < n; s += GISTK_CONV_CHUNK) {
+        size_t m = n - s < GISTK_CONV_CHUNK ? n - s : GISTK_CONV_CHUNK;
+        gistk_conv_chunk(in + s, m, a, b, lo, hi, is_int,
+                         has_in_nodata, in_nodata, out_nodata, tmp);
+
+        switch ( out_type ) {
+        case GDT_Byte: {
+            uint8_t * restrict o = (uint8_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (uint8_t) tmp[i];
+        } break;
+        case GDT_Int16: {
+            int16_t * restrict o = (int16_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (int16_t) tmp[i];
+        } break;
+        case GDT_UInt16: {
+            uint16_t * restrict o = (uint16_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (uint16_t) tmp[i];
+        } break;
+        case GDT_Int32: {
+            int32_t * restrict o = (int32_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (int32_t) tmp[i];
+        } break;
+        case GDT_UInt32: {
+            uint32_t * restrict o = (uint32_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (uint32_t) tmp[i];
+        } break;
+#ifdef GISTK_HAS_FLOAT16
+        case GDT_Float16: {
+            uint16_t * restrict o = (uint16_t *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = gistk_conv_half((float) tmp[i]);
+        } break;
+#endif
+        case GDT_Float32: {
+            float * restrict o = (float *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = (float) tmp[i];
+        } break;
+        default: {
+            double * restrict o = (double *) out + s;
+            for (size_t i=0; i < m; i++) o[i] = tmp[i];
+        } break;
+        }
+    }
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
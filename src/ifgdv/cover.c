@@ -0,0 +1,285 @@
+// =====================================================================
+// Coarse coverage mask of a raster source
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/cover.h"
+
+// Metadata keys of the persisted mask
+#define GISTK_COVER_MD_CELL  "GISTK_COVER_CELL"
+#define GISTK_COVER_MD_MTIME "GISTK_COVER_SOURCE_MTIME"
+#define GISTK_COVER_MD_SIZE  "GISTK_COVER_SOURCE_SIZE"
+
+// ----------------------------------------------------------------
+static void gistk_cover_alloc(const gistk_raster_t * source, int cell,
+                              gistk_cover_t * result) {
+    if ( cell < 1 )
+        gistk_error_fatal(GISTK_ERRC_COVER_CELL,
+                          GISTK_ERRS_COVER_CELL, cell);
+    result->cell = cell;
+    result->src_cols = source->num_cols;
+    result->src_rows = source->num_rows;
+    result->num_cols = (source->num_cols + cell - 1) / cell;
+    result->num_rows = (source->num_rows + cell - 1) / cell;
+    result->valid = CPLCalloc((size_t) result->num_cols * result->num_rows,
+                              sizeof(float));
+}
+
+// ----------------------------------------------------------------
+// Try to read a persisted mask which fits the source
+static bool gistk_cover_load(const char * maskname,
+                             const struct stat * info,
+                             const gistk_raster_t * source, int cell,
+                             gistk_cover_t * result) {
+
+    CPLPushErrorHandler(CPLQuietErrorHandler);
+    GDALDatasetH data = GDALOpen(maskname, GA_ReadOnly);
+    CPLPopErrorHandler();
+    if ( data == NULL ) return false;
+
+    char stamp[64];
+    bool valid = true;
+    const char * md_cell  = GDALGetMetadataItem(data, GISTK_COVER_MD_CELL, NULL);
+    const char * md_mtime = GDALGetMetadataItem(data, GISTK_COVER_MD_MTIME, NULL);
+    const char * md_size  = GDALGetMetadataItem(data, GISTK_COVER_MD_SIZE, NULL);
+    if ( md_cell == NULL || atoi(md_cell) != cell ) valid = false;
+    sprintf(stamp, "%lld", (long long) info->st_mtime);
+    if ( md_mtime == NULL || strcmp(md_mtime, stamp) != 0 ) valid = false;
+    sprintf(stamp, "%lld", (long long) info->st_size);
+    if ( md_size == NULL || strcmp(md_size, stamp) != 0 ) valid = false;
+
+    if ( valid ) {
+        gistk_cover_alloc(source, cell, result);
+        if ( GDALGetRasterXSize(data) != result->num_cols ||
+             GDALGetRasterYSize(data) != result->num_rows ||
+             GDALRasterIO(GDALGetRasterBand(data, 1), GF_Read, 0, 0,
+                          result->num_cols, result->num_rows,
+                          result->valid, result->num_cols, result->num_rows,
+                          GDT_Float32, 0, 0) != CE_None ) {
+            gistk_cover_free(result);
+            valid = false;
+        }
+    }
+    GDALClose(data);
+    return valid;
+}
+
+// ----------------------------------------------------------------
+// Persist the mask as a small GeoTIFF beside the source
+static void gistk_cover_save(const char * maskname,
+                             const struct stat * info,
+                             const gistk_raster_t * source,
+                             const gistk_cover_t * cover) {
+
+    GDALDriverH driver = GDALGetDriverByName(GISTK_FMT_GTIFF);
+    char ** options = CSLSetNameValue(NULL, "COMPRESS", "DEFLATE");
+    CPLPushErrorHandler(CPLQuietErrorHandler);
+    GDALDatasetH data = GDALCreate(driver, maskname,
+                                   cover->num_cols, cover->num_rows, 1,
+                                   GDT_Float32, options);
+    CPLPopErrorHandler();
+    CSLDestroy(options);
+    if ( data == NULL ) {
+        // read only source directory, the mask lives for this run only
+        fprintf(stderr, "# COVERAGE MASK %s NOT WRITABLE\n", maskname);
+        return;
+    }
+
+    double trfm[6];
+    for (int i=0; i<6; i++) trfm[i] = source->trfm[i];
+    trfm[1] *= cover->cell; trfm[2] *= cover->cell;
+    trfm[4] *= cover->cell; trfm[5] *= cover->cell;
+    GDALSetGeoTransform(data, trfm);
+    GDALSetProjection(data, source->proj_info);
+
+    char stamp[64];
+    sprintf(stamp, "%d", cover->cell);
+    GDALSetMetadataItem(data, GISTK_COVER_MD_CELL, stamp, NULL);
+    sprintf(stamp, "%lld", (long long) info->st_mtime);
+    GDALSetMetadataItem(data, GISTK_COVER_MD_MTIME, stamp, NULL);
+    sprintf(stamp, "%lld", (long long) info->st_size);
+    GDALSetMetadataItem(data, GISTK_COVER_MD_SIZE, stamp, NULL);
+
+    GDALRasterIO(GDALGetRasterBand(data, 1), GF_Write, 0, 0,
+                 cover->num_cols, cover->num_rows,
+                 cover->valid, cover->num_cols, cover->num_rows,
+                 GDT_Float32, 0, 0);
+    GDALClose(data);
+}
+
+// ----------------------------------------------------------------
+void gistk_cover_open(const char * filename,
+                      const gistk_raster_t * source,
+                      int cell,
+                      gistk_cover_t * result) {
+
+    struct stat info;
+    if ( stat(filename, &info) != 0 )
+        memset(&info, 0, sizeof(info));
+
+    char maskname[strlen(filename) + strlen(GISTK_COVER_EXT) + 1];
+    sprintf(maskname, "%s%s", filename, GISTK_COVER_EXT);
+
+    if ( gistk_cover_load(maskname, &info, source, cell, result) )
+        return;
+
+    gistk_cover_build(source, cell, result);
+    gistk_cover_save(maskname, &info, source, result);
+}
+
+// ----------------------------------------------------------------
+void gistk_cover_build(const gistk_raster_t * source,
+                       int cell,
+                       gistk_cover_t * result) {
+
+    gistk_cover_alloc(source, cell, result);
+
+    size_t num_cells = (size_t) result->num_cols * result->num_rows;
+    float * total = CPLCalloc(num_cells, sizeof(float));
+
+    GDALRasterBandH band = GDALGetRasterBand(source->data, 1);
+
+    // Look for the coarsest overview with at least 2x2 pixels per cell
+    GDALRasterBandH ovr = NULL;
+    double ovr_fact = 1.0;
+    for (int o=0; o < GDALGetOverviewCount(band); o++) {
+        GDALRasterBandH cand = GDALGetOverview(band, o);
+        double fact = (double) source->num_cols / GDALGetRasterBandXSize(cand);
+        if ( fact <= cell / 2.0 && fact > ovr_fact ) {
+            ovr = cand;
+            ovr_fact = fact;
+        }
+    }
+
+    if ( ovr != NULL ) {
+
+        // Every overview pixel votes for the cell of its center
+        int ocols = GDALGetRasterBandXSize(ovr);
+        int orows = GDALGetRasterBandYSize(ovr);
+        double fx = (double) source->num_cols / ocols;
+        double fy = (double) source->num_rows / orows;
+        GByte * mask = CPLMalloc((size_t) ocols * orows);
+        GDALRasterIO(GDALGetMaskBand(ovr), GF_Read, 0, 0, ocols, orows,
+                     mask, ocols, orows, GDT_Byte, 0, 0);
+        for (int r=0; r < orows; r++) {
+            int cy = (int) ((r + 0.5) * fy) / cell;
+            for (int c=0; c < ocols; c++) {
+                int cx = (int) ((c + 0.5) * fx) / cell;
+                size_t idx = (size_t) cy * result->num_cols + cx;
+                total[idx] += 1;
+                result->valid[idx] += mask[(size_t) r * ocols + c] > 0;
+            }
+        }
+        CPLFree(mask);
+
+    } else {
+
+        // One sequential pass in strips of one cell row
+        GDALRasterBandH mband = GDALGetMaskBand(band);
+        GByte * mask = CPLMalloc((size_t) source->num_cols * cell);
+        for (int cy=0; cy < result->num_rows; cy++) {
+            int y0 = cy * cell;
+            int rows = source->num_rows - y0 < cell ?
+                       source->num_rows - y0 : cell;
+            GDALRasterIO(mband, GF_Read, 0, y0, source->num_cols, rows,
+                         mask, source->num_cols, rows, GDT_Byte, 0, 0);
+            for (int r=0; r < rows; r++) {
+                const GByte * line = mask + (size_t) r * source->num_cols;
+                for (int c=0; c < source->num_cols; c++) {
+                    size_t idx = (size_t) cy * result->num_cols + c / cell;
+                    total[idx] += 1;
+                    result->valid[idx] += line[c] > 0;
+                }
+            }
+        }
+        CPLFree(mask);
+    }
+
+    for (size_t i=0; i < num_cells; i++)
+        result->valid[i] = total[i] > 0 ? result->valid[i] / total[i] : 0;
+    CPLFree(total);
+}
+
+// ----------------------------------------------------------------
+void gistk_cover_bounds(const gistk_cover_t * cover,
+                        int x0, int y0, int width, int height,
+                        double * lower, double * estimate, double * upper) {
+
+    double area = (double) width * height;
+    double lo = 0.0; double est = 0.0; double hi = 0.0;
+
+    // Pixels outside of the raster are invalid
+    int x1 = x0 + width;  int y1 = y0 + height;
+    if ( x0 < 0 ) x0 = 0;
+    if ( y0 < 0 ) y0 = 0;
+    if ( x1 > cover->src_cols ) x1 = cover->src_cols;
+    if ( y1 > cover->src_rows ) y1 = cover->src_rows;
+
+    for (int cy = y0 / cover->cell; y0 < y1 && cy * cover->cell < y1; cy++) {
+        int cy0 = cy * cover->cell;
+        int cy1 = cy0 + cover->cell;
+        if ( cy1 > cover->src_rows ) cy1 = cover->src_rows;
+        int oy = (cy1 < y1 ? cy1 : y1) - (cy0 > y0 ? cy0 : y0);
+
+        for (int cx = x0 / cover->cell; x0 < x1 && cx * cover->cell < x1; cx++) {
+            int cx0 = cx * cover->cell;
+            int cx1 = cx0 + cover->cell;
+            if ( cx1 > cover->src_cols ) cx1 = cover->src_cols;
+            int ox = (cx1 < x1 ? cx1 : x1) - (cx0 > x0 ? cx0 : x0);
+
+            // Overlap, cell area and valid pixels of the cell
+            double over = (double) ox * oy;
+            double carea = (double) (cx1 - cx0) * (cy1 - cy0);
+            double frac = cover->valid[(size_t) cy * cover->num_cols + cx];
+            double cvalid = frac * carea;
+
+            est += frac * over;
+            hi += cvalid < over ? cvalid : over;
+            lo += cvalid - (carea - over) > 0 ? cvalid - (carea - over) : 0;
+        }
+    }
+
+    *lower = area > 0 ? lo / area : 0;
+    *estimate = area > 0 ? est / area : 0;
+    *upper = area > 0 ? hi / area : 0;
+}
+
+// ----------------------------------------------------------------
+double gistk_cover_exact(const gistk_raster_t * source,
+                         int x0, int y0, int width, int height) {
+
+    double area = (double) width * height;
+    int x1 = x0 + width;  int y1 = y0 + height;
+    if ( x0 < 0 ) x0 = 0;
+    if ( y0 < 0 ) y0 = 0;
+    if ( x1 > source->num_cols ) x1 = source->num_cols;
+    if ( y1 > source->num_rows ) y1 = source->num_rows;
+    if ( area <= 0 || x1 <= x0 || y1 <= y0 ) return 0.0;
+
+    size_t num_pix = (size_t) (x1 - x0) * (y1 - y0);
+    GByte * mask = CPLMalloc(num_pix);
+    GDALRasterBandH band = GDALGetRasterBand(source->data, 1);
+    GDALRasterIO(GDALGetMaskBand(band), GF_Read, x0, y0, x1 - x0, y1 - y0,
+                 mask, x1 - x0, y1 - y0, GDT_Byte, 0, 0);
+    size_t cnt = 0;
+    for (size_t i=0; i < num_pix; i++) cnt += mask[i] > 0;
+    CPLFree(mask);
+    return cnt / area;
+}
+
+// ----------------------------------------------------------------
+void gistk_cover_free(gistk_cover_t * cover) {
+    if ( cover->valid != NULL ) CPLFree(cover->valid);
+    cover->valid = NULL;
+    cover->num_cols = cover->num_rows = 0;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -4,10 +4,34 @@
 
 #include "ifgdv/error.h"
 
+// Trap of the running library call, one per thread
+static __thread gistk_error_trap_t * gistk_error_current = NULL;
+
+// ---------------------------------------------------------------
+void gistk_error_trap(gistk_error_trap_t * trap) {
+    trap->code = 0;
+    trap->message[0] = '\0';
+    trap->prev = gistk_error_current;
+    gistk_error_current = trap;
+}
+
+// ---------------------------------------------------------------
+void gistk_error_untrap(gistk_error_trap_t * trap) {
+    gistk_error_current = trap->prev;
+}
+
 // ---------------------------------------------------------------
 void gistk_error_fatal(int code, const char *message, ...) {
     va_list arglist;
     va_start(arglist,message);
+    gistk_error_trap_t * trap = gistk_error_current;
+    if ( trap != NULL ) {
+        vsnprintf(trap->message, GISTK_ERROR_MSG, message, arglist);
+        va_end(arglist);
+        trap->code = code != 0 ? code : 1;
+        gistk_error_current = trap->prev;
+        longjmp(trap->env, 1);
+    }
     vfprintf(stderr, message, arglist );
     va_end(arglist);
     exit(code);
@@ -0,0 +1,405 @@
+// =====================================================================
+// Reentrant batch API of libgistk
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// The service routines report errors through gistk_error_fatal. Every
+// entry point sets an error trap, so a failing request returns its
+// error code instead of exiting the process. The trap jumps over the
+// cleanup of the stages, so the state a request opens lives in the
+// reader and is released by the trap handler.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <unistd.h>
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/tile.h"
+#include "ifgdv/gistk.h"
+
+// Dataset handle, tile cache and chip buffers of one calling thread
+typedef struct gistk_reader_s {
+  gistk_raster_t raster;
+  gistk_tile_cache_t cache;
+  bool cached;
+  gistk_chip_t chip;
+  gistk_raster_t written;   // output of the running request
+  bool writing;
+  struct gistk_reader_s * next_idle;
+  struct gistk_reader_s * next_all;
+} gistk_reader_t;
+
+struct gistk_ctx_s {
+  char * filename;
+  size_t cache_bytes;
+  gistk_raster_driver_t gtiff;
+  int num_cols;
+  int num_rows;
+  int num_bands;
+  double trfm[6];
+  double inv[6];
+  pthread_mutex_t lock;
+  gistk_reader_t * idle;
+  gistk_reader_t * all;
+};
+
+// Driver registration runs once per process
+static pthread_once_t gistk_lib_once = PTHREAD_ONCE_INIT;
+static int gistk_lib_init_code = GISTK_OK;
+
+// Message of the last error per thread
+static __thread char gistk_lib_message[GISTK_ERROR_MSG];
+
+// ----------------------------------------------------------------
+static void gistk_lib_init(void) {
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) == 0 ) {
+        gistk_init(true, false);
+        gistk_error_untrap(&trap);
+    } else {
+        gistk_lib_init_code = trap.code;
+    }
+}
+
+// ----------------------------------------------------------------
+static int gistk_lib_fail(const gistk_error_trap_t * trap) {
+    snprintf(gistk_lib_message, GISTK_ERROR_MSG, "%s", trap->message);
+    return trap->code;
+}
+
+// ----------------------------------------------------------------
+// Borrows a reader of the pool or opens a new one
+static int gistk_reader_get(gistk_ctx_t * ctx, gistk_reader_t ** result) {
+
+    pthread_mutex_lock(&ctx->lock);
+    gistk_reader_t * reader = ctx->idle;
+    if ( reader != NULL ) ctx->idle = reader->next_idle;
+    pthread_mutex_unlock(&ctx->lock);
+    if ( reader != NULL ) {
+        *result = reader;
+        return GISTK_OK;
+    }
+
+    reader = CPLCalloc(1, sizeof(gistk_reader_t));
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+        if ( reader->cache.slots != NULL )
+            gistk_tile_cache_close(&reader->raster, &reader->cache);
+        if ( reader->raster.data != NULL )
+            gistk_close_raster(&reader->raster);
+        CPLFree(reader);
+        return gistk_lib_fail(&trap);
+    }
+    gistk_open_raster(ctx->filename, true, &reader->raster);
+    if ( ctx->cache_bytes > 0 ) {
+        gistk_tile_cache_open(ctx->filename, &reader->raster,
+                              ctx->cache_bytes, false, &reader->cache);
+        reader->cached = true;
+    }
+    gistk_chip_init(&reader->chip);
+    gistk_error_untrap(&trap);
+
+    pthread_mutex_lock(&ctx->lock);
+    reader->next_all = ctx->all;
+    ctx->all = reader;
+    pthread_mutex_unlock(&ctx->lock);
+    *result = reader;
+    return GISTK_OK;
+}
+
+// ----------------------------------------------------------------
+static void gistk_reader_put(gistk_ctx_t * ctx, gistk_reader_t * reader) {
+    pthread_mutex_lock(&ctx->lock);
+    reader->next_idle = ctx->idle;
+    ctx->idle = reader;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+// ----------------------------------------------------------------
+int gistk_ctx_open(const char * filename, size_t cache_bytes,
+                   gistk_ctx_t ** ctx) {
+
+    *ctx = NULL;
+    pthread_once(&gistk_lib_once, gistk_lib_init);
+    if ( gistk_lib_init_code != GISTK_OK ) {
+        snprintf(gistk_lib_message, GISTK_ERROR_MSG,
+                 GISTK_ERRS_GDAL_LOAD_DRVS);
+        return gistk_lib_init_code;
+    }
+
+    gistk_ctx_t * result = CPLCalloc(1, sizeof(gistk_ctx_t));
+    result->filename = CPLStrdup(filename);
+    result->cache_bytes = cache_bytes;
+    pthread_mutex_init(&result->lock, NULL);
+
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+        gistk_ctx_close(result);
+        return gistk_lib_fail(&trap);
+    }
+    gistk_open_raster_driver(GISTK_FMT_GTIFF, true, true, false,
+                             &result->gtiff);
+    gistk_error_untrap(&trap);
+
+    // The first reader checks the file and provides the info
+    gistk_reader_t * reader;
+    int code = gistk_reader_get(result, &reader);
+    if ( code != GISTK_OK ) {
+        gistk_ctx_close(result);
+        return code;
+    }
+    result->num_cols = reader->raster.num_cols;
+    result->num_rows = reader->raster.num_rows;
+    result->num_bands = reader->raster.num_bands;
+    memcpy(result->trfm, reader->raster.trfm, sizeof(result->trfm));
+    GDALInvGeoTransform(result->trfm, result->inv);
+    gistk_reader_put(result, reader);
+
+    *ctx = result;
+    return GISTK_OK;
+}
+
+// ----------------------------------------------------------------
+void gistk_ctx_info(const gistk_ctx_t * ctx,
+                    int * num_cols, int * num_rows, int * num_bands,
+                    double * trfm) {
+    if ( num_cols != NULL ) *num_cols = ctx->num_cols;
+    if ( num_rows != NULL ) *num_rows = ctx->num_rows;
+    if ( num_bands != NULL ) *num_bands = ctx->num_bands;
+    if ( trfm != NULL ) memcpy(trfm, ctx->trfm, sizeof(ctx->trfm));
+}
+
+// ----------------------------------------------------------------
+void gistk_ctx_close(gistk_ctx_t * ctx) {
+    if ( ctx == NULL ) return;
+    gistk_reader_t * reader = ctx->all;
+    while ( reader != NULL ) {
+        gistk_reader_t * next = reader->next_all;
+        if ( reader->cached )
+            gistk_tile_cache_close(&reader->raster, &reader->cache);
+        gistk_chip_free(&reader->chip);
+        gistk_close_raster(&reader->raster);
+        CPLFree(reader);
+        reader = next;
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    CPLFree(ctx->filename);
+    CPLFree(ctx);
+}
+
+// ----------------------------------------------------------------
+// Releases what a failed cut request left open: the output is closed
+// and removed, the chip buffers are freed
+static void gistk_lib_cut_abort(gistk_reader_t * reader,
+                                const char * filename) {
+    if ( reader->written.data != NULL )
+        gistk_close_raster(&reader->written);
+    memset(&reader->written, 0, sizeof(gistk_raster_t));
+    if ( reader->writing ) unlink(filename);
+    reader->writing = false;
+    gistk_chip_free(&reader->chip);
+}
+
+// ----------------------------------------------------------------
+static int gistk_lib_cut_one(gistk_ctx_t * ctx, gistk_reader_t * reader,
+                             const gistk_cut_opts_t * opts,
+                             int width, int height, GDALDataType buf_type,
+                             gistk_cut_req_t * req) {
+
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+        gistk_lib_cut_abort(reader, req->filename);
+        return gistk_lib_fail(&trap);
+    }
+
+    long icol = -1, irow = -1;
+    trfm_geo_pix(ctx->trfm, req->x, req->y, &icol, &irow);
+    long x0 = icol - width / 2;
+    long y0 = irow - height / 2;
+    if ( x0 < 0 || y0 < 0 ||
+         x0 + width > ctx->num_cols || y0 + height > ctx->num_rows )
+        gistk_error_fatal(GISTK_ERRC_LIB_OUTSIDE, GISTK_ERRS_LIB_OUTSIDE);
+
+    gistk_chip_t * chip = &reader->chip;
+    const char * name = req->filename != NULL ? req->filename : ctx->filename;
+    gistk_chip_read(&reader->raster, name, x0, y0, x0 + width, y0 + height,
+                    opts, chip);
+    if ( chip->width != width || chip->height != height )
+        gistk_error_fatal(GISTK_ERRC_LIB_OUTSIDE, GISTK_ERRS_LIB_OUTSIDE);
+    gistk_chip_transform(opts, chip);
+
+    if ( req->filename != NULL ) {
+        memset(&reader->written, 0, sizeof(gistk_raster_t));
+        reader->writing = true;
+        gistk_chip_write(ctx->gtiff, &reader->raster, req->filename,
+                         opts, chip, &reader->written);
+        gistk_close_raster(&reader->written);
+        memset(&reader->written, 0, sizeof(gistk_raster_t));
+        reader->writing = false;
+    }
+
+    if ( req->buffer != NULL ) {
+        size_t num_pix = (size_t) width * height;
+        int bsize = GDALGetDataTypeSize(buf_type) / 8;
+        GByte * dst = req->buffer;
+        for (int b=0; b < chip->num_copied; b++) {
+            const gistk_chip_band_t * cb = &chip->bands[b];
+            GDALDataType type = chip->convert ? cb->out_type : cb->in_type;
+            GDALCopyWords(chip->convert ? cb->out : cb->in, type,
+                          GDALGetDataTypeSize(type) / 8,
+                          dst, buf_type, bsize, (int) num_pix);
+            dst += num_pix * bsize;
+        }
+        for (int d=0; d < chip->num_derived; d++) {
+            GDALCopyWords(chip->derived[d], GDT_Float32, sizeof(float),
+                          dst, buf_type, bsize, (int) num_pix);
+            dst += num_pix * bsize;
+        }
+    }
+
+    gistk_error_untrap(&trap);
+    return GISTK_OK;
+}
+
+// ----------------------------------------------------------------
+int gistk_cut_batch(gistk_ctx_t * ctx, const gistk_cut_opts_t * opts,
+                    int width, int height, GDALDataType buf_type,
+                    gistk_cut_req_t * reqs, size_t num_reqs) {
+
+    if ( width < 1 || height < 1 ||
+         ( opts != NULL && opts->num_scales > 0 ) ) {
+        snprintf(gistk_lib_message, GISTK_ERROR_MSG,
+                 GISTK_ERRS_LIB_ARGS, "gistk_cut_batch");
+        return GISTK_ERRC_LIB_ARGS;
+    }
+
+    gistk_reader_t * reader;
+    int code = gistk_reader_get(ctx, &reader);
+    if ( code != GISTK_OK ) return code;
+
+    // The chip and the stages expect options
+    gistk_cut_opts_t plain;
+    if ( opts == NULL ) {
+        gistk_cut_opts_init(&plain);
+        opts = &plain;
+    }
+
+    int first = GISTK_OK;
+    for (size_t r=0; r < num_reqs; r++) {
+        reqs[r].status = gistk_lib_cut_one(ctx, reader, opts,
+                                           width, height, buf_type, &reqs[r]);
+        if ( first == GISTK_OK ) first = reqs[r].status;
+    }
+
+    gistk_reader_put(ctx, reader);
+    return first;
+}
+
+// ----------------------------------------------------------------
+// Point of a sample batch in block order
+typedef struct {
+  long key;
+  size_t index;
+  int col;
+  int row;
+} gistk_sample_t;
+
+static int gistk_sample_cmp(const void * a, const void * b) {
+    const gistk_sample_t * sa = a;
+    const gistk_sample_t * sb = b;
+    if ( sa->key != sb->key ) return sa->key < sb->key ? -1 : 1;
+    return sa->index < sb->index ? -1 : sa->index > sb->index;
+}
+
+// ----------------------------------------------------------------
+static int gistk_lib_sample_one(gistk_reader_t * reader, int band,
+                                bool has_nodata, double nodata,
+                                const gistk_sample_t * point,
+                                double * value) {
+
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+        *value = NAN;
+        return gistk_lib_fail(&trap);
+    }
+    gistk_raster_read(&reader->raster, band, point->col, point->row, 1, 1,
+                      value, GDT_Float64, 0);
+    gistk_error_untrap(&trap);
+
+    if ( isnan(*value) || ( has_nodata && *value == nodata ) ) {
+        *value = NAN;
+        return GISTK_ERRC_LIB_NODATA;
+    }
+    return GISTK_OK;
+}
+
+// ----------------------------------------------------------------
+int gistk_sample_batch(gistk_ctx_t * ctx, int band,
+                       const double * x, const double * y,
+                       size_t num_points, double * values, int * status) {
+
+    if ( band < 1 || band > ctx->num_bands ) {
+        snprintf(gistk_lib_message, GISTK_ERROR_MSG,
+                 GISTK_ERRS_LIB_ARGS, "gistk_sample_batch");
+        return GISTK_ERRC_LIB_ARGS;
+    }
+
+    gistk_reader_t * reader;
+    int code = gistk_reader_get(ctx, &reader);
+    if ( code != GISTK_OK ) return code;
+
+    GDALRasterBandH hband = GDALGetRasterBand(reader->raster.data, band);
+    int has = 0;
+    double nodata = GDALGetRasterNoDataValue(hband, &has);
+    int block_w, block_h;
+    GDALGetBlockSize(hband, &block_w, &block_h);
+    long blocks_x = (ctx->num_cols + block_w - 1) / block_w;
+
+    // Sort the points by block, so every block is decoded once
+    gistk_sample_t * points = CPLMalloc(sizeof(gistk_sample_t) * num_points);
+    size_t num_inside = 0;
+    for (size_t p=0; p < num_points; p++) {
+        const double * inv = ctx->inv;
+        double col = floor(inv[0] + inv[1] * x[p] + inv[2] * y[p]);
+        double row = floor(inv[3] + inv[4] * x[p] + inv[5] * y[p]);
+        if ( ! ( col >= 0 && col < ctx->num_cols &&
+                 row >= 0 && row < ctx->num_rows ) ) {
+            values[p] = NAN;
+            if ( status != NULL ) status[p] = GISTK_ERRC_LIB_OUTSIDE;
+            continue;
+        }
+        gistk_sample_t * point = &points[num_inside++];
+        point->col = (int) col;
+        point->row = (int) row;
+        point->index = p;
+        point->key = (point->row / block_h) * blocks_x + point->col / block_w;
+    }
+    qsort(points, num_inside, sizeof(gistk_sample_t), gistk_sample_cmp);
+
+    for (size_t p=0; p < num_inside; p++) {
+        size_t index = points[p].index;
+        int result = gistk_lib_sample_one(reader, band, has != 0, nodata,
+                                          &points[p], &values[index]);
+        if ( status != NULL ) status[index] = result;
+    }
+
+    CPLFree(points);
+    gistk_reader_put(ctx, reader);
+    return GISTK_OK;
+}
+
+// ----------------------------------------------------------------
+const char * gistk_last_error(void) {
+    return gistk_lib_message;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -0,0 +1,312 @@
+// =====================================================================
+// Band math over geotiffs on a common grid
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-calc.c is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// gtif-calc.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-calc.c.  If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+// The expression is compiled once into a tape (calc.h). Threads take
+// the blocks of the tiled output, read the inputs of a block with own
+// dataset handles, run the tape over it and write the block. Memory
+// stays at a few blocks per thread whatever the raster size.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "ifgdv/error.h"
+#include "ifgdv/util.h"
+#include "ifgdv/stats.h"
+#include "ifgdv/calc.h"
+#include "ifgdv/pipe.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] OUT EXPR NAME=FILE ...!\n" \
+  "Options:\n" \
+  "  -t TYPE      output data type (default Float32)\n" \
+  "  -n NODATA    output nodata value (default -99999), it has to\n" \
+  "               fit into the output type\n" \
+  "  -c COMPRESS  output compression (default DEFLATE)\n" \
+  "  -T SIZE      block size [pixel], multiple of 16 (default 256)\n" \
+  "  -j THREADS   number of threads (default all cores)\n" \
+  "  -m           write statistics into the output metadata\n" \
+  "Inputs are named NAME=FILE for band 1 or NAME:BAND=FILE. Nodata\n" \
+  "pixels are nodata in the expression and propagate, the constant\n" \
+  "nodata and isnodata(X) test and set them.\n" \
+  "Operators: ?: || && < <= > >= == != + - * / %% ^ !\n" \
+  "Functions: abs sqrt exp log floor ceil min max isnodata\n" \
+  "Example: %s depth.tif 'D < 0 ? -D : nodata' D=dem.v2.3d.tif\n"
+
+// -------------------------------------------------------------------
+// One input raster band
+typedef struct {
+  char name[32];
+  const char * filename;
+  int band;
+  bool has_nodata;
+  double nodata;
+} calc_input_t;
+
+// State shared by the threads
+typedef struct {
+  gistk_calc_t calc;
+  calc_input_t inputs[GISTK_CALC_MAX_VARS];
+  int num_inputs;
+  int num_cols;
+  int num_rows;
+  int block;
+  int blocks_x;
+  int num_blocks;
+  double nodata;
+  bool with_stats;
+  gistk_stats_t stats;
+  GDALRasterBandH out;     // written under the lock
+  gistk_pool_t pool;
+} calc_job_t;
+
+// -------------------------------------------------------------------
+static void calc_run(void * ctx) {
+  calc_job_t * job = ctx;
+  size_t n = (size_t) job->block * job->block;
+
+  GDALDatasetH data[GISTK_CALC_MAX_VARS];
+  double * vars[GISTK_CALC_MAX_VARS];
+  bool ok = true;
+  for (int v=0; v < job->num_inputs; v++) {
+    data[v] = NULL;
+    vars[v] = NULL;
+    if ( ! job->calc.uses[v] ) continue;
+    data[v] = gistk_pool_open(&job->pool, job->inputs[v].filename);
+    if ( data[v] == NULL ) ok = false;
+    vars[v] = CPLMalloc(sizeof(double) * n);
+  }
+  double * work = CPLMalloc(sizeof(double) *
+                            (gistk_calc_work_size(&job->calc, n) + 1));
+  double * out = CPLMalloc(sizeof(double) * n);
+  gistk_stats_t stats;
+  gistk_stats_init(&stats);
+
+  int b;
+  while ( ok && (b = gistk_pool_next(&job->pool)) >= 0 ) {
+    int x0 = (b % job->blocks_x) * job->block;
+    int y0 = (b / job->blocks_x) * job->block;
+    int w = job->num_cols - x0 < job->block ? job->num_cols - x0 : job->block;
+    int h = job->num_rows - y0 < job->block ? job->num_rows - y0 : job->block;
+    size_t m = (size_t) w * h;
+
+    for (int v=0; ok && v < job->num_inputs; v++) {
+      if ( data[v] == NULL ) continue;
+      const calc_input_t * input = &job->inputs[v];
+      GDALRasterBandH band = GDALGetRasterBand(data[v], input->band);
+      if ( GDALRasterIO(band, GF_Read, x0, y0, w, h, vars[v], w, h,
+                        GDT_Float64, 0, 0) != CE_None ) {
+        ok = false;
+        break;
+      }
+      if ( input->has_nodata )
+        for (size_t i=0; i < m; i++)
+          if ( vars[v][i] == input->nodata ) vars[v][i] = NAN;
+    }
+    if ( ! ok ) break;
+
+    gistk_calc_eval(&job->calc, (const double * const *) vars, m, work, out);
+    for (size_t i=0; i < m; i++)
+      if ( out[i] != out[i] ) out[i] = job->nodata;
+    if ( job->with_stats ) gistk_stats_add(&stats, out, m, true, job->nodata);
+
+    pthread_mutex_lock(&job->pool.lock);
+    if ( GDALRasterIO(job->out, GF_Write, x0, y0, w, h, out, w, h,
+                      GDT_Float64, 0, 0) != CE_None ) ok = false;
+    pthread_mutex_unlock(&job->pool.lock);
+  }
+
+  pthread_mutex_lock(&job->pool.lock);
+  if ( ! ok ) gistk_pool_fail(&job->pool);
+  if ( job->with_stats ) gistk_stats_merge(&job->stats, &stats);
+  pthread_mutex_unlock(&job->pool.lock);
+
+  CPLFree(out);
+  CPLFree(work);
+  for (int v=0; v < job->num_inputs; v++) {
+    CPLFree(vars[v]);
+    if ( data[v] != NULL ) GDALClose(data[v]);
+  }
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  calc_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.block = 256;
+  job.nodata = -99999.0;
+  GDALDataType out_type = GDT_Float32;
+  const char * compress = "DEFLATE";
+  int num_threads = gistk_pool_threads(NULL);
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+t:n:c:T:j:m")) != -1 ) {
+    switch ( opt ) {
+    case 't':
+      out_type = gistk_conv_type_by_name(optarg);
+      if ( out_type == GDT_Unknown )
+        gistk_error_fatal(1, "Invalid data type %s!\n", optarg);
+      break;
+    case 'n':
+      if (! sscanf(optarg,"%lf",&job.nodata) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "NODATA", optarg);
+      break;
+    case 'c':
+      compress = optarg;
+      break;
+    case 'T':
+      if (! sscanf(optarg,"%d",&job.block) || job.block < 16 ||
+          job.block % 16 != 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "SIZE", optarg);
+      break;
+    case 'j':
+      num_threads = gistk_pool_threads(optarg);
+      break;
+    case 'm':
+      job.with_stats = true;
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+  if ( ! gistk_conv_fits(out_type, job.nodata) )
+    gistk_error_fatal(1, "The nodata value %g does not fit into %s, "
+                      "set one with -n!\n", job.nodata,
+                      GDALGetDataTypeName(out_type));
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 4 )
+    gistk_error_fatal(1, "Missing parameter at least 3\n" USAGE, prog, prog);
+  const char * out_file = argv[1];
+  const char * expr = argv[2];
+
+  // Inputs NAME=FILE or NAME:BAND=FILE
+  const char * names[GISTK_CALC_MAX_VARS];
+  for (int i=3; i < argc; i++) {
+    if ( job.num_inputs == GISTK_CALC_MAX_VARS )
+      gistk_error_fatal(1, "More than %d inputs!\n", GISTK_CALC_MAX_VARS);
+    calc_input_t * input = &job.inputs[job.num_inputs];
+    const char * eq = strchr(argv[i], '=');
+    size_t len = eq != NULL ? (size_t) (eq - argv[i]) : 0;
+    if ( len == 0 || len >= sizeof(input->name) )
+      gistk_error_fatal(1, "Invalid input %s, use NAME=FILE!\n", argv[i]);
+    memcpy(input->name, argv[i], len);
+    input->name[len] = '\0';
+    input->band = 1;
+    char * colon = strchr(input->name, ':');
+    if ( colon != NULL ) {
+      *colon = '\0';
+      if ( sscanf(colon + 1, "%d", &input->band) != 1 || input->band < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "BAND", argv[i]);
+    }
+    input->filename = eq + 1;
+    names[job.num_inputs++] = input->name;
+  }
+  gistk_calc_compile(expr, job.num_inputs, names, &job.calc);
+
+  // Register the drivers
+  gistk_init(true, false);
+
+  // All inputs on the grid of the first one
+  gistk_raster_t rasters[GISTK_CALC_MAX_VARS];
+  for (int v=0; v < job.num_inputs; v++) {
+    calc_input_t * input = &job.inputs[v];
+    gistk_open_raster(input->filename, true, &rasters[v]);
+    if ( input->band > rasters[v].num_bands )
+      gistk_error_fatal(1, "Band %d is not available in %s!\n",
+                        input->band, input->filename);
+    int has = 0;
+    input->nodata = GDALGetRasterNoDataValue(
+      GDALGetRasterBand(rasters[v].data, input->band), &has);
+    input->has_nodata = has != 0;
+    bool same = rasters[v].num_cols == rasters[0].num_cols &&
+                rasters[v].num_rows == rasters[0].num_rows;
+    double tol = 1e-6 * fabs(rasters[0].trfm[1]);
+    for (int t=0; same && t < 6; t++)
+      same = fabs(rasters[v].trfm[t] - rasters[0].trfm[t]) <= tol;
+    if ( ! same )
+      gistk_error_fatal(GISTK_ERRC_CALC_GRID, GISTK_ERRS_CALC_GRID,
+                        input->filename, job.inputs[0].filename);
+  }
+  job.num_cols = rasters[0].num_cols;
+  job.num_rows = rasters[0].num_rows;
+
+  // Tiled output, the predictor suits the data type
+  gistk_raster_driver_t tool;
+  gistk_open_raster_driver(GISTK_FMT_GTIFF, true, true, false, &tool);
+  char size[32];
+  snprintf(size, sizeof(size), "%d", job.block);
+  bool is_float = out_type == GDT_Float32 || out_type == GDT_Float64;
+  char ** create_opts = NULL;
+  create_opts = CSLSetNameValue(create_opts, "TILED", "YES");
+  create_opts = CSLSetNameValue(create_opts, "BLOCKXSIZE", size);
+  create_opts = CSLSetNameValue(create_opts, "BLOCKYSIZE", size);
+  create_opts = CSLSetNameValue(create_opts, "COMPRESS", compress);
+  create_opts = CSLSetNameValue(create_opts, "PREDICTOR", is_float ? "3" : "2");
+  create_opts = CSLSetNameValue(create_opts, "BIGTIFF", "IF_SAFER");
+  GDALDatasetH out_data = GDALCreate(tool.driver, out_file, job.num_cols,
+                                     job.num_rows, 1, out_type, create_opts);
+  CSLDestroy(create_opts);
+  if ( out_data == NULL )
+    gistk_error_fatal(GISTK_ERRC_CUT_RST_CREATE, GISTK_ERRS_CUT_RST_CREATE,
+                      out_file);
+  GDALSetGeoTransform(out_data, rasters[0].trfm);
+  GDALSetProjection(out_data, rasters[0].proj_info);
+  job.out = GDALGetRasterBand(out_data, 1);
+  GDALSetRasterNoDataValue(job.out, job.nodata);
+
+  job.blocks_x = (job.num_cols + job.block - 1) / job.block;
+  job.num_blocks = job.blocks_x * ((job.num_rows + job.block - 1) / job.block);
+  gistk_stats_init(&job.stats);
+
+  for (int v=0; v < job.num_inputs; v++)
+    printf("# IN %-10s %s:%d\n", job.inputs[v].name,
+           job.inputs[v].filename, job.inputs[v].band);
+  printf("# OUT FILE:      %s\n", out_file);
+  printf("# EXPRESSION:    %s\n", expr);
+  printf("# TAPE:          %d instructions\n", job.calc.num_instr);
+  printf("# BLOCKS:        %d of %d\n", job.num_blocks, job.block);
+
+  gistk_pool_init(&job.pool);
+  if ( ! gistk_pool_run(&job.pool, job.num_blocks, num_threads,
+                        calc_run, &job) )
+    gistk_error_fatal(GISTK_ERRC_CALC_THREAD, GISTK_ERRS_CALC_THREAD);
+  gistk_pool_free(&job.pool);
+  if ( job.pool.failed )
+    gistk_error_fatal(GISTK_ERRC_CALC_READ, GISTK_ERRS_CALC_READ);
+
+  if ( job.with_stats ) {
+    gistk_stats_write(job.out, &job.stats);
+    printf("# VALID:         %llu of %llu\n",
+           (unsigned long long) job.stats.count,
+           (unsigned long long) job.stats.total);
+  }
+  GDALClose(out_data);
+  gistk_calc_free(&job.calc);
+  for (int v=0; v < job.num_inputs; v++) gistk_close_raster(&rasters[v]);
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
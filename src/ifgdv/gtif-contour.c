@@ -0,0 +1,872 @@
+// =====================================================================
+// Tiled contour (isobath) extraction of a geotiff DEM
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-contour.c is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// gtif-contour.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-contour.c.  If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+// Worker threads run marching squares over strips of rows and chain
+// the segments of a strip into lines. Every line end is named by the
+// grid edge it lies on, so the main thread glues the ends on the strip
+// borders strip by strip in row order. The output depends on the strip
+// height only, not on the number of threads or their timing.
+// Finished lines are simplified and written in large transactions.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <stdint.h>
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/util.h"
+#include "ifgdv/pipe.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] IN OUT!\n" \
+  "Options:\n" \
+  "  -i INTERVAL  distance between the contour levels\n" \
+  "  -o OFFSET    level of one contour (default 0)\n" \
+  "  -l LIST      comma separated contour levels instead of -i\n" \
+  "  -b BAND      band of the DEM (default 1)\n" \
+  "  -s TOL       simplify the lines with Douglas-Peucker [world]\n" \
+  "  -f FORMAT    vector format of OUT (default GPKG)\n" \
+  "  -n LAYER     name of the layer (default contour)\n" \
+  "  -T ROWS      rows per strip (default 256)\n" \
+  "  -j THREADS   number of threads (default all cores)\n" \
+  "Example: %s -i 5 -s 10 dem.v2.3d.tif isobaths.gpkg\n"
+
+// Maximal number of contour levels
+#define CONTOUR_MAX_LEVELS 4096
+
+// Features per transaction
+#define CONTOUR_BATCH 20000
+
+// -------------------------------------------------------------------
+typedef struct {
+  double x;
+  double y;
+} contour_point_t;
+
+// Segment of one cell, ends named by their grid edges
+typedef struct {
+  int64_t key[2];
+  contour_point_t pts[2];
+} contour_seg_t;
+
+// Chained line, open ends keep their edge keys, dead ends and
+// closed rings have -1
+typedef struct {
+  int level;
+  int merged;          // line that absorbed this one or -1
+  int64_t head;
+  int64_t tail;
+  size_t num;
+  size_t mem;
+  contour_point_t * pts;
+} contour_line_t;
+
+// Lines of a strip handed from a worker to the main thread
+typedef struct {
+  contour_line_t * lines;
+  size_t num;
+  bool ready;
+} contour_strip_t;
+
+// Edge key to up to two indices
+typedef struct {
+  int64_t * keys;
+  int * vals;
+  size_t mem;
+  size_t size;
+} contour_map_t;
+
+// State shared by the threads
+typedef struct {
+  const char * filename;
+  int band;
+  int num_cols;
+  int num_rows;
+  int strip_rows;
+  int num_strips;
+  int num_levels;    // levels of -l, 0 for the levels of -i
+  double levels[CONTOUR_MAX_LEVELS];
+  double interval;
+  double offset;
+  int level_bits;    // low bits of an edge key holding the level
+  contour_strip_t * strips;
+  int done;          // strips glued by the main thread
+  int window;        // strips a worker may run ahead
+  gistk_pool_t pool; // its lock guards done and the strips
+  pthread_cond_t cond;
+} contour_job_t;
+
+// Output layer
+typedef struct {
+  GDALDatasetH data;
+  OGRLayerH layer;
+  OGRFeatureH feature;
+  OGRGeometryH line;
+  int fld_level;
+  int num_batch;
+  GUIntBig num_features;
+  GUIntBig num_points;
+  double tolerance;
+  double trfm[6];
+  char * keep;
+  size_t * stack;
+  size_t mem;
+} contour_writer_t;
+
+// -------------------------------------------------------------------
+static void contour_map_init(contour_map_t * map, size_t expected) {
+  map->mem = 64;
+  while ( map->mem < 2 * expected ) map->mem *= 2;
+  map->size = 0;
+  map->keys = CPLMalloc(sizeof(int64_t) * map->mem);
+  map->vals = CPLMalloc(sizeof(int) * 2 * map->mem);
+  memset(map->keys, 0xff, sizeof(int64_t) * map->mem);
+  memset(map->vals, 0xff, sizeof(int) * 2 * map->mem);
+}
+
+// -------------------------------------------------------------------
+static void contour_map_free(contour_map_t * map) {
+  CPLFree(map->keys);
+  CPLFree(map->vals);
+  map->keys = NULL;
+  map->vals = NULL;
+}
+
+// -------------------------------------------------------------------
+static size_t contour_map_hash(const contour_map_t * map, int64_t key) {
+  uint64_t h = (uint64_t) key * 0x9E3779B97F4A7C15ull;
+  return (size_t) (h ^ (h >> 29)) & (map->mem - 1);
+}
+
+// -------------------------------------------------------------------
+// Values of a key, NULL if absent and not inserted
+static int * contour_map_get(contour_map_t * map, int64_t key, bool insert) {
+  if ( insert && 2 * (map->size + 1) > map->mem ) {
+    contour_map_t grown;
+    contour_map_init(&grown, map->mem);
+    for (size_t i=0; i < map->mem; i++) {
+      if ( map->keys[i] < 0 ) continue;
+      int * vals = contour_map_get(&grown, map->keys[i], true);
+      vals[0] = map->vals[2*i];
+      vals[1] = map->vals[2*i+1];
+    }
+    contour_map_free(map);
+    *map = grown;
+  }
+  size_t i = contour_map_hash(map, key);
+  while ( map->keys[i] >= 0 && map->keys[i] != key )
+    i = (i + 1) & (map->mem - 1);
+  if ( map->keys[i] < 0 ) {
+    if ( ! insert ) return NULL;
+    map->keys[i] = key;
+    map->size++;
+  }
+  return &map->vals[2*i];
+}
+
+// -------------------------------------------------------------------
+static void contour_line_add(contour_line_t * line, contour_point_t pt) {
+  if ( line->num == line->mem ) {
+    line->mem = line->mem * 2 + 16;
+    line->pts = CPLRealloc(line->pts, sizeof(contour_point_t) * line->mem);
+  }
+  line->pts[line->num++] = pt;
+}
+
+// -------------------------------------------------------------------
+static void contour_line_reverse(contour_line_t * line) {
+  for (size_t i=0, j=line->num-1; i < j; i++, j--) {
+    contour_point_t t = line->pts[i];
+    line->pts[i] = line->pts[j];
+    line->pts[j] = t;
+  }
+  int64_t t = line->head;
+  line->head = line->tail;
+  line->tail = t;
+}
+
+// -------------------------------------------------------------------
+// Value of a level, an index into -l or a multiple of -i
+static double contour_level(const contour_job_t * job, int level) {
+  return job->num_levels > 0 ? job->levels[level] :
+                               job->offset + level * job->interval;
+}
+
+// -------------------------------------------------------------------
+// Key of a grid edge and level, horizontal edges are even. The level
+// is stored with a bias in the low bits, levels of -i may be negative.
+static int64_t contour_key(const contour_job_t * job, int x, int y,
+                           int vertical, int level) {
+  int64_t edge = ((int64_t) y * job->num_cols + x) * 2 + vertical;
+  return ( edge << job->level_bits ) +
+         level + ( (int64_t) 1 << (job->level_bits - 1) );
+}
+
+// -------------------------------------------------------------------
+// Level of an edge key
+static int contour_key_level(const contour_job_t * job, int64_t key) {
+  int64_t mask = ( (int64_t) 1 << job->level_bits ) - 1;
+  return (int) ( (key & mask) - ( (int64_t) 1 << (job->level_bits - 1) ) );
+}
+
+// -------------------------------------------------------------------
+// Row of a horizontal edge key, -1 for vertical edges
+static int contour_key_row(const contour_job_t * job, int64_t key) {
+  int64_t edge = key >> job->level_bits;
+  if ( key < 0 || edge % 2 != 0 ) return -1;
+  return (int) (edge / 2 / job->num_cols);
+}
+
+// -------------------------------------------------------------------
+// Marching squares in one cell, corners a b / d c
+static void contour_cell(const contour_job_t * job, int x, int y,
+                         const float v[4], contour_seg_t ** segs,
+                         size_t * num, size_t * mem) {
+
+  // Corners of the edges top, right, bottom and left
+  static const int e0[4] = { 0, 1, 3, 0 };
+  static const int e1[4] = { 1, 2, 2, 3 };
+  static const int ex[4] = { 0, 1, 0, 0 };
+  static const int ey[4] = { 0, 0, 1, 0 };
+  static const int ev[4] = { 0, 1, 0, 1 };
+  static const double cx[4] = { 0, 1, 1, 0 };
+  static const double cy[4] = { 0, 0, 1, 1 };
+
+  float lo = v[0], hi = v[0];
+  for (int c=1; c < 4; c++) {
+    if ( v[c] < lo ) lo = v[c];
+    if ( v[c] > hi ) hi = v[c];
+  }
+
+  // First level above the lowest corner. Levels of -i follow from the
+  // cell values, so no extremes of the band are needed; one level
+  // below the estimate absorbs the rounding of the division.
+  int l0 = 0, l_end = job->num_levels;
+  if ( job->num_levels > 0 ) {
+    int l1 = job->num_levels;
+    while ( l0 < l1 ) {
+      int m = (l0 + l1) / 2;
+      if ( job->levels[m] > lo ) l1 = m; else l0 = m + 1;
+    }
+  } else {
+    double k0 = floor((lo - job->offset) / job->interval) - 1;
+    double k1 = floor((hi - job->offset) / job->interval) + 1;
+    double range = (double) ( (int64_t) 1 << (job->level_bits - 1) );
+    if ( k0 < -range || k1 >= range - 1 )
+      gistk_error_fatal(1, "Level %g is out of the range of %d bit level "
+                        "keys, use a larger interval!\n",
+                        job->offset + k0 * job->interval, job->level_bits);
+    l0 = (int) k0;
+    l_end = (int) k1 + 1;
+  }
+
+  for (int l = l0; l < l_end; l++) {
+    double level = contour_level(job, l);
+    if ( level <= lo ) continue;
+    if ( level > hi ) break;
+    int pairs[4];
+    int num_pairs = 0;
+    int crossed[4];
+    int num_crossed = 0;
+    for (int e=0; e < 4; e++)
+      if ( (v[e0[e]] >= level) != (v[e1[e]] >= level) )
+        crossed[num_crossed++] = e;
+    if ( num_crossed == 2 ) {
+      pairs[0] = crossed[0]; pairs[1] = crossed[1];
+      num_pairs = 2;
+    } else if ( num_crossed == 4 ) {
+
+      // Saddle, the center value decides which corners connect
+      bool center = (v[0] + v[1] + v[2] + v[3]) / 4.0 >= level;
+      bool ac = v[0] >= level;
+      if ( ac == center ) {
+        pairs[0] = 0; pairs[1] = 1; pairs[2] = 2; pairs[3] = 3;
+      } else {
+        pairs[0] = 0; pairs[1] = 3; pairs[2] = 1; pairs[3] = 2;
+      }
+      num_pairs = 4;
+    }
+
+    for (int p=0; p < num_pairs; p += 2) {
+      if ( *num == *mem ) {
+        *mem = *mem * 2 + 1024;
+        *segs = CPLRealloc(*segs, sizeof(contour_seg_t) * *mem);
+      }
+      contour_seg_t * seg = &(*segs)[(*num)++];
+      for (int s=0; s < 2; s++) {
+        int e = pairs[p+s];
+        double t = (level - v[e0[e]]) / (v[e1[e]] - v[e0[e]]);
+        seg->key[s] = contour_key(job, x + ex[e], y + ey[e], ev[e], l);
+        seg->pts[s].x = x + cx[e0[e]] + t * (cx[e1[e]] - cx[e0[e]]);
+        seg->pts[s].y = y + cy[e0[e]] + t * (cy[e1[e]] - cy[e0[e]]);
+      }
+    }
+  }
+}
+
+// -------------------------------------------------------------------
+static int contour_other(contour_map_t * map, int64_t key, int seg) {
+  int * vals = contour_map_get(map, key, false);
+  if ( vals == NULL ) return -1;
+  return vals[0] == seg ? vals[1] : vals[0];
+}
+
+// -------------------------------------------------------------------
+// Chains the segments of a strip into lines, ends off the strip
+// borders are dead
+static void contour_chain(const contour_job_t * job, int r0, int r1,
+                          contour_seg_t * segs, size_t num,
+                          contour_strip_t * strip) {
+  contour_map_t map;
+  contour_map_init(&map, 2 * num);
+  for (size_t s=0; s < num; s++)
+    for (int k=0; k < 2; k++) {
+      int * vals = contour_map_get(&map, segs[s].key[k], true);
+      vals[vals[0] < 0 ? 0 : 1] = (int) s;
+    }
+
+  char * visited = CPLCalloc(num + 1, 1);
+  size_t mem = 0;
+  strip->lines = NULL;
+  strip->num = 0;
+  for (size_t s=0; s < num; s++) {
+    if ( visited[s] ) continue;
+
+    // Walk back to the start of an open line
+    int cur = (int) s;
+    int64_t key = segs[s].key[0];
+    for (;;) {
+      int t = contour_other(&map, key, cur);
+      if ( t < 0 ) break;
+      if ( t == (int) s ) { cur = (int) s; key = segs[s].key[0]; break; }
+      key = segs[t].key[0] == key ? segs[t].key[1] : segs[t].key[0];
+      cur = t;
+    }
+
+    if ( strip->num == mem ) {
+      mem = mem * 2 + 64;
+      strip->lines = CPLRealloc(strip->lines, sizeof(contour_line_t) * mem);
+    }
+    contour_line_t * line = &strip->lines[strip->num++];
+    memset(line, 0, sizeof(contour_line_t));
+    line->level = contour_key_level(job, key);
+    line->merged = -1;
+    line->head = key;
+    contour_line_add(line, segs[cur].pts[segs[cur].key[0] == key ? 0 : 1]);
+    for (;;) {
+      visited[cur] = 1;
+      int j = segs[cur].key[0] == key ? 1 : 0;
+      contour_line_add(line, segs[cur].pts[j]);
+      key = segs[cur].key[j];
+      int t = contour_other(&map, key, cur);
+      if ( t < 0 || visited[t] ) break;
+      cur = t;
+    }
+    line->tail = key;
+
+    // Only ends on the borders to the neighbour strips stay open
+    if ( line->head == line->tail ) {
+      line->head = line->tail = -1;
+    } else {
+      int hr = contour_key_row(job, line->head);
+      int tr = contour_key_row(job, line->tail);
+      if ( ! ( ( hr == r0 && r0 > 0 ) ||
+               ( hr == r1 && r1 < job->num_rows - 1 ) ) ) line->head = -1;
+      if ( ! ( ( tr == r0 && r0 > 0 ) ||
+               ( tr == r1 && r1 < job->num_rows - 1 ) ) ) line->tail = -1;
+    }
+  }
+  CPLFree(visited);
+  contour_map_free(&map);
+}
+
+// -------------------------------------------------------------------
+// Worker thread, takes strips but stays close to the main thread
+static void contour_run(void * ctx) {
+  contour_job_t * job = ctx;
+  GDALDatasetH data = gistk_pool_open(&job->pool, job->filename);
+  if ( data == NULL ) {
+
+    // Wake the main thread waiting for a strip
+    pthread_mutex_lock(&job->pool.lock);
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->pool.lock);
+    return;
+  }
+  GDALRasterBandH band = GDALGetRasterBand(data, job->band);
+  int has_nodata = 0;
+  float nodata = (float) GDALGetRasterNoDataValue(band, &has_nodata);
+  int w = job->num_cols;
+  float * z = CPLMalloc(sizeof(float) * w * (job->strip_rows + 1));
+  contour_seg_t * segs = NULL;
+  size_t mem = 0;
+
+  int i;
+  while ( (i = gistk_pool_next(&job->pool)) >= 0 ) {
+
+    pthread_mutex_lock(&job->pool.lock);
+    while ( i >= job->done + job->window )
+      pthread_cond_wait(&job->cond, &job->pool.lock);
+    pthread_mutex_unlock(&job->pool.lock);
+
+    // Cells of the strip need the first row of the next one
+    int r0 = i * job->strip_rows;
+    int r1 = r0 + job->strip_rows;
+    if ( r1 > job->num_rows - 1 ) r1 = job->num_rows - 1;
+    bool ok =
+      GDALRasterIO(band, GF_Read, 0, r0, w, r1 - r0 + 1, z, w, r1 - r0 + 1,
+                   GDT_Float32, 0, 0) == CE_None;
+
+    size_t num = 0;
+    for (int y=r0; ok && y < r1; y++) {
+      const float * top = z + (size_t) (y - r0) * w;
+      const float * bottom = top + w;
+      for (int x=0; x < w - 1; x++) {
+        float v[4] = { top[x], top[x+1], bottom[x+1], bottom[x] };
+        if ( v[0] != v[0] || v[1] != v[1] || v[2] != v[2] || v[3] != v[3] )
+          continue;
+        if ( has_nodata && ( v[0] == nodata || v[1] == nodata ||
+                             v[2] == nodata || v[3] == nodata ) ) continue;
+        contour_cell(job, x, y, v, &segs, &num, &mem);
+      }
+    }
+
+    contour_strip_t strip;
+    memset(&strip, 0, sizeof(strip));
+    if ( ok ) contour_chain(job, r0, r1, segs, num, &strip);
+
+    pthread_mutex_lock(&job->pool.lock);
+    if ( ! ok ) gistk_pool_fail(&job->pool);
+    job->strips[i] = strip;
+    job->strips[i].ready = true;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->pool.lock);
+  }
+
+  CPLFree(segs);
+  CPLFree(z);
+  GDALClose(data);
+}
+
+// -------------------------------------------------------------------
+// Simplifies a line in place with Douglas-Peucker
+static size_t contour_simplify(contour_writer_t * out,
+                               contour_point_t * pts, size_t num) {
+  if ( num < 3 || out->tolerance <= 0 ) return num;
+  if ( num > out->mem ) {
+    out->mem = num;
+    out->keep = CPLRealloc(out->keep, num);
+    out->stack = CPLRealloc(out->stack, sizeof(size_t) * 2 * num);
+  }
+  memset(out->keep, 0, num);
+  out->keep[0] = out->keep[num-1] = 1;
+  double tol2 = out->tolerance * out->tolerance;
+
+  size_t top = 0;
+  out->stack[top++] = 0;
+  out->stack[top++] = num - 1;
+  while ( top > 0 ) {
+    size_t b = out->stack[--top];
+    size_t a = out->stack[--top];
+    double dx = pts[b].x - pts[a].x;
+    double dy = pts[b].y - pts[a].y;
+    double len2 = dx * dx + dy * dy;
+    double best = -1;
+    size_t far = a;
+    for (size_t i=a+1; i < b; i++) {
+      double px = pts[i].x - pts[a].x;
+      double py = pts[i].y - pts[a].y;
+
+      // Rings start and end in one point
+      double d2 = len2 > 0 ?
+        (px * dy - py * dx) * (px * dy - py * dx) / len2 : px * px + py * py;
+      if ( d2 > best ) { best = d2; far = i; }
+    }
+    if ( best > tol2 ) {
+      out->keep[far] = 1;
+      out->stack[top++] = a; out->stack[top++] = far;
+      out->stack[top++] = far; out->stack[top++] = b;
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i=0; i < num; i++)
+    if ( out->keep[i] ) pts[n++] = pts[i];
+  return n;
+}
+
+// -------------------------------------------------------------------
+static void contour_commit(contour_writer_t * out, bool restart) {
+  if ( GDALDatasetCommitTransaction(out->data) != OGRERR_NONE )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_COMMIT,
+                      GISTK_ERRS_CONTOUR_COMMIT, "commit");
+  if ( restart &&
+       GDALDatasetStartTransaction(out->data, FALSE) != OGRERR_NONE )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_COMMIT,
+                      GISTK_ERRS_CONTOUR_COMMIT, "start");
+  out->num_batch = 0;
+}
+
+// -------------------------------------------------------------------
+// Writes and frees a finished line
+static void contour_write(contour_writer_t * out, const contour_job_t * job,
+                          contour_line_t * line) {
+
+  // Pixel centers to world coordinates
+  for (size_t i=0; i < line->num; i++) {
+    double x, y;
+    trfm_pix_geo(out->trfm, line->pts[i].x + 0.5, line->pts[i].y + 0.5,
+                 &x, &y);
+    line->pts[i].x = x;
+    line->pts[i].y = y;
+  }
+  size_t num = contour_simplify(out, line->pts, line->num);
+  if ( num >= 2 ) {
+    OGR_G_SetPoints(out->line, (int) num,
+                    &line->pts[0].x, sizeof(contour_point_t),
+                    &line->pts[0].y, sizeof(contour_point_t), NULL, 0);
+    OGR_F_SetFID(out->feature, OGRNullFID);
+    OGR_F_SetFieldDouble(out->feature, out->fld_level,
+                         contour_level(job, line->level));
+    OGR_F_SetGeometry(out->feature, out->line);
+    if ( OGR_L_CreateFeature(out->layer, out->feature) != OGRERR_NONE )
+      gistk_error_fatal(GISTK_ERRC_CONTOUR_FEATURE,
+                        GISTK_ERRS_CONTOUR_FEATURE,
+                        contour_level(job, line->level));
+    out->num_features++;
+    out->num_points += num;
+    if ( ++out->num_batch >= CONTOUR_BATCH ) contour_commit(out, true);
+  }
+  CPLFree(line->pts);
+  line->pts = NULL;
+  line->num = 0;
+}
+
+// -------------------------------------------------------------------
+static int contour_find(contour_line_t * pool, int id) {
+  while ( pool[id].merged >= 0 ) id = pool[id].merged;
+  return id;
+}
+
+// -------------------------------------------------------------------
+// Points an open end registered for one line to another
+static void contour_rename(contour_map_t * map, int64_t key, int from, int to) {
+  if ( key < 0 ) return;
+  int * vals = contour_map_get(map, key, false);
+  if ( vals != NULL && vals[0] == from ) vals[0] = to;
+}
+
+// -------------------------------------------------------------------
+// Appends line b to line a over their common end key
+static void contour_join(contour_line_t * pool, int a, int b, int64_t key,
+                         contour_map_t * cur, contour_map_t * next) {
+  contour_line_t * la = &pool[a];
+  contour_line_t * lb = &pool[b];
+  if ( la->head == key ) contour_line_reverse(la);
+  if ( lb->tail == key ) contour_line_reverse(lb);
+  for (size_t i=1; i < lb->num; i++) contour_line_add(la, lb->pts[i]);
+  la->tail = lb->tail;
+  contour_rename(cur, lb->tail, b, a);
+  contour_rename(next, lb->tail, b, a);
+  CPLFree(lb->pts);
+  lb->pts = NULL;
+  lb->num = 0;
+  lb->head = lb->tail = -1;
+  lb->merged = a;
+
+  // Both ends met, the line is a ring
+  if ( la->head >= 0 && la->head == la->tail ) {
+    int * vals = contour_map_get(cur, la->head, false);
+    if ( vals != NULL ) vals[0] = -1;
+    la->head = la->tail = -1;
+  }
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  contour_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.band = 1;
+  job.strip_rows = 256;
+  const char * format = "GPKG";
+  const char * layer_name = "contour";
+  int num_threads = gistk_pool_threads(NULL);
+  contour_writer_t out;
+  memset(&out, 0, sizeof(out));
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+i:o:l:b:s:f:n:T:j:")) != -1 ) {
+    switch ( opt ) {
+    case 'i':
+      if (! sscanf(optarg,"%lf",&job.interval) || job.interval <= 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "INTERVAL", optarg);
+      break;
+    case 'o':
+      if (! sscanf(optarg,"%lf",&job.offset) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "OFFSET", optarg);
+      break;
+    case 'l': {
+      char * end = optarg;
+      job.num_levels = 0;
+      while ( *end != '\0' ) {
+        if ( job.num_levels == CONTOUR_MAX_LEVELS )
+          gistk_error_fatal(1, "More than %d contour levels!\n",
+                            CONTOUR_MAX_LEVELS);
+        char * pos = end;
+        job.levels[job.num_levels++] = strtod(pos, &end);
+        if ( end == pos || ( *end != ',' && *end != '\0' ) )
+          gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "LIST", optarg);
+        if ( *end == ',' ) end++;
+      }
+      break;
+    }
+    case 'b':
+      if (! sscanf(optarg,"%d",&job.band) || job.band < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "BAND", optarg);
+      break;
+    case 's':
+      if (! sscanf(optarg,"%lf",&out.tolerance) || out.tolerance < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "TOL", optarg);
+      break;
+    case 'f':
+      format = optarg;
+      break;
+    case 'n':
+      layer_name = optarg;
+      break;
+    case 'T':
+      if (! sscanf(optarg,"%d",&job.strip_rows) || job.strip_rows < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "ROWS", optarg);
+      break;
+    case 'j':
+      num_threads = gistk_pool_threads(optarg);
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 3 )
+    gistk_error_fatal(1, "Missing parameter at least 2\n" USAGE, prog, prog);
+  if ( job.num_levels == 0 && job.interval <= 0 )
+    gistk_error_fatal(1, "Contour levels need -i or -l!\n");
+  job.filename = argv[1];
+  const char * out_file = argv[2];
+
+  // Register the drivers
+  gistk_init(true, true);
+
+  gistk_raster_t src_raster;
+  gistk_open_raster(job.filename, true, &src_raster);
+  if ( job.band > src_raster.num_bands )
+    gistk_error_fatal(1, "Band %d is not available in %s!\n",
+                      job.band, job.filename);
+  job.num_cols = src_raster.num_cols;
+  job.num_rows = src_raster.num_rows;
+  memcpy(out.trfm, src_raster.trfm, sizeof(out.trfm));
+
+  // Edge keys hold the level in the bits the edges leave free, at
+  // least the bits of the -l indices
+  int64_t num_edges = (int64_t) job.num_cols * job.num_rows * 2;
+  int edge_bits = 1;
+  while ( edge_bits < 62 && ( (int64_t) 1 << edge_bits ) < num_edges )
+    edge_bits++;
+  job.level_bits = 63 - edge_bits > 32 ? 32 : 63 - edge_bits;
+  if ( job.level_bits < 14 )
+    gistk_error_fatal(1, "%s is too large for the contour keys!\n",
+                      job.filename);
+
+  // Sorted levels of -l, the levels of -i are found per cell
+  if ( job.num_levels > 0 ) {
+    for (int i=1; i < job.num_levels; i++)
+      for (int j=i; j > 0 && job.levels[j-1] > job.levels[j]; j--) {
+        double t = job.levels[j];
+        job.levels[j] = job.levels[j-1];
+        job.levels[j-1] = t;
+      }
+  }
+
+  // Output layer
+  GDALDriverH driver = GDALGetDriverByName(format);
+  if ( driver == NULL )
+    gistk_error_fatal(GISTK_ERRC_OPEN_DRV_VALID, GISTK_ERRS_OPEN_DRV_VALID,
+                      format);
+  out.data = GDALCreate(driver, out_file, 0, 0, 0, GDT_Unknown, NULL);
+  if ( out.data == NULL )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_CREATE, GISTK_ERRS_CONTOUR_CREATE,
+                      out_file);
+  out.layer = GDALDatasetCreateLayer(out.data, layer_name, src_raster.srs,
+                                     wkbLineString, NULL);
+  if ( out.layer == NULL )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_CREATE, GISTK_ERRS_CONTOUR_CREATE,
+                      out_file);
+  OGRFieldDefnH field = OGR_Fld_Create("level", OFTReal);
+  if ( OGR_L_CreateField(out.layer, field, TRUE) != OGRERR_NONE )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_CREATE, GISTK_ERRS_CONTOUR_CREATE,
+                      out_file);
+  OGR_Fld_Destroy(field);
+  out.fld_level = OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(out.layer), "level");
+  out.feature = OGR_F_Create(OGR_L_GetLayerDefn(out.layer));
+  out.line = OGR_G_CreateGeometry(wkbLineString);
+  if ( GDALDatasetStartTransaction(out.data, FALSE) != OGRERR_NONE )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_COMMIT,
+                      GISTK_ERRS_CONTOUR_COMMIT, "start");
+
+  printf("# IN FILE:       %s\n", job.filename);
+  printf("# OUT FILE:      %s\n", out_file);
+  if ( job.num_levels > 0 )
+    printf("# LEVELS:        %d from %g to %g\n", job.num_levels,
+           job.levels[0], job.levels[job.num_levels-1]);
+  else
+    printf("# LEVELS:        every %g from %g\n", job.interval, job.offset);
+
+  // Workers
+  job.num_strips = job.num_rows > 1 ?
+    (job.num_rows - 1 + job.strip_rows - 1) / job.strip_rows : 0;
+  job.strips = CPLCalloc(job.num_strips + 1, sizeof(contour_strip_t));
+  job.window = 2 * num_threads;
+  gistk_pool_init(&job.pool);
+  pthread_cond_init(&job.cond, NULL);
+  if ( ! gistk_pool_start(&job.pool, job.num_strips, num_threads,
+                          contour_run, &job) )
+    gistk_error_fatal(GISTK_ERRC_CONTOUR_THREAD, GISTK_ERRS_CONTOUR_THREAD);
+
+  // Glue the strips in row order, the open ends on the border above
+  // the current strip are in cur, the ones below go to next
+  contour_line_t * pool = NULL;
+  size_t num_pool = 0, mem_pool = 0;
+  contour_map_t cur, next;
+  contour_map_init(&cur, 1024);
+  contour_map_init(&next, 1024);
+  for (int i=0; i < job.num_strips; i++) {
+    pthread_mutex_lock(&job.pool.lock);
+    while ( ! job.strips[i].ready && ! job.pool.failed )
+      pthread_cond_wait(&job.cond, &job.pool.lock);
+    pthread_mutex_unlock(&job.pool.lock);
+    if ( job.pool.failed )
+      gistk_error_fatal(GISTK_ERRC_CONTOUR_READ, GISTK_ERRS_CONTOUR_READ,
+                        job.filename);
+
+    int r0 = i * job.strip_rows;
+    int r1 = r0 + job.strip_rows;
+    contour_strip_t * strip = &job.strips[i];
+    if ( num_pool + strip->num > mem_pool ) {
+      mem_pool = (num_pool + strip->num) * 2;
+      pool = CPLRealloc(pool, sizeof(contour_line_t) * mem_pool);
+    }
+    size_t first = num_pool;
+    for (size_t l=0; l < strip->num; l++) {
+      int id = (int) num_pool;
+      pool[num_pool++] = strip->lines[l];
+      int64_t ends[2] = { pool[id].head, pool[id].tail };
+      for (int e=0; e < 2; e++) {
+        if ( contour_key_row(&job, ends[e]) != r0 ) continue;
+        int owner = contour_find(pool, id);
+        int * vals = contour_map_get(&cur, ends[e], false);
+        int other = vals != NULL ? vals[0] : -1;
+        if ( vals != NULL ) vals[0] = -1;
+        if ( other < 0 || other == owner ) {
+
+          // No partner above or the ring closed already
+          if ( pool[owner].head == ends[e] ) pool[owner].head = -1;
+          if ( pool[owner].tail == ends[e] ) pool[owner].tail = -1;
+          continue;
+        }
+        contour_join(pool, other, owner, ends[e], &cur, &next);
+      }
+    }
+
+    // Open ends on the border below wait for the next strip
+    for (size_t l=first; l < num_pool; l++) {
+      int owner = contour_find(pool, (int) l);
+      int64_t ends[2] = { pool[owner].head, pool[owner].tail };
+      for (int e=0; e < 2; e++)
+        if ( ends[e] >= 0 && contour_key_row(&job, ends[e]) == r1 )
+          contour_map_get(&next, ends[e], true)[0] = owner;
+    }
+
+    // Ends above that found no partner are dead
+    for (size_t k=0; k < cur.mem; k++) {
+      if ( cur.keys[k] < 0 || cur.vals[2*k] < 0 ) continue;
+      contour_line_t * line = &pool[cur.vals[2*k]];
+      if ( line->head == cur.keys[k] ) line->head = -1;
+      if ( line->tail == cur.keys[k] ) line->tail = -1;
+    }
+    contour_map_free(&cur);
+    cur = next;
+    contour_map_init(&next, cur.size + 1024);
+    CPLFree(strip->lines);
+    strip->lines = NULL;
+
+    // Release the workers before writing
+    pthread_mutex_lock(&job.pool.lock);
+    job.done = i + 1;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.pool.lock);
+
+    // Write finished lines and keep the open ones in pool order
+    int * ids = CPLMalloc(sizeof(int) * (num_pool + 1));
+    size_t kept = 0;
+    for (size_t l=0; l < num_pool; l++) {
+      ids[l] = -1;
+      if ( pool[l].merged >= 0 || pool[l].pts == NULL ) continue;
+      if ( pool[l].head < 0 && pool[l].tail < 0 ) {
+        contour_write(&out, &job, &pool[l]);
+        continue;
+      }
+      ids[l] = (int) kept;
+      pool[kept++] = pool[l];
+    }
+    for (size_t k=0; k < cur.mem; k++)
+      if ( cur.keys[k] >= 0 && cur.vals[2*k] >= 0 )
+        cur.vals[2*k] = ids[cur.vals[2*k]];
+    CPLFree(ids);
+    num_pool = kept;
+  }
+  for (size_t l=0; l < num_pool; l++) contour_write(&out, &job, &pool[l]);
+
+  gistk_pool_join(&job.pool);
+  pthread_cond_destroy(&job.cond);
+  gistk_pool_free(&job.pool);
+  contour_map_free(&cur);
+  contour_map_free(&next);
+  CPLFree(pool);
+  CPLFree(job.strips);
+
+  contour_commit(&out, false);
+  printf("# FEATURES:      %llu\n", (unsigned long long) out.num_features);
+  printf("# POINTS:        %llu\n", (unsigned long long) out.num_points);
+  OGR_G_DestroyGeometry(out.line);
+  OGR_F_Destroy(out.feature);
+  CPLFree(out.keep);
+  CPLFree(out.stack);
+  GDALClose(out.data);
+  gistk_close_raster(&src_raster);
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
@@ -17,20 +17,566 @@
 // along with gtif-cut.c.  If not, see <http://www.gnu.org/licenses/>.
 // =====================================================================
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
 #include "ifgdv/error.h"
 #include "ifgdv/alg.h"
 #include "ifgdv/util.h"
+#include "ifgdv/cover.h"
+#include "ifgdv/pipe.h"
+#include "ifgdv/tile.h"
+#include "ifgdv/catalog.h"
+#include "ifgdv/store.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] IN OUT EXT WSZ HSZ ID1 X1 Y1 ID2 X2 Y2 ...!\n" \
+  "Options:\n" \
+  "  -t TYPE      output type Byte, Int16, UInt16, Int32, UInt32,\n" \
+  "               Float16, Float32 or Float64\n" \
+  "  -s SCALE     scale the pixel values\n" \
+  "  -o OFFSET    add an offset to the scaled pixel values\n" \
+  "  -c MIN:MAX   clamp the resulting values\n" \
+  "  -n chip      normalize every band by the mean/std of the chip\n" \
+  "  -n MEAN:STD  normalize every band by a fixed mean/std\n" \
+  "  -d NODATA    nodata value of the output\n" \
+  "  -f FRAC      skip chips with a valid fraction below FRAC\n" \
+  "  -F CELL      cell size of the coverage mask [pixel]\n" \
+  "  -x           check uncertain chips at full resolution\n" \
+  "  -D LIST      append terrain derivatives of the first band, a\n" \
+  "               comma separated list of slope, aspect, hillshade,\n" \
+  "               curvature and only to drop the source bands, the\n" \
+  "               target becomes Float32 unless -t sets Float64\n" \
+  "  -S LIST      comma separated scale factors, every position\n" \
+  "               gets a WSZ x HSZ chip per factor OUT.ID.sFACTOR.EXT\n" \
+  "               from one read of the largest footprint\n" \
+  "  -r FILTER    reduction filter box or gauss (factors 2^n)\n" \
+  "  -q DEPTH     chips in flight between reading, transforming and\n" \
+  "               writing threads, 0 works serially (default 4)\n" \
+  "  -B MB        decode the source through a tile cache of MB\n" \
+  "               megabytes with background prefetch\n" \
+  "  -P N         positions the prefetch looks ahead (default 8)\n" \
+  "  -g GPKG      write the chip footprints into a GeoPackage catalog\n" \
+  "  -m           write statistics, histogram and percentiles into\n" \
+  "               the metadata of every chip\n" \
+  "  -i SRS       reference system of the positions, EPSG:4326 fex,\n" \
+  "               positions that cannot be transformed get ERR\n" \
+  "  -z CODEC     error bounded chips, lerc:ERROR or quant:ERROR with\n" \
+  "               the maximal absolute error, every chip is read back\n" \
+  "               and checked against the bound, chips beyond it are\n" \
+  "               removed and reported as ERR\n" \
+  "  -C DIR       serve chips cut before out of the result store DIR\n" \
+  "               and add the new ones, keyed by source, window and\n" \
+  "               options; runs may share the store\n" \
+  "  -M MB        size cap of the result store (default 4096)\n" \
+  "  -L           serve stored chips by hardlink instead of a copy,\n" \
+  "               the chips must not be changed in place then\n" \
+  "Example: %s -t Int16 -s 100 dem.v2.3d.tif zz tif 128 128 "\
+  "1 399000 6038000 2 380000 6100000\n"
+
+// -------------------------------------------------------------------
+// State of a cut run shared by the pipeline stages
+typedef struct {
+  gistk_raster_t * src_raster;
+  gistk_raster_driver_t * tool;
+  gistk_cut_opts_t * opts;
+  int_vector_t * id;
+  dbl_vector_t * pos_x;
+  dbl_vector_t * pos_y;
+  const bool * pos_failed;
+  const char * ofile;
+  const char * ext;
+  int wsize;
+  int hsize;
+  int max_scale;
+  gistk_cover_t * cover;
+  double min_valid;
+  bool cover_exact;
+  gistk_tile_cache_t * cache;
+  int lookahead;
+  gistk_catalog_t * catalog;
+  gistk_store_t * store;
+  size_t next;
+  size_t num_beyond;
+} cut_job_t;
+
+// One position travelling through the pipeline
+typedef struct {
+  gistk_chip_t chip;
+  gistk_chip_t scaled[GISTK_SCALE_MAX];
+  const char * status;
+  int id;
+  long icol;
+  long irow;
+  double frac;
+  bool streamed;    // cut in strips by the reader, see cut_read
+  bool beyond;      // the chip failed the error bound and is removed
+  gistk_raster_t out;
+  uint64_t keys[GISTK_SCALE_MAX];
+  char cfile[1024];
+} cut_item_t;
+
+// -------------------------------------------------------------------
+// Hints the window of a position to the tile cache, the positions
+// are track ordered so the blocks of the next ones are predictable
+static void cut_hint(cut_job_t * job, size_t c) {
+  if ( job->cache == NULL || c >= job->pos_x->length ) return;
+  if ( job->pos_failed != NULL && job->pos_failed[c] ) return;
+  long icol = -1, irow = -1;
+  trfm_geo_pix(job->src_raster->trfm, job->pos_x->data[c],
+               job->pos_y->data[c], &icol, &irow);
+  int wsize = job->wsize * job->max_scale;
+  int hsize = job->hsize * job->max_scale;
+  int band = job->opts->terrain.only ? 1 : 0;
+  gistk_tile_cache_hint(job->cache, band,
+                        icol - wsize/2 - 1, irow - hsize/2 - 1,
+                        wsize + 2, hsize + 2);
+}
+
+// -------------------------------------------------------------------
+// Name of the chip of a scale, the single scale chip is item->cfile
+static void cut_scale_file(const cut_job_t * job, const cut_item_t * item,
+                           int s, char * name) {
+  sprintf(name, "%s.%d.s%d.%s", job->ofile, item->id,
+          job->opts->scales[s], job->ext);
+}
+
+// -------------------------------------------------------------------
+// Serves all chips of a position out of the result store, a partial
+// hit takes the served chips back as misses and the position is cut
+// anew
+static bool cut_stored(cut_job_t * job, cut_item_t * item,
+                       int x0, int y0, int wsize, int hsize) {
+  int num_out = job->opts->num_scales == 0 ? 1 : job->opts->num_scales;
+  bool hit[GISTK_SCALE_MAX];
+  bool all = true;
+  char name[1024];
+  for (int s=0; s < num_out; s++) {
+    int scale = job->opts->num_scales == 0 ? 1 : job->opts->scales[s];
+    if ( job->opts->num_scales == 0 ) strcpy(name, item->cfile);
+    else cut_scale_file(job, item, s, name);
+    item->keys[s] = gistk_store_key(job->store, x0, y0, wsize, hsize,
+                                    job->wsize, job->hsize, scale);
+    hit[s] = gistk_store_get(job->store, item->keys[s], name);
+    all = all && hit[s];
+  }
+  if ( all ) return true;
+  for (int s=0; s < num_out; s++) {
+    if ( ! hit[s] ) continue;
+    if ( job->opts->num_scales == 0 ) strcpy(name, item->cfile);
+    else cut_scale_file(job, item, s, name);
+    gistk_store_unget(job->store, name);
+  }
+  return false;
+}
+
+// -------------------------------------------------------------------
+// Writes a chip to item->cfile, or cuts the window of a streamed
+// position when chip is NULL. A chip beyond the error bound is
+// removed and false returned, any other error stays fatal.
+static bool cut_output(cut_job_t * job, cut_item_t * item,
+                       const gistk_chip_t * chip) {
+  gistk_error_trap_t trap;
+  gistk_error_trap(&trap);
+  if ( setjmp(trap.env) != 0 ) {
+    if ( item->out.data != NULL ) gistk_close_raster(&item->out);
+    unlink(item->cfile);
+    if ( trap.code != GISTK_ERRC_LOSSY_BOUND )
+      gistk_error_fatal(trap.code, "%s\n", trap.message);
+    fprintf(stderr, "%s\n", trap.message);
+    return false;
+  }
+  memset(&item->out, 0, sizeof(gistk_raster_t));
+  if ( chip == NULL ) {
+    int wsize = job->wsize;
+    int hsize = job->hsize;
+    gistk_cut_raster_stream(*job->tool, job->src_raster, item->cfile,
+                            item->icol-wsize/2, item->irow-hsize/2,
+                            item->icol-wsize/2+wsize,
+                            item->irow-hsize/2+hsize,
+                            job->opts, GISTK_CUT_BUDGET, &item->out);
+  } else {
+    gistk_chip_write(*job->tool, job->src_raster, item->cfile,
+                     job->opts, chip, &item->out);
+  }
+  gistk_error_untrap(&trap);
+  gistk_close_raster(&item->out);
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Reader stage: locate the next position and read its window
+static bool cut_read(void * ctx, void * data) {
+  cut_job_t * job = ctx;
+  cut_item_t * item = data;
+  if ( job->next >= job->pos_x->length ) return false;
+  size_t c = job->next++;
+  cut_hint(job, c + job->lookahead);
+
+  // Transform cut position (world) to image positions
+  item->icol = -1; item->irow = -1;
+  item->beyond = false;
+  item->id = job->id->data[c];
+
+  // Create filename from patter id and extention
+  sprintf(item->cfile,"%s.%d.%s",job->ofile, item->id, job->ext);
+
+  // Positions the reprojection failed for
+  if ( job->pos_failed != NULL && job->pos_failed[c] ) {
+    item->status = "ERR";
+    return true;
+  }
+  trfm_geo_pix(job->src_raster->trfm, job->pos_x->data[c],
+               job->pos_y->data[c], &item->icol , &item->irow);
+
+  // Test if the window is inside the image and
+  // skip the stuff if outside, multi scale cuts read
+  // the footprint of the largest scale
+  int wsize = job->wsize * job->max_scale;
+  int hsize = job->hsize * job->max_scale;
+  if (item->icol-wsize/2<=0 ||
+      item->irow-hsize/2<=0 ||
+      item->icol+wsize/2>=job->src_raster->num_cols ||
+      item->irow+hsize/2>=job->src_raster->num_rows)
+  {
+    item->status = "IGN";
+    return true;
+  }
+
+  int ioffs_col = item->icol-wsize/2;
+  int ioffs_row = item->irow-hsize/2;
+
+  // Skip chips without enough valid pixels before reading them
+  if ( job->min_valid > 0.0 ) {
+    double lower, upper;
+    gistk_cover_bounds(job->cover, ioffs_col, ioffs_row, wsize, hsize,
+                       &lower, &item->frac, &upper);
+    // uncertain chips straddle the threshold
+    if ( lower < job->min_valid && upper >= job->min_valid &&
+         job->cover_exact )
+      item->frac = gistk_cover_exact(job->src_raster, ioffs_col, ioffs_row,
+                                     wsize, hsize);
+    if ( item->frac < job->min_valid ) {
+      item->status = "SKP";
+      return true;
+    }
+  }
+
+  // Chips cut before by this or another run
+  if ( job->store != NULL &&
+       cut_stored(job, item, ioffs_col, ioffs_row, wsize, hsize) ) {
+    item->status = "HIT";
+    return true;
+  }
+
+  // Windows beyond the memory budget are cut in strips right here,
+  // the reader stage is the only one touching the source
+  item->status = "ADD";
+  item->streamed = job->opts->num_scales == 0 &&
+                   gistk_chip_bytes(job->src_raster, job->opts,
+                                    wsize, hsize) > GISTK_CUT_BUDGET;
+  if ( item->streamed ) {
+    item->beyond = ! cut_output(job, item, NULL);
+    if ( item->beyond ) item->status = "ERR";
+    return true;
+  }
+
+  // read the sub image
+  gistk_chip_read(job->src_raster, item->cfile,
+                  ioffs_col, ioffs_row,
+                  ioffs_col+wsize, ioffs_row+hsize,
+                  job->opts, &item->chip);
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Transform stage: convert pixels and compute derived bands
+static void cut_transform(void * ctx, void * data) {
+  cut_job_t * job = ctx;
+  cut_item_t * item = data;
+  if ( strcmp(item->status, "ADD") != 0 || item->streamed ) return;
+  if ( job->opts->num_scales == 0 ) {
+    gistk_chip_transform(job->opts, &item->chip);
+    return;
+  }
+  for (int s=0; s < job->opts->num_scales; s++) {
+    gistk_chip_scale(job->opts, &item->chip, job->opts->scales[s],
+                     job->wsize, job->hsize, &item->scaled[s]);
+    gistk_chip_transform(job->opts, &item->scaled[s]);
+  }
+}
+
+// -------------------------------------------------------------------
+// Adds the source window of a chip to the catalog
+static void cut_catalog(cut_job_t * job, cut_item_t * item, int scale,
+                        long col, long row, int width, int height) {
+  if ( job->catalog == NULL ) return;
+  double valid = job->min_valid > 0.0 && strcmp(item->status, "IGN") != 0 ?
+                 item->frac : -1.0;
+  gistk_catalog_add(job->catalog, job->src_raster, item->id, item->cfile,
+                    scale, col, row, width, height, item->status, valid);
+}
+
+// -------------------------------------------------------------------
+// Writer stage: report the position and write the chip
+static void cut_write(void * ctx, void * data) {
+  cut_job_t * job = ctx;
+  cut_item_t * item = data;
+
+  // Footprint of the largest scale for skipped and ignored positions
+  int wsize = job->wsize * job->max_scale;
+  int hsize = job->hsize * job->max_scale;
+
+  // Stored chips are reported and cataloged like new ones
+  if ( strcmp(item->status, "HIT") == 0 ) {
+    int x0 = item->icol - wsize/2;
+    int y0 = item->irow - hsize/2;
+    if ( job->opts->num_scales == 0 ) {
+      printf ("HIT %d %s %ld %ld\n", item->id, item->cfile,
+              item->icol, item->irow);
+      cut_catalog(job, item, 1, x0, y0, job->wsize, job->hsize);
+      return;
+    }
+    for (int s=0; s < job->opts->num_scales; s++) {
+      int scale = job->opts->scales[s];
+      cut_scale_file(job, item, s, item->cfile);
+      printf ("HIT %d %s %ld %ld\n", item->id, item->cfile,
+              item->icol, item->irow);
+      cut_catalog(job, item, scale,
+                  x0 + (wsize - job->wsize * scale) / 2,
+                  y0 + (hsize - job->hsize * scale) / 2,
+                  job->wsize * scale, job->hsize * scale);
+    }
+    return;
+  }
+
+  // Positions without a chip are reported under the names of the
+  // chips they would have got, one line per scale
+  if ( strcmp(item->status, "ADD") != 0 ) {
+    if ( item->beyond ) job->num_beyond++;
+    int num_out = job->opts->num_scales == 0 ? 1 : job->opts->num_scales;
+    for (int s=0; s < num_out; s++) {
+      if ( job->opts->num_scales > 0 )
+        cut_scale_file(job, item, s, item->cfile);
+      if ( strcmp(item->status, "SKP") == 0 )
+        printf ("SKP %d %s %ld %ld %.3f\n",item->id, item->cfile,
+                item->icol, item->irow, item->frac);
+      else
+        printf ("%s %d %s %ld %ld\n",item->status, item->id, item->cfile,
+                item->icol, item->irow);
+      int scale = job->opts->num_scales == 0 ? 1 : job->opts->scales[s];
+      if ( strcmp(item->status, "ERR") != 0 )
+        cut_catalog(job, item, scale,
+                    item->icol - wsize/2 + (wsize - job->wsize * scale) / 2,
+                    item->irow - hsize/2 + (hsize - job->hsize * scale) / 2,
+                    job->wsize * scale, job->hsize * scale);
+    }
+    return;
+  }
+  // Streamed positions were written by the reader
+  if ( item->streamed ) {
+    printf ("ADD %d %s %ld %ld\n",item->id, item->cfile,
+            item->icol, item->irow);
+    if ( job->store != NULL )
+      gistk_store_put(job->store, item->keys[0], item->cfile);
+    cut_catalog(job, item, 1, item->icol-wsize/2, item->irow-hsize/2,
+                wsize, hsize);
+    return;
+  }
+
+  // All scales of a position are written together, a chip beyond
+  // the error bound is reported as ERR and the run goes on
+  int num_out = job->opts->num_scales == 0 ? 1 : job->opts->num_scales;
+  for (int s=0; s < num_out; s++) {
+    const gistk_chip_t * chip = &item->chip;
+    if ( job->opts->num_scales > 0 ) {
+      cut_scale_file(job, item, s, item->cfile);
+      chip = &item->scaled[s];
+    }
+    if ( ! cut_output(job, item, chip) ) {
+      printf ("ERR %d %s %ld %ld\n",item->id, item->cfile,
+              item->icol, item->irow);
+      job->num_beyond++;
+      continue;
+    }
+    printf ("ADD %d %s %ld %ld\n",item->id, item->cfile,
+            item->icol, item->irow);
+    if ( job->store != NULL )
+      gistk_store_put(job->store, item->keys[s], item->cfile);
+    cut_catalog(job, item, chip->scale, chip->win_x, chip->win_y,
+                chip->width * chip->scale, chip->height * chip->scale);
+  }
+}
 
 // -------------------------------------------------------------------
 int main(int argc, char **argv)
 {
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  // Read the options
+  gistk_cut_opts_t opts;
+  gistk_cut_opts_init(&opts);
+
+  // Coverage prefilter settings
+  double min_valid = 0.0;
+  int cover_cell = GISTK_COVER_CELL;
+  bool cover_exact = false;
+
+  // Pipeline depth
+  int depth = GISTK_PIPE_DEPTH;
+
+  // Tile cache budget [MB] and prefetch distance [positions]
+  int cache_mb = 0;
+  int lookahead = 8;
+
+  // Footprint catalog
+  const char * catalog_file = NULL;
+
+  // Reference system of the positions
+  const char * input_srs = NULL;
+
+  // Result store, its size cap [MB] and hits by hardlink
+  const char * store_dir = NULL;
+  long store_mb = GISTK_STORE_BUDGET >> 20;
+  bool store_link = false;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+t:s:o:c:n:d:f:F:xD:S:r:q:B:P:g:mi:z:C:M:L")) != -1 ) {
+    switch ( opt ) {
+    case 't':
+      opts.conv.out_type = gistk_conv_type_by_name(optarg);
+      if ( opts.conv.out_type == GDT_Unknown )
+        gistk_error_fatal(1, "Invalid output type %s!\n", optarg);
+      break;
+    case 's':
+      if (! sscanf(optarg,"%lf",&opts.conv.scale) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "SCALE", optarg);
+      break;
+    case 'o':
+      if (! sscanf(optarg,"%lf",&opts.conv.offset) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "OFFSET", optarg);
+      break;
+    case 'c':
+      if ( sscanf(optarg,"%lf:%lf",
+                  &opts.conv.clamp_min, &opts.conv.clamp_max) != 2 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "MIN:MAX", optarg);
+      sort_dbl(&opts.conv.clamp_min, &opts.conv.clamp_max);
+      opts.conv.clamp = true;
+      break;
+    case 'n':
+      if ( strcmp(optarg, "chip") == 0 ) {
+        opts.conv.norm = GISTK_NORM_CHIP;
+      } else {
+        if ( sscanf(optarg,"%lf:%lf",
+                    &opts.conv.norm_mean, &opts.conv.norm_std) != 2 ||
+             opts.conv.norm_std <= 0 )
+          gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC,
+                            "MEAN:STD", optarg);
+        opts.conv.norm = GISTK_NORM_FIXED;
+      }
+      break;
+    case 'd':
+      if (! sscanf(optarg,"%lf",&opts.conv.out_nodata) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "NODATA", optarg);
+      opts.conv.has_out_nodata = true;
+      break;
+    case 'f':
+      if (! sscanf(optarg,"%lf",&min_valid) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "FRAC", optarg);
+      break;
+    case 'F':
+      if (! sscanf(optarg,"%d",&cover_cell) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "CELL", optarg);
+      break;
+    case 'x':
+      cover_exact = true;
+      break;
+    case 'D':
+      if ( ! gistk_terrain_parse(optarg, &opts.terrain) )
+        gistk_error_fatal(1, "Invalid terrain derivatives %s!\n", optarg);
+      break;
+    case 'S':
+      opts.num_scales = gistk_scale_parse(optarg, opts.scales);
+      if ( opts.num_scales == 0 )
+        gistk_error_fatal(1, "Invalid scale factors %s!\n", optarg);
+      break;
+    case 'r':
+      if ( strcmp(optarg, "box") == 0 )
+        opts.reduce = GISTK_REDUCE_BOX;
+      else if ( strcmp(optarg, "gauss") == 0 )
+        opts.reduce = GISTK_REDUCE_GAUSS;
+      else
+        gistk_error_fatal(1, "Invalid reduction filter %s!\n", optarg);
+      break;
+    case 'q':
+      if (! sscanf(optarg,"%d",&depth) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "DEPTH", optarg);
+      break;
+    case 'B':
+      if (! sscanf(optarg,"%d",&cache_mb) || cache_mb < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "MB", optarg);
+      break;
+    case 'P':
+      if (! sscanf(optarg,"%d",&lookahead) || lookahead < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "N", optarg);
+      break;
+    case 'g':
+      catalog_file = optarg;
+      break;
+    case 'm':
+      opts.stats = true;
+      break;
+    case 'i':
+      input_srs = optarg;
+      break;
+    case 'z':
+      if ( ! gistk_lossy_parse(optarg, &opts.lossy, &opts.max_error) )
+        gistk_error_fatal(1, "Invalid error bounded codec %s!\n", optarg);
+      break;
+    case 'C':
+      store_dir = optarg;
+      break;
+    case 'M':
+      if (! sscanf(optarg,"%ld",&store_mb) || store_mb < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "MB", optarg);
+      break;
+    case 'L':
+      store_link = true;
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+
+  // Check the multi scale settings
+  int max_scale = 1;
+  for (int s=0; s < opts.num_scales; s++) {
+    if ( opts.scales[s] > max_scale ) max_scale = opts.scales[s];
+    if ( opts.reduce == GISTK_REDUCE_GAUSS &&
+         ! gistk_scale_is_pow2(opts.scales[s]) )
+      gistk_error_fatal(1, "The gauss filter needs factors 2^n not %d!\n",
+                        opts.scales[s]);
+  }
+  if ( opts.num_scales > 0 && gistk_terrain_count(&opts.terrain) > 0 )
+    gistk_error_fatal(1, "Terrain derivatives are not available "
+                      "for multi scale cuts!\n");
+  if ( gistk_terrain_count(&opts.terrain) > 0 &&
+       opts.conv.out_type != GDT_Unknown &&
+       opts.conv.out_type != GDT_Float32 && opts.conv.out_type != GDT_Float64 )
+    gistk_error_fatal(1, "Terrain derivatives need a float target "
+                      "type not %s!\n",
+                      GDALGetDataTypeName(opts.conv.out_type));
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+
   // Check the minimum of cmd params
   if (argc<7) {
     gistk_error_fatal(1,
-	"Missing parameter at least 8\n"
-        "Usage: %s IN OUT EXT WSZ HSZ ID1 X1 Y1 ID2 X2 Y2 ...!\n"
-        "Example: %s  dem.v2.3d.tif zz tif 128 423 1 399000 6038000 2 380000 6100000\n",
-         argv[0], argv[0]);
+	"Missing parameter at least 8\n" USAGE,
+         prog, prog);
   }
 
   // Read infile pattern from cli
@@ -39,9 +585,6 @@ int main(int argc, char **argv)
   // Read outfile pattern from cli
   char *ofile = argv[2];
 
-  // var for the resulting filename
-  char cfile[1024];
-
   // Read file extension from cli
   char *ext   = argv[3];
 
@@ -91,7 +634,7 @@ int main(int argc, char **argv)
   }
 
   // Register the drivers
-  gistk_init(true,false);
+  gistk_init(true, catalog_file != NULL);
 
   // Get the GTiff driver an assure raste, read and write capabilities
   gistk_raster_driver_t gtiff;
@@ -107,47 +650,131 @@ int main(int argc, char **argv)
   printf("# NUM TUPLE:     %d\n", pos_x.length);
   printf("# WINDOW WIDTH:  %d\n",wsize);
   printf("# WINDOW HEIGHT: %d\n",hsize);
+  for (int s=0; s < opts.num_scales; s++)
+    printf("# SCALE:         %d\n", opts.scales[s]);
+  if ( opts.lossy != GISTK_LOSSY_NONE )
+    printf("# MAX ERROR:     %g %s\n", opts.max_error,
+           gistk_lossy_name(opts.lossy));
+
+  // Positions into the reference system of the raster in batches
+  bool * pos_failed = NULL;
+  if ( input_srs != NULL ) {
+    pos_failed = CPLCalloc(pos_x.length + 1, sizeof(bool));
+    size_t num_failed = gistk_reproject(input_srs, &src_raster,
+                                        pos_x.data, pos_y.data,
+                                        pos_x.length, pos_failed);
+    printf("# INPUT SRS:     %s\n", input_srs);
+    printf("# REPROJ FAILED: %zu\n", num_failed);
+  }
+
+  // Load or build the coverage mask once per source
+  gistk_cover_t cover;
+  cover.valid = NULL;
+  if ( min_valid > 0.0 ) {
+    gistk_cover_open(ifile, &src_raster, cover_cell, &cover);
+    printf("# MIN. VALID:    %g\n", min_valid);
+    printf("# COVER CELL:    %d\n", cover_cell);
+  }
+
+  // Decode the source through an own tile cache
+  gistk_tile_cache_t cache;
+  if ( cache_mb > 0 ) {
+    gistk_tile_cache_open(ifile, &src_raster, (size_t) cache_mb << 20,
+                          lookahead > 0, &cache);
+    printf("# TILE CACHE:    %d MB %d TILES\n", cache_mb, cache.num_slots);
+  }
+
+  // Open the footprint catalog
+  gistk_catalog_t catalog;
+  if ( catalog_file != NULL ) {
+    gistk_catalog_open(catalog_file, &src_raster, &catalog);
+    printf("# CATALOG:       %s\n", catalog_file);
+  }
+
+  // Open the result store
+  gistk_store_t store;
+  if ( store_dir != NULL ) {
+    gistk_store_open(store_dir, ifile, &opts, ext,
+                     (uint64_t) store_mb << 20, store_link, &store);
+    printf("# RESULT STORE:  %s %ld MB%s\n", store_dir, store_mb,
+           store_link ? " HARDLINK" : "");
+  }
 
   // Create snippets
-  for (int c=0; c < pos_x.length; c++ ) {
-
-    // Transform cut position (world) to image positions
-    long icol = -1; long irow = -1;
-    trfm_geo_pix(src_raster.trfm, pos_x.data[c], pos_y.data[c], &icol , &irow);
-
-    // Create filename from patter id and extention
-    sprintf(cfile,"%s.%d.%s",ofile, id.data[c], ext);
-
-    // Test if the window is inside the image and
-    // skip the stuff if outside
-    if (icol-wsize/2<=0 ||
-	irow-hsize/2<=0 ||
-	icol+wsize/2>=src_raster.num_cols ||
-	irow+hsize/2>=src_raster.num_rows)
-    {
-      printf ("IGN %d %s %d %d\n",id.data[c], cfile, icol, irow);
-      continue;
-    }
+  cut_job_t job;
+  job.src_raster = &src_raster;
+  job.tool = &gtiff;
+  job.opts = &opts;
+  job.id = &id;
+  job.pos_x = &pos_x;
+  job.pos_y = &pos_y;
+  job.pos_failed = pos_failed;
+  job.ofile = ofile;
+  job.ext = ext;
+  job.wsize = wsize;
+  job.hsize = hsize;
+  job.max_scale = max_scale;
+  job.cover = &cover;
+  job.min_valid = min_valid;
+  job.cover_exact = cover_exact;
+  job.cache = cache_mb > 0 ? &cache : NULL;
+  job.lookahead = lookahead;
+  job.catalog = catalog_file != NULL ? &catalog : NULL;
+  job.store = store_dir != NULL ? &store : NULL;
+  job.next = 0;
+  job.num_beyond = 0;
+
+  // Prime the prefetch with the first positions
+  for (int c=0; c < lookahead; c++) cut_hint(&job, c);
+
+  // Pool of chips handed between the stages
+  int num_items = depth < 1 ? 1 : depth;
+  cut_item_t * items = CPLCalloc(num_items, sizeof(cut_item_t));
+  void * pool[num_items];
+  for (int i=0; i < num_items; i++) {
+    gistk_chip_init(&items[i].chip);
+    for (int s=0; s < GISTK_SCALE_MAX; s++)
+      gistk_chip_init(&items[i].scaled[s]);
+    pool[i] = &items[i];
+  }
+
+  gistk_pipe_run(&job, pool, depth, cut_read, cut_transform, cut_write);
 
-    // cut the sub image
-    printf ("ADD %d %s %d %d\n",id.data[c], cfile, icol, irow);
+  for (int i=0; i < num_items; i++) {
+    gistk_chip_free(&items[i].chip);
+    for (int s=0; s < GISTK_SCALE_MAX; s++)
+      gistk_chip_free(&items[i].scaled[s]);
+  }
+  CPLFree(items);
 
-    int ioffs_col = icol-wsize/2;
-    int ioffs_row = irow-hsize/2;
+  if ( opts.lossy != GISTK_LOSSY_NONE )
+    printf("# BEYOND BOUND:  %zu\n", job.num_beyond);
 
-    gistk_raster_t new_raster;
-    gistk_cut_raster(gtiff,
-                    src_raster,
-                    cfile,
-                    ioffs_col, ioffs_col+wsize,
-                    ioffs_row, ioffs_row+hsize,
-                    &new_raster);
+  if ( cache_mb > 0 ) {
+    printf("# CACHE HITS:    %lu\n", cache.hits);
+    printf("# CACHE MISSES:  %lu\n", cache.misses);
+    printf("# PREFETCHES:    %lu\n", cache.prefetches);
+    printf("# EVICTIONS:     %lu\n", cache.evictions);
+    gistk_tile_cache_close(&src_raster, &cache);
+  }
 
-    gistk_close_raster(&new_raster);
+  if ( store_dir != NULL ) {
+    gistk_store_close(&store);
+    printf("# STORE HITS:    %lu\n", store.hits);
+    printf("# STORE MISSES:  %lu\n", store.misses);
+    printf("# STORE ADDED:   %lu\n", store.stores);
+    printf("# STORE EVICTED: %lu\n", store.evictions);
+    printf("# STORE BYTES:   %llu\n", (unsigned long long) store.num_bytes);
+  }
 
-  } // EOF positions
+  if ( catalog_file != NULL ) {
+    printf("# CATALOG CHIPS: %zu\n", catalog.num_chips);
+    gistk_catalog_close(&catalog);
+  }
 
   // Close source image
+  CPLFree(pos_failed);
+  if ( cover.valid != NULL ) gistk_cover_free(&cover);
   gistk_close_raster(&src_raster);
 
   return 0;
@@ -0,0 +1,456 @@
+// =====================================================================
+// Block wise change detection between two releases of a geotiff
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-diff.c is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// gtif-diff.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-diff.c.  If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+// Two releases written with the same block layout, type and codec
+// store an unchanged block as the same compressed bytes. The TIFF
+// driver reports where every block lies (BLOCK_OFFSET_X_Y and
+// BLOCK_SIZE_X_Y), so equal blocks are found by comparing raw bytes
+// without decoding. Only the other blocks are decoded and compared
+// pixel by pixel. Threads take blocks with an atomic counter.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <cpl_vsi.h>
+#include "ifgdv/error.h"
+#include "ifgdv/util.h"
+#include "ifgdv/stats.h"
+#include "ifgdv/pipe.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] OLD NEW!\n" \
+  "Options:\n" \
+  "  -b BAND      band to compare (default 1)\n" \
+  "  -e EPS       smallest difference counted as change (default 0)\n" \
+  "  -o FILE      write the difference NEW - OLD of changed blocks,\n" \
+  "               blocks without change stay empty (nodata)\n" \
+  "  -r           decode every block, skip the raw byte comparison\n" \
+  "  -j THREADS   number of threads (default all cores)\n" \
+  "Prints BX BY X Y CHANGED MEAN MIN MAX RMS per changed block.\n" \
+  "Example: %s dem.v01-00.tif dem.v01-01.tif\n"
+
+// Nodata of the difference raster
+#define DIFF_NODATA -99999.0
+
+// Block states
+#define DIFF_RAW     'R'   // identical compressed bytes
+#define DIFF_EQUAL   'E'   // decoded and equal
+#define DIFF_CHANGED 'C'
+
+// -------------------------------------------------------------------
+// Result of one block
+typedef struct {
+  char state;
+  GUIntBig changed;     // changed pixels, validity changes included
+  GUIntBig compared;    // pixels valid in both files
+  GUIntBig differ;      // valid in both with a difference
+  double sum;
+  double sqr;
+  double min;
+  double max;
+} diff_block_t;
+
+// State shared by the threads
+typedef struct {
+  const char * old_file;
+  const char * new_file;
+  int band;
+  double eps;
+  bool raw;
+  int block_w;
+  int block_h;
+  int blocks_x;
+  int num_blocks;
+  int num_cols;
+  int num_rows;
+  diff_block_t * blocks;
+  gistk_stats_t stats;   // differences of all changed pixels
+  GDALRasterBandH out;   // written under the lock
+  gistk_pool_t pool;
+} diff_job_t;
+
+// -------------------------------------------------------------------
+// Offset and size of a stored block, false for sparse blocks
+static bool diff_block_pos(GDALRasterBandH band, int bx, int by,
+                           vsi_l_offset * offset, size_t * size) {
+  char key[64];
+  snprintf(key, sizeof(key), "BLOCK_OFFSET_%d_%d", bx, by);
+  const char * value = GDALGetMetadataItem(band, key, "TIFF");
+  if ( value == NULL ) return false;
+  *offset = (vsi_l_offset) strtoull(value, NULL, 10);
+  snprintf(key, sizeof(key), "BLOCK_SIZE_%d_%d", bx, by);
+  value = GDALGetMetadataItem(band, key, "TIFF");
+  if ( value == NULL ) return false;
+  *size = (size_t) strtoull(value, NULL, 10);
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Compares the compressed bytes of a block in both files
+static bool diff_raw_equal(GDALRasterBandH old_band, GDALRasterBandH new_band,
+                           VSILFILE * old_fp, VSILFILE * new_fp,
+                           int bx, int by, GByte ** buf, size_t * mem) {
+  vsi_l_offset old_off, new_off;
+  size_t old_size, new_size;
+  bool old_has = diff_block_pos(old_band, bx, by, &old_off, &old_size);
+  bool new_has = diff_block_pos(new_band, bx, by, &new_off, &new_size);
+  if ( ! old_has || ! new_has ) return false;
+
+  // Empty blocks in both files
+  if ( old_off == 0 && new_off == 0 ) return true;
+  if ( old_size != new_size || old_off == 0 || new_off == 0 ) return false;
+  if ( 2 * old_size > *mem ) {
+    *mem = 2 * old_size;
+    *buf = CPLRealloc(*buf, *mem);
+  }
+  if ( VSIFSeekL(old_fp, old_off, SEEK_SET) != 0 ||
+       VSIFReadL(*buf, 1, old_size, old_fp) != old_size ) return false;
+  if ( VSIFSeekL(new_fp, new_off, SEEK_SET) != 0 ||
+       VSIFReadL(*buf + old_size, 1, new_size, new_fp) != new_size )
+    return false;
+  return memcmp(*buf, *buf + old_size, old_size) == 0;
+}
+
+// -------------------------------------------------------------------
+// Decodes a block of both files and compares the pixels
+static bool diff_decoded(diff_job_t * job, GDALRasterBandH old_band,
+                         GDALRasterBandH new_band, int x0, int y0,
+                         int w, int h, double * a, double * b,
+                         gistk_stats_t * stats, diff_block_t * result) {
+  if ( GDALRasterIO(old_band, GF_Read, x0, y0, w, h, a, w, h,
+                    GDT_Float64, 0, 0) != CE_None ||
+       GDALRasterIO(new_band, GF_Read, x0, y0, w, h, b, w, h,
+                    GDT_Float64, 0, 0) != CE_None ) return false;
+  int has_old = 0, has_new = 0;
+  double old_nodata = GDALGetRasterNoDataValue(old_band, &has_old);
+  double new_nodata = GDALGetRasterNoDataValue(new_band, &has_new);
+
+  result->min = INFINITY;
+  result->max = -INFINITY;
+  size_t n = (size_t) w * h;
+  for (size_t i=0; i < n; i++) {
+    bool va = a[i] == a[i] && ! ( has_old && a[i] == old_nodata );
+    bool vb = b[i] == b[i] && ! ( has_new && b[i] == new_nodata );
+    if ( va != vb ) {
+      result->changed++;
+      a[i] = DIFF_NODATA;
+      continue;
+    }
+    if ( ! va ) {
+      a[i] = DIFF_NODATA;
+      continue;
+    }
+    double d = b[i] - a[i];
+    a[i] = d;
+    result->compared++;
+    if ( fabs(d) <= job->eps ) continue;
+    result->changed++;
+    result->differ++;
+    result->sum += d;
+    result->sqr += d * d;
+    if ( d < result->min ) result->min = d;
+    if ( d > result->max ) result->max = d;
+  }
+  result->state = result->changed > 0 ? DIFF_CHANGED : DIFF_EQUAL;
+  if ( result->state == DIFF_CHANGED )
+    gistk_stats_add(stats, a, n, true, DIFF_NODATA);
+  return true;
+}
+
+// -------------------------------------------------------------------
+static void diff_run(void * ctx) {
+  diff_job_t * job = ctx;
+  GDALDatasetH old_data = gistk_pool_open(&job->pool, job->old_file);
+  GDALDatasetH new_data = gistk_pool_open(&job->pool, job->new_file);
+
+  // The file handles of the raw compare are not shared either
+  VSILFILE * old_fp = job->raw ? VSIFOpenL(job->old_file, "rb") : NULL;
+  VSILFILE * new_fp = job->raw ? VSIFOpenL(job->new_file, "rb") : NULL;
+  bool ok = old_data != NULL && new_data != NULL &&
+            ( ! job->raw || ( old_fp != NULL && new_fp != NULL ) );
+  GDALRasterBandH old_band = ok ? GDALGetRasterBand(old_data, job->band) : NULL;
+  GDALRasterBandH new_band = ok ? GDALGetRasterBand(new_data, job->band) : NULL;
+
+  size_t n = (size_t) job->block_w * job->block_h;
+  double * a = CPLMalloc(sizeof(double) * n);
+  double * b = CPLMalloc(sizeof(double) * n);
+  GByte * raw = NULL;
+  size_t mem = 0;
+  gistk_stats_t stats;
+  gistk_stats_init(&stats);
+
+  int k;
+  while ( ok && (k = gistk_pool_next(&job->pool)) >= 0 ) {
+    int bx = k % job->blocks_x;
+    int by = k / job->blocks_x;
+    diff_block_t * result = &job->blocks[k];
+    memset(result, 0, sizeof(diff_block_t));
+
+    if ( job->raw && diff_raw_equal(old_band, new_band, old_fp, new_fp,
+                                    bx, by, &raw, &mem) ) {
+      result->state = DIFF_RAW;
+      continue;
+    }
+
+    int x0 = bx * job->block_w;
+    int y0 = by * job->block_h;
+    int w = job->num_cols - x0 < job->block_w ? job->num_cols - x0 : job->block_w;
+    int h = job->num_rows - y0 < job->block_h ? job->num_rows - y0 : job->block_h;
+    if ( ! diff_decoded(job, old_band, new_band, x0, y0, w, h, a, b,
+                        &stats, result) ) {
+      ok = false;
+      break;
+    }
+    if ( job->out != NULL && result->state == DIFF_CHANGED ) {
+      pthread_mutex_lock(&job->pool.lock);
+      if ( GDALRasterIO(job->out, GF_Write, x0, y0, w, h, a, w, h,
+                        GDT_Float64, 0, 0) != CE_None ) ok = false;
+      pthread_mutex_unlock(&job->pool.lock);
+    }
+  }
+
+  pthread_mutex_lock(&job->pool.lock);
+  if ( ! ok ) gistk_pool_fail(&job->pool);
+  gistk_stats_merge(&job->stats, &stats);
+  pthread_mutex_unlock(&job->pool.lock);
+
+  CPLFree(raw);
+  CPLFree(b);
+  CPLFree(a);
+  if ( new_fp != NULL ) VSIFCloseL(new_fp);
+  if ( old_fp != NULL ) VSIFCloseL(old_fp);
+  if ( new_data != NULL ) GDALClose(new_data);
+  if ( old_data != NULL ) GDALClose(old_data);
+}
+
+// -------------------------------------------------------------------
+// Raw bytes are comparable only for the same layout, codec and nodata
+static const char * diff_raw_layout(GDALDatasetH old_data,
+                                    GDALDatasetH new_data,
+                                    GDALRasterBandH old_band,
+                                    GDALRasterBandH new_band) {
+  static const char * keys[] = { "COMPRESSION", "INTERLEAVE", "PREDICTOR" };
+  if ( ! EQUAL(GDALGetDriverShortName(GDALGetDatasetDriver(old_data)),
+               GISTK_FMT_GTIFF) ||
+       ! EQUAL(GDALGetDriverShortName(GDALGetDatasetDriver(new_data)),
+               GISTK_FMT_GTIFF) ) return "no GTiff";
+  if ( GDALGetRasterDataType(old_band) != GDALGetRasterDataType(new_band) )
+    return "data types differ";
+  if ( GDALGetRasterCount(old_data) != GDALGetRasterCount(new_data) )
+    return "band counts differ";
+
+  // Equal bytes mean equal pixels only under the same nodata value
+  int old_has = 0, new_has = 0;
+  double old_nodata = GDALGetRasterNoDataValue(old_band, &old_has);
+  double new_nodata = GDALGetRasterNoDataValue(new_band, &new_has);
+  if ( ( old_has != 0 ) != ( new_has != 0 ) ||
+       ( old_has && old_nodata != new_nodata &&
+         ! ( old_nodata != old_nodata && new_nodata != new_nodata ) ) )
+    return "nodata values differ";
+  int ow, oh, nw, nh;
+  GDALGetBlockSize(old_band, &ow, &oh);
+  GDALGetBlockSize(new_band, &nw, &nh);
+  if ( ow != nw || oh != nh ) return "block sizes differ";
+  for (size_t k=0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+    const char * a = GDALGetMetadataItem(old_data, keys[k], "IMAGE_STRUCTURE");
+    const char * b = GDALGetMetadataItem(new_data, keys[k], "IMAGE_STRUCTURE");
+    if ( ( a == NULL ) != ( b == NULL ) || ( a != NULL && ! EQUAL(a, b) ) )
+      return "codecs differ";
+  }
+  if ( GDALGetMetadataItem(old_band, "BLOCK_OFFSET_0_0", "TIFF") == NULL )
+    return "no block offsets";
+  return NULL;
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  diff_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.band = 1;
+  job.raw = true;
+  const char * out_file = NULL;
+  int num_threads = gistk_pool_threads(NULL);
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+b:e:o:rj:")) != -1 ) {
+    switch ( opt ) {
+    case 'b':
+      if (! sscanf(optarg,"%d",&job.band) || job.band < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "BAND", optarg);
+      break;
+    case 'e':
+      if (! sscanf(optarg,"%lf",&job.eps) || job.eps < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "EPS", optarg);
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case 'r':
+      job.raw = false;
+      break;
+    case 'j':
+      num_threads = gistk_pool_threads(optarg);
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 3 )
+    gistk_error_fatal(1, "Missing parameter at least 2\n" USAGE, prog, prog);
+  job.old_file = argv[1];
+  job.new_file = argv[2];
+
+  // Register the drivers
+  gistk_init(true, false);
+
+  gistk_raster_t old_raster, new_raster;
+  gistk_open_raster(job.old_file, true, &old_raster);
+  gistk_open_raster(job.new_file, true, &new_raster);
+  if ( job.band > old_raster.num_bands || job.band > new_raster.num_bands )
+    gistk_error_fatal(1, "Band %d is not available in both files!\n",
+                      job.band);
+  bool same = old_raster.num_cols == new_raster.num_cols &&
+              old_raster.num_rows == new_raster.num_rows;
+  for (int t=0; same && t < 6; t++)
+    same = fabs(old_raster.trfm[t] - new_raster.trfm[t]) <=
+           1e-6 * fabs(old_raster.trfm[1]);
+  if ( ! same )
+    gistk_error_fatal(GISTK_ERRC_DIFF_GRID, GISTK_ERRS_DIFF_GRID,
+                      job.new_file, job.old_file);
+  job.num_cols = old_raster.num_cols;
+  job.num_rows = old_raster.num_rows;
+
+  GDALRasterBandH old_band = GDALGetRasterBand(old_raster.data, job.band);
+  GDALRasterBandH new_band = GDALGetRasterBand(new_raster.data, job.band);
+  const char * why = NULL;
+  if ( job.raw ) {
+    why = diff_raw_layout(old_raster.data, new_raster.data,
+                          old_band, new_band);
+    if ( why != NULL ) job.raw = false;
+  }
+  GDALGetBlockSize(old_band, &job.block_w, &job.block_h);
+  job.blocks_x = (job.num_cols + job.block_w - 1) / job.block_w;
+  job.num_blocks = job.blocks_x *
+                   ((job.num_rows + job.block_h - 1) / job.block_h);
+  job.blocks = CPLCalloc(job.num_blocks + 1, sizeof(diff_block_t));
+  gistk_stats_init(&job.stats);
+
+  // Difference raster in the block layout of the old release
+  GDALDatasetH out_data = NULL;
+  if ( out_file != NULL ) {
+    gistk_raster_driver_t tool;
+    gistk_open_raster_driver(GISTK_FMT_GTIFF, true, true, false, &tool);
+    char bw[32], bh[32];
+    snprintf(bw, sizeof(bw), "%d", job.block_w);
+    snprintf(bh, sizeof(bh), "%d", job.block_h);
+    bool tiled = job.block_w % 16 == 0 && job.block_h % 16 == 0 &&
+                 job.block_w < job.num_cols;
+    char ** create_opts = NULL;
+    if ( tiled ) {
+      create_opts = CSLSetNameValue(create_opts, "TILED", "YES");
+      create_opts = CSLSetNameValue(create_opts, "BLOCKXSIZE", bw);
+    }
+    create_opts = CSLSetNameValue(create_opts, "BLOCKYSIZE", bh);
+    create_opts = CSLSetNameValue(create_opts, "COMPRESS", "DEFLATE");
+    create_opts = CSLSetNameValue(create_opts, "PREDICTOR", "3");
+    create_opts = CSLSetNameValue(create_opts, "SPARSE_OK", "TRUE");
+    create_opts = CSLSetNameValue(create_opts, "BIGTIFF", "IF_SAFER");
+    out_data = GDALCreate(tool.driver, out_file, job.num_cols, job.num_rows,
+                          1, GDT_Float32, create_opts);
+    CSLDestroy(create_opts);
+    if ( out_data == NULL )
+      gistk_error_fatal(GISTK_ERRC_CUT_RST_CREATE, GISTK_ERRS_CUT_RST_CREATE,
+                        out_file);
+    GDALSetGeoTransform(out_data, old_raster.trfm);
+    GDALSetProjection(out_data, old_raster.proj_info);
+    job.out = GDALGetRasterBand(out_data, 1);
+    GDALSetRasterNoDataValue(job.out, DIFF_NODATA);
+  }
+
+  gistk_pool_init(&job.pool);
+  if ( ! gistk_pool_run(&job.pool, job.num_blocks, num_threads,
+                        diff_run, &job) )
+    gistk_error_fatal(GISTK_ERRC_DIFF_THREAD, GISTK_ERRS_DIFF_THREAD);
+  gistk_pool_free(&job.pool);
+  if ( job.pool.failed )
+    gistk_error_fatal(GISTK_ERRC_DIFF_READ, GISTK_ERRS_DIFF_READ,
+                      job.old_file, job.new_file);
+
+  // Summary
+  int num_raw = 0, num_equal = 0, num_changed = 0;
+  GUIntBig changed = 0, compared = 0;
+  for (int k=0; k < job.num_blocks; k++) {
+    num_raw += job.blocks[k].state == DIFF_RAW;
+    num_equal += job.blocks[k].state == DIFF_EQUAL;
+    num_changed += job.blocks[k].state == DIFF_CHANGED;
+    changed += job.blocks[k].changed;
+    compared += job.blocks[k].compared;
+  }
+  printf("# OLD FILE:      %s\n", job.old_file);
+  printf("# NEW FILE:      %s\n", job.new_file);
+  printf("# RAW COMPARE:   %s\n", job.raw ? "yes" : why != NULL ? why : "off");
+  printf("# BLOCKS:        %d of %dx%d\n", job.num_blocks,
+         job.block_w, job.block_h);
+  printf("# RAW EQUAL:     %d\n", num_raw);
+  printf("# DECODED EQUAL: %d\n", num_equal);
+  printf("# CHANGED:       %d\n", num_changed);
+  printf("# CHANGED PIX:   %llu, %llu compared\n",
+         (unsigned long long) changed, (unsigned long long) compared);
+  // Differences over the pixels of the changed blocks
+  if ( job.stats.count > 0 ) {
+    printf("# DIFF MEAN:     %g\n", job.stats.mean);
+    printf("# DIFF STD:      %g\n", sqrt(job.stats.m2 / job.stats.count));
+    printf("# DIFF MIN MAX:  %g %g\n", job.stats.min, job.stats.max);
+    printf("# DIFF P5 P95:   %g %g\n", gistk_stats_percentile(&job.stats, 5),
+           gistk_stats_percentile(&job.stats, 95));
+  }
+  printf("# BX BY X Y CHANGED MEAN MIN MAX RMS\n");
+  for (int k=0; k < job.num_blocks; k++) {
+    const diff_block_t * block = &job.blocks[k];
+    if ( block->state != DIFF_CHANGED ) continue;
+    int bx = k % job.blocks_x;
+    int by = k / job.blocks_x;
+    GUIntBig n = block->changed;
+    GUIntBig m = block->differ;
+    printf("%d %d %d %d %llu", bx, by, bx * job.block_w, by * job.block_h,
+           (unsigned long long) n);
+    if ( m > 0 )
+      printf(" %g %g %g %g\n", block->sum / m, block->min, block->max,
+             sqrt(block->sqr / m));
+    else
+      printf(" NA NA NA NA\n");
+  }
+
+  if ( out_data != NULL ) GDALClose(out_data);
+  CPLFree(job.blocks);
+  gistk_close_raster(&new_raster);
+  gistk_close_raster(&old_raster);
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
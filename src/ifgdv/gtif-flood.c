@@ -0,0 +1,843 @@
+// =====================================================================
+// Sea level inundation of a geotiff DEM for many water levels
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-flood.c is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// gtif-flood.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-flood.c.  If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+// A cell is flooded at level L if a path from the sea reaches it
+// without crossing a cell above L. The lowest such level of every
+// cell (its flood level) answers all thresholds at once.
+//
+// 1. Every tile floods from its perimeter cells with a priority queue
+//    and keeps the cheapest crossing between the regions of two
+//    perimeter cells as an edge. Tiles run in parallel.
+// 2. The perimeter cells of all tiles, the edges between neighbour
+//    tiles and the sea form a small graph. Kruskal with union-find
+//    over the sorted edges gives the level at which each perimeter
+//    cell joins the sea component.
+// 3. Every tile floods again from its perimeter cells at their
+//    global levels and writes flood levels, masks and counts.
+// Only the graph is kept for the whole raster, the tiles stream.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <stdint.h>
+#include <gdal_alg.h>
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/util.h"
+#include "ifgdv/pipe.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] IN!\n" \
+  "Options:\n" \
+  "  -l LIST      comma separated water levels, at most 256\n" \
+  "  -p X,Y       sea seed point [world], repeatable, without seed\n" \
+  "               points the water enters over the raster border\n" \
+  "  -e           let the water enter over the raster border too\n" \
+  "  -8           connect diagonal neighbours\n" \
+  "  -o FILE      write the flood level of every cell (Float32)\n" \
+  "  -m FILE      write a mask band (Byte) per water level\n" \
+  "  -g GPKG      write the flooded areas per level as polygons\n" \
+  "  -b BAND      band of the DEM (default 1)\n" \
+  "  -T SIZE      tile size [pixel], multiple of 16 (default 512)\n" \
+  "  -j THREADS   number of threads (default all cores)\n" \
+  "Prints LEVEL CELLS AREA per water level.\n" \
+  "Example: %s -l 0.5,1,2 -m flood.tif dem.v2.3d.tif\n"
+
+// Maximal number of water levels
+#define FLOOD_MAX_LEVELS 256
+
+// Flood level of cells the water never reaches
+#define FLOOD_NODATA -99999.0
+
+// Node of the sea in the border graph
+#define FLOOD_SEA 0
+
+// -------------------------------------------------------------------
+// Edge between two regions or nodes, cheapest crossing level
+typedef struct {
+  int a;
+  int b;
+  float w;
+} flood_edge_t;
+
+// Priority queue entry
+typedef struct {
+  float level;
+  int cell;
+} flood_entry_t;
+
+typedef struct {
+  flood_entry_t * data;
+  size_t size;
+  size_t mem;
+} flood_heap_t;
+
+// One tile and its part of the border graph
+typedef struct {
+  int x0;
+  int y0;
+  int w;
+  int h;
+  int base;           // node of the first perimeter cell
+  int num_perim;
+  float * perim_z;    // NAN for nodata
+  float * perim_f;    // global flood levels of the perimeter
+  int num_seeds;      // seeds inside the tile, nodes after the perimeter
+  int * seed_cells;
+  flood_edge_t * edges;
+  int num_edges;
+} flood_tile_t;
+
+// State shared by the threads
+typedef struct {
+  const char * filename;
+  int band;
+  int num_cols;
+  int num_rows;
+  int tile_size;
+  int tiles_x;
+  int tiles_y;
+  flood_tile_t * tiles;
+  int num_tiles;
+  int num_nbrs;
+  int pass;
+  int num_levels;
+  double levels[FLOOD_MAX_LEVELS];
+  GUIntBig counts[FLOOD_MAX_LEVELS];
+  GDALDatasetH level_data;  // outputs, written under the lock
+  GDALDatasetH mask_data;
+  gistk_pool_t pool;        // its lock guards the outputs
+} flood_job_t;
+
+static const int flood_dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+static const int flood_dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+// -------------------------------------------------------------------
+static void flood_push(flood_heap_t * heap, float level, int cell) {
+  if ( heap->size == heap->mem ) {
+    heap->mem = heap->mem * 2 + 1024;
+    heap->data = CPLRealloc(heap->data, sizeof(flood_entry_t) * heap->mem);
+  }
+  size_t i = heap->size++;
+  while ( i > 0 ) {
+    size_t p = (i - 1) / 2;
+    if ( heap->data[p].level <= level ) break;
+    heap->data[i] = heap->data[p];
+    i = p;
+  }
+  heap->data[i].level = level;
+  heap->data[i].cell = cell;
+}
+
+// -------------------------------------------------------------------
+static flood_entry_t flood_pop(flood_heap_t * heap) {
+  flood_entry_t top = heap->data[0];
+  flood_entry_t last = heap->data[--heap->size];
+  size_t i = 0;
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if ( c >= heap->size ) break;
+    if ( c + 1 < heap->size && heap->data[c+1].level < heap->data[c].level )
+      c++;
+    if ( last.level <= heap->data[c].level ) break;
+    heap->data[i] = heap->data[c];
+    i = c;
+  }
+  if ( heap->size > 0 ) heap->data[i] = last;
+  return top;
+}
+
+// -------------------------------------------------------------------
+// Index of a perimeter cell: top row, bottom row, left and right
+// column without the corners, -1 inside
+static int flood_perim(int w, int h, int lx, int ly) {
+  if ( ly == 0 ) return lx;
+  if ( ly == h - 1 ) return w + lx;
+  if ( lx == 0 ) return 2 * w + (ly - 1);
+  if ( lx == w - 1 ) return 2 * w + (h - 2) + (ly - 1);
+  return -1;
+}
+
+// -------------------------------------------------------------------
+static int flood_num_perim(int w, int h) {
+  return h == 1 ? w : w == 1 ? h : 2 * w + 2 * (h - 2);
+}
+
+// -------------------------------------------------------------------
+// Reads a tile as floats, nodata becomes NAN
+static bool flood_read(GDALDatasetH data, const flood_job_t * job,
+                       const flood_tile_t * tile, float * z) {
+  GDALRasterBandH band = GDALGetRasterBand(data, job->band);
+  if ( GDALRasterIO(band, GF_Read, tile->x0, tile->y0, tile->w, tile->h,
+                    z, tile->w, tile->h, GDT_Float32, 0, 0) != CE_None )
+    return false;
+  int has = 0;
+  float nodata = (float) GDALGetRasterNoDataValue(band, &has);
+  if ( has )
+    for (size_t i=0; i < (size_t) tile->w * tile->h; i++)
+      if ( z[i] == nodata ) z[i] = NAN;
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Keeps the cheapest crossing per pair of regions in an open
+// addressing table
+typedef struct {
+  uint64_t * keys;
+  float * weights;
+  size_t mem;
+  size_t size;
+} flood_pairs_t;
+
+static void flood_pairs_put(flood_pairs_t * pairs, int a, int b, float w) {
+  if ( 2 * (pairs->size + 1) > pairs->mem ) {
+    flood_pairs_t grown;
+    grown.mem = pairs->mem == 0 ? 4096 : 2 * pairs->mem;
+    grown.size = 0;
+    grown.keys = CPLMalloc(sizeof(uint64_t) * grown.mem);
+    grown.weights = CPLMalloc(sizeof(float) * grown.mem);
+    memset(grown.keys, 0xff, sizeof(uint64_t) * grown.mem);
+    for (size_t i=0; i < pairs->mem; i++)
+      if ( pairs->keys[i] != UINT64_MAX )
+        flood_pairs_put(&grown, (int) (pairs->keys[i] >> 32),
+                        (int) (pairs->keys[i] & 0xffffffffu),
+                        pairs->weights[i]);
+    CPLFree(pairs->keys);
+    CPLFree(pairs->weights);
+    *pairs = grown;
+  }
+  if ( a > b ) { int t = a; a = b; b = t; }
+  uint64_t key = ((uint64_t) a << 32) | (uint32_t) b;
+  size_t i = (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 20) & (pairs->mem - 1);
+  while ( pairs->keys[i] != UINT64_MAX && pairs->keys[i] != key )
+    i = (i + 1) & (pairs->mem - 1);
+  if ( pairs->keys[i] == key ) {
+    if ( w < pairs->weights[i] ) pairs->weights[i] = w;
+    return;
+  }
+  pairs->keys[i] = key;
+  pairs->weights[i] = w;
+  pairs->size++;
+}
+
+// -------------------------------------------------------------------
+// Pass 1: regions of the perimeter cells and seeds inside a tile
+static void flood_regions(const flood_job_t * job, flood_tile_t * tile,
+                          const float * z, int * label, float * f,
+                          flood_heap_t * heap) {
+  int w = tile->w;
+  int h = tile->h;
+  size_t n = (size_t) w * h;
+  for (size_t i=0; i < n; i++) label[i] = -1;
+
+  tile->perim_z = CPLMalloc(sizeof(float) * tile->num_perim);
+  heap->size = 0;
+  for (int ly=0; ly < h; ly++)
+    for (int lx=0; lx < w; lx++) {
+      int p = flood_perim(w, h, lx, ly);
+      if ( p < 0 ) continue;
+      int c = ly * w + lx;
+      tile->perim_z[p] = z[c];
+      if ( z[c] != z[c] ) continue;
+      label[c] = p; f[c] = z[c];
+      flood_push(heap, z[c], c);
+    }
+  for (int s=0; s < tile->num_seeds; s++) {
+    int c = tile->seed_cells[s];
+    if ( z[c] != z[c] || label[c] >= 0 ) continue;
+    label[c] = tile->num_perim + s; f[c] = z[c];
+    flood_push(heap, z[c], c);
+  }
+
+  flood_pairs_t pairs;
+  memset(&pairs, 0, sizeof(pairs));
+  while ( heap->size > 0 ) {
+    flood_entry_t e = flood_pop(heap);
+    int cx = e.cell % w;
+    int cy = e.cell / w;
+    for (int k=0; k < job->num_nbrs; k++) {
+      int nx = cx + flood_dx[k];
+      int ny = cy + flood_dy[k];
+      if ( nx < 0 || ny < 0 || nx >= w || ny >= h ) continue;
+      int c = ny * w + nx;
+      if ( z[c] != z[c] ) continue;
+      if ( label[c] < 0 ) {
+        label[c] = label[e.cell];
+        f[c] = z[c] > e.level ? z[c] : e.level;
+        flood_push(heap, f[c], c);
+      } else if ( label[c] != label[e.cell] ) {
+        flood_pairs_put(&pairs, label[c], label[e.cell],
+                        f[c] > e.level ? f[c] : e.level);
+      }
+    }
+  }
+
+  tile->num_edges = 0;
+  tile->edges = CPLMalloc(sizeof(flood_edge_t) * (pairs.size + 1));
+  for (size_t i=0; i < pairs.mem; i++) {
+    if ( pairs.keys[i] == UINT64_MAX ) continue;
+    flood_edge_t * edge = &tile->edges[tile->num_edges++];
+    edge->a = (int) (pairs.keys[i] >> 32);
+    edge->b = (int) (pairs.keys[i] & 0xffffffffu);
+    edge->w = pairs.weights[i];
+  }
+  CPLFree(pairs.keys);
+  CPLFree(pairs.weights);
+}
+
+// -------------------------------------------------------------------
+// Pass 3: flood levels of a tile from the global perimeter levels
+static void flood_levels(const flood_job_t * job, const flood_tile_t * tile,
+                         const float * z, float * f, flood_heap_t * heap) {
+  int w = tile->w;
+  int h = tile->h;
+  size_t n = (size_t) w * h;
+  for (size_t i=0; i < n; i++) f[i] = NAN;
+
+  heap->size = 0;
+  for (int ly=0; ly < h; ly++)
+    for (int lx=0; lx < w; lx++) {
+      int p = flood_perim(w, h, lx, ly);
+      if ( p < 0 ) continue;
+      float level = tile->perim_f[p];
+      if ( level != level ) continue;
+      f[ly * w + lx] = level;
+      flood_push(heap, level, ly * w + lx);
+    }
+  for (int s=0; s < tile->num_seeds; s++) {
+    int c = tile->seed_cells[s];
+    float level = tile->perim_f[tile->num_perim + s];
+    if ( level != level || f[c] == f[c] ) continue;
+    if ( z[c] > level ) level = z[c];
+    f[c] = level;
+    flood_push(heap, level, c);
+  }
+
+  while ( heap->size > 0 ) {
+    flood_entry_t e = flood_pop(heap);
+    int cx = e.cell % w;
+    int cy = e.cell / w;
+    for (int k=0; k < job->num_nbrs; k++) {
+      int nx = cx + flood_dx[k];
+      int ny = cy + flood_dy[k];
+      if ( nx < 0 || ny < 0 || nx >= w || ny >= h ) continue;
+      int c = ny * w + nx;
+      if ( z[c] != z[c] || f[c] == f[c] ) continue;
+      f[c] = z[c] > e.level ? z[c] : e.level;
+      flood_push(heap, f[c], c);
+    }
+  }
+}
+
+// -------------------------------------------------------------------
+// Writes the flood levels and masks of a tile, the masks are computed
+// outside of the lock, only the writes are serialized
+static void flood_write(flood_job_t * job, const flood_tile_t * tile,
+                        float * f, GByte * mask) {
+  size_t n = (size_t) tile->w * tile->h;
+
+  for (int l=0; l < job->num_levels; l++) {
+    float level = (float) job->levels[l];
+    GUIntBig cnt = 0;
+    for (size_t i=0; i < n; i++) {
+      mask[i] = f[i] <= level;
+      cnt += mask[i];
+    }
+    __atomic_fetch_add(&job->counts[l], cnt, __ATOMIC_RELAXED);
+    if ( job->mask_data == NULL ) continue;
+    pthread_mutex_lock(&job->pool.lock);
+    GDALRasterIO(GDALGetRasterBand(job->mask_data, l+1), GF_Write,
+                 tile->x0, tile->y0, tile->w, tile->h,
+                 mask, tile->w, tile->h, GDT_Byte, 0, 0);
+    pthread_mutex_unlock(&job->pool.lock);
+  }
+  if ( job->level_data != NULL ) {
+    for (size_t i=0; i < n; i++)
+      if ( f[i] != f[i] ) f[i] = FLOOD_NODATA;
+    pthread_mutex_lock(&job->pool.lock);
+    GDALRasterIO(GDALGetRasterBand(job->level_data, 1), GF_Write,
+                 tile->x0, tile->y0, tile->w, tile->h,
+                 f, tile->w, tile->h, GDT_Float32, 0, 0);
+    pthread_mutex_unlock(&job->pool.lock);
+  }
+}
+
+// -------------------------------------------------------------------
+// Thread of pass 1 or 3, takes tiles until all are done
+static void flood_run(void * ctx) {
+  flood_job_t * job = ctx;
+  GDALDatasetH data = gistk_pool_open(&job->pool, job->filename);
+  if ( data == NULL ) return;
+
+  size_t n = (size_t) job->tile_size * job->tile_size;
+  float * z = CPLMalloc(sizeof(float) * n);
+  float * f = CPLMalloc(sizeof(float) * n);
+  int * label = job->pass == 1 ? CPLMalloc(sizeof(int) * n) : NULL;
+  GByte * mask = job->pass == 3 ? CPLMalloc(n) : NULL;
+  flood_heap_t heap;
+  memset(&heap, 0, sizeof(heap));
+
+  int t;
+  while ( (t = gistk_pool_next(&job->pool)) >= 0 ) {
+    flood_tile_t * tile = &job->tiles[t];
+    if ( ! flood_read(data, job, tile, z) ) {
+      gistk_pool_fail(&job->pool);
+      break;
+    }
+    if ( job->pass == 1 ) {
+      flood_regions(job, tile, z, label, f, &heap);
+    } else {
+      flood_levels(job, tile, z, f, &heap);
+      flood_write(job, tile, f, mask);
+    }
+  }
+
+  CPLFree(heap.data);
+  CPLFree(mask);
+  CPLFree(label);
+  CPLFree(f);
+  CPLFree(z);
+  GDALClose(data);
+}
+
+// -------------------------------------------------------------------
+static void flood_pass(flood_job_t * job, int pass, int num_threads) {
+  job->pass = pass;
+  if ( ! gistk_pool_run(&job->pool, job->num_tiles, num_threads,
+                        flood_run, job) )
+    gistk_error_fatal(GISTK_ERRC_FLOOD_THREAD, GISTK_ERRS_FLOOD_THREAD);
+  if ( job->pool.failed )
+    gistk_error_fatal(GISTK_ERRC_FLOOD_READ, GISTK_ERRS_FLOOD_READ,
+                      job->filename);
+}
+
+// -------------------------------------------------------------------
+// Node of the perimeter cell at a raster position
+static int flood_node(const flood_job_t * job, int gx, int gy,
+                      const flood_tile_t ** tile, int * p) {
+  int tx = gx / job->tile_size;
+  int ty = gy / job->tile_size;
+  *tile = &job->tiles[ty * job->tiles_x + tx];
+  *p = flood_perim((*tile)->w, (*tile)->h, gx - (*tile)->x0, gy - (*tile)->y0);
+  return (*tile)->base + *p;
+}
+
+// -------------------------------------------------------------------
+static int flood_edge_cmp(const void * a, const void * b) {
+  float wa = ((const flood_edge_t *) a)->w;
+  float wb = ((const flood_edge_t *) b)->w;
+  return wa < wb ? -1 : wa > wb;
+}
+
+// -------------------------------------------------------------------
+static int flood_find(int * parent, int a) {
+  while ( parent[a] != a ) {
+    parent[a] = parent[parent[a]];
+    a = parent[a];
+  }
+  return a;
+}
+
+// -------------------------------------------------------------------
+// Pass 2: level at which every node joins the sea, Kruskal over the
+// sorted edges of the border graph
+static void flood_merge(flood_job_t * job, int num_nodes, bool border) {
+
+  // Edges inside the tiles, between the tiles and to the sea
+  size_t num_edges = 0;
+  for (int t=0; t < job->num_tiles; t++)
+    num_edges += job->tiles[t].num_edges + job->tiles[t].num_seeds +
+                 (size_t) job->tiles[t].num_perim * (job->num_nbrs + 1);
+  flood_edge_t * edges = CPLMalloc(sizeof(flood_edge_t) * num_edges);
+  size_t e = 0;
+
+  for (int t=0; t < job->num_tiles; t++) {
+    const flood_tile_t * tile = &job->tiles[t];
+    for (int i=0; i < tile->num_edges; i++) {
+      edges[e].a = tile->base + tile->edges[i].a;
+      edges[e].b = tile->base + tile->edges[i].b;
+      edges[e].w = tile->edges[i].w;
+      e++;
+    }
+    for (int s=0; s < tile->num_seeds; s++) {
+      int c = tile->seed_cells[s];
+      int p = flood_perim(tile->w, tile->h, c % tile->w, c / tile->w);
+      edges[e].a = FLOOD_SEA;
+      edges[e].b = tile->base + ( p >= 0 ? p : tile->num_perim + s );
+      edges[e].w = -INFINITY;
+      e++;
+    }
+
+    for (int ly=0; ly < tile->h; ly++)
+      for (int lx=0; lx < tile->w; lx++) {
+        int p = flood_perim(tile->w, tile->h, lx, ly);
+        if ( p < 0 || tile->perim_z[p] != tile->perim_z[p] ) continue;
+        int gx = tile->x0 + lx;
+        int gy = tile->y0 + ly;
+        float zp = tile->perim_z[p];
+        if ( border && ( gx == 0 || gy == 0 || gx == job->num_cols - 1 ||
+                         gy == job->num_rows - 1 ) ) {
+          edges[e].a = FLOOD_SEA;
+          edges[e].b = tile->base + p;
+          edges[e].w = zp;
+          e++;
+        }
+        for (int k=0; k < job->num_nbrs; k++) {
+          int nx = gx + flood_dx[k];
+          int ny = gy + flood_dy[k];
+          if ( nx < 0 || ny < 0 || nx >= job->num_cols || ny >= job->num_rows )
+            continue;
+          if ( nx / job->tile_size == gx / job->tile_size &&
+               ny / job->tile_size == gy / job->tile_size ) continue;
+          const flood_tile_t * other;
+          int q;
+          int b = flood_node(job, nx, ny, &other, &q);
+          float zq = other->perim_z[q];
+          if ( b < tile->base + p || zq != zq ) continue;
+          edges[e].a = tile->base + p;
+          edges[e].b = b;
+          edges[e].w = zp > zq ? zp : zq;
+          e++;
+        }
+      }
+  }
+  qsort(edges, e, sizeof(flood_edge_t), flood_edge_cmp);
+
+  // Union-find with member lists, a component joining the sea gets
+  // the level of the joining edge
+  int * parent = CPLMalloc(sizeof(int) * num_nodes);
+  int * size = CPLMalloc(sizeof(int) * num_nodes);
+  int * next = CPLMalloc(sizeof(int) * num_nodes);
+  int * last = CPLMalloc(sizeof(int) * num_nodes);
+  float * level = CPLMalloc(sizeof(float) * num_nodes);
+  for (int i=0; i < num_nodes; i++) {
+    parent[i] = i; size[i] = 1; next[i] = -1; last[i] = i;
+    level[i] = NAN;
+  }
+  level[FLOOD_SEA] = -INFINITY;
+
+  for (size_t i=0; i < e; i++) {
+    int ra = flood_find(parent, edges[i].a);
+    int rb = flood_find(parent, edges[i].b);
+    if ( ra == rb ) continue;
+    bool wet_a = level[ra] == level[ra];
+    bool wet_b = level[rb] == level[rb];
+    if ( wet_a != wet_b ) {
+      int dry = wet_a ? rb : ra;
+      for (int m = dry; m >= 0; m = next[m]) level[m] = edges[i].w;
+    }
+    if ( size[ra] < size[rb] ) { int t = ra; ra = rb; rb = t; }
+    parent[rb] = ra;
+    size[ra] += size[rb];
+    next[last[ra]] = rb;
+    last[ra] = last[rb];
+  }
+
+  // A seed floods at least to its own height
+  for (int t=0; t < job->num_tiles; t++) {
+    flood_tile_t * tile = &job->tiles[t];
+    int num = tile->num_perim + tile->num_seeds;
+    tile->perim_f = CPLMalloc(sizeof(float) * num);
+    for (int i=0; i < num; i++) {
+      float zi = i < tile->num_perim ? tile->perim_z[i] : NAN;
+      float fi = level[tile->base + i];
+      tile->perim_f[i] = fi == fi && zi == zi && zi > fi ? zi : fi;
+    }
+  }
+
+  CPLFree(level); CPLFree(last); CPLFree(next); CPLFree(size);
+  CPLFree(parent); CPLFree(edges);
+}
+
+// -------------------------------------------------------------------
+// Output raster with the tiling of the flood
+static GDALDatasetH flood_create(const char * filename, const flood_job_t * job,
+                                 const gistk_raster_t * source,
+                                 int num_bands, GDALDataType type) {
+  GDALDriverH driver = GDALGetDriverByName(GISTK_FMT_GTIFF);
+  char size[32];
+  snprintf(size, sizeof(size), "%d", job->tile_size);
+  char ** create_opts = NULL;
+  create_opts = CSLSetNameValue(create_opts, "TILED", "YES");
+  create_opts = CSLSetNameValue(create_opts, "BLOCKXSIZE", size);
+  create_opts = CSLSetNameValue(create_opts, "BLOCKYSIZE", size);
+  create_opts = CSLSetNameValue(create_opts, "COMPRESS", "DEFLATE");
+  create_opts = CSLSetNameValue(create_opts, "BIGTIFF", "IF_SAFER");
+  GDALDatasetH data = GDALCreate(driver, filename, job->num_cols,
+                                 job->num_rows, num_bands, type, create_opts);
+  CSLDestroy(create_opts);
+  if ( data == NULL )
+    gistk_error_fatal(GISTK_ERRC_CUT_RST_CREATE, GISTK_ERRS_CUT_RST_CREATE,
+                      filename);
+  double trfm[6];
+  memcpy(trfm, source->trfm, sizeof(trfm));
+  GDALSetGeoTransform(data, trfm);
+  GDALSetProjection(data, source->proj_info);
+  return data;
+}
+
+// -------------------------------------------------------------------
+// Polygons of the flooded cells per level from the mask bands
+static void flood_polygons(const char * filename, const char * mask_file,
+                           const flood_job_t * job,
+                           const gistk_raster_t * source) {
+  GDALDriverH driver = GDALGetDriverByName("GPKG");
+  if ( driver == NULL )
+    gistk_error_fatal(GISTK_ERRC_OPEN_DRV_VALID, GISTK_ERRS_OPEN_DRV_VALID,
+                      "GPKG");
+  GDALDatasetH vector = GDALCreate(driver, filename, 0, 0, 0,
+                                   GDT_Unknown, NULL);
+  if ( vector == NULL )
+    gistk_error_fatal(GISTK_ERRC_CUT_RST_CREATE, GISTK_ERRS_CUT_RST_CREATE,
+                      filename);
+  GDALDatasetH masks = GDALOpen(mask_file, GA_ReadOnly);
+  if ( masks == NULL )
+    gistk_error_fatal(GISTK_ERRC_OPEN_RST_SRCR, GISTK_ERRS_OPEN_RST_SRC,
+                      mask_file, "readable");
+
+  for (int l=0; l < job->num_levels; l++) {
+    char name[64];
+    snprintf(name, sizeof(name), "flood_%g", job->levels[l]);
+    OGRLayerH layer = GDALDatasetCreateLayer(vector, name, source->srs,
+                                             wkbPolygon, NULL);
+    OGRFieldDefnH field = OGR_Fld_Create("flooded", OFTInteger);
+    OGR_L_CreateField(layer, field, TRUE);
+    OGR_Fld_Destroy(field);
+
+    // The mask band masks itself, only flooded cells become polygons
+    GDALRasterBandH band = GDALGetRasterBand(masks, l+1);
+    GDALDatasetStartTransaction(vector, FALSE);
+    GDALPolygonize(band, band, layer, 0, NULL, NULL, NULL);
+    GDALDatasetCommitTransaction(vector);
+  }
+  GDALClose(masks);
+  GDALClose(vector);
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  flood_job_t job;
+  memset(&job, 0, sizeof(job));
+  job.band = 1;
+  job.tile_size = 512;
+  job.num_nbrs = 4;
+  bool border = false;
+  int num_threads = gistk_pool_threads(NULL);
+  const char * level_file = NULL;
+  const char * mask_file = NULL;
+  const char * poly_file = NULL;
+  dbl_vector_t seed_x;
+  dbl_vector_init(&seed_x, 4);
+  dbl_vector_t seed_y;
+  dbl_vector_init(&seed_y, 4);
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+l:p:e8o:m:g:b:T:j:")) != -1 ) {
+    switch ( opt ) {
+    case 'l': {
+      char * end = optarg;
+      job.num_levels = 0;
+      while ( *end != '\0' ) {
+        if ( job.num_levels == FLOOD_MAX_LEVELS )
+          gistk_error_fatal(1, "More than %d water levels!\n",
+                            FLOOD_MAX_LEVELS);
+        char * pos = end;
+        job.levels[job.num_levels++] = strtod(pos, &end);
+        if ( end == pos || ( *end != ',' && *end != '\0' ) )
+          gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "LIST", optarg);
+        if ( *end == ',' ) end++;
+      }
+      break;
+    }
+    case 'p': {
+      double x, y;
+      if ( sscanf(optarg, "%lf,%lf", &x, &y) != 2 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "X,Y", optarg);
+      dbl_vector_add(&seed_x, x);
+      dbl_vector_add(&seed_y, y);
+      break;
+    }
+    case 'e':
+      border = true;
+      break;
+    case '8':
+      job.num_nbrs = 8;
+      break;
+    case 'o':
+      level_file = optarg;
+      break;
+    case 'm':
+      mask_file = optarg;
+      break;
+    case 'g':
+      poly_file = optarg;
+      break;
+    case 'b':
+      if (! sscanf(optarg,"%d",&job.band) || job.band < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "BAND", optarg);
+      break;
+    case 'T':
+      if (! sscanf(optarg,"%d",&job.tile_size) || job.tile_size < 16 ||
+          job.tile_size % 16 != 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "SIZE", optarg);
+      break;
+    case 'j':
+      num_threads = gistk_pool_threads(optarg);
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+  if ( seed_x.length == 0 ) border = true;
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 2 )
+    gistk_error_fatal(1, "Missing parameter at least 1\n" USAGE, prog, prog);
+  if ( job.num_levels == 0 && ( mask_file != NULL || poly_file != NULL ) )
+    gistk_error_fatal(1, "Masks and polygons need water levels -l!\n");
+  job.filename = argv[1];
+
+  // Register the drivers
+  gistk_init(true, poly_file != NULL);
+
+  gistk_raster_t src_raster;
+  gistk_open_raster(job.filename, true, &src_raster);
+  if ( job.band > src_raster.num_bands )
+    gistk_error_fatal(1, "Band %d is not available in %s!\n",
+                      job.band, job.filename);
+  job.num_cols = src_raster.num_cols;
+  job.num_rows = src_raster.num_rows;
+
+  // Tiles and the nodes of their perimeter cells
+  job.tiles_x = (job.num_cols + job.tile_size - 1) / job.tile_size;
+  job.tiles_y = (job.num_rows + job.tile_size - 1) / job.tile_size;
+  job.num_tiles = job.tiles_x * job.tiles_y;
+  job.tiles = CPLCalloc(job.num_tiles, sizeof(flood_tile_t));
+  for (int t=0; t < job.num_tiles; t++) {
+    flood_tile_t * tile = &job.tiles[t];
+    tile->x0 = (t % job.tiles_x) * job.tile_size;
+    tile->y0 = (t / job.tiles_x) * job.tile_size;
+    tile->w = job.num_cols - tile->x0 < job.tile_size ?
+              job.num_cols - tile->x0 : job.tile_size;
+    tile->h = job.num_rows - tile->y0 < job.tile_size ?
+              job.num_rows - tile->y0 : job.tile_size;
+    tile->num_perim = flood_num_perim(tile->w, tile->h);
+  }
+
+  // Seed points go to their tiles
+  double inv[6];
+  if ( ! GDALInvGeoTransform(src_raster.trfm, inv) )
+    gistk_error_fatal(GISTK_ERRC_OPEN_RST_TRFM, GISTK_ERRS_OPEN_RST_TRFM,
+                      job.filename);
+  for (size_t s=0; s < seed_x.length; s++) {
+    double px = floor(inv[0] + inv[1] * seed_x.data[s] + inv[2] * seed_y.data[s]);
+    double py = floor(inv[3] + inv[4] * seed_x.data[s] + inv[5] * seed_y.data[s]);
+    if ( px < 0 || py < 0 || px >= job.num_cols || py >= job.num_rows )
+      gistk_error_fatal(1, "Seed %g,%g is outside of %s!\n",
+                        seed_x.data[s], seed_y.data[s], job.filename);
+    int gx = (int) px;
+    int gy = (int) py;
+    flood_tile_t * tile =
+      &job.tiles[(gy / job.tile_size) * job.tiles_x + gx / job.tile_size];
+    tile->seed_cells = CPLRealloc(tile->seed_cells,
+                                  sizeof(int) * (tile->num_seeds + 1));
+    tile->seed_cells[tile->num_seeds++] =
+      (gy - tile->y0) * tile->w + (gx - tile->x0);
+  }
+
+  long num_nodes = 1;
+  for (int t=0; t < job.num_tiles; t++) {
+    job.tiles[t].base = (int) num_nodes;
+    num_nodes += job.tiles[t].num_perim + job.tiles[t].num_seeds;
+  }
+  if ( num_nodes > INT_MAX )
+    gistk_error_fatal(GISTK_ERRC_FLOOD_NODES, GISTK_ERRS_FLOOD_NODES,
+                      job.filename);
+
+  printf("# IN FILE:       %s\n", job.filename);
+  printf("# TILES:         %d x %d of %d\n", job.tiles_x, job.tiles_y,
+         job.tile_size);
+  printf("# GRAPH NODES:   %ld\n", num_nodes);
+  printf("# SEEDS:         %zu%s\n", seed_x.length, border ? " BORDER" : "");
+
+  gistk_pool_init(&job.pool);
+  flood_pass(&job, 1, num_threads);
+  flood_merge(&job, (int) num_nodes, border);
+
+  // Masks for polygons without own mask file go to a temporary file
+  char temp_file[1024];
+  const char * masks = mask_file;
+  if ( poly_file != NULL && mask_file == NULL ) {
+    snprintf(temp_file, sizeof(temp_file), "%s.masks.tif", poly_file);
+    masks = temp_file;
+  }
+  if ( level_file != NULL ) {
+    job.level_data = flood_create(level_file, &job, &src_raster, 1,
+                                  GDT_Float32);
+    GDALSetRasterNoDataValue(GDALGetRasterBand(job.level_data, 1),
+                             FLOOD_NODATA);
+  }
+  if ( masks != NULL ) {
+    job.mask_data = flood_create(masks, &job, &src_raster, job.num_levels,
+                                 GDT_Byte);
+    for (int l=0; l < job.num_levels; l++) {
+      char name[64];
+      snprintf(name, sizeof(name), "flood %g", job.levels[l]);
+      GDALSetDescription(GDALGetRasterBand(job.mask_data, l+1), name);
+    }
+  }
+  flood_pass(&job, 3, num_threads);
+  if ( job.level_data != NULL ) GDALClose(job.level_data);
+  if ( job.mask_data != NULL ) GDALClose(job.mask_data);
+  gistk_pool_free(&job.pool);
+
+  if ( poly_file != NULL ) {
+    flood_polygons(poly_file, masks, &job, &src_raster);
+    if ( mask_file == NULL ) unlink(masks);
+  }
+
+  // Counts and areas per level
+  double cell_area = fabs(src_raster.trfm[1] * src_raster.trfm[5] -
+                          src_raster.trfm[2] * src_raster.trfm[4]);
+  printf("# LEVEL CELLS AREA\n");
+  for (int l=0; l < job.num_levels; l++)
+    printf("%g %llu %.3f\n", job.levels[l],
+           (unsigned long long) job.counts[l], job.counts[l] * cell_area);
+
+  for (int t=0; t < job.num_tiles; t++) {
+    CPLFree(job.tiles[t].perim_z);
+    CPLFree(job.tiles[t].perim_f);
+    CPLFree(job.tiles[t].seed_cells);
+    CPLFree(job.tiles[t].edges);
+  }
+  CPLFree(job.tiles);
+  dbl_vector_free(&seed_x);
+  dbl_vector_free(&seed_y);
+  gistk_close_raster(&src_raster);
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
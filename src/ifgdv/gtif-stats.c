@@ -0,0 +1,205 @@
+// =====================================================================
+// Statistics and histograms of geotiffs in one parallel read
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-stats.c is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// gtif-stats.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-stats.c.  If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "ifgdv/error.h"
+#include "ifgdv/util.h"
+#include "ifgdv/stats.h"
+#include "ifgdv/pipe.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] FILE1 FILE2 ...!\n" \
+  "Options:\n" \
+  "  -j THREADS   number of reading threads (default all cores)\n" \
+  "  -n           print only, do not write the metadata\n" \
+  "Writes min, max, mean, std, valid count, histogram and the\n" \
+  "percentiles STATISTICS_Pnn into the band metadata.\n" \
+  "Example: %s -j 8 dem.v2.3d.tif\n"
+
+// Minimal rows of a strip handed to a thread
+#define STATS_MIN_ROWS 64
+
+// -------------------------------------------------------------------
+// Strips of a file shared by the threads. The statistics of each
+// strip are merged in strip order, the merge is not associative in
+// floating point and the thread order would change the results.
+typedef struct {
+  const char * filename;
+  int num_cols;
+  int num_rows;
+  int num_bands;
+  int strip_rows;
+  int num_strips;
+  gistk_pool_t pool;
+  gistk_stats_t ** done;  // finished strips waiting for their merge
+  int merged;             // strips merged into stats
+  gistk_stats_t * stats;
+} stats_job_t;
+
+// -------------------------------------------------------------------
+// Hands a finished strip over and merges all strips in order up to
+// the first one still running
+static void stats_done(stats_job_t * job, int s, gistk_stats_t * strip) {
+  pthread_mutex_lock(&job->pool.lock);
+  job->done[s] = strip;
+  while ( job->merged < job->num_strips &&
+          job->done[job->merged] != NULL ) {
+    gistk_stats_t * next = job->done[job->merged];
+    for (int b=0; b < job->num_bands; b++)
+      gistk_stats_merge(&job->stats[b], &next[b]);
+    CPLFree(next);
+    job->done[job->merged++] = NULL;
+  }
+  pthread_mutex_unlock(&job->pool.lock);
+}
+
+// -------------------------------------------------------------------
+// Reads strips in file order until all are taken
+static void stats_run(void * ctx) {
+  stats_job_t * job = ctx;
+  GDALDatasetH data = gistk_pool_open(&job->pool, job->filename);
+  if ( data == NULL ) return;
+
+  double * buffer = CPLMalloc(sizeof(double) *
+                              (size_t) job->num_cols * job->strip_rows);
+  int s;
+  while ( (s = gistk_pool_next(&job->pool)) >= 0 ) {
+    int y0 = s * job->strip_rows;
+    int rows = job->num_rows - y0 < job->strip_rows ?
+               job->num_rows - y0 : job->strip_rows;
+    gistk_stats_t * strip = CPLMalloc(sizeof(gistk_stats_t) * job->num_bands);
+    bool valid = true;
+    for (int b=0; b < job->num_bands && valid; b++) {
+      GDALRasterBandH band = GDALGetRasterBand(data, b+1);
+      int has = 0;
+      double nodata = GDALGetRasterNoDataValue(band, &has);
+      gistk_stats_init(&strip[b]);
+      valid = GDALRasterIO(band, GF_Read, 0, y0, job->num_cols, rows,
+                           buffer, job->num_cols, rows, GDT_Float64,
+                           0, 0) == CE_None;
+      if ( valid )
+        gistk_stats_add(&strip[b], buffer,
+                        (size_t) job->num_cols * rows, has != 0, nodata);
+    }
+    if ( ! valid ) {
+      CPLFree(strip);
+      gistk_pool_fail(&job->pool);
+      break;
+    }
+    stats_done(job, s, strip);
+  }
+
+  CPLFree(buffer);
+  GDALClose(data);
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  int num_threads = gistk_pool_threads(NULL);
+  bool write = true;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+j:n")) != -1 ) {
+    switch ( opt ) {
+    case 'j':
+      num_threads = gistk_pool_threads(optarg);
+      break;
+    case 'n':
+      write = false;
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+
+  // Drop the options, the files follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 2 )
+    gistk_error_fatal(1, "Missing parameter at least 1\n" USAGE, prog, prog);
+
+  // Register the drivers
+  gistk_init(true,false);
+
+  for (int f=1; f < argc; f++) {
+
+    // Metadata goes through this handle, read only files keep it in
+    // the .aux.xml
+    gistk_raster_t raster;
+    gistk_open_raster(argv[f], true, &raster);
+
+    stats_job_t job;
+    job.filename = argv[f];
+    job.num_cols = raster.num_cols;
+    job.num_rows = raster.num_rows;
+    job.num_bands = raster.num_bands;
+
+    // Strips of whole block rows
+    int block_w, block_h;
+    GDALGetBlockSize(GDALGetRasterBand(raster.data, 1), &block_w, &block_h);
+    job.strip_rows = block_h;
+    while ( job.strip_rows < STATS_MIN_ROWS ) job.strip_rows += block_h;
+    job.num_strips = (job.num_rows + job.strip_rows - 1) / job.strip_rows;
+
+    job.merged = 0;
+    job.done = CPLCalloc(job.num_strips, sizeof(gistk_stats_t *));
+    job.stats = CPLMalloc(sizeof(gistk_stats_t) * job.num_bands);
+    for (int b=0; b < job.num_bands; b++) gistk_stats_init(&job.stats[b]);
+    gistk_pool_init(&job.pool);
+
+    int num_workers = num_threads < job.num_strips ?
+                      num_threads : job.num_strips;
+    if ( ! gistk_pool_run(&job.pool, job.num_strips, num_threads,
+                          stats_run, &job) )
+      gistk_error_fatal(GISTK_ERRC_STATS_THREAD, GISTK_ERRS_STATS_THREAD);
+    if ( job.pool.failed )
+      gistk_error_fatal(GISTK_ERRC_STATS_READ, GISTK_ERRS_STATS_READ, argv[f]);
+
+    printf("# FILE:          %s\n", argv[f]);
+    printf("# THREADS:       %d\n", num_workers);
+    printf("# BAND MIN MAX MEAN STD COUNT P02 P50 P98\n");
+    for (int b=0; b < job.num_bands; b++) {
+      const gistk_stats_t * stats = &job.stats[b];
+      double std = stats->count > 0 ? sqrt(stats->m2 / stats->count) : NAN;
+      printf("%d %.10g %.10g %.10g %.10g %llu %.10g %.10g %.10g\n",
+             b+1, stats->min, stats->max, stats->mean, std,
+             (unsigned long long) stats->count,
+             gistk_stats_percentile(stats, 2),
+             gistk_stats_percentile(stats, 50),
+             gistk_stats_percentile(stats, 98));
+      if ( write )
+        gistk_stats_write(GDALGetRasterBand(raster.data, b+1), stats);
+    }
+
+    gistk_pool_free(&job.pool);
+    CPLFree(job.done);
+    CPLFree(job.stats);
+    gistk_close_raster(&raster);
+  }
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
@@ -0,0 +1,374 @@
+// =====================================================================
+// Profiles of a geotiff band along polylines
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// gtif-transect.c is free software: you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or any later version.
+//
+// gtif-transect.c is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with gtif-transect.c. If not, see <http://www.gnu.org/licenses/>.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include "ifgdv/error.h"
+#include "ifgdv/alg.h"
+#include "ifgdv/util.h"
+#include "ifgdv/tile.h"
+
+#define USAGE \
+  "Usage: %s [OPTIONS] IN ROUTES!\n" \
+  "ROUTES is a text file or - for stdin with one vertex ID X Y per\n" \
+  "line, consecutive lines with the same ID form a route.\n" \
+  "Options:\n" \
+  "  -b BAND      band to sample (default 1)\n" \
+  "  -s STEP      sample every STEP world units along the route,\n" \
+  "               default is one sample per crossed pixel\n" \
+  "  -i INTERP    nearest or bilinear (default nearest)\n" \
+  "  -B MB        tile cache size in megabytes (default 64)\n" \
+  "  -P N         segments the prefetch looks ahead (default 4)\n" \
+  "Prints ID DIST X Y VALUE per sample, NA outside or for nodata.\n" \
+  "Example: %s -s 10 -i bilinear dem.v2.3d.tif routes.txt\n"
+
+// Line length of the route file
+#define TRANSECT_LINE 1024
+
+// -------------------------------------------------------------------
+// State of the route walk
+typedef struct {
+  gistk_raster_t * raster;
+  gistk_tile_cache_t * cache;
+  int band;
+  bool bilinear;
+  bool has_nodata;
+  double nodata;
+  double inv[6];
+  int id;
+  double x0;        // segment start and end [world]
+  double y0;
+  double x1;
+  double y1;
+  double dist0;     // route distance at the segment start
+  double seg_len;
+  long * keys;      // blocks hinted for a segment
+  size_t num_keys;
+  size_t mem_keys;
+} transect_t;
+
+// Visitor of a cell crossed between the parameters t0 and t1
+typedef void (*transect_visit_f)(transect_t * tr, long cx, long cy,
+                                 double t0, double t1);
+
+// -------------------------------------------------------------------
+// Cells of size cw x ch crossed by the line (x0,y0)-(x1,y1) in the
+// order of the line, Amanatides and Woo
+static void transect_dda(transect_t * tr,
+                         double x0, double y0, double x1, double y1,
+                         double cw, double ch, transect_visit_f visit) {
+  double dx = x1 - x0;
+  double dy = y1 - y0;
+  long cx = (long) floor(x0 / cw);
+  long cy = (long) floor(y0 / ch);
+  long ex = (long) floor(x1 / cw);
+  long ey = (long) floor(y1 / ch);
+  int sx = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+  int sy = dy > 0 ? 1 : dy < 0 ? -1 : 0;
+  double tdx = sx != 0 ? cw / fabs(dx) : INFINITY;
+  double tdy = sy != 0 ? ch / fabs(dy) : INFINITY;
+  double tx = sx > 0 ? ((cx + 1) * cw - x0) / dx :
+              sx < 0 ? (cx * cw - x0) / dx : INFINITY;
+  double ty = sy > 0 ? ((cy + 1) * ch - y0) / dy :
+              sy < 0 ? (cy * ch - y0) / dy : INFINITY;
+
+  long steps = labs(ex - cx) + labs(ey - cy);
+  double t = 0.0;
+  for (long s=0; s <= steps; s++) {
+    double tn = tx < ty ? tx : ty;
+    if ( tn > 1.0 || s == steps ) tn = 1.0;
+    visit(tr, cx, cy, t, tn);
+    if ( tn >= 1.0 ) break;
+    if ( tx < ty ) { cx += sx; t = tx; tx += tdx; }
+    else           { cy += sy; t = ty; ty += tdy; }
+  }
+}
+
+// -------------------------------------------------------------------
+// Collects the key of a crossed block
+static void transect_block(transect_t * tr, long bx, long by,
+                           double t0, double t1) {
+  const gistk_tile_cache_t * cache = tr->cache;
+  if ( bx < 0 || by < 0 || bx >= cache->blocks_x || by >= cache->blocks_y )
+    return;
+  if ( tr->num_keys == tr->mem_keys ) {
+    tr->mem_keys = tr->mem_keys * 2 + 64;
+    tr->keys = CPLRealloc(tr->keys, sizeof(long) * tr->mem_keys);
+  }
+  tr->keys[tr->num_keys++] = gistk_tile_cache_key(cache, tr->band, bx, by);
+}
+
+// -------------------------------------------------------------------
+// Hints the blocks a segment crosses to the prefetch thread
+static void transect_hint(transect_t * tr, double x0, double y0,
+                          double x1, double y1) {
+  const double * inv = tr->inv;
+  tr->num_keys = 0;
+  transect_dda(tr,
+               inv[0] + inv[1] * x0 + inv[2] * y0,
+               inv[3] + inv[4] * x0 + inv[5] * y0,
+               inv[0] + inv[1] * x1 + inv[2] * y1,
+               inv[3] + inv[4] * x1 + inv[5] * y1,
+               tr->cache->block_w, tr->cache->block_h, transect_block);
+  gistk_tile_cache_prefetch(tr->cache, tr->keys, tr->num_keys);
+}
+
+// -------------------------------------------------------------------
+// Valid pixel value test
+static bool transect_valid(const transect_t * tr, double v) {
+  return v == v && ! ( tr->has_nodata && v == tr->nodata );
+}
+
+// -------------------------------------------------------------------
+// Value at a pixel position, false outside or without valid pixels
+static bool transect_value(transect_t * tr, double px, double py,
+                           double * value) {
+  const gistk_raster_t * raster = tr->raster;
+  if ( ! ( px >= 0 && py >= 0 &&
+           px < raster->num_cols && py < raster->num_rows ) )
+    return false;
+
+  if ( ! tr->bilinear ) {
+    gistk_raster_read(raster, tr->band, (int) px, (int) py, 1, 1,
+                      value, GDT_Float64, 0);
+    return transect_valid(tr, *value);
+  }
+
+  // Neighbours around the pixel centers, replicated at the border
+  double u = px - 0.5;
+  double v = py - 0.5;
+  long i = (long) floor(u);
+  long j = (long) floor(v);
+  double fx = u - i;
+  double fy = v - j;
+  long xa = i < 0 ? 0 : i;
+  long xb = i + 1 > raster->num_cols - 1 ? raster->num_cols - 1 : i + 1;
+  long ya = j < 0 ? 0 : j;
+  long yb = j + 1 > raster->num_rows - 1 ? raster->num_rows - 1 : j + 1;
+  int w = (int) (xb - xa + 1);
+  int h = (int) (yb - ya + 1);
+  double buf[4];
+  gistk_raster_read(raster, tr->band, (int) xa, (int) ya, w, h,
+                    buf, GDT_Float64, 0);
+  double q[4] = { buf[0], buf[w-1], buf[(h-1)*w], buf[(h-1)*w + w-1] };
+  double wt[4] = { (1-fx)*(1-fy), fx*(1-fy), (1-fx)*fy, fx*fy };
+
+  // Nodata neighbours drop out, the weights are renormalized
+  double sum = 0.0; double wsum = 0.0;
+  for (int k=0; k < 4; k++) {
+    if ( ! transect_valid(tr, q[k]) ) continue;
+    sum += wt[k] * q[k];
+    wsum += wt[k];
+  }
+  if ( wsum <= 0.0 ) return false;
+  *value = sum / wsum;
+  return true;
+}
+
+// -------------------------------------------------------------------
+// Prints the sample at the segment parameter t
+static void transect_sample(transect_t * tr, double t) {
+  double x = tr->x0 + t * (tr->x1 - tr->x0);
+  double y = tr->y0 + t * (tr->y1 - tr->y0);
+  const double * inv = tr->inv;
+  double px = inv[0] + inv[1] * x + inv[2] * y;
+  double py = inv[3] + inv[4] * x + inv[5] * y;
+  double value;
+  if ( transect_value(tr, px, py, &value) )
+    printf("%d %.3f %.3f %.3f %.10g\n", tr->id,
+           tr->dist0 + t * tr->seg_len, x, y, value);
+  else
+    printf("%d %.3f %.3f %.3f NA\n", tr->id,
+           tr->dist0 + t * tr->seg_len, x, y);
+}
+
+// -------------------------------------------------------------------
+// Samples a crossed pixel in the middle of its part of the segment
+static void transect_pixel(transect_t * tr, long cx, long cy,
+                           double t0, double t1) {
+  transect_sample(tr, 0.5 * (t0 + t1));
+}
+
+// -------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  // Program name for the usage message
+  char *prog = argv[0];
+
+  int band = 1;
+  double step = 0.0;
+  bool bilinear = false;
+  int cache_mb = 64;
+  int lookahead = 4;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "+b:s:i:B:P:")) != -1 ) {
+    switch ( opt ) {
+    case 'b':
+      if (! sscanf(optarg,"%d",&band) || band < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "BAND", optarg);
+      break;
+    case 's':
+      if (! sscanf(optarg,"%lf",&step) || step < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "STEP", optarg);
+      break;
+    case 'i':
+      if ( strcmp(optarg, "nearest") == 0 )
+        bilinear = false;
+      else if ( strcmp(optarg, "bilinear") == 0 )
+        bilinear = true;
+      else
+        gistk_error_fatal(1, "Invalid interpolation %s!\n", optarg);
+      break;
+    case 'B':
+      if (! sscanf(optarg,"%d",&cache_mb) || cache_mb < 1 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "MB", optarg);
+      break;
+    case 'P':
+      if (! sscanf(optarg,"%d",&lookahead) || lookahead < 0 )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "N", optarg);
+      break;
+    default:
+      gistk_error_fatal(1, USAGE, prog, prog);
+    }
+  }
+
+  // Drop the options, the positional parameter follow
+  argv += optind - 1;
+  argc -= optind - 1;
+  if ( argc < 3 )
+    gistk_error_fatal(1, "Missing parameter at least 2\n" USAGE, prog, prog);
+  char *ifile = argv[1];
+  char *rfile = argv[2];
+
+  // Read the route vertices
+  FILE * routes = strcmp(rfile, "-") == 0 ? stdin : fopen(rfile, "r");
+  if ( routes == NULL )
+    gistk_error_fatal(2, "Cannot open the routes %s!\n", rfile);
+  int_vector_t id;
+  int_vector_init(&id, 1024);
+  dbl_vector_t pos_x;
+  dbl_vector_init(&pos_x, 1024);
+  dbl_vector_t pos_y;
+  dbl_vector_init(&pos_y, 1024);
+  char line[TRANSECT_LINE];
+  long num_line = 0;
+  while ( fgets(line, sizeof(line), routes) != NULL ) {
+    num_line++;
+    int pk; double x, y;
+    if ( line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0' ) continue;
+    if ( sscanf(line, "%d %lf %lf", &pk, &x, &y) != 3 )
+      gistk_error_fatal(2, "Invalid vertex in line %ld of %s!\n",
+                        num_line, rfile);
+    int_vector_add(&id, pk);
+    dbl_vector_add(&pos_x, x);
+    dbl_vector_add(&pos_y, y);
+  }
+  if ( routes != stdin ) fclose(routes);
+
+  // Register the drivers
+  gistk_init(true,false);
+
+  gistk_raster_t src_raster;
+  gistk_open_raster(ifile, true, &src_raster);
+  if ( band > src_raster.num_bands )
+    gistk_error_fatal(1, "Band %d is not available in %s!\n", band, ifile);
+
+  // Only the blocks along the routes are decoded, the cache keeps
+  // them for consecutive segments
+  gistk_tile_cache_t cache;
+  gistk_tile_cache_open(ifile, &src_raster, (size_t) cache_mb << 20,
+                        lookahead > 0, &cache);
+
+  transect_t tr;
+  memset(&tr, 0, sizeof(tr));
+  tr.raster = &src_raster;
+  tr.cache = &cache;
+  tr.band = band;
+  tr.bilinear = bilinear;
+  int has = 0;
+  tr.nodata = GDALGetRasterNoDataValue(
+                GDALGetRasterBand(src_raster.data, band), &has);
+  tr.has_nodata = has != 0;
+  if ( ! GDALInvGeoTransform(src_raster.trfm, tr.inv) )
+    gistk_error_fatal(GISTK_ERRC_OPEN_RST_TRFM, GISTK_ERRS_OPEN_RST_TRFM,
+                      ifile);
+
+  printf("# IN FILE:       %s\n", ifile);
+  printf("# ROUTES:        %s\n", rfile);
+  printf("# NUM VERTICES:  %zu\n", id.length);
+  printf("# ID DIST X Y VALUE\n");
+
+  // Walk the segments, the blocks of the next ones are hinted ahead
+  size_t num = id.length;
+  size_t hinted = 0;
+  double next = 0.0;
+  for (size_t v=0; v + 1 < num; v++) {
+
+    for ( ; lookahead > 0 && hinted + 1 < num &&
+            hinted <= v + lookahead; hinted++)
+      if ( id.data[hinted] == id.data[hinted+1] )
+        transect_hint(&tr, pos_x.data[hinted], pos_y.data[hinted],
+                      pos_x.data[hinted+1], pos_y.data[hinted+1]);
+
+    // A new route starts
+    if ( v == 0 || id.data[v] != id.data[v-1] ) {
+      tr.dist0 = 0.0;
+      next = 0.0;
+    }
+    if ( id.data[v] != id.data[v+1] ) continue;
+
+    tr.id = id.data[v];
+    tr.x0 = pos_x.data[v];   tr.y0 = pos_y.data[v];
+    tr.x1 = pos_x.data[v+1]; tr.y1 = pos_y.data[v+1];
+    tr.seg_len = hypot(tr.x1 - tr.x0, tr.y1 - tr.y0);
+    if ( tr.seg_len <= 0.0 ) continue;
+
+    if ( step > 0.0 ) {
+      // Fixed distance, the remainder carries into the next segment
+      for ( ; next <= tr.dist0 + tr.seg_len; next += step)
+        transect_sample(&tr, (next - tr.dist0) / tr.seg_len);
+    } else {
+      const double * inv = tr.inv;
+      transect_dda(&tr,
+                   inv[0] + inv[1] * tr.x0 + inv[2] * tr.y0,
+                   inv[3] + inv[4] * tr.x0 + inv[5] * tr.y0,
+                   inv[0] + inv[1] * tr.x1 + inv[2] * tr.y1,
+                   inv[3] + inv[4] * tr.x1 + inv[5] * tr.y1,
+                   1.0, 1.0, transect_pixel);
+    }
+    tr.dist0 += tr.seg_len;
+  }
+
+  printf("# CACHE HITS:    %lu\n", cache.hits);
+  printf("# CACHE MISSES:  %lu\n", cache.misses);
+  printf("# PREFETCHES:    %lu\n", cache.prefetches);
+
+  CPLFree(tr.keys);
+  gistk_tile_cache_close(&src_raster, &cache);
+  gistk_close_raster(&src_raster);
+  int_vector_free(&id);
+  dbl_vector_free(&pos_x);
+  dbl_vector_free(&pos_y);
+
+  return 0;
+}
+
+// --- EOF -----------------------------------------------------------
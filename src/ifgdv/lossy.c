@@ -0,0 +1,146 @@
+// =====================================================================
+// Error bounded storage of rasters
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// LERC bounds the error inside the codec. The quantization rounds
+// to a power of two step in front of the float predictor, so the
+// bound holds exactly for every value a float can carry. Both are
+// checked by reading the written file back, see util.c.
+// =====================================================================
+
+#include "ifgdv/error.h"
+#include "ifgdv/lossy.h"
+
+// Codec names in the order of gistk_lossy_t
+static const char * gistk_lossy_names[] = { "none", "lerc", "quant" };
+
+// ---------------------------------------------------------------
+bool gistk_lossy_parse(const char * text, gistk_lossy_t * mode,
+                       double * max_error) {
+    const char * colon = strchr(text, ':');
+    const char * value = text;
+    *mode = GISTK_LOSSY_LERC;
+    if ( colon != NULL ) {
+      size_t len = colon - text;
+      if ( len == 4 && strncmp(text, "lerc", 4) == 0 )
+        *mode = GISTK_LOSSY_LERC;
+      else if ( len == 5 && strncmp(text, "quant", 5) == 0 )
+        *mode = GISTK_LOSSY_QUANT;
+      else
+        return false;
+      value = colon + 1;
+    }
+    char * end = NULL;
+    *max_error = strtod(value, &end);
+    return end != value && *end == '\0' &&
+           isfinite(*max_error) && *max_error > 0.0;
+}
+
+// ---------------------------------------------------------------
+const char * gistk_lossy_name(gistk_lossy_t mode) {
+    return gistk_lossy_names[mode];
+}
+
+// ---------------------------------------------------------------
+double gistk_lossy_step(double max_error) {
+    // 2 e = frac 2^exp2 with frac in [0.5, 1)
+    int exp2 = 0;
+    frexp(2.0 * max_error, &exp2);
+    return ldexp(1.0, exp2 - 1);
+}
+
+// ---------------------------------------------------------------
+// Tests if the creation options of a driver offer a compression
+static bool gistk_lossy_has_codec(GDALDriverH driver, const char * codec) {
+    const char * list = GDALGetMetadataItem(driver,
+                                            GDAL_DMD_CREATIONOPTIONLIST,
+                                            NULL);
+    char value[64];
+    snprintf(value, sizeof(value), "<Value>%s</Value>", codec);
+    return list != NULL && strstr(list, value) != NULL;
+}
+
+// ---------------------------------------------------------------
+char ** gistk_lossy_options(GDALDriverH driver, gistk_lossy_t mode,
+                            double max_error, GDALDataType type,
+                            char ** options) {
+    if ( mode == GISTK_LOSSY_NONE ) return options;
+
+    const char * format = GDALGetDriverShortName(driver);
+    const char * codec = mode == GISTK_LOSSY_LERC ? "LERC_ZSTD" : "ZSTD";
+    if ( ! EQUAL(format, "GTiff") || ! gistk_lossy_has_codec(driver, codec) ) {
+      CSLDestroy(options);
+      gistk_error_fatal(GISTK_ERRC_LOSSY_CODEC, GISTK_ERRS_LOSSY_CODEC,
+                        format, GDALGetDataTypeName(type), codec);
+    }
+
+    // Tiles keep the codec blocks square and compact
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "COMPRESS", codec);
+    if ( mode == GISTK_LOSSY_LERC ) {
+      char value[32];
+      snprintf(value, sizeof(value), "%.17g", max_error);
+      options = CSLSetNameValue(options, "MAX_Z_ERROR", value);
+    } else {
+      // Integer bands are stored losslessly
+      bool is_float = type == GDT_Float32 || type == GDT_Float64;
+      options = CSLSetNameValue(options, "PREDICTOR", is_float ? "3" : "2");
+    }
+    return options;
+}
+
+// ---------------------------------------------------------------
+void gistk_lossy_quantize(double * values, size_t n,
+                          bool has_nodata, double nodata, double step) {
+    for (size_t i=0; i < n; i++) {
+      double v = values[i];
+      if ( v != v || ( has_nodata && v == nodata ) ) continue;
+      values[i] = round(v / step) * step;
+    }
+}
+
+// ---------------------------------------------------------------
+long gistk_lossy_check(GDALRasterBandH band, int row,
+                       int width, int height,
+                       const void * ref, GDALDataType ref_type,
+                       bool has_nodata, double nodata,
+                       double max_error, double * worst) {
+    int ref_size = GDALGetDataTypeSize(ref_type) / 8;
+
+    double * want = CPLMalloc(sizeof(double) * width);
+    double * got = CPLMalloc(sizeof(double) * width);
+    long num_bad = 0;
+    double max_diff = 0.0;
+    for (int r=0; r < height && num_bad >= 0; r++) {
+      if ( GDALRasterIO(band, GF_Read, 0, row + r, width, 1, got,
+                        width, 1, GDT_Float64, 0, 0) != CE_None ) {
+        num_bad = -1;
+        break;
+      }
+      GDALCopyWords((const GByte *) ref + (size_t) r * width * ref_size,
+                    ref_type, ref_size, want, GDT_Float64, sizeof(double),
+                    width);
+      for (int c=0; c < width; c++) {
+        double diff;
+        if ( want[c] != want[c] )
+          diff = got[c] != got[c] ? 0.0 : INFINITY;
+        else if ( has_nodata && want[c] == nodata )
+          diff = got[c] == nodata ? 0.0 : INFINITY;
+        else if ( got[c] != got[c] || ( has_nodata && got[c] == nodata ) )
+          diff = INFINITY;
+        else
+          diff = fabs(got[c] - want[c]);
+        if ( diff > max_diff ) max_diff = diff;
+        if ( diff > max_error ) num_bad++;
+      }
+    }
+    CPLFree(want);
+    CPLFree(got);
+    if ( worst != NULL && max_diff > *worst ) *worst = max_diff;
+    return num_bad;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -0,0 +1,242 @@
+// =====================================================================
+// Bounded read/transform/write pipeline and worker pools
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <cpl_conv.h>
+#include "ifgdv/error.h"
+#include "ifgdv/pipe.h"
+
+// Spins before a waiting stage starts to sleep
+#define GISTK_PIPE_SPINS 64
+
+// Marks the end of the input in the rings
+static char gistk_pipe_end;
+
+// ----------------------------------------------------------------
+// Back off while a ring is full or empty
+static void gistk_ring_wait(int * spins) {
+    if ( (*spins)++ < GISTK_PIPE_SPINS ) {
+        sched_yield();
+    } else {
+        struct timespec pause = { 0, 50000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+// ----------------------------------------------------------------
+void gistk_ring_init(gistk_ring_t * ring, size_t capacity) {
+    ring->slots = malloc(sizeof(void *) * capacity);
+    if ( ring->slots == NULL )
+        gistk_error_fatal(GISTK_ERRC_PIPE_MEM, GISTK_ERRS_PIPE_MEM, capacity);
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+// ----------------------------------------------------------------
+void gistk_ring_push(gistk_ring_t * ring, void * item) {
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    int spins = 0;
+    while ( tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+            >= ring->capacity )
+        gistk_ring_wait(&spins);
+    ring->slots[tail % ring->capacity] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// ----------------------------------------------------------------
+void * gistk_ring_pop(gistk_ring_t * ring) {
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    int spins = 0;
+    while ( head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) )
+        gistk_ring_wait(&spins);
+    void * item = ring->slots[head % ring->capacity];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// ----------------------------------------------------------------
+void gistk_ring_free(gistk_ring_t * ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+    ring->capacity = 0;
+}
+
+// ----------------------------------------------------------------
+// State shared by the stage threads
+typedef struct {
+    void * ctx;
+    gistk_pipe_work_f transform;
+    gistk_pipe_work_f write;
+    gistk_ring_t free_items;   // writer -> reader
+    gistk_ring_t read_items;   // reader -> transform
+    gistk_ring_t done_items;   // transform -> writer
+} gistk_pipe_t;
+
+// ----------------------------------------------------------------
+static void * gistk_pipe_transform(void * arg) {
+    gistk_pipe_t * pipe = arg;
+    for (;;) {
+        void * item = gistk_ring_pop(&pipe->read_items);
+        if ( item != &gistk_pipe_end )
+            pipe->transform(pipe->ctx, item);
+        gistk_ring_push(&pipe->done_items, item);
+        if ( item == &gistk_pipe_end ) return NULL;
+    }
+}
+
+// ----------------------------------------------------------------
+static void * gistk_pipe_write(void * arg) {
+    gistk_pipe_t * pipe = arg;
+    for (;;) {
+        void * item = gistk_ring_pop(&pipe->done_items);
+        if ( item == &gistk_pipe_end ) return NULL;
+        pipe->write(pipe->ctx, item);
+        gistk_ring_push(&pipe->free_items, item);
+    }
+}
+
+// ----------------------------------------------------------------
+void gistk_pipe_run(void * ctx, void ** items, int depth,
+                    gistk_pipe_read_f read,
+                    gistk_pipe_work_f transform,
+                    gistk_pipe_work_f write) {
+
+    // Serial mode
+    if ( depth < 1 ) {
+        while ( read(ctx, items[0]) ) {
+            transform(ctx, items[0]);
+            write(ctx, items[0]);
+        }
+        return;
+    }
+
+    gistk_pipe_t pipe;
+    pipe.ctx = ctx;
+    pipe.transform = transform;
+    pipe.write = write;
+    gistk_ring_init(&pipe.free_items, depth);
+    gistk_ring_init(&pipe.read_items, depth + 1);
+    gistk_ring_init(&pipe.done_items, depth + 1);
+    for (int i=0; i < depth; i++)
+        gistk_ring_push(&pipe.free_items, items[i]);
+
+    pthread_t transformer, writer;
+    if ( pthread_create(&transformer, NULL, gistk_pipe_transform, &pipe) != 0 ||
+         pthread_create(&writer, NULL, gistk_pipe_write, &pipe) != 0 )
+        gistk_error_fatal(GISTK_ERRC_PIPE_THREAD, GISTK_ERRS_PIPE_THREAD, 0);
+
+    // Reader stage in the calling thread
+    for (;;) {
+        void * item = gistk_ring_pop(&pipe.free_items);
+        if ( ! read(ctx, item) ) break;
+        gistk_ring_push(&pipe.read_items, item);
+    }
+    gistk_ring_push(&pipe.read_items, &gistk_pipe_end);
+
+    pthread_join(transformer, NULL);
+    pthread_join(writer, NULL);
+
+    gistk_ring_free(&pipe.free_items);
+    gistk_ring_free(&pipe.read_items);
+    gistk_ring_free(&pipe.done_items);
+}
+
+// ----------------------------------------------------------------
+int gistk_pool_threads(const char * arg) {
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( arg != NULL &&
+         ( ! sscanf(arg, "%ld", &num_threads) || num_threads < 1 ) )
+        gistk_error_fatal(1, GISTK_ERRS_INVALID_NUMERIC, "THREADS", arg);
+    return num_threads < 1 ? 1 : (int) num_threads;
+}
+
+// ----------------------------------------------------------------
+void gistk_pool_init(gistk_pool_t * pool) {
+    memset(pool, 0, sizeof(gistk_pool_t));
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+// ----------------------------------------------------------------
+static void * gistk_pool_thread(void * arg) {
+    gistk_pool_t * pool = arg;
+    pool->work(pool->ctx);
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+bool gistk_pool_start(gistk_pool_t * pool, int num_items, int num_threads,
+                      gistk_pool_work_f work, void * ctx) {
+    pool->num_items = num_items;
+    pool->next = 0;
+    pool->failed = 0;
+    pool->work = work;
+    pool->ctx = ctx;
+    if ( num_threads > num_items ) num_threads = num_items;
+    pool->threads = CPLMalloc(sizeof(pthread_t) * (num_threads + 1));
+    pool->num_threads = 0;
+    for (int t=0; t < num_threads; t++) {
+        if ( pthread_create(&pool->threads[t], NULL,
+                            gistk_pool_thread, pool) != 0 ) {
+            gistk_pool_fail(pool);
+            gistk_pool_join(pool);
+            return false;
+        }
+        pool->num_threads++;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------
+void gistk_pool_join(gistk_pool_t * pool) {
+    for (int t=0; t < pool->num_threads; t++)
+        pthread_join(pool->threads[t], NULL);
+    CPLFree(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+}
+
+// ----------------------------------------------------------------
+bool gistk_pool_run(gistk_pool_t * pool, int num_items, int num_threads,
+                    gistk_pool_work_f work, void * ctx) {
+    if ( ! gistk_pool_start(pool, num_items, num_threads, work, ctx) )
+        return false;
+    gistk_pool_join(pool);
+    return true;
+}
+
+// ----------------------------------------------------------------
+int gistk_pool_next(gistk_pool_t * pool) {
+    if ( __atomic_load_n(&pool->failed, __ATOMIC_RELAXED) ) return -1;
+    int item = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    return item < pool->num_items ? item : -1;
+}
+
+// ----------------------------------------------------------------
+void gistk_pool_fail(gistk_pool_t * pool) {
+    __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+}
+
+// ----------------------------------------------------------------
+GDALDatasetH gistk_pool_open(gistk_pool_t * pool, const char * filename) {
+    GDALDatasetH data = GDALOpen(filename, GA_ReadOnly);
+    if ( data == NULL ) gistk_pool_fail(pool);
+    return data;
+}
+
+// ----------------------------------------------------------------
+void gistk_pool_free(gistk_pool_t * pool) {
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -0,0 +1,173 @@
+// =====================================================================
+// Reduction of pixel windows to coarser scales
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// Both filters keep separate sums of the weighted values and of the
+// weights of the valid pixels. The inner loops run along the rows
+// without branches and are vectorized by the compiler.
+// =====================================================================
+
+#include "ifgdv/error.h"
+#include "ifgdv/scale.h"
+
+// ---------------------------------------------------------------
+int gistk_scale_parse(const char *list, int *scales) {
+    int num = 0;
+    const char *pos = list;
+    while ( *pos != '\0' ) {
+        char *end = NULL;
+        long factor = strtol(pos, &end, 10);
+        if ( end == pos || factor < 1 || factor > 1024 ||
+             num == GISTK_SCALE_MAX ) return 0;
+        scales[num++] = (int) factor;
+        if ( *end == ',' ) end++;
+        else if ( *end != '\0' ) return 0;
+        pos = end;
+    }
+    return num;
+}
+
+// ---------------------------------------------------------------
+bool gistk_scale_is_pow2(int factor) {
+    return factor > 0 && (factor & (factor - 1)) == 0;
+}
+
+// ---------------------------------------------------------------
+// Weight of a pixel, 0 for nodata and NaN
+static void gistk_scale_weights(const double * restrict in, size_t n,
+                                bool has_nodata, double nodata,
+                                double * restrict val,
+                                double * restrict wgt) {
+    for (size_t i=0; i < n; i++) {
+        double v = in[i];
+        bool bad = v != v || ( has_nodata && v == nodata );
+        wgt[i] = bad ? 0.0 : 1.0;
+        val[i] = bad ? 0.0 : v;
+    }
+}
+
+// ---------------------------------------------------------------
+void gistk_scale_box(const double *in, size_t stride,
+                     int out_w, int out_h, int factor,
+                     bool has_nodata, double nodata, double *out) {
+
+    int in_w = out_w * factor;
+    double *val = malloc(sizeof(double) * in_w);
+    double *wgt = malloc(sizeof(double) * in_w);
+    double *sum = malloc(sizeof(double) * out_w);
+    double *cnt = malloc(sizeof(double) * out_w);
+    if ( val == NULL || wgt == NULL || sum == NULL || cnt == NULL )
+        gistk_error_fatal(GISTK_ERRC_SCALE_MEM, GISTK_ERRS_SCALE_MEM, 0);
+
+    for (int y=0; y < out_h; y++) {
+        for (int x=0; x < out_w; x++) { sum[x] = 0.0; cnt[x] = 0.0; }
+
+        for (int r=0; r < factor; r++) {
+            const double *line = in + (size_t) (y * factor + r) * stride;
+            gistk_scale_weights(line, in_w, has_nodata, nodata, val, wgt);
+            for (int k=0; k < factor; k++)
+                for (int x=0; x < out_w; x++) {
+                    sum[x] += val[x * factor + k];
+                    cnt[x] += wgt[x * factor + k];
+                }
+        }
+
+        double *o = out + (size_t) y * out_w;
+        for (int x=0; x < out_w; x++)
+            o[x] = cnt[x] > 0.0 ? sum[x] / cnt[x] : nodata;
+    }
+
+    free(val); free(wgt); free(sum); free(cnt);
+}
+
+// ---------------------------------------------------------------
+// One pyramid level: (2w x 2h) values and weights to (w x h)
+static void gistk_scale_halve(const double *val, const double *wgt,
+                              size_t stride, int out_w, int out_h,
+                              double *oval, double *owgt,
+                              double *tval, double *twgt) {
+
+    static const double k[5] = { 1.0/16, 4.0/16, 6.0/16, 4.0/16, 1.0/16 };
+    int in_w = out_w * 2;
+    int in_h = out_h * 2;
+
+    // Horizontal pass into (w x 2h), the border is repeated
+    for (int r=0; r < in_h; r++) {
+        const double *v = val + (size_t) r * stride;
+        const double *g = wgt + (size_t) r * stride;
+        double *tv = tval + (size_t) r * out_w;
+        double *tg = twgt + (size_t) r * out_w;
+        for (int x=0; x < out_w; x++) {
+            double sv = 0.0; double sg = 0.0;
+            for (int i=0; i < 5; i++) {
+                int c = 2 * x + i - 2;
+                c = c < 0 ? 0 : c;
+                c = c >= in_w ? in_w - 1 : c;
+                sv += k[i] * v[c];
+                sg += k[i] * g[c];
+            }
+            tv[x] = sv; tg[x] = sg;
+        }
+    }
+
+    // Vertical pass into (w x h)
+    for (int y=0; y < out_h; y++) {
+        double *ov = oval + (size_t) y * out_w;
+        double *og = owgt + (size_t) y * out_w;
+        for (int x=0; x < out_w; x++) { ov[x] = 0.0; og[x] = 0.0; }
+        for (int i=0; i < 5; i++) {
+            int r = 2 * y + i - 2;
+            r = r < 0 ? 0 : r;
+            r = r >= in_h ? in_h - 1 : r;
+            const double * restrict tv = tval + (size_t) r * out_w;
+            const double * restrict tg = twgt + (size_t) r * out_w;
+            for (int x=0; x < out_w; x++) {
+                ov[x] += k[i] * tv[x];
+                og[x] += k[i] * tg[x];
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------
+void gistk_scale_gauss(const double *in, size_t stride,
+                       int out_w, int out_h, int factor,
+                       bool has_nodata, double nodata, double *out) {
+
+    int w = out_w * factor;
+    int h = out_h * factor;
+    size_t n = (size_t) w * h;
+
+    // Level 0: weighted values and weights of the input
+    double *val  = malloc(sizeof(double) * n);
+    double *wgt  = malloc(sizeof(double) * n);
+    double *nval = malloc(sizeof(double) * n / 4 + 1);
+    double *nwgt = malloc(sizeof(double) * n / 4 + 1);
+    double *tval = malloc(sizeof(double) * n / 2 + 1);
+    double *twgt = malloc(sizeof(double) * n / 2 + 1);
+    if ( val == NULL || wgt == NULL || nval == NULL || nwgt == NULL ||
+         tval == NULL || twgt == NULL )
+        gistk_error_fatal(GISTK_ERRC_SCALE_MEM, GISTK_ERRS_SCALE_MEM, 0);
+
+    for (int r=0; r < h; r++)
+        gistk_scale_weights(in + (size_t) r * stride, w, has_nodata, nodata,
+                            val + (size_t) r * w, wgt + (size_t) r * w);
+
+    for (int f=factor; f > 1; f /= 2) {
+        gistk_scale_halve(val, wgt, w, w / 2, h / 2, nval, nwgt, tval, twgt);
+        w /= 2; h /= 2;
+        double *t;
+        t = val; val = nval; nval = t;
+        t = wgt; wgt = nwgt; nwgt = t;
+    }
+
+    for (size_t i=0; i < (size_t) out_w * out_h; i++)
+        out[i] = wgt[i] > 0.0 ? val[i] / wgt[i] : nodata;
+
+    free(val); free(wgt); free(nval); free(nwgt); free(tval); free(twgt);
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -0,0 +1,206 @@
+// =====================================================================
+// Mergeable band statistics and histograms
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+
+#include "ifgdv/stats.h"
+#include "ifgdv/conv.h"
+
+// ---------------------------------------------------------------
+void gistk_stats_init(gistk_stats_t *stats) {
+    memset(stats, 0, sizeof(gistk_stats_t));
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+}
+
+// ---------------------------------------------------------------
+// Doubles the histogram range. The origin is a multiple of half the
+// width, so a range can hold both signs, and the new origin is one
+// of the multiples of the old width that keep the old range: the
+// lower one to grow down, the upper one to grow up. The old range
+// starts 0, 64 or 128 new bins in, so pairs of bins merge exactly.
+static void gistk_stats_grow(gistk_stats_t *stats, bool down) {
+    double width = 2.0 * stats->width;
+    double lo = down ? ceil(stats->lo / stats->width - 1.0) * stats->width
+                     : floor(stats->lo / stats->width) * stats->width;
+    int shift = (int) ((stats->lo - lo) / stats->width * GISTK_STATS_BINS);
+    GUIntBig hist[GISTK_STATS_BINS];
+    memset(hist, 0, sizeof(hist));
+    for (int i=0; i < GISTK_STATS_BINS; i++)
+        hist[(shift + i) / 2] += stats->hist[i];
+    memcpy(stats->hist, hist, sizeof(hist));
+    stats->lo = lo;
+    stats->width = width;
+}
+
+// ---------------------------------------------------------------
+// Grows the histogram range until it holds [min, max]
+static void gistk_stats_cover(gistk_stats_t *stats, double min, double max) {
+    while ( min < stats->lo || max >= stats->lo + stats->width )
+        gistk_stats_grow(stats, min < stats->lo);
+}
+
+// ---------------------------------------------------------------
+// Smallest aligned range holding [min, max]
+static void gistk_stats_range(gistk_stats_t *stats, double min, double max) {
+    double span = max - min;
+    double mag = fabs(min) > fabs(max) ? fabs(min) : fabs(max);
+    if ( span <= mag * 1e-9 ) span = mag > 0.0 ? mag * 1e-9 : 1e-9;
+    stats->width = ldexp(1.0, (int) ceil(log2(span)));
+    stats->lo = floor(min / stats->width * 2.0) * stats->width / 2.0;
+    gistk_stats_cover(stats, min, max);
+}
+
+// ---------------------------------------------------------------
+void gistk_stats_add(gistk_stats_t *stats, const double *in, size_t n,
+                     bool has_nodata, double nodata) {
+
+    // Moments of the block, merged afterwards. Infinite values are
+    // left out like NaN, the histogram range could never hold them
+    double sum = 0.0; double min = INFINITY; double max = -INFINITY;
+    size_t cnt = 0;
+    for (size_t i=0; i < n; i++) {
+        double v = in[i];
+        if ( ! isfinite(v) || ( has_nodata && v == nodata ) ) continue;
+        sum += v; cnt++;
+        if ( v < min ) min = v;
+        if ( v > max ) max = v;
+    }
+    stats->total += n;
+    if ( cnt == 0 ) return;
+
+    double mean = sum / cnt;
+    double m2 = 0.0;
+    for (size_t i=0; i < n; i++) {
+        double v = in[i];
+        if ( ! isfinite(v) || ( has_nodata && v == nodata ) ) continue;
+        m2 += (v - mean) * (v - mean);
+    }
+
+    if ( stats->count == 0 )
+        gistk_stats_range(stats, min, max);
+    gistk_stats_cover(stats, min, max);
+
+    double scale = GISTK_STATS_BINS / stats->width;
+    for (size_t i=0; i < n; i++) {
+        double v = in[i];
+        if ( ! isfinite(v) || ( has_nodata && v == nodata ) ) continue;
+        int bin = (int) ((v - stats->lo) * scale);
+        if ( bin >= GISTK_STATS_BINS ) bin = GISTK_STATS_BINS - 1;
+        stats->hist[bin]++;
+    }
+
+    // Chan et al. update of the running moments
+    double delta = mean - stats->mean;
+    GUIntBig total = stats->count + cnt;
+    stats->mean += delta * cnt / total;
+    stats->m2 += m2 + delta * delta * ((double) stats->count * cnt / total);
+    stats->count = total;
+    if ( min < stats->min ) stats->min = min;
+    if ( max > stats->max ) stats->max = max;
+}
+
+// ---------------------------------------------------------------
+void gistk_stats_add_typed(gistk_stats_t *stats, const void *in,
+                           GDALDataType type, size_t n,
+                           bool has_nodata, double nodata) {
+    if ( type == GDT_Float64 ) {
+        gistk_stats_add(stats, in, n, has_nodata, nodata);
+        return;
+    }
+    double chunk[GISTK_CONV_CHUNK];
+    int size = GDALGetDataTypeSize(type) / 8;
+    for (size_t i=0; i < n; i += GISTK_CONV_CHUNK) {
+        int m = n - i < GISTK_CONV_CHUNK ? (int) (n - i) : GISTK_CONV_CHUNK;
+        GDALCopyWords((const GByte *) in + i * size, type, size,
+                      chunk, GDT_Float64, sizeof(double), m);
+        gistk_stats_add(stats, chunk, m, has_nodata, nodata);
+    }
+}
+
+// ---------------------------------------------------------------
+void gistk_stats_merge(gistk_stats_t *stats, const gistk_stats_t *other) {
+    stats->total += other->total;
+    if ( other->count == 0 ) return;
+    if ( stats->count == 0 ) {
+        GUIntBig total = stats->total;
+        *stats = *other;
+        stats->total = total;
+        return;
+    }
+
+    // Grow the target over the range and the width of the other
+    // histogram, then the other one into the target: any aligned
+    // range inside the target is reached by growing it towards it
+    gistk_stats_t copy = *other;
+    while ( copy.lo < stats->lo || stats->width < copy.width ||
+            copy.lo + copy.width > stats->lo + stats->width )
+        gistk_stats_grow(stats, copy.lo < stats->lo);
+    while ( copy.width < stats->width ) {
+        double up = floor(copy.lo / copy.width) * copy.width;
+        bool down = up + 2.0 * copy.width > stats->lo + stats->width;
+        gistk_stats_grow(&copy, down);
+    }
+    for (int i=0; i < GISTK_STATS_BINS; i++) stats->hist[i] += copy.hist[i];
+
+    double delta = other->mean - stats->mean;
+    GUIntBig total = stats->count + other->count;
+    stats->mean += delta * other->count / total;
+    stats->m2 += other->m2 + delta * delta *
+                 ((double) stats->count * other->count / total);
+    stats->count = total;
+    if ( other->min < stats->min ) stats->min = other->min;
+    if ( other->max > stats->max ) stats->max = other->max;
+}
+
+// ---------------------------------------------------------------
+double gistk_stats_percentile(const gistk_stats_t *stats, double p) {
+    if ( stats->count == 0 ) return NAN;
+    double rank = p / 100.0 * stats->count;
+    double bin_w = stats->width / GISTK_STATS_BINS;
+    double cum = 0.0;
+    for (int i=0; i < GISTK_STATS_BINS; i++) {
+        double next = cum + stats->hist[i];
+        if ( next >= rank && stats->hist[i] > 0 ) {
+            // linear inside the bin, clipped to the seen values
+            double v = stats->lo + bin_w * (i + (rank - cum) / stats->hist[i]);
+            return v < stats->min ? stats->min : v > stats->max ? stats->max : v;
+        }
+        cum = next;
+    }
+    return stats->max;
+}
+
+// ---------------------------------------------------------------
+void gistk_stats_write(GDALRasterBandH band, const gistk_stats_t *stats) {
+    if ( stats->count == 0 ) return;
+
+    double std = sqrt(stats->m2 / stats->count);
+    GDALSetRasterStatistics(band, stats->min, stats->max, stats->mean, std);
+
+    char value[64];
+    snprintf(value, sizeof(value), "%llu", (unsigned long long) stats->count);
+    GDALSetMetadataItem(band, "STATISTICS_VALID_COUNT", value, NULL);
+    snprintf(value, sizeof(value), "%.4f",
+             100.0 * stats->count / (stats->total > 0 ? stats->total : 1));
+    GDALSetMetadataItem(band, "STATISTICS_VALID_PERCENT", value, NULL);
+
+    static const double percentiles[] = GISTK_STATS_PERCENTILES;
+    for (size_t i=0; i < sizeof(percentiles) / sizeof(double); i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "STATISTICS_P%02d", (int) percentiles[i]);
+        snprintf(value, sizeof(value), "%.17g",
+                 gistk_stats_percentile(stats, percentiles[i]));
+        GDALSetMetadataItem(band, key, value, NULL);
+    }
+
+    GUIntBig hist[GISTK_STATS_BINS];
+    memcpy(hist, stats->hist, sizeof(hist));
+    GDALSetDefaultHistogramEx(band, stats->lo, stats->lo + stats->width,
+                              GISTK_STATS_BINS, hist);
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
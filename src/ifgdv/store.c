@@ -0,0 +1,439 @@
+// =====================================================================
+// Persistent content addressed store of cut results
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// Results are published with rename and served with link or a plain
+// copy, both are safe against concurrent runs without a lock: a
+// result evicted in between is a miss. Only the index needs the
+// fcntl lock, it is rewritten on close and replaced with rename.
+// Runs killed before their close leave results outside the index
+// and temporary files behind, the next open reconciles both.
+// =====================================================================
+
+#define _XOPEN_SOURCE 700
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ifgdv/error.h"
+#include "ifgdv/store.h"
+
+// Age after which a temporary file is stale in any case [s]
+#define GISTK_STORE_TMP_AGE 86400
+
+// FNV-1a 64 bit
+#define GISTK_STORE_FNV_BASIS 14695981039346656037ULL
+#define GISTK_STORE_FNV_PRIME 1099511628211ULL
+
+// ----------------------------------------------------------------
+static uint64_t gistk_store_fnv(uint64_t hash, const char * text) {
+    for (const unsigned char * c = (const unsigned char *) text; *c; c++) {
+        hash ^= *c;
+        hash *= GISTK_STORE_FNV_PRIME;
+    }
+    return hash;
+}
+
+// ----------------------------------------------------------------
+// Path of a stored result, DIR/xx/KEY, the extension is in the key
+static void gistk_store_path(const gistk_store_t * store, uint64_t key,
+                             char * path, size_t len) {
+    snprintf(path, len, "%s/%02x/%016llx", store->dir,
+             (unsigned) (key >> 56), (unsigned long long) key);
+}
+
+// ----------------------------------------------------------------
+// Copies a file with plain reads and writes, the target is created
+static bool gistk_store_copy(const char * from, const char * to) {
+    int in = open(from, O_RDONLY);
+    if ( in < 0 ) return false;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ( out < 0 ) {
+        close(in);
+        return false;
+    }
+    char buf[65536];
+    bool ok = true;
+    ssize_t num;
+    while ( ok && (num = read(in, buf, sizeof(buf))) != 0 ) {
+        if ( num < 0 ) {
+            ok = errno == EINTR;
+            continue;
+        }
+        for (ssize_t done = 0; ok && done < num; ) {
+            ssize_t put = write(out, buf + done, num - done);
+            if ( put < 0 ) ok = errno == EINTR;
+            else done += put;
+        }
+    }
+    close(in);
+    if ( close(out) != 0 ) ok = false;
+    if ( ! ok ) unlink(to);
+    return ok;
+}
+
+// ----------------------------------------------------------------
+// Notes the use of a result in the journal of the run
+static void gistk_store_note(gistk_store_t * store, uint64_t key,
+                             const char * path) {
+    struct stat info;
+    if ( stat(path, &info) != 0 ) return;
+    pthread_mutex_lock(&store->lock);
+    if ( store->num_journal == store->mem_journal ) {
+        store->mem_journal = store->mem_journal * 2 + 256;
+        store->journal = CPLRealloc(store->journal, store->mem_journal *
+                                    sizeof(gistk_store_entry_t));
+    }
+    gistk_store_entry_t * entry = &store->journal[store->num_journal++];
+    entry->key = key;
+    entry->size = (uint64_t) info.st_size;
+    entry->used = (int64_t) time(NULL);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// ----------------------------------------------------------------
+// Locks the index against other runs, returns the lock descriptor
+static int gistk_store_lock(const gistk_store_t * store) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/%s", store->dir, GISTK_STORE_LOCK);
+    int fd = open(name, O_RDWR | O_CREAT, 0664);
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    if ( fd < 0 || fcntl(fd, F_SETLKW, &lock) != 0 )
+        gistk_error_fatal(GISTK_ERRC_STORE_LOCK, GISTK_ERRS_STORE_LOCK,
+                          store->dir);
+    return fd;
+}
+
+// ----------------------------------------------------------------
+static void gistk_store_unlock(int fd) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    fcntl(fd, F_SETLK, &lock);
+    close(fd);
+}
+
+// ----------------------------------------------------------------
+// Reads the index, a missing or foreign file is an empty index
+static gistk_store_entry_t * gistk_store_read(const char * name,
+                                              size_t * num) {
+    *num = 0;
+    FILE * fp = fopen(name, "rb");
+    if ( fp == NULL ) return NULL;
+    char magic[8];
+    gistk_store_entry_t * entries = NULL;
+    size_t mem = 0;
+    if ( fread(magic, 1, 8, fp) == 8 &&
+         memcmp(magic, GISTK_STORE_MAGIC, 8) == 0 ) {
+        gistk_store_entry_t entry;
+        while ( fread(&entry, sizeof(entry), 1, fp) == 1 ) {
+            if ( *num == mem ) {
+                mem = mem * 2 + 1024;
+                entries = CPLRealloc(entries, mem * sizeof(entry));
+            }
+            entries[(*num)++] = entry;
+        }
+    }
+    fclose(fp);
+    return entries;
+}
+
+// ----------------------------------------------------------------
+// Replaces the index with the entries, the lock has to be held
+static void gistk_store_write(const gistk_store_t * store, const char * name,
+                              const gistk_store_entry_t * entries,
+                              size_t num) {
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s/%s.%ld", store->dir,
+             GISTK_STORE_INDEX, (long) getpid());
+    FILE * fp = fopen(temp, "wb");
+    bool ok = fp != NULL &&
+              fwrite(GISTK_STORE_MAGIC, 1, 8, fp) == 8 &&
+              fwrite(entries, sizeof(gistk_store_entry_t), num, fp) == num;
+    if ( fp != NULL && fclose(fp) != 0 ) ok = false;
+    if ( ! ok || rename(temp, name) != 0 ) {
+        unlink(temp);
+        gistk_error_fatal(GISTK_ERRC_STORE_INDEX, GISTK_ERRS_STORE_INDEX,
+                          store->dir);
+    }
+}
+
+// ----------------------------------------------------------------
+static int gistk_store_by_key(const void * a, const void * b) {
+    const gistk_store_entry_t * ea = a;
+    const gistk_store_entry_t * eb = b;
+    if ( ea->key != eb->key ) return ea->key < eb->key ? -1 : 1;
+    return ea->used < eb->used ? -1 : ea->used > eb->used;
+}
+
+// ----------------------------------------------------------------
+static int gistk_store_key_cmp(const void * a, const void * b) {
+    const gistk_store_entry_t * ea = a;
+    const gistk_store_entry_t * eb = b;
+    return ea->key < eb->key ? -1 : ea->key > eb->key;
+}
+
+// ----------------------------------------------------------------
+static int gistk_store_by_use(const void * a, const void * b) {
+    const gistk_store_entry_t * ea = a;
+    const gistk_store_entry_t * eb = b;
+    return ea->used < eb->used ? -1 : ea->used > eb->used;
+}
+
+// ----------------------------------------------------------------
+// A temporary file tmp.PID.SEQ is stale if its run is gone or it is
+// older than any run should take
+static bool gistk_store_stale(const char * name, const struct stat * info) {
+    long pid = 0;
+    if ( sscanf(name, "tmp.%ld.", &pid) != 1 || pid <= 0 ) return true;
+    if ( time(NULL) - info->st_mtime > GISTK_STORE_TMP_AGE ) return true;
+    return kill((pid_t) pid, 0) != 0 && errno == ESRCH;
+}
+
+// ----------------------------------------------------------------
+// Brings the index and the files in line under the lock: results
+// without an entry are indexed, entries without a result dropped
+// and stale temporary files removed
+static void gistk_store_reconcile(const gistk_store_t * store) {
+    char name[PATH_MAX], path[PATH_MAX];
+    int fd = gistk_store_lock(store);
+    snprintf(name, sizeof(name), "%s/%s", store->dir, GISTK_STORE_INDEX);
+    size_t num = 0;
+    gistk_store_entry_t * entries = gistk_store_read(name, &num);
+    if ( num > 1 )
+        qsort(entries, num, sizeof(gistk_store_entry_t), gistk_store_by_key);
+
+    gistk_store_entry_t * found = NULL;
+    size_t num_found = 0, mem_found = 0;
+    bool changed = false;
+    for (int sub=0; sub < 256; sub++) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/%02x", store->dir, sub);
+        DIR * dp = opendir(dir);
+        if ( dp == NULL ) continue;
+        struct dirent * de;
+        while ( (de = readdir(dp)) != NULL ) {
+            if ( de->d_name[0] == '.' ) continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            struct stat info;
+            if ( stat(path, &info) != 0 || ! S_ISREG(info.st_mode) ) continue;
+            if ( strncmp(de->d_name, "tmp.", 4) == 0 ) {
+                if ( gistk_store_stale(de->d_name, &info) ) unlink(path);
+                continue;
+            }
+
+            // Results are named by their key
+            char * end = NULL;
+            unsigned long long key = strtoull(de->d_name, &end, 16);
+            if ( strlen(de->d_name) != 16 || *end != '\0' ||
+                 (int) (key >> 56) != sub )
+                continue;
+            if ( num_found == mem_found ) {
+                mem_found = mem_found * 2 + 1024;
+                found = CPLRealloc(found,
+                                   mem_found * sizeof(gistk_store_entry_t));
+            }
+            gistk_store_entry_t * entry = &found[num_found++];
+            entry->key = (uint64_t) key;
+            entry->size = (uint64_t) info.st_size;
+            entry->used = (int64_t) info.st_mtime;
+            const gistk_store_entry_t * known =
+                bsearch(entry, entries, num, sizeof(gistk_store_entry_t),
+                        gistk_store_key_cmp);
+            if ( known != NULL ) *entry = *known;
+            else changed = true;
+        }
+        closedir(dp);
+    }
+
+    // Every result found kept its entry, so a count below the index
+    // means entries without a result
+    if ( changed || num_found != num )
+        gistk_store_write(store, name, found, num_found);
+    gistk_store_unlock(fd);
+    CPLFree(entries);
+    CPLFree(found);
+}
+
+// ----------------------------------------------------------------
+void gistk_store_open(const char * dir, const char * filename,
+                      const gistk_cut_opts_t * opts, const char * ext,
+                      uint64_t max_bytes, bool hardlink,
+                      gistk_store_t * store) {
+
+    struct stat info;
+    if ( mkdir(dir, 0775) != 0 && errno != EEXIST )
+        gistk_error_fatal(GISTK_ERRC_STORE_DIR, GISTK_ERRS_STORE_DIR, dir);
+    if ( stat(dir, &info) != 0 || ! S_ISDIR(info.st_mode) )
+        gistk_error_fatal(GISTK_ERRC_STORE_DIR, GISTK_ERRS_STORE_DIR, dir);
+
+    memset(store, 0, sizeof(gistk_store_t));
+    store->dir = CPLStrdup(dir);
+    store->max_bytes = max_bytes;
+    store->hardlink = hardlink;
+    pthread_mutex_init(&store->lock, NULL);
+
+    // Identity of the source
+    char real[PATH_MAX];
+    if ( realpath(filename, real) == NULL )
+        snprintf(real, sizeof(real), "%s", filename);
+    if ( stat(filename, &info) != 0 )
+        memset(&info, 0, sizeof(info));
+
+    // Everything of the options which changes the pixels or the file
+    const gistk_conv_t * c = &opts->conv;
+    const gistk_terrain_t * t = &opts->terrain;
+    char text[PATH_MAX + 1024];
+    snprintf(text, sizeof(text),
+             "%s|%lld|%lld|%s|%d %.17g %.17g %d %.17g %.17g %d %.17g %.17g "
+             "%d %.17g|%d %d %.17g %.17g %.17g|%d %d|%d %.17g",
+             real, (long long) info.st_mtime, (long long) info.st_size, ext,
+             (int) c->out_type, c->scale, c->offset, c->clamp,
+             c->clamp_min, c->clamp_max, (int) c->norm, c->norm_mean,
+             c->norm_std, c->has_out_nodata, c->out_nodata,
+             t->bands, t->only, t->z_factor, t->azimuth, t->altitude,
+             (int) opts->reduce, opts->stats,
+             (int) opts->lossy, opts->max_error);
+    store->base = gistk_store_fnv(GISTK_STORE_FNV_BASIS, text);
+
+    gistk_store_reconcile(store);
+}
+
+// ----------------------------------------------------------------
+uint64_t gistk_store_key(const gistk_store_t * store,
+                         long x0, long y0, int width, int height,
+                         int out_width, int out_height, int scale) {
+    char text[128];
+    snprintf(text, sizeof(text), "|%ld %ld %d %d|%d %d|%d",
+             x0, y0, width, height, out_width, out_height, scale);
+    return gistk_store_fnv(store->base, text);
+}
+
+// ----------------------------------------------------------------
+bool gistk_store_get(gistk_store_t * store, uint64_t key,
+                     const char * filename) {
+    char path[PATH_MAX];
+    gistk_store_path(store, key, path, sizeof(path));
+
+    unlink(filename);
+    bool hit = store->hardlink && link(path, filename) == 0;
+    if ( ! hit ) hit = gistk_store_copy(path, filename);
+
+    if ( hit ) gistk_store_note(store, key, path);
+    pthread_mutex_lock(&store->lock);
+    if ( hit ) store->hits++;
+    else store->misses++;
+    pthread_mutex_unlock(&store->lock);
+    return hit;
+}
+
+// ----------------------------------------------------------------
+void gistk_store_unget(gistk_store_t * store, const char * filename) {
+    unlink(filename);
+    pthread_mutex_lock(&store->lock);
+    store->hits--;
+    store->misses++;
+    pthread_mutex_unlock(&store->lock);
+}
+
+// ----------------------------------------------------------------
+void gistk_store_put(gistk_store_t * store, uint64_t key,
+                     const char * filename) {
+    char path[PATH_MAX];
+    gistk_store_path(store, key, path, sizeof(path));
+
+    // Another run may have stored the same result meanwhile
+    if ( access(path, F_OK) != 0 ) {
+        char sub[PATH_MAX];
+        snprintf(sub, sizeof(sub), "%s/%02x", store->dir,
+                 (unsigned) (key >> 56));
+        mkdir(sub, 0775);
+
+        pthread_mutex_lock(&store->lock);
+        unsigned long seq = store->seq++;
+        pthread_mutex_unlock(&store->lock);
+        char temp[PATH_MAX];
+        snprintf(temp, sizeof(temp), "%s/tmp.%ld.%lu",
+                 sub, (long) getpid(), seq);
+
+        bool ok = store->hardlink && link(filename, temp) == 0;
+        if ( ! ok ) ok = gistk_store_copy(filename, temp);
+        if ( ok && rename(temp, path) != 0 ) {
+            unlink(temp);
+            ok = false;
+        }
+        if ( ! ok ) return;
+        pthread_mutex_lock(&store->lock);
+        store->stores++;
+        pthread_mutex_unlock(&store->lock);
+    }
+    gistk_store_note(store, key, path);
+}
+
+// ----------------------------------------------------------------
+void gistk_store_close(gistk_store_t * store) {
+
+    char name[PATH_MAX], path[PATH_MAX];
+    int fd = gistk_store_lock(store);
+
+    // Index and journal, results evicted by other runs meanwhile
+    // are dropped from the journal
+    snprintf(name, sizeof(name), "%s/%s", store->dir, GISTK_STORE_INDEX);
+    size_t num = 0;
+    gistk_store_entry_t * entries = gistk_store_read(name, &num);
+    size_t mem = num + store->num_journal;
+    entries = CPLRealloc(entries, (mem > 0 ? mem : 1) *
+                         sizeof(gistk_store_entry_t));
+    for (size_t j=0; j < store->num_journal; j++) {
+        gistk_store_path(store, store->journal[j].key, path, sizeof(path));
+        if ( access(path, F_OK) == 0 ) entries[num++] = store->journal[j];
+    }
+
+    // One entry per key with its latest use
+    qsort(entries, num, sizeof(gistk_store_entry_t), gistk_store_by_key);
+    size_t uniq = 0;
+    for (size_t i=0; i < num; i++) {
+        if ( uniq > 0 && entries[uniq-1].key == entries[i].key )
+            uniq--;
+        entries[uniq++] = entries[i];
+    }
+    num = uniq;
+
+    // Least recently used results beyond the size cap
+    uint64_t total = 0;
+    for (size_t i=0; i < num; i++) total += entries[i].size;
+    qsort(entries, num, sizeof(gistk_store_entry_t), gistk_store_by_use);
+    size_t first = 0;
+    while ( total > store->max_bytes && first < num ) {
+        gistk_store_path(store, entries[first].key, path, sizeof(path));
+        unlink(path);
+        total -= entries[first].size;
+        store->evictions++;
+        first++;
+    }
+    store->num_bytes = total;
+
+    gistk_store_write(store, name, entries + first, num - first);
+    gistk_store_unlock(fd);
+
+    CPLFree(entries);
+    CPLFree(store->journal);
+    CPLFree(store->dir);
+    pthread_mutex_destroy(&store->lock);
+    store->journal = NULL;
+    store->dir = NULL;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -0,0 +1,248 @@
+// =====================================================================
+// Terrain derivatives of a elevation band
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// The stencils are evaluated row by row in separate passes for the
+// gradients, the nodata mask and every derived band. The passes are
+// branch free loops over contiguous arrays which the compiler turns
+// into SIMD code.
+// =====================================================================
+
+#include "ifgdv/terrain.h"
+
+#define GISTK_DEG2RAD (M_PI / 180.0)
+#define GISTK_RAD2DEG (180.0 / M_PI)
+
+static const char * gistk_terrain_names[GISTK_TERRAIN_NUM] = {
+    "slope", "aspect", "hillshade", "curvature"
+};
+
+// ---------------------------------------------------------------
+void gistk_terrain_init(gistk_terrain_t *terrain) {
+    terrain->bands = 0;
+    terrain->only = false;
+    terrain->z_factor = 1.0;
+    terrain->azimuth = 315.0;
+    terrain->altitude = 45.0;
+}
+
+// ---------------------------------------------------------------
+bool gistk_terrain_parse(const char *list, gistk_terrain_t *terrain) {
+    char ** items = CSLTokenizeString2(list, ",", 0);
+    bool valid = CSLCount(items) > 0;
+    for (int i=0; items != NULL && items[i] != NULL; i++) {
+        bool found = false;
+        for (int n=0; n < GISTK_TERRAIN_NUM; n++)
+            if ( EQUAL(items[i], gistk_terrain_names[n]) ) {
+                terrain->bands |= 1 << n;
+                found = true;
+            }
+        if ( EQUAL(items[i], "only") ) {
+            terrain->only = true;
+            found = true;
+        }
+        valid = valid && found;
+    }
+    CSLDestroy(items);
+    return valid && terrain->bands != 0;
+}
+
+// ---------------------------------------------------------------
+int gistk_terrain_count(const gistk_terrain_t *terrain) {
+    if ( terrain == NULL ) return 0;
+    int cnt = 0;
+    for (int n=0; n < GISTK_TERRAIN_NUM; n++)
+        if ( terrain->bands & (1 << n) ) cnt++;
+    return cnt;
+}
+
+// ---------------------------------------------------------------
+const char * gistk_terrain_name(const gistk_terrain_t *terrain, int n) {
+    for (int b=0; b < GISTK_TERRAIN_NUM; b++)
+        if ( (terrain->bands & (1 << b)) && n-- == 0 )
+            return gistk_terrain_names[b];
+    return NULL;
+}
+
+// ---------------------------------------------------------------
+void gistk_terrain_cellsize(OGRSpatialReferenceH srs, const double *trfm,
+                            double row, double *dx, double *dy) {
+
+    if ( srs == NULL || ! OSRIsGeographic(srs) ) {
+        double unit = srs == NULL ? 1.0 : OSRGetLinearUnits(srs, NULL);
+        *dx = hypot(trfm[1], trfm[4]) * unit;
+        *dy = hypot(trfm[2], trfm[5]) * unit;
+        return;
+    }
+
+    // Radii of curvature in the prime vertical and the meridian
+    OGRErr err = OGRERR_NONE;
+    double a = OSRGetSemiMajor(srs, &err);
+    double b = OSRGetSemiMinor(srs, &err);
+    double e2 = 1.0 - (b * b) / (a * a);
+    double lat = (trfm[3] + trfm[5] * (row + 0.5)) * GISTK_DEG2RAD;
+    double s = sin(lat);
+    double w = sqrt(1.0 - e2 * s * s);
+    double rn = a / w;
+    double rm = a * (1.0 - e2) / (w * w * w);
+
+    *dx = hypot(trfm[1], trfm[4]) * GISTK_DEG2RAD * rn * cos(lat);
+    *dy = hypot(trfm[2], trfm[5]) * GISTK_DEG2RAD * rm;
+}
+
+// ---------------------------------------------------------------
+void gistk_terrain_window(int num_cols, int num_rows,
+                          int x0, int y0, int width, int height,
+                          int *rx0, int *ry0, int *rw, int *rh) {
+    *rx0 = x0 - 1 < 0 ? 0 : x0 - 1;
+    *ry0 = y0 - 1 < 0 ? 0 : y0 - 1;
+    int rx1 = x0 + width + 1 > num_cols ? num_cols : x0 + width + 1;
+    int ry1 = y0 + height + 1 > num_rows ? num_rows : y0 + height + 1;
+    *rw = rx1 - *rx0;
+    *rh = ry1 - *ry0;
+}
+
+// ---------------------------------------------------------------
+void gistk_terrain_pad(double *halo, int width, int height,
+                       int ox, int oy, int rw, int rh) {
+
+    // Repeat the edge pixels into the missing halo columns and rows
+    int hw = width + 2;
+    int last_x = ox + rw - 1;
+    int last_y = oy + rh - 1;
+    for (int r = oy; r <= last_y; r++) {
+        double *line = halo + (size_t) r * hw;
+        for (int c = 0; c < ox; c++) line[c] = line[ox];
+        for (int c = last_x + 1; c < hw; c++) line[c] = line[last_x];
+    }
+    for (int r = 0; r < oy; r++)
+        memcpy(halo + (size_t) r * hw, halo + (size_t) oy * hw,
+               hw * sizeof(double));
+    for (int r = last_y + 1; r < height + 2; r++)
+        memcpy(halo + (size_t) r * hw, halo + (size_t) last_y * hw,
+               hw * sizeof(double));
+}
+
+// ---------------------------------------------------------------
+void gistk_terrain_read(GDALRasterBandH band, int num_cols, int num_rows,
+                        int x0, int y0, int width, int height,
+                        double *halo) {
+
+    // Part of the halo window inside the raster
+    int rx0, ry0, rw, rh;
+    gistk_terrain_window(num_cols, num_rows, x0, y0, width, height,
+                         &rx0, &ry0, &rw, &rh);
+    int ox = rx0 - (x0 - 1);
+    int oy = ry0 - (y0 - 1);
+
+    GDALRasterIO(band, GF_Read, rx0, ry0, rw, rh,
+                 halo + (size_t) oy * (width + 2) + ox, rw, rh,
+                 GDT_Float64, 0, (width + 2) * (int) sizeof(double));
+    gistk_terrain_pad(halo, width, height, ox, oy, rw, rh);
+}
+
+// ---------------------------------------------------------------
+void gistk_terrain_apply(const gistk_terrain_t *terrain,
+                         const double *halo, int width, int height,
+                         const double *dx, const double *dy,
+                         bool has_nodata, double nodata,
+                         float **out) {
+
+    int hw = width + 2;
+    double zf = terrain->z_factor;
+    double zenith = (90.0 - terrain->altitude) * GISTK_DEG2RAD;
+    double azimuth = fmod(450.0 - terrain->azimuth, 360.0) * GISTK_DEG2RAD;
+    double cos_zen = cos(zenith);
+    double sin_zen = sin(zenith);
+
+    double *p    = CPLMalloc(sizeof(double) * width);
+    double *q    = CPLMalloc(sizeof(double) * width);
+    double *curv = CPLMalloc(sizeof(double) * width);
+    double *bad  = CPLMalloc(sizeof(double) * width);
+
+    for (int r=0; r < height; r++) {
+
+        // a b c
+        // d e f   rows t, m and u of the stencil
+        // g h i
+        const double * restrict t = halo + (size_t) r * hw;
+        const double * restrict m = t + hw;
+        const double * restrict u = m + hw;
+        double idx = 1.0 / (8.0 * dx[r]);
+        double idy = 1.0 / (8.0 * dy[r]);
+        double idx2 = 1.0 / (dx[r] * dx[r]);
+        double idy2 = 1.0 / (dy[r] * dy[r]);
+
+        // Horn gradients and Zevenbergen-Thorne curvature
+        for (int c=0; c < width; c++) {
+            p[c] = ((t[c+2] + 2.0 * m[c+2] + u[c+2]) -
+                    (t[c]   + 2.0 * m[c]   + u[c])) * idx * zf;
+            q[c] = ((u[c] + 2.0 * u[c+1] + u[c+2]) -
+                    (t[c] + 2.0 * t[c+1] + t[c+2])) * idy * zf;
+            double cd = ((m[c] + m[c+2]) * 0.5 - m[c+1]) * idx2;
+            double ce = ((t[c+1] + u[c+1]) * 0.5 - m[c+1]) * idy2;
+            curv[c] = -2.0 * (cd + ce) * 100.0 * zf;
+        }
+
+        // Stencils touching a nodata pixel give nodata
+        for (int c=0; c < width; c++) {
+            double s = t[c] + t[c+1] + t[c+2] + m[c] + m[c+1] + m[c+2] +
+                       u[c] + u[c+1] + u[c+2];
+            bad[c] = s != s;
+        }
+        if ( has_nodata )
+            for (int c=0; c < width; c++)
+                bad[c] = ( bad[c] != 0.0 ||
+                           t[c] == nodata || t[c+1] == nodata ||
+                           t[c+2] == nodata || m[c] == nodata ||
+                           m[c+1] == nodata || m[c+2] == nodata ||
+                           u[c] == nodata || u[c+1] == nodata ||
+                           u[c+2] == nodata ) ? 1.0 : 0.0;
+
+        int n = 0;
+        size_t off = (size_t) r * width;
+        if ( terrain->bands & GISTK_TERRAIN_SLOPE ) {
+            float * restrict o = out[n++] + off;
+            for (int c=0; c < width; c++) {
+                double v = atan(sqrt(p[c] * p[c] + q[c] * q[c])) * GISTK_RAD2DEG;
+                o[c] = (float) (bad[c] != 0.0 ? GISTK_TERRAIN_NODATA : v);
+            }
+        }
+        if ( terrain->bands & GISTK_TERRAIN_ASPECT ) {
+            float * restrict o = out[n++] + off;
+            for (int c=0; c < width; c++) {
+                // compass direction of the downslope, flat is nodata
+                double a = atan2(q[c], -p[c]) * GISTK_RAD2DEG;
+                double v = a > 90.0 ? 450.0 - a : 90.0 - a;
+                bool flat = p[c] == 0.0 && q[c] == 0.0;
+                o[c] = (float) (bad[c] != 0.0 || flat ? GISTK_TERRAIN_NODATA : v);
+            }
+        }
+        if ( terrain->bands & GISTK_TERRAIN_HILLSHADE ) {
+            float * restrict o = out[n++] + off;
+            for (int c=0; c < width; c++) {
+                double slope = atan(sqrt(p[c] * p[c] + q[c] * q[c]));
+                double aspect = atan2(q[c], -p[c]);
+                double v = 255.0 * (cos_zen * cos(slope) +
+                           sin_zen * sin(slope) * cos(azimuth - aspect));
+                v = v < 0.0 ? 0.0 : v;
+                o[c] = (float) (bad[c] != 0.0 ? GISTK_TERRAIN_NODATA : v);
+            }
+        }
+        if ( terrain->bands & GISTK_TERRAIN_CURVATURE ) {
+            float * restrict o = out[n++] + off;
+            for (int c=0; c < width; c++)
+                o[c] = (float) (bad[c] != 0.0 ? GISTK_TERRAIN_NODATA : curv[c]);
+        }
+    }
+
+    CPLFree(p);
+    CPLFree(q);
+    CPLFree(curv);
+    CPLFree(bad);
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
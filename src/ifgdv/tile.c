@@ -0,0 +1,361 @@
+// =====================================================================
+// Decoded tile cache with prefetch for gistk rasters
+// (c) - 2015 A. Weidauer  alex.weidauer@huckfinn.de
+// All rights reserved to A. Weidauer
+// =====================================================================
+// The blocks are decoded with GDALReadBlock, which bypasses the GDAL
+// block cache, so every block lives only once in memory. A mutex
+// guards the slots and the queue; decoding runs outside of the lock
+// while the slot is marked as loading and cannot be evicted.
+// =====================================================================
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ifgdv/error.h"
+#include "ifgdv/tile.h"
+
+// ----------------------------------------------------------------
+static long gistk_tile_key(const gistk_tile_cache_t * cache,
+                           int band, int bx, int by) {
+    return ((long) (band - 1) * cache->blocks_y + by) * cache->blocks_x + bx;
+}
+
+// ----------------------------------------------------------------
+static int gistk_tile_find(const gistk_tile_cache_t * cache, long key) {
+    int s = cache->buckets[key % cache->num_buckets];
+    while ( s >= 0 && cache->slots[s].key != key )
+        s = cache->slots[s].next;
+    return s;
+}
+
+// ----------------------------------------------------------------
+static void gistk_tile_link(gistk_tile_cache_t * cache, int s, long key) {
+    int b = key % cache->num_buckets;
+    cache->slots[s].key = key;
+    cache->slots[s].next = cache->buckets[b];
+    cache->buckets[b] = s;
+}
+
+// ----------------------------------------------------------------
+static void gistk_tile_unlink(gistk_tile_cache_t * cache, int s) {
+    int * pos = &cache->buckets[cache->slots[s].key % cache->num_buckets];
+    while ( *pos != s ) pos = &cache->slots[*pos].next;
+    *pos = cache->slots[s].next;
+    cache->slots[s].next = -1;
+}
+
+// ----------------------------------------------------------------
+// CLOCK: referenced tiles get a second chance, loading tiles are
+// skipped. Returns -1 if every slot is loading.
+static int gistk_tile_victim(gistk_tile_cache_t * cache) {
+    for (int n=0; n < 2 * cache->num_slots + 1; n++) {
+        int s = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->num_slots;
+        gistk_tile_t * tile = &cache->slots[s];
+        if ( tile->state == GISTK_TILE_LOADING ) continue;
+        if ( tile->state == GISTK_TILE_VALID ) {
+            if ( tile->referenced ) {
+                tile->referenced = false;
+                continue;
+            }
+            gistk_tile_unlink(cache, s);
+            if ( tile->prefetched ) cache->unused_prefetched--;
+            tile->prefetched = false;
+            tile->state = GISTK_TILE_EMPTY;
+            cache->evictions++;
+        }
+        if ( tile->data == NULL )
+            tile->data = CPLMalloc(cache->tile_bytes);
+        return s;
+    }
+    return -1;
+}
+
+// ----------------------------------------------------------------
+// Returns the slot of a valid tile, the lock is held on call and
+// on return but released while decoding
+static int gistk_tile_get(gistk_tile_cache_t * cache,
+                          int band, int bx, int by) {
+    long key = gistk_tile_key(cache, band, bx, by);
+    for (;;) {
+        int s = gistk_tile_find(cache, key);
+        if ( s >= 0 ) {
+            gistk_tile_t * tile = &cache->slots[s];
+            if ( tile->state == GISTK_TILE_VALID ) {
+                cache->hits++;
+                tile->referenced = true;
+                if ( tile->prefetched ) {
+                    tile->prefetched = false;
+                    cache->unused_prefetched--;
+                    pthread_cond_broadcast(&cache->changed);
+                }
+                return s;
+            }
+            // the prefetch thread is decoding it
+            pthread_cond_wait(&cache->changed, &cache->lock);
+            continue;
+        }
+
+        s = gistk_tile_victim(cache);
+        if ( s < 0 ) {
+            pthread_cond_wait(&cache->changed, &cache->lock);
+            continue;
+        }
+
+        cache->misses++;
+        gistk_tile_t * tile = &cache->slots[s];
+        gistk_tile_link(cache, s, key);
+        tile->state = GISTK_TILE_LOADING;
+        pthread_mutex_unlock(&cache->lock);
+        CPLErr err = GDALReadBlock(GDALGetRasterBand(cache->data, band),
+                                   bx, by, tile->data);
+        pthread_mutex_lock(&cache->lock);
+        if ( err != CE_None ) {
+            // leave the cache usable for a trapped error
+            gistk_tile_unlink(cache, s);
+            tile->state = GISTK_TILE_EMPTY;
+            pthread_cond_broadcast(&cache->changed);
+            pthread_mutex_unlock(&cache->lock);
+            gistk_error_fatal(GISTK_ERRC_TILE_READ, GISTK_ERRS_TILE_READ,
+                              bx, by, band);
+        }
+        tile->state = GISTK_TILE_VALID;
+        tile->referenced = true;
+        pthread_cond_broadcast(&cache->changed);
+        return s;
+    }
+}
+
+// ----------------------------------------------------------------
+static void * gistk_tile_prefetch_run(void * arg) {
+    gistk_tile_cache_t * cache = arg;
+    long per_band = (long) cache->blocks_x * cache->blocks_y;
+
+    pthread_mutex_lock(&cache->lock);
+    while ( ! cache->stop ) {
+
+        // Stay ahead of the consumer by at most half of the cache
+        if ( cache->queue_head == cache->queue_tail ||
+             cache->unused_prefetched >= cache->num_slots / 2 ) {
+            pthread_cond_wait(&cache->changed, &cache->lock);
+            continue;
+        }
+
+        long key = cache->queue[cache->queue_head++ % GISTK_TILE_QUEUE];
+        if ( gistk_tile_find(cache, key) >= 0 ) continue;
+        int s = gistk_tile_victim(cache);
+        if ( s < 0 ) continue;
+
+        gistk_tile_t * tile = &cache->slots[s];
+        gistk_tile_link(cache, s, key);
+        tile->state = GISTK_TILE_LOADING;
+        tile->prefetched = true;
+        cache->unused_prefetched++;
+
+        int band = (int) (key / per_band) + 1;
+        int by = (int) (key % per_band) / cache->blocks_x;
+        int bx = (int) (key % per_band) % cache->blocks_x;
+        pthread_mutex_unlock(&cache->lock);
+        CPLErr err = GDALReadBlock(GDALGetRasterBand(cache->prefetch_data,
+                                                     band),
+                                   bx, by, tile->data);
+        pthread_mutex_lock(&cache->lock);
+
+        if ( err != CE_None ) {
+            // the consumer reports the error if it needs the block
+            gistk_tile_unlink(cache, s);
+            tile->state = GISTK_TILE_EMPTY;
+            tile->prefetched = false;
+            cache->unused_prefetched--;
+        } else {
+            tile->state = GISTK_TILE_VALID;
+            tile->referenced = true;
+            cache->prefetches++;
+        }
+        pthread_cond_broadcast(&cache->changed);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+void gistk_tile_cache_open(const char * filename,
+                           gistk_raster_t * raster,
+                           size_t budget, bool prefetch,
+                           gistk_tile_cache_t * cache) {
+
+    memset(cache, 0, sizeof(gistk_tile_cache_t));
+    cache->data = raster->data;
+    cache->num_bands = raster->num_bands;
+    cache->num_cols = raster->num_cols;
+    cache->num_rows = raster->num_rows;
+
+    // The bands share the block layout of the first band
+    GDALGetBlockSize(GDALGetRasterBand(raster->data, 1),
+                     &cache->block_w, &cache->block_h);
+    cache->blocks_x = (raster->num_cols + cache->block_w - 1) / cache->block_w;
+    cache->blocks_y = (raster->num_rows + cache->block_h - 1) / cache->block_h;
+
+    int max_size = 1;
+    cache->types = CPLMalloc(sizeof(GDALDataType) * raster->num_bands);
+    for (int b=0; b < raster->num_bands; b++) {
+        cache->types[b] =
+            GDALGetRasterDataType(GDALGetRasterBand(raster->data, b+1));
+        int size = GDALGetDataTypeSize(cache->types[b]) / 8;
+        if ( size > max_size ) max_size = size;
+    }
+    cache->tile_bytes = (size_t) cache->block_w * cache->block_h * max_size;
+
+    // Slots are filled lazily up to the budget
+    cache->num_slots = (int) (budget / cache->tile_bytes);
+    if ( cache->num_slots < 4 ) cache->num_slots = 4;
+    cache->slots = CPLCalloc(cache->num_slots, sizeof(gistk_tile_t));
+    for (int s=0; s < cache->num_slots; s++) cache->slots[s].next = -1;
+    cache->num_buckets = 2 * cache->num_slots + 1;
+    cache->buckets = CPLMalloc(sizeof(int) * cache->num_buckets);
+    for (int b=0; b < cache->num_buckets; b++) cache->buckets[b] = -1;
+    cache->queue = CPLMalloc(sizeof(long) * GISTK_TILE_QUEUE);
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->changed, NULL);
+
+    // GDAL handles are not thread safe, the prefetcher gets its own
+    if ( prefetch ) {
+        cache->prefetch_data = GDALOpen(filename, GA_ReadOnly);
+        if ( cache->prefetch_data == NULL )
+            gistk_error_fatal(GISTK_ERRC_OPEN_RST_SRCR,
+                              GISTK_ERRS_OPEN_RST_SRC,
+                              filename, "readable");
+        if ( pthread_create(&cache->thread, NULL,
+                            gistk_tile_prefetch_run, cache) != 0 )
+            gistk_error_fatal(GISTK_ERRC_TILE_THREAD,
+                              GISTK_ERRS_TILE_THREAD, filename);
+        cache->running = true;
+    }
+
+    raster->cache = cache;
+}
+
+// ----------------------------------------------------------------
+void gistk_tile_cache_read(gistk_tile_cache_t * cache, int band,
+                           int x0, int y0, int width, int height,
+                           void * buffer, GDALDataType buf_type,
+                           int line_space) {
+
+    GDALDataType type = cache->types[band - 1];
+    int tsize = GDALGetDataTypeSize(type) / 8;
+    int bsize = GDALGetDataTypeSize(buf_type) / 8;
+    if ( line_space == 0 ) line_space = width * bsize;
+
+    int bx0 = x0 / cache->block_w;
+    int by0 = y0 / cache->block_h;
+    int bx1 = (x0 + width - 1) / cache->block_w;
+    int by1 = (y0 + height - 1) / cache->block_h;
+
+    pthread_mutex_lock(&cache->lock);
+    for (int by = by0; by <= by1; by++) {
+        int ty0 = by * cache->block_h;
+        int ry0 = y0 > ty0 ? y0 : ty0;
+        int ry1 = y0 + height < ty0 + cache->block_h ?
+                  y0 + height : ty0 + cache->block_h;
+        for (int bx = bx0; bx <= bx1; bx++) {
+            int tx0 = bx * cache->block_w;
+            int rx0 = x0 > tx0 ? x0 : tx0;
+            int rx1 = x0 + width < tx0 + cache->block_w ?
+                      x0 + width : tx0 + cache->block_w;
+
+            int s = gistk_tile_get(cache, band, bx, by);
+            const GByte * tile = cache->slots[s].data;
+            for (int r = ry0; r < ry1; r++) {
+                const GByte * src = tile +
+                    ((size_t) (r - ty0) * cache->block_w + (rx0 - tx0)) * tsize;
+                GByte * dst = (GByte *) buffer +
+                    (size_t) (r - y0) * line_space + (size_t) (rx0 - x0) * bsize;
+                GDALCopyWords(src, type, tsize, dst, buf_type, bsize, rx1 - rx0);
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// ----------------------------------------------------------------
+long gistk_tile_cache_key(const gistk_tile_cache_t * cache,
+                          int band, int bx, int by) {
+    return gistk_tile_key(cache, band, bx, by);
+}
+
+// ----------------------------------------------------------------
+void gistk_tile_cache_prefetch(gistk_tile_cache_t * cache,
+                               const long * keys, size_t num_keys) {
+    if ( ! cache->running ) return;
+    pthread_mutex_lock(&cache->lock);
+    for (size_t k=0; k < num_keys; k++) {
+        // a full queue drops the hint, the read will decode it
+        if ( cache->queue_tail - cache->queue_head >= GISTK_TILE_QUEUE )
+            break;
+        cache->queue[cache->queue_tail++ % GISTK_TILE_QUEUE] = keys[k];
+    }
+    pthread_cond_broadcast(&cache->changed);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// ----------------------------------------------------------------
+void gistk_tile_cache_hint(gistk_tile_cache_t * cache, int band,
+                           int x0, int y0, int width, int height) {
+
+    // Clip the window to the raster
+    if ( x0 < 0 ) { width += x0; x0 = 0; }
+    if ( y0 < 0 ) { height += y0; y0 = 0; }
+    if ( x0 + width > cache->num_cols ) width = cache->num_cols - x0;
+    if ( y0 + height > cache->num_rows ) height = cache->num_rows - y0;
+    if ( width < 1 || height < 1 ) return;
+
+    int bx0 = x0 / cache->block_w;
+    int by0 = y0 / cache->block_h;
+    int bx1 = (x0 + width - 1) / cache->block_w;
+    int by1 = (y0 + height - 1) / cache->block_h;
+    int b0 = band > 0 ? band : 1;
+    int b1 = band > 0 ? band : cache->num_bands;
+
+    // Blocks in the reading order of gistk_tile_cache_read
+    size_t num_keys = (size_t) (b1 - b0 + 1) * (by1 - by0 + 1) * (bx1 - bx0 + 1);
+    long * keys = CPLMalloc(sizeof(long) * num_keys);
+    size_t k = 0;
+    for (int b = b0; b <= b1; b++)
+        for (int by = by0; by <= by1; by++)
+            for (int bx = bx0; bx <= bx1; bx++)
+                keys[k++] = gistk_tile_key(cache, b, bx, by);
+    gistk_tile_cache_prefetch(cache, keys, num_keys);
+    CPLFree(keys);
+}
+
+// ----------------------------------------------------------------
+void gistk_tile_cache_close(gistk_raster_t * raster,
+                            gistk_tile_cache_t * cache) {
+
+    if ( cache->running ) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stop = true;
+        pthread_cond_broadcast(&cache->changed);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_join(cache->thread, NULL);
+        GDALClose(cache->prefetch_data);
+        cache->running = false;
+    }
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->changed);
+
+    for (int s=0; s < cache->num_slots; s++)
+        if ( cache->slots[s].data != NULL ) CPLFree(cache->slots[s].data);
+    CPLFree(cache->slots);
+    CPLFree(cache->buckets);
+    CPLFree(cache->queue);
+    CPLFree(cache->types);
+    cache->slots = NULL;
+
+    if ( raster != NULL && raster->cache == cache ) raster->cache = NULL;
+}
+
+// =====================================================================
+// EOF
+// =====================================================================
@@ -7,6 +7,7 @@
 #include "ifgdv/error.h"
 #include "ifgdv/alg.h"
 #include "ifgdv/util.h"
+#include "ifgdv/tile.h"
 
 static bool gistk_raster_driver_loaded = false;
 static bool gistk_vector_driver_loaded = false;
@@ -142,6 +143,7 @@ void gistk_open_raster(const char * filename, bool readonly, gistk_raster_t * re
 
     // Check the memory validity of the result object
     gistk_check_raster_init(GISTK_ERRC_OPEN_RST_INIT, filename, result);
+    result->cache = NULL;
 
     // Get the data source and check the results for
     // the read and write case.
@@ -231,112 +233,805 @@ void gistk_close_raster(gistk_raster_t * result)
 
 }
 
+// -----------------------------------------------------------------------
+void gistk_raster_read(const gistk_raster_t * source, int band,
+                       int x0, int y0, int width, int height,
+                       void * buffer, GDALDataType buf_type,
+                       int line_space) {
+    if ( source->cache != NULL ) {
+      gistk_tile_cache_read(source->cache, band, x0, y0, width, height,
+                            buffer, buf_type, line_space);
+      return;
+    }
+    CPLErr err = GDALRasterIO( GDALGetRasterBand( source->data, band ),
+                               GF_Read, x0, y0, width, height,
+                               buffer, width, height,
+                               buf_type, 0, line_space );
+    if ( err != CE_None )
+      gistk_error_fatal(GISTK_ERRC_TILE_READ, GISTK_ERRS_TILE_WINDOW,
+                        x0, y0, band);
+}
+
+// -----------------------------------------------------------------------
+size_t gistk_reproject(const char * srs, const gistk_raster_t * target,
+                       double * x, double * y, size_t n, bool * failed) {
+    OGRSpatialReferenceH src_srs = OSRNewSpatialReference(NULL);
+    if ( OSRSetFromUserInput(src_srs, srs) != OGRERR_NONE )
+        gistk_error_fatal(GISTK_ERRC_REPROJ_SRS, GISTK_ERRS_REPROJ_SRS, srs);
+    OGRSpatialReferenceH dst_srs = OSRNewSpatialReference(target->proj_info);
+    if ( dst_srs == NULL )
+        gistk_error_fatal(GISTK_ERRC_OPEN_RST_CSRS, GISTK_ERRS_OPEN_RST_CSRS,
+                          "target", target->proj_info);
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,0,0)
+    // Points come as x/y and lon/lat whatever the authority says
+    OSRSetAxisMappingStrategy(src_srs, OAMS_TRADITIONAL_GIS_ORDER);
+    OSRSetAxisMappingStrategy(dst_srs, OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+
+    // One transformer for all points
+    OGRCoordinateTransformationH trans =
+        OCTNewCoordinateTransformation(src_srs, dst_srs);
+    if ( trans == NULL )
+        gistk_error_fatal(GISTK_ERRC_REPROJ_TRANS, GISTK_ERRS_REPROJ_TRANS,
+                          srs);
+
+    // Batches keep the input of failed points
+    size_t batch = n < GISTK_REPROJECT_BATCH ? n : GISTK_REPROJECT_BATCH;
+    double * bx = CPLMalloc(sizeof(double) * (batch + 1));
+    double * by = CPLMalloc(sizeof(double) * (batch + 1));
+    int * ok = CPLMalloc(sizeof(int) * (batch + 1));
+    size_t num_failed = 0;
+    for (size_t p0=0; p0 < n; p0 += batch) {
+        int m = (int) ( n - p0 < batch ? n - p0 : batch );
+        memcpy(bx, x + p0, sizeof(double) * m);
+        memcpy(by, y + p0, sizeof(double) * m);
+        for (int i=0; i < m; i++) ok[i] = FALSE;
+        OCTTransformEx(trans, m, bx, by, NULL, ok);
+        for (int i=0; i < m; i++) {
+            bool bad = ! ok[i] || ! isfinite(bx[i]) || ! isfinite(by[i]);
+            if ( failed != NULL ) failed[p0 + i] = bad;
+            if ( bad ) {
+                num_failed++;
+                continue;
+            }
+            x[p0 + i] = bx[i];
+            y[p0 + i] = by[i];
+        }
+    }
+
+    CPLFree(ok);
+    CPLFree(by);
+    CPLFree(bx);
+    OCTDestroyCoordinateTransformation(trans);
+    OSRDestroySpatialReference(dst_srs);
+    OSRDestroySpatialReference(src_srs);
+    return num_failed;
+}
+
+// -----------------------------------------------------------------------
+void gistk_cut_opts_init(gistk_cut_opts_t * opts) {
+    gistk_conv_init(&opts->conv);
+    gistk_terrain_init(&opts->terrain);
+    opts->num_scales = 0;
+    opts->reduce = GISTK_REDUCE_BOX;
+    opts->stats = false;
+    opts->lossy = GISTK_LOSSY_NONE;
+    opts->max_error = 0.0;
+}
+
+// -----------------------------------------------------------------------
+// Sorts and clips a cut window to the source
+static void gistk_cut_window(const gistk_raster_t * source,
+                             const char * filename,
+                             int * win_min_x, int * win_min_y,
+                             int * win_max_x, int * win_max_y) {
+
+    // sort the window parameter
+    sort_int( win_min_x, win_max_x);
+    sort_int( win_min_y, win_max_y);
+
+    // Check the boundaries of the pixel, the maxima are exclusive
+    if ( *win_min_x < 0) *win_min_x = 0;
+    if ( *win_max_x < 0) *win_max_x = 0;
+    if ( *win_min_y < 0) *win_min_y = 0;
+    if ( *win_max_y < 0) *win_max_y = 0;
+    if ( *win_min_x > source->num_cols-1) *win_min_x = source->num_cols-1;
+    if ( *win_max_x > source->num_cols) *win_max_x = source->num_cols;
+    if ( *win_min_y > source->num_rows-1) *win_min_y = source->num_rows-1;
+    if ( *win_max_y > source->num_rows) *win_max_y = source->num_rows;
+
+    // Prevent mal formed images
+    if ( *win_max_x - *win_min_x < 1 )
+        gistk_error_fatal(GISTK_ERRC_CUT_RST_WIDTH,
+                          GISTK_ERRS_CUT_RST_WIDTH ,
+                          filename);
+
+    if ( *win_max_y - *win_min_y < 1 )
+        gistk_error_fatal(GISTK_ERRC_CUT_RST_HEIGHT,
+                          GISTK_ERRS_CUT_RST_HEIGHT,
+                          filename);
+}
+
+// -----------------------------------------------------------------------
+// Pixels of a target band in the chip, their type and nodata value
+static const void * gistk_chip_band_data(const gistk_chip_t * chip, int b,
+                                         GDALDataType * type,
+                                         bool * has_nodata, double * nodata) {
+    if ( b >= chip->num_copied ) {
+      *type = GDT_Float32;
+      *has_nodata = true;
+      *nodata = GISTK_TERRAIN_NODATA;
+      return chip->derived[b - chip->num_copied];
+    }
+    const gistk_chip_band_t * cb = &chip->bands[b];
+    if ( chip->convert ) {
+      *type = cb->out_type;
+      *has_nodata = cb->has_out_nodata;
+      *nodata = cb->out_nodata;
+      return cb->out;
+    }
+    // multi scale chips read the source as doubles
+    *type = chip->doubles ? GDT_Float64 : cb->in_type;
+    *has_nodata = cb->has_in_nodata;
+    *nodata = cb->in_nodata;
+    return cb->in;
+}
+
+// -----------------------------------------------------------------------
+// Reopens an error bounded target read only, so the pixels come back
+// through the codec and not out of the block cache
+static void gistk_lossy_reopen(const char * filename,
+                               gistk_raster_t * result) {
+    GDALClose(result->data);
+    result->data = GDALOpen(filename, GA_ReadOnly);
+    if ( result->data == NULL )
+        gistk_error_fatal(GISTK_ERRC_LOSSY_REOPEN,
+                          GISTK_ERRS_LOSSY_REOPEN,
+                          filename);
+    result->proj_info = GDALGetProjectionRef(result->data);
+    result->readonly = true;
+}
+
+// -----------------------------------------------------------------------
+// Compares the rows of a chip with a reopened error bounded target
+static void gistk_chip_check(const gistk_cut_opts_t * opts,
+                             const gistk_chip_t * chip, int row,
+                             const char * filename,
+                             const gistk_raster_t * result) {
+
+    for (int b=0; b < chip->num_copied + chip->num_derived; b++) {
+      GDALDataType type;
+      bool has_nodata;
+      double nodata;
+      const void * data = gistk_chip_band_data(chip, b, &type,
+                                               &has_nodata, &nodata);
+      double worst = 0.0;
+      long num_bad = gistk_lossy_check(GDALGetRasterBand(result->data, b+1),
+                                       row, chip->width, chip->height,
+                                       data, type, has_nodata, nodata,
+                                       opts->max_error, &worst);
+      if ( num_bad < 0 )
+        gistk_error_fatal(GISTK_ERRC_LOSSY_REOPEN,
+                          GISTK_ERRS_LOSSY_REOPEN,
+                          filename);
+      if ( num_bad > 0 )
+        gistk_error_fatal(GISTK_ERRC_LOSSY_BOUND,
+                          GISTK_ERRS_LOSSY_BOUND,
+                          b+1, filename, num_bad, opts->max_error, worst);
+    }
+}
+
 // -----------------------------------------------------------------------
 void gistk_cut_raster(const gistk_raster_driver_t tool,
                 const gistk_raster_t source, const char * filename,
                     int win_min_x, int win_min_y,
                     int win_max_x, int win_max_y,
                     gistk_raster_t * result) {
+    gistk_cut_raster_opt(tool, source, filename,
+                         win_min_x, win_min_y, win_max_x, win_max_y,
+                         NULL, result);
+}
+
+// -----------------------------------------------------------------------
+void gistk_cut_raster_opt(const gistk_raster_driver_t tool,
+                const gistk_raster_t source, const char * filename,
+                    int win_min_x, int win_min_y,
+                    int win_max_x, int win_max_y,
+                    const gistk_cut_opts_t * opts,
+                    gistk_raster_t * result) {
+
+    gistk_cut_raster_stream(tool, &source, filename,
+                            win_min_x, win_min_y, win_max_x, win_max_y,
+                            opts, GISTK_CUT_BUDGET, result);
+}
+
+// -----------------------------------------------------------------------
+size_t gistk_chip_bytes(const gistk_raster_t * source,
+                        const gistk_cut_opts_t * opts,
+                        int width, int height) {
+    // Doubles for the source and the converted pixels, floats for the
+    // derived bands, the halo of the first band
+    const gistk_terrain_t * terrain = opts == NULL ? NULL : &opts->terrain;
+    size_t pix_bytes = (size_t) source->num_bands * 2 * sizeof(double) +
+                       gistk_terrain_count(terrain) * sizeof(float) +
+                       sizeof(double);
+    return (size_t) (width + 2) * height * pix_bytes;
+}
+
+// -----------------------------------------------------------------------
+void gistk_cut_raster_stream(const gistk_raster_driver_t tool,
+                const gistk_raster_t * source, const char * filename,
+                    int win_min_x, int win_min_y,
+                    int win_max_x, int win_max_y,
+                    const gistk_cut_opts_t * opts,
+                    size_t budget,
+                    gistk_raster_t * result) {
 
     // Check the memory validity of the result object
     gistk_check_raster_init(GISTK_ERRC_CUT_RST_INIT, filename, result);
 
-    // sort the window parameter
-    sort_int( &win_min_x, &win_max_x);
-    sort_int( &win_min_y, &win_max_y);
-
-    // Check the boundaries of the pixel
-    if ( win_min_x < 0) win_min_x = 0;
-    if ( win_max_x < 0) win_max_x = 0;
-    if ( win_min_y < 0) win_min_y = 0;
-    if ( win_max_y < 0) win_max_y = 0;
-    if ( win_min_x > source.num_cols-1) win_min_x = source.num_cols-1;
-    if ( win_max_x > source.num_cols-1) win_max_x = source.num_cols-1;
-    if ( win_min_y > source.num_rows-1) win_min_y = source.num_rows-1;
-    if ( win_max_y > source.num_rows-1) win_max_y = source.num_rows-1;
-
-    // Calculate the width and heigh of the new image
+    // The strips carry the base scale only
+    if ( opts != NULL && opts->num_scales > 0 )
+        gistk_error_fatal(GISTK_ERRC_CUT_RST_SCALES,
+                          GISTK_ERRS_CUT_RST_SCALES,
+                          filename);
+
+    gistk_cut_window(source, filename,
+                     &win_min_x, &win_min_y, &win_max_x, &win_max_y);
     int width = win_max_x - win_min_x;
     int height = win_max_y - win_min_y;
 
-    // Prevent mal formed images
-    if ( width < 1 )
-        gistk_error_fatal(GISTK_ERRC_CUT_RST_WIDTH,
-                          GISTK_ERRS_CUT_RST_WIDTH ,
-                          filename);
+    // Bytes of the chip buffers per window row
+    const gistk_terrain_t * terrain = opts == NULL ? NULL : &opts->terrain;
+    size_t row_bytes = gistk_chip_bytes(source, opts, width, 1);
 
-    if ( height < 1 )
-        gistk_error_fatal(GISTK_ERRC_CUT_RST_HEIGHT,
-                          GISTK_ERRS_CUT_RST_HEIGHT,
-                          filename);
+    // Strips of whole source block rows, a single block row wider
+    // than the budget is split into fewer rows
+    int block_w, block_h;
+    GDALGetBlockSize(GDALGetRasterBand(source->data, 1), &block_w, &block_h);
+    size_t fit = budget / row_bytes;
+    int strip_rows = fit < 1 ? 1 : fit > (size_t) height ? height : (int) fit;
+    bool aligned = strip_rows >= block_h && strip_rows < height;
+    if ( aligned ) strip_rows -= strip_rows % block_h;
+
+    gistk_chip_t chip;
+    gistk_chip_init(&chip);
+
+    // The chip normalization needs the moments of the whole window,
+    // their pass reads the source bands without the terrain halo
+    bool streamed = strip_rows < height;
+    bool window_stats = streamed && opts != NULL &&
+                        opts->conv.norm == GISTK_NORM_CHIP &&
+                        ! ( gistk_terrain_count(terrain) > 0 && terrain->only );
+    gistk_cut_opts_t sums_opts;
+    if ( window_stats ) {
+      sums_opts = *opts;
+      gistk_terrain_init(&sums_opts.terrain);
+    }
+    int num_bands = source->num_bands;
+    double sum[num_bands], sqr[num_bands];
+    size_t cnt[num_bands];
+    for (int b=0; b < num_bands; b++) {
+      sum[b] = 0.0; sqr[b] = 0.0; cnt[b] = 0;
+    }
+
+    // Statistics of the target bands merged over the strips
+    int num_out = num_bands + GISTK_TERRAIN_NUM;
+    gistk_stats_t * volatile stats = NULL;
+    if ( opts != NULL && opts->stats ) {
+      stats = CPLMalloc(sizeof(gistk_stats_t) * num_out);
+      for (int b=0; b < num_out; b++) gistk_stats_init(&stats[b]);
+    }
 
-    // Get the sizes for the io buffer
-    GDALDataType in_types [source.num_bands];
-    int in_sizes [source.num_bands];
-    for(int b=0 ; b < source.num_bands; b++) {
-      GDALRasterBandH in_band = GDALGetRasterBand( source.data, b+1 );
-      in_types[b] = GDALGetRasterDataType( in_band );
-
-      int num_bits = GDALGetDataTypeSize( in_types[b] );
-      // @TODO Use GDALGetDataTypeSizeBytes( in_types[b] );
-      int num_bytes = num_bits / 8;
-      // @TODO Bit packed stuff?
-      // if ( num_bits % 8 > 0) num_bytes += 1;
-      in_sizes[b] = num_bytes;
+    // A caller trapping the errors goes on with the next cut, so the
+    // strip buffers are released before the error is passed on
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+      gistk_chip_free(&chip);
+      CPLFree(stats);
+      gistk_error_fatal(trap.code, "%s", trap.message);
     }
 
+    // An error bounded target is read back in a third pass
+    bool lossy = opts != NULL && opts->lossy != GISTK_LOSSY_NONE;
+    int num_pass = lossy ? 3 : 2;
+
+    for (int pass = window_stats ? 0 : 1; pass < num_pass; pass++) {
+      int y = win_min_y;
+      while ( y < win_max_y ) {
+
+        // End the strip at a block boundary of the source
+        int end = y + strip_rows;
+        if ( aligned && end % block_h != 0 && end - end % block_h > y )
+          end -= end % block_h;
+        if ( end > win_max_y ) end = win_max_y;
+
+        gistk_chip_read(source, filename, win_min_x, y, win_max_x, end,
+                        pass == 0 ? &sums_opts : opts, &chip);
+        size_t num_pix = (size_t) chip.width * chip.height;
+
+        if ( pass == 0 ) {
+          for (int b=0; b < chip.num_copied; b++)
+            gistk_conv_sums(chip.bands[b].in, num_pix,
+                            chip.bands[b].has_in_nodata,
+                            chip.bands[b].in_nodata,
+                            &sum[b], &sqr[b], &cnt[b]);
+        } else {
+          if ( window_stats )
+            for (int b=0; b < chip.num_copied; b++) {
+              chip.bands[b].has_stats = true;
+              gistk_conv_moments(sum[b], sqr[b], cnt[b],
+                                 &chip.bands[b].mean, &chip.bands[b].std);
+            }
+          gistk_chip_transform(opts, &chip);
+          if ( pass == 2 ) {
+            gistk_chip_check(opts, &chip, y - win_min_y, filename, result);
+            y = end;
+            continue;
+          }
+          if ( y == win_min_y )
+            gistk_chip_create(tool, source, filename, opts, &chip,
+                              width, height, result);
+          gistk_chip_put(opts, &chip, y - win_min_y, result);
+          if ( chip.with_stats )
+            for (int b=0; b < chip.num_copied + chip.num_derived; b++)
+              gistk_stats_merge(&stats[b], &chip.stats[b]);
+        }
+        y = end;
+      }
+
+      if ( pass != 1 ) continue;
+      if ( stats != NULL ) {
+        for (int b=0; b < result->num_bands; b++)
+          gistk_stats_write(GDALGetRasterBand(result->data, b+1), &stats[b]);
+        CPLFree(stats);
+        stats = NULL;
+      }
+      if ( lossy ) gistk_lossy_reopen(filename, result);
+    }
+    gistk_error_untrap(&trap);
+    gistk_chip_free(&chip);
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_init(gistk_chip_t * chip) {
+    memset(chip, 0, sizeof(gistk_chip_t));
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_free(gistk_chip_t * chip) {
+    for (int b=0; b < chip->mem_bands; b++) {
+        CPLFree(chip->bands[b].in);
+        CPLFree(chip->bands[b].out);
+    }
+    CPLFree(chip->bands);
+    for (int d=0; d < GISTK_TERRAIN_NUM; d++) CPLFree(chip->derived[d]);
+    CPLFree(chip->halo);
+    CPLFree(chip->dx);
+    CPLFree(chip->dy);
+    CPLFree(chip->stats);
+    memset(chip, 0, sizeof(gistk_chip_t));
+}
+
+// -----------------------------------------------------------------------
+// Grow the buffers of a chip, the memory is kept for the next chip
+static void gistk_chip_alloc(gistk_chip_t * chip, int num_bands,
+                             int num_derived, int width, int height) {
+
+    size_t num_pix = (size_t) width * height;
+    size_t num_halo = (size_t) (width + 2) * (height + 2);
+
+    if ( num_pix > chip->mem_pix || num_bands > chip->mem_bands ) {
+        size_t mem_pix = num_pix > chip->mem_pix ? num_pix : chip->mem_pix;
+        int mem_bands = num_bands > chip->mem_bands ? num_bands : chip->mem_bands;
+        chip->bands = CPLRealloc(chip->bands,
+                                 sizeof(gistk_chip_band_t) * mem_bands);
+        for (int b=0; b < mem_bands; b++) {
+            if ( b >= chip->mem_bands ) {
+                chip->bands[b].in = NULL;
+                chip->bands[b].out = NULL;
+            }
+            // Space for doubles, the widest type of the buffers
+            chip->bands[b].in = CPLRealloc(chip->bands[b].in,
+                                           sizeof(double) * mem_pix);
+            chip->bands[b].out = CPLRealloc(chip->bands[b].out,
+                                            sizeof(double) * mem_pix);
+        }
+        chip->mem_bands = mem_bands;
+        if ( num_pix > chip->mem_pix )
+            for (int d=0; d < GISTK_TERRAIN_NUM; d++)
+                if ( chip->derived[d] != NULL )
+                    chip->derived[d] = CPLRealloc(chip->derived[d],
+                                                  sizeof(float) * mem_pix);
+        chip->mem_pix = mem_pix;
+    }
+
+    if ( num_derived > 0 ) {
+        for (int d=0; d < num_derived; d++)
+            if ( chip->derived[d] == NULL )
+                chip->derived[d] = CPLMalloc(sizeof(float) * chip->mem_pix);
+        if ( num_halo > chip->mem_halo ) {
+            chip->halo = CPLRealloc(chip->halo, sizeof(double) * num_halo);
+            chip->mem_halo = num_halo;
+        }
+        if ( height > chip->mem_rows ) {
+            chip->dx = CPLRealloc(chip->dx, sizeof(double) * height);
+            chip->dy = CPLRealloc(chip->dy, sizeof(double) * height);
+            chip->mem_rows = height;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_read(const gistk_raster_t * source,
+                     const char * filename,
+                     int win_min_x, int win_min_y,
+                     int win_max_x, int win_max_y,
+                     const gistk_cut_opts_t * opts,
+                     gistk_chip_t * chip) {
+
+    gistk_cut_window(source, filename,
+                     &win_min_x, &win_min_y, &win_max_x, &win_max_y);
+    int width = win_max_x - win_min_x;
+    int height = win_max_y - win_min_y;
+
+    // Pixel conversion requested?
+    const gistk_conv_t * conv = opts == NULL ? NULL : &opts->conv;
+    chip->convert = ! gistk_conv_is_identity(conv);
+
+    // Terrain derivatives are appended to the source bands
+    const gistk_terrain_t * terrain = opts == NULL ? NULL : &opts->terrain;
+    chip->num_derived = gistk_terrain_count(terrain);
+    chip->num_copied = chip->num_derived > 0 && terrain->only ?
+                       0 : source->num_bands;
+
+    gistk_chip_alloc(chip, source->num_bands, chip->num_derived,
+                     width, height);
+
+    chip->win_x = win_min_x;
+    chip->win_y = win_min_y;
+    chip->width = width;
+    chip->height = height;
+    chip->scale = 1;
+    chip->with_stats = false;
+
+    // Multi scale cuts reduce doubles
+    chip->doubles = chip->convert || ( opts != NULL && opts->num_scales > 0 );
+
+    // Get the types, nodata values and sizes for the io buffer
+    for(int b=0 ; b < source->num_bands; b++) {
+      gistk_chip_band_t * cb = &chip->bands[b];
+      GDALRasterBandH in_band = GDALGetRasterBand( source->data, b+1 );
+      cb->in_type = GDALGetRasterDataType( in_band );
+
+      int has = 0;
+      cb->in_nodata = GDALGetRasterNoDataValue( in_band, &has );
+      cb->has_in_nodata = has != 0;
+
+      cb->out_type = cb->in_type;
+      cb->has_out_nodata = false;
+      cb->out_nodata = 0.0;
+      cb->has_stats = false;
+      if ( chip->convert )
+        gistk_conv_resolve(conv, cb->in_type, cb->has_in_nodata,
+                           &cb->out_type, &cb->has_out_nodata,
+                           &cb->out_nodata);
+
+      if ( b >= chip->num_copied ) continue;
+
+      // Read unchanged pixels in their own type, converted pixels
+      // as doubles
+      gistk_raster_read( source, b+1,
+                         win_min_x, win_min_y, width, height,
+                         cb->in, chip->doubles ? GDT_Float64 : cb->in_type, 0 );
+    }
+
+    // The derived bands need the first band with a halo of one pixel
+    // and the metric cell size of every row
+    if ( chip->num_derived > 0 ) {
+      int rx0, ry0, rw, rh;
+      gistk_terrain_window(source->num_cols, source->num_rows,
+                           win_min_x, win_min_y, width, height,
+                           &rx0, &ry0, &rw, &rh);
+      int ox = rx0 - (win_min_x - 1);
+      int oy = ry0 - (win_min_y - 1);
+      gistk_raster_read(source, 1, rx0, ry0, rw, rh,
+                        chip->halo + (size_t) oy * (width + 2) + ox,
+                        GDT_Float64, (width + 2) * (int) sizeof(double));
+      gistk_terrain_pad(chip->halo, width, height, ox, oy, rw, rh);
+      for (int r=0; r < height; r++)
+        gistk_terrain_cellsize(source->srs, source->trfm, win_min_y + r,
+                               &chip->dx[r], &chip->dy[r]);
+    }
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_transform(const gistk_cut_opts_t * opts,
+                          gistk_chip_t * chip) {
+
+    size_t num_pix = (size_t) chip->width * chip->height;
+
+    if ( chip->convert ) {
+      const gistk_conv_t * conv = &opts->conv;
+      for (int b=0; b < chip->num_copied; b++) {
+        gistk_chip_band_t * cb = &chip->bands[b];
+        double mean = 0.0; double std = 1.0;
+        if ( conv->norm == GISTK_NORM_CHIP && cb->has_stats ) {
+          mean = cb->mean;
+          std = cb->std;
+        } else if ( conv->norm == GISTK_NORM_CHIP ) {
+          gistk_conv_stats(cb->in, num_pix,
+                           cb->has_in_nodata, cb->in_nodata, &mean, &std);
+        }
+        gistk_conv_apply(conv, cb->in, num_pix,
+                         cb->has_in_nodata, cb->in_nodata, mean, std,
+                         cb->out_type, cb->out_nodata, cb->out);
+      }
+    }
+
+    if ( chip->num_derived > 0 )
+      gistk_terrain_apply(&opts->terrain, chip->halo,
+                          chip->width, chip->height, chip->dx, chip->dy,
+                          chip->bands[0].has_in_nodata,
+                          chip->bands[0].in_nodata, chip->derived);
+
+    // Statistics of the target bands while the pixels are in memory
+    if ( opts != NULL && opts->stats ) {
+      int num_out = chip->num_copied + chip->num_derived;
+      if ( num_out > chip->mem_stats ) {
+        chip->stats = CPLRealloc(chip->stats, sizeof(gistk_stats_t) * num_out);
+        chip->mem_stats = num_out;
+      }
+      for (int b=0; b < chip->num_copied; b++) {
+        const gistk_chip_band_t * cb = &chip->bands[b];
+        gistk_stats_init(&chip->stats[b]);
+        if ( chip->convert )
+          gistk_stats_add_typed(&chip->stats[b], cb->out, cb->out_type,
+                                num_pix, cb->has_out_nodata, cb->out_nodata);
+        else
+          gistk_stats_add_typed(&chip->stats[b], cb->in,
+                                chip->doubles ? GDT_Float64 : cb->in_type,
+                                num_pix, cb->has_in_nodata, cb->in_nodata);
+      }
+      for (int d=0; d < chip->num_derived; d++) {
+        gistk_stats_t * stats = &chip->stats[chip->num_copied + d];
+        gistk_stats_init(stats);
+        gistk_stats_add_typed(stats, chip->derived[d], GDT_Float32, num_pix,
+                              true, GISTK_TERRAIN_NODATA);
+      }
+      chip->with_stats = true;
+    }
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_scale(const gistk_cut_opts_t * opts,
+                      const gistk_chip_t * chip,
+                      int factor, int width, int height,
+                      gistk_chip_t * result) {
+
+    gistk_chip_alloc(result, chip->num_copied, 0, width, height);
+
+    // Centered part of the chip covered by the reduced chip
+    int offs_x = (chip->width - width * factor) / 2;
+    int offs_y = (chip->height - height * factor) / 2;
+
+    result->win_x = chip->win_x + offs_x;
+    result->win_y = chip->win_y + offs_y;
+    result->width = width;
+    result->height = height;
+    result->scale = chip->scale * factor;
+    result->num_copied = chip->num_copied;
+    result->num_derived = 0;
+    result->doubles = true;
+    result->convert = true;
+
+    // The statistics of the reduced pixels, not of the source chip,
+    // are computed by gistk_chip_transform on the scaled chip
+    result->with_stats = false;
+
+    for (int b=0; b < chip->num_copied; b++) {
+      const gistk_chip_band_t * cb = &chip->bands[b];
+      gistk_chip_band_t * rb = &result->bands[b];
+      rb->in_type = cb->in_type;
+      rb->out_type = cb->out_type;
+      rb->has_out_nodata = cb->has_out_nodata;
+      rb->out_nodata = cb->out_nodata;
+      rb->has_stats = false;
+
+      // Blocks without valid pixels get the source nodata value, a
+      // source without one falls back to the target nodata value and
+      // only then to NaN, so the blocks never carry an undefined value
+      bool has_nodata = cb->has_in_nodata ||
+                        ( chip->convert && cb->has_out_nodata );
+      double nodata = cb->has_in_nodata ? cb->in_nodata :
+                      has_nodata ? cb->out_nodata : NAN;
+      rb->has_in_nodata = has_nodata;
+      rb->in_nodata = nodata;
+
+      // Without conversion the reduced doubles go back to the source
+      // type and keep the source nodata value
+      if ( ! chip->convert ) {
+        rb->has_out_nodata = has_nodata;
+        rb->out_nodata = nodata;
+      }
+
+      const double * in = (const double *) cb->in +
+                          (size_t) offs_y * chip->width + offs_x;
+      if ( opts->reduce == GISTK_REDUCE_GAUSS )
+        gistk_scale_gauss(in, chip->width, width, height, factor,
+                          cb->has_in_nodata, nodata, rb->in);
+      else
+        gistk_scale_box(in, chip->width, width, height, factor,
+                        cb->has_in_nodata, nodata, rb->in);
+    }
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_create(const gistk_raster_driver_t tool,
+                       const gistk_raster_t * source,
+                       const char * filename,
+                       const gistk_cut_opts_t * opts,
+                       const gistk_chip_t * chip,
+                       int width, int height,
+                       gistk_raster_t * result) {
+
+    // Check the memory validity of the result object
+    gistk_check_raster_init(GISTK_ERRC_CUT_RST_INIT, filename, result);
+
+    // Derived bands are floats and share the type of the target, an
+    // integer type would truncate them and miss their nodata value
+    GDALDataType create_type = chip->num_copied > 0 ?
+                               chip->bands[0].out_type : opts->conv.out_type;
+    if ( chip->num_derived > 0 &&
+         create_type != GDT_Float32 && create_type != GDT_Float64 )
+      create_type = GDT_Float32;
+
+    // Large cuts may pass the 4 GB limit of classic TIFF
+    char ** create_opts = NULL;
+    if ( EQUAL(GDALGetDriverShortName(tool.driver), GISTK_FMT_GTIFF) ) {
+      create_opts = CSLSetNameValue(create_opts, "BIGTIFF", "IF_SAFER");
+
+      // A streamed target is written in strips of source block rows,
+      // tiles of the source block size keep the writes block aligned
+      if ( chip->height < height ) {
+        int block_w, block_h;
+        GDALGetBlockSize(GDALGetRasterBand(source->data, 1),
+                         &block_w, &block_h);
+        create_opts = CSLSetNameValue(create_opts, "TILED", "YES");
+        if ( block_w < source->num_cols &&
+             block_w % 16 == 0 && block_h % 16 == 0 ) {
+          char value[32];
+          snprintf(value, sizeof(value), "%d", block_w);
+          create_opts = CSLSetNameValue(create_opts, "BLOCKXSIZE", value);
+          snprintf(value, sizeof(value), "%d", block_h);
+          create_opts = CSLSetNameValue(create_opts, "BLOCKYSIZE", value);
+        }
+      }
+    }
+
+    // Error bounded codec of the target
+    if ( opts != NULL )
+      create_opts = gistk_lossy_options(tool.driver, opts->lossy,
+                                        opts->max_error, create_type,
+                                        create_opts);
+
     // Create a new raster file
+    result->cache = NULL;
     result->data = GDALCreate( tool.driver, filename,
                                width,  height,
-                               source.num_bands,
-                               in_types[0], NULL);
+                               chip->num_copied + chip->num_derived,
+                               create_type, create_opts);
+    CSLDestroy(create_opts);
+    if ( result->data == NULL )
+        gistk_error_fatal(GISTK_ERRC_CUT_RST_CREATE,
+                          GISTK_ERRS_CUT_RST_CREATE,
+                          filename);
 
     // Create th new transformation
     double goffx = 0; double goffy = 0;
-    trfm_pix_geo(source.trfm, win_min_x, win_min_y, &goffx, &goffy);
+    trfm_pix_geo(source->trfm, chip->win_x, chip->win_y, &goffx, &goffy);
 
     result->trfm[0] = goffx;
-    result->trfm[1] = source.trfm[1];
-    result->trfm[2] = source.trfm[2];
+    result->trfm[1] = source->trfm[1] * chip->scale;
+    result->trfm[2] = source->trfm[2] * chip->scale;
     result->trfm[3] = goffy;
-    result->trfm[4] = source.trfm[4];
-    result->trfm[5] = source.trfm[5];
+    result->trfm[4] = source->trfm[4] * chip->scale;
+    result->trfm[5] = source->trfm[5] * chip->scale;
 
     // Set transformation an coordinate system
     GDALSetGeoTransform(result->data, result->trfm);
-    GDALSetProjection(result->data, source.proj_info);
+    GDALSetProjection(result->data, source->proj_info);
 
-    // TRansfer the image data
-    for (int b=0; b < source.num_bands; b++) {
-
-      GDALRasterBandH in_band = GDALGetRasterBand( source.data, b+1 );
-
-      // alloc io buffer for the copy @todo static
-      void *io_buffer = CPLMalloc(in_sizes[b] * width * height);
-
-      // copy pixels
-      GDALRasterIO( in_band, GF_Read,
-		    win_min_x, win_min_y, width, height,
-		    io_buffer, width, height, in_types[b], 0, 0 );
-
-      // address pixel to band handle of and copy the io buffer
-      GDALRasterBandH out_band = GDALGetRasterBand(result->data, b+1);
-      GDALRasterIO( out_band, GF_Write, 0, 0, width, height,
-		    io_buffer, width, height, in_types[b], 0, 0 );
-      // free io buffer
-      CPLFree(io_buffer);
+    // Nodata values and names of the bands, an unconverted band keeps
+    // the source nodata, so a codec like LERC masks it instead of
+    // encoding it as a value
+    for (int b=0; b < chip->num_copied; b++) {
+      const gistk_chip_band_t * cb = &chip->bands[b];
+      if ( chip->convert ? cb->has_out_nodata : cb->has_in_nodata )
+        GDALSetRasterNoDataValue(GDALGetRasterBand(result->data, b+1),
+                                 chip->convert ? cb->out_nodata :
+                                                 cb->in_nodata);
+    }
+    for (int d=0; d < chip->num_derived; d++) {
+      GDALRasterBandH out_band =
+        GDALGetRasterBand(result->data, chip->num_copied + d + 1);
+      GDALSetDescription(out_band, gistk_terrain_name(&opts->terrain, d));
+      GDALSetRasterNoDataValue(out_band, GISTK_TERRAIN_NODATA);
     }
 
     // Set the remaining parts for the raster
     result->proj_info = GDALGetProjectionRef(result->data);
     result->srs  = OSRNewSpatialReference(result->proj_info);
-    result->num_bands = source.num_bands;
+    result->num_bands = chip->num_copied + chip->num_derived;
     result->num_cols = width;
     result->num_rows = height;
     result->readonly = false;
     result->is_open  = true;
 }
 
+// -----------------------------------------------------------------------
+void gistk_chip_put(const gistk_cut_opts_t * opts,
+                    const gistk_chip_t * chip, int row,
+                    gistk_raster_t * result) {
+
+    int width = chip->width;
+    int height = chip->height;
+    size_t num_pix = (size_t) width * height;
+
+    // Float bands of the quant codec are written from a rounded copy
+    double step = 0.0;
+    double * quant = NULL;
+    if ( opts != NULL && opts->lossy == GISTK_LOSSY_QUANT ) {
+      step = gistk_lossy_step(opts->max_error);
+      quant = CPLMalloc(sizeof(double) * num_pix);
+    }
+
+    // TRansfer the image data
+    for (int b=0; b < chip->num_copied + chip->num_derived; b++) {
+      GDALRasterBandH out_band = GDALGetRasterBand(result->data, b+1);
+      GDALDataType type;
+      bool has_nodata;
+      double nodata;
+      const void * data = gistk_chip_band_data(chip, b, &type,
+                                               &has_nodata, &nodata);
+      GDALDataType band_type = GDALGetRasterDataType(out_band);
+      if ( quant != NULL &&
+           ( band_type == GDT_Float32 || band_type == GDT_Float64 ) ) {
+        GDALCopyWords((void *) data, type, GDALGetDataTypeSize(type) / 8,
+                      quant, GDT_Float64, sizeof(double), (int) num_pix);
+        gistk_lossy_quantize(quant, num_pix, has_nodata, nodata, step);
+        data = quant;
+        type = GDT_Float64;
+      }
+      GDALRasterIO( out_band, GF_Write, 0, row, width, height,
+                    (void *) data, width, height, type, 0, 0 );
+    }
+    CPLFree(quant);
+}
+
+// -----------------------------------------------------------------------
+void gistk_chip_write(const gistk_raster_driver_t tool,
+                      const gistk_raster_t * source,
+                      const char * filename,
+                      const gistk_cut_opts_t * opts,
+                      const gistk_chip_t * chip,
+                      gistk_raster_t * result) {
+    gistk_chip_create(tool, source, filename, opts, chip,
+                      chip->width, chip->height, result);
+    gistk_chip_put(opts, chip, 0, result);
+    if ( chip->with_stats )
+      for (int b=0; b < result->num_bands; b++)
+        gistk_stats_write(GDALGetRasterBand(result->data, b+1),
+                          &chip->stats[b]);
+
+    // Read the error bounded target back through its codec
+    if ( opts != NULL && opts->lossy != GISTK_LOSSY_NONE ) {
+      gistk_lossy_reopen(filename, result);
+      gistk_chip_check(opts, chip, 0, filename, result);
+    }
+}
 
 // =====================================================================
 // EOF
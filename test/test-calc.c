@@ -0,0 +1,117 @@
+// =====================================================================
+// Tests of the band math expressions
+// =====================================================================
+
+#include <setjmp.h>
+#include <cpl_conv.h>
+#include "ifgdv/error.h"
+#include "ifgdv/calc.h"
+#include "test.h"
+
+// Pixels of a test block
+#define TEST_PIXELS 3
+
+// Variables of the test expressions
+static const char * const test_names[] = { "A", "B" };
+
+// ----------------------------------------------------------------
+// Evaluates an expression over the pixels a[i], b[i]
+static void test_eval(const char * expr, const double * a, const double * b,
+                      double * out) {
+    gistk_calc_t calc;
+    gistk_calc_compile(expr, 2, test_names, &calc);
+    const double * vars[2] = { a, b };
+    double * work = CPLMalloc(sizeof(double) *
+                              (gistk_calc_work_size(&calc, TEST_PIXELS) + 1));
+    gistk_calc_eval(&calc, vars, TEST_PIXELS, work, out);
+    CPLFree(work);
+    gistk_calc_free(&calc);
+}
+
+// ----------------------------------------------------------------
+// Result of an expression for A = NaN, 6, 4 and B = 1, NaN, 0
+static void test_nan(const char * expr,
+                     double nan_a, double six, double four) {
+    const double a[TEST_PIXELS] = { NAN, 6.0, 4.0 };
+    const double b[TEST_PIXELS] = { 1.0, NAN, 0.0 };
+    const double want[TEST_PIXELS] = { nan_a, six, four };
+    double out[TEST_PIXELS];
+    test_eval(expr, a, b, out);
+    for (int i=0; i < TEST_PIXELS; i++) {
+        bool ok = isnan(want[i]) ? isnan(out[i]) : out[i] == want[i];
+        if ( ! ok )
+            fprintf(stderr, "%s: pixel %d is %g, not %g\n",
+                    expr, i, out[i], want[i]);
+        CHECK(ok);
+    }
+}
+
+// ----------------------------------------------------------------
+// Nodata propagates through the arithmetic, the comparisons, the
+// logic operators and the condition of ?:
+static void test_propagation(void) {
+    test_nan("A + 1", NAN, 7.0, 5.0);
+    test_nan("A > 5", NAN, 1.0, 0.0);
+    test_nan("A > 5 ? 1 : 0", NAN, 1.0, 0.0);
+    test_nan("!(A > 5)", NAN, 0.0, 1.0);
+    test_nan("A > 5 && 1", NAN, 1.0, 0.0);
+    test_nan("A > 5 || 0", NAN, 1.0, 0.0);
+    test_nan("A == A", NAN, 1.0, 1.0);
+    test_nan("min(A, 5)", NAN, 5.0, 4.0);
+    test_nan("max(A, 5)", NAN, 6.0, 5.0);
+    test_nan("A < 5 ? 2 : 3", NAN, 3.0, 2.0);
+
+    // Nodata of B only where it is used
+    test_nan("B", 1.0, NAN, 0.0);
+    test_nan("A > 5 ? B : A", NAN, NAN, 4.0);
+    test_nan("A > 5 ? A : B", NAN, 6.0, 0.0);
+    test_nan("A && B", NAN, NAN, 0.0);
+
+    // isnodata is the only way to test nodata
+    test_nan("isnodata(A)", 1.0, 0.0, 0.0);
+    test_nan("isnodata(A) ? -1 : A", -1.0, 6.0, 4.0);
+    test_nan("isnodata(A + B) ? 0 : A + B", 0.0, 0.0, 4.0);
+    test_nan("A == nodata", NAN, NAN, NAN);
+}
+
+// ----------------------------------------------------------------
+// Constant parts are folded with the same rules
+static void test_folding(void) {
+    test_nan("nodata", NAN, NAN, NAN);
+    test_nan("nodata > 1 ? 1 : 2", NAN, NAN, NAN);
+    test_nan("isnodata(nodata) ? A : 0", NAN, 6.0, 4.0);
+    test_nan("2 > 1 ? A : B", NAN, 6.0, 4.0);
+    test_nan("1 + 2 * 3 ^ 2", 19.0, 19.0, 19.0);
+    test_nan("(1 - 1) || nodata", NAN, NAN, NAN);
+    test_nan("abs(-2) + floor(2.5) + ceil(0.5) + sqrt(4)", 7.0, 7.0, 7.0);
+}
+
+// ----------------------------------------------------------------
+// A syntax error is reported with its code
+static void test_syntax(const char * expr) {
+    gistk_calc_t calc;
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) == 0 ) {
+        gistk_calc_compile(expr, 2, test_names, &calc);
+        gistk_error_untrap(&trap);
+        fprintf(stderr, "%s: compiled\n", expr);
+        CHECK(false);
+    } else {
+        gistk_error_untrap(&trap);
+        CHECK(trap.code == GISTK_ERRC_CALC_SYNTAX);
+    }
+    gistk_calc_free(&calc);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    test_propagation();
+    test_folding();
+    test_syntax("A +");
+    test_syntax("C + 1");
+    test_syntax("A ? B");
+    test_syntax("min(A)");
+    test_syntax("(A");
+    return test_done("test-calc");
+}
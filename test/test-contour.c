@@ -0,0 +1,143 @@
+// =====================================================================
+// Tests of gtif-contour: closed rings across strips and threads
+// =====================================================================
+
+#define _XOPEN_SOURCE 700
+
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <gdal.h>
+#include <ogr_api.h>
+#include <ogr_srs_api.h>
+#include <cpl_conv.h>
+#include "test.h"
+
+// Tool under test, the first argument overrides it
+#define TEST_TOOL "./build/gtif-contour"
+
+// Size of the DEM, centre and height of its cone [cells]
+#define TEST_COLS 200
+#define TEST_ROWS 150
+#define TEST_CX   97.3
+#define TEST_CY   71.7
+#define TEST_TOP  50.0
+
+// Plateau around the cone, below the lowest ring
+#define TEST_FLOOR -25.0
+
+// Cell size and origin of the DEM
+#define TEST_CELL 2.0
+#define TEST_X0   1000.0
+#define TEST_Y0   5000.0
+
+// ----------------------------------------------------------------
+// Writes a cone on a plateau, all contours down to the plateau are
+// rings inside the DEM
+static bool test_dem(const char * filename) {
+    GDALDriverH driver = GDALGetDriverByName("GTiff");
+    if ( driver == NULL ) return false;
+    GDALDatasetH data = GDALCreate(driver, filename, TEST_COLS, TEST_ROWS, 1,
+                                   GDT_Float32, NULL);
+    if ( data == NULL ) return false;
+    double trfm[6] = { TEST_X0, TEST_CELL, 0.0, TEST_Y0, 0.0, -TEST_CELL };
+    GDALSetGeoTransform(data, trfm);
+    OGRSpatialReferenceH srs = OSRNewSpatialReference(NULL);
+    char * wkt = NULL;
+    OSRImportFromEPSG(srs, 25833);
+    OSRExportToWkt(srs, &wkt);
+    GDALSetProjection(data, wkt);
+    CPLFree(wkt);
+    OSRDestroySpatialReference(srs);
+
+    float * z = CPLMalloc(sizeof(float) * TEST_COLS * TEST_ROWS);
+    for (int row=0; row < TEST_ROWS; row++)
+        for (int col=0; col < TEST_COLS; col++) {
+            double v = TEST_TOP - hypot(col + 0.5 - TEST_CX, row + 0.5 - TEST_CY);
+            z[row * TEST_COLS + col] = (float) (v < TEST_FLOOR ? TEST_FLOOR : v);
+        }
+    bool ok = GDALRasterIO(GDALGetRasterBand(data, 1), GF_Write, 0, 0,
+                           TEST_COLS, TEST_ROWS, z, TEST_COLS, TEST_ROWS,
+                           GDT_Float32, 0, 0) == CE_None;
+    CPLFree(z);
+    GDALClose(data);
+    return ok;
+}
+
+// ----------------------------------------------------------------
+// Runs the tool and checks that it wrote one closed ring per level
+// at the distance of its level from the cone top
+static void test_rings(const char * tool, const char * dem,
+                       const char * out, const char * opts,
+                       const double * levels, int num_levels) {
+    char cmd[2048];
+    unlink(out);
+    snprintf(cmd, sizeof(cmd), "%s %s %s %s > /dev/null",
+             tool, opts, dem, out);
+    CHECK(system(cmd) == 0);
+
+    GDALDatasetH data = GDALOpenEx(out, GDAL_OF_VECTOR, NULL, NULL, NULL);
+    CHECK(data != NULL);
+    if ( data == NULL ) return;
+    OGRLayerH layer = GDALDatasetGetLayer(data, 0);
+    int field = OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(layer), "level");
+    int found[64];
+    memset(found, 0, sizeof(found));
+    int num_features = 0;
+    double cx = TEST_X0 + TEST_CX * TEST_CELL;
+    double cy = TEST_Y0 - TEST_CY * TEST_CELL;
+    OGRFeatureH feature;
+    while ( (feature = OGR_L_GetNextFeature(layer)) != NULL ) {
+        num_features++;
+        double level = OGR_F_GetFieldAsDouble(feature, field);
+        for (int l=0; l < num_levels; l++)
+            if ( level == levels[l] ) found[l]++;
+
+        OGRGeometryH line = OGR_F_GetGeometryRef(feature);
+        int n = OGR_G_GetPointCount(line);
+        CHECK(n >= 4);
+        CHECK(OGR_G_GetX(line, 0) == OGR_G_GetX(line, n - 1));
+        CHECK(OGR_G_GetY(line, 0) == OGR_G_GetY(line, n - 1));
+        double radius = (TEST_TOP - level) * TEST_CELL;
+        double worst = 0.0;
+        for (int i=0; i < n; i++) {
+            double d = hypot(OGR_G_GetX(line, i) - cx,
+                             OGR_G_GetY(line, i) - cy);
+            if ( fabs(d - radius) > worst ) worst = fabs(d - radius);
+        }
+        CHECK(worst < TEST_CELL);
+        OGR_F_Destroy(feature);
+    }
+    GDALClose(data);
+    CHECK(num_features == num_levels);
+    for (int l=0; l < num_levels; l++) CHECK(found[l] == 1);
+}
+
+// ----------------------------------------------------------------
+int main(int argc, char ** argv) {
+    const char * tool = argc > 1 ? argv[1] : TEST_TOOL;
+    GDALAllRegister();
+    char dir[] = "/tmp/test-contour.XXXXXX";
+    if ( mkdtemp(dir) == NULL ) {
+        perror("test-contour");
+        return EXIT_FAILURE;
+    }
+    char dem[256], out[256];
+    snprintf(dem, sizeof(dem), "%s/cone.tif", dir);
+    snprintf(out, sizeof(out), "%s/rings.gpkg", dir);
+    CHECK(test_dem(dem));
+
+    // Levels of -i from the plateau up, strips much lower than the
+    // rings, so every ring is glued over several strip borders; the
+    // simplified rings keep their ends
+    const double every[] = { -20, -10, 0, 10, 20, 30, 40 };
+    test_rings(tool, dem, out, "-i 10 -T 16 -j 4", every, 7);
+    test_rings(tool, dem, out, "-i 10 -T 1 -j 3 -s 1", every, 7);
+    const double listed[] = { 5.5, 25, 49 };
+    test_rings(tool, dem, out, "-l 25,49,5.5 -T 7 -j 2", listed, 3);
+
+    unlink(dem);
+    unlink(out);
+    rmdir(dir);
+    return test_done("test-contour");
+}
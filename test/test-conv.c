@@ -0,0 +1,81 @@
+// =====================================================================
+// Tests of the pixel conversion
+// =====================================================================
+
+#include <stdint.h>
+#include "ifgdv/conv.h"
+#include "test.h"
+
+// ----------------------------------------------------------------
+// A float source without nodata gets one, its NaN pixels map to it
+static void test_resolve(void) {
+    gistk_conv_t conv;
+    gistk_conv_init(&conv);
+    GDALDataType type;
+    bool has_nodata;
+    double nodata;
+
+    gistk_conv_resolve(&conv, GDT_Float32, false, &type, &has_nodata, &nodata);
+    CHECK(type == GDT_Float32);
+    CHECK(has_nodata);
+    CHECK_NAN(nodata);
+
+    gistk_conv_resolve(&conv, GDT_Int16, false, &type, &has_nodata, &nodata);
+    CHECK(type == GDT_Int16);
+    CHECK(! has_nodata);
+
+    conv.out_type = GDT_Int16;
+    gistk_conv_resolve(&conv, GDT_Float32, false, &type, &has_nodata, &nodata);
+    CHECK(type == GDT_Int16);
+    CHECK(has_nodata);
+    CHECK(nodata == -32768.0);
+
+    conv.out_type = GDT_Byte;
+    conv.has_out_nodata = true;
+    conv.out_nodata = 0.0;
+    gistk_conv_resolve(&conv, GDT_Int16, false, &type, &has_nodata, &nodata);
+    CHECK(has_nodata);
+    CHECK(nodata == 0.0);
+}
+
+// ----------------------------------------------------------------
+// Scaling, rounding and clamping keep the nodata value free
+static void test_apply(void) {
+    gistk_conv_t conv;
+    gistk_conv_init(&conv);
+    conv.out_type = GDT_Byte;
+    conv.scale = 2.0;
+    conv.offset = 1.0;
+    GDALDataType type;
+    bool has_nodata;
+    double nodata;
+    gistk_conv_resolve(&conv, GDT_Float64, false, &type, &has_nodata, &nodata);
+    CHECK(nodata == 255.0);
+
+    const double in[] = { 0.0, 1.2, -7.0, 200.0, NAN, -9999.0 };
+    uint8_t out[6];
+    gistk_conv_apply(&conv, in, 6, true, -9999.0, 0.0, 1.0,
+                     type, nodata, out);
+    CHECK(out[0] == 1);
+    CHECK(out[1] == 3);
+    CHECK(out[2] == 0);
+    CHECK(out[3] == 254);
+    CHECK(out[4] == 255);
+    CHECK(out[5] == 255);
+
+    // NaN pixels of a float source without nodata
+    gistk_conv_init(&conv);
+    gistk_conv_resolve(&conv, GDT_Float32, false, &type, &has_nodata, &nodata);
+    float fout[6];
+    gistk_conv_apply(&conv, in, 6, false, 0.0, 0.0, 1.0, type, nodata, fout);
+    CHECK(fout[1] == 1.2f);
+    CHECK_NAN(fout[4]);
+    CHECK(fout[5] == -9999.0f);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    test_resolve();
+    test_apply();
+    return test_done("test-conv");
+}
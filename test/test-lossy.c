@@ -0,0 +1,195 @@
+// =====================================================================
+// Tests of the error bounded storage
+// =====================================================================
+
+#include <setjmp.h>
+#include <cpl_vsi.h>
+#include "ifgdv/error.h"
+#include "ifgdv/lossy.h"
+#include "test.h"
+
+// Size of the test bands
+#define TEST_COLS 64
+#define TEST_ROWS 48
+
+// Maximal error of the tests and the nodata value
+#define TEST_ERROR  0.05
+#define TEST_NODATA -9999.0
+
+// ----------------------------------------------------------------
+static void test_parse(void) {
+    gistk_lossy_t mode;
+    double max_error;
+    CHECK(gistk_lossy_parse("0.01", &mode, &max_error));
+    CHECK(mode == GISTK_LOSSY_LERC && max_error == 0.01);
+    CHECK(gistk_lossy_parse("quant:0.5", &mode, &max_error));
+    CHECK(mode == GISTK_LOSSY_QUANT && max_error == 0.5);
+    CHECK(gistk_lossy_parse("lerc:2", &mode, &max_error));
+    CHECK(mode == GISTK_LOSSY_LERC && max_error == 2.0);
+    CHECK(! gistk_lossy_parse("zip:0.1", &mode, &max_error));
+    CHECK(! gistk_lossy_parse("quant:", &mode, &max_error));
+    CHECK(! gistk_lossy_parse("lerc:0", &mode, &max_error));
+    CHECK(! gistk_lossy_parse("-1", &mode, &max_error));
+    CHECK(! gistk_lossy_parse("0.1m", &mode, &max_error));
+    CHECK(strcmp(gistk_lossy_name(GISTK_LOSSY_QUANT), "quant") == 0);
+}
+
+// ----------------------------------------------------------------
+// The step is a power of two in (e, 2e], quantized floats stay
+// within the bound and nodata and NaN are kept
+static void test_quantize(void) {
+    const double errors[] = { 0.01, 0.05, 0.5, 1.0, 3.0 };
+    for (int e=0; e < 5; e++) {
+        double step = gistk_lossy_step(errors[e]);
+        int exp2;
+        CHECK(frexp(step, &exp2) == 0.5);
+        CHECK(step > errors[e] && step <= 2.0 * errors[e]);
+    }
+
+    double step = gistk_lossy_step(TEST_ERROR);
+    double worst = 0.0;
+    srand(7);
+    for (int i=0; i < 100000; i++) {
+        float v = (float) ((rand() / (double) RAND_MAX - 0.5) * 2e4);
+        double q = v;
+        gistk_lossy_quantize(&q, 1, false, 0.0, step);
+        double err = fabs((double) (float) q - v);
+        if ( err > worst ) worst = err;
+    }
+    CHECK(worst <= TEST_ERROR);
+
+    double values[] = { TEST_NODATA, NAN, 1.013, -2.49 };
+    gistk_lossy_quantize(values, 4, true, TEST_NODATA, step);
+    CHECK(values[0] == TEST_NODATA);
+    CHECK_NAN(values[1]);
+    CHECK(values[2] == 1.0);
+    CHECK(fabs(values[3] + 2.49) <= TEST_ERROR);
+}
+
+// ----------------------------------------------------------------
+// Values of the test band, a slope with a nodata hole
+static void test_values(float * values) {
+    for (int r=0; r < TEST_ROWS; r++)
+        for (int c=0; c < TEST_COLS; c++)
+            values[r * TEST_COLS + c] =
+                (float) (-30.0 + 0.37 * c + 0.11 * r * r + 0.013 * c * r);
+    for (int r=10; r < 14; r++)
+        for (int c=20; c < 26; c++)
+            values[r * TEST_COLS + c] = (float) TEST_NODATA;
+}
+
+// ----------------------------------------------------------------
+// Compares a band written with changed values against the values
+static long test_check(float * values, int cell, float change,
+                       double * worst) {
+    GDALDatasetH data = GDALCreate(GDALGetDriverByName("MEM"), "",
+                                   TEST_COLS, TEST_ROWS, 1, GDT_Float32, NULL);
+    float saved = values[cell];
+    values[cell] = change;
+    GDALRasterBandH band = GDALGetRasterBand(data, 1);
+    GDALRasterIO(band, GF_Write, 0, 0, TEST_COLS, TEST_ROWS, values,
+                 TEST_COLS, TEST_ROWS, GDT_Float32, 0, 0);
+    values[cell] = saved;
+    *worst = 0.0;
+    long num_bad = gistk_lossy_check(band, 0, TEST_COLS, TEST_ROWS,
+                                     values, GDT_Float32, true, TEST_NODATA,
+                                     TEST_ERROR, worst);
+    GDALClose(data);
+    return num_bad;
+}
+
+// ----------------------------------------------------------------
+// Values within the bound pass, nodata and NaN have to come back
+// exactly and no valid value may turn into them
+static void test_bound(float * values) {
+    double worst;
+    float saved = values[5];
+    values[5] = NAN;
+    int valid = 3 * TEST_COLS + 7;
+    int hole = 11 * TEST_COLS + 21;
+    CHECK(test_check(values, valid, values[valid], &worst) == 0);
+    CHECK(worst == 0.0);
+    CHECK(test_check(values, valid, values[valid] + 0.04f, &worst) == 0);
+    CHECK(worst > 0.03 && worst <= TEST_ERROR);
+    CHECK(test_check(values, valid, values[valid] + 0.1f, &worst) == 1);
+    CHECK(worst > TEST_ERROR);
+    CHECK(test_check(values, valid, (float) TEST_NODATA, &worst) == 1);
+    CHECK(isinf(worst));
+    CHECK(test_check(values, valid, NAN, &worst) == 1);
+    CHECK(test_check(values, hole, (float) TEST_NODATA + 0.01f, &worst) == 1);
+    CHECK(test_check(values, hole, NAN, &worst) == 1);
+    CHECK(test_check(values, 5, 0.0f, &worst) == 1);
+    CHECK(test_check(values, 5, NAN, &worst) == 0);
+    values[5] = saved;
+}
+
+// ----------------------------------------------------------------
+// Writes the values with a codec and reads them back, skipped if
+// GDAL lacks the codec
+static void test_round_trip(float * values, gistk_lossy_t mode) {
+    const char * name = "/vsimem/test-lossy.tif";
+    GDALDriverH driver = GDALGetDriverByName("GTiff");
+    char ** options = NULL;
+    gistk_error_trap_t trap;
+    gistk_error_trap(&trap);
+    if ( setjmp(trap.env) != 0 ) {
+        gistk_error_untrap(&trap);
+        CHECK(trap.code == GISTK_ERRC_LOSSY_CODEC);
+        printf("test-lossy: %s skipped, %s\n", gistk_lossy_name(mode),
+               trap.message);
+        return;
+    }
+    options = gistk_lossy_options(driver, mode, TEST_ERROR, GDT_Float32,
+                                  options);
+    gistk_error_untrap(&trap);
+
+    float * stored = CPLMalloc(sizeof(float) * TEST_COLS * TEST_ROWS);
+    memcpy(stored, values, sizeof(float) * TEST_COLS * TEST_ROWS);
+    if ( mode == GISTK_LOSSY_QUANT ) {
+        double step = gistk_lossy_step(TEST_ERROR);
+        for (int i=0; i < TEST_COLS * TEST_ROWS; i++) {
+            double v = stored[i];
+            gistk_lossy_quantize(&v, 1, true, TEST_NODATA, step);
+            stored[i] = (float) v;
+        }
+    }
+    GDALDatasetH data = GDALCreate(driver, name, TEST_COLS, TEST_ROWS, 1,
+                                   GDT_Float32, options);
+    CSLDestroy(options);
+    CHECK(data != NULL);
+    if ( data == NULL ) {
+        CPLFree(stored);
+        return;
+    }
+    GDALRasterBandH band = GDALGetRasterBand(data, 1);
+    GDALSetRasterNoDataValue(band, TEST_NODATA);
+    CHECK(GDALRasterIO(band, GF_Write, 0, 0, TEST_COLS, TEST_ROWS, stored,
+                       TEST_COLS, TEST_ROWS, GDT_Float32, 0, 0) == CE_None);
+    GDALClose(data);
+    CPLFree(stored);
+
+    data = GDALOpen(name, GA_ReadOnly);
+    CHECK(data != NULL);
+    if ( data == NULL ) return;
+    double worst = 0.0;
+    CHECK(gistk_lossy_check(GDALGetRasterBand(data, 1), 0,
+                            TEST_COLS, TEST_ROWS, values, GDT_Float32,
+                            true, TEST_NODATA, TEST_ERROR, &worst) == 0);
+    CHECK(worst <= TEST_ERROR);
+    GDALClose(data);
+    VSIUnlink(name);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    GDALAllRegister();
+    float * values = CPLMalloc(sizeof(float) * TEST_COLS * TEST_ROWS);
+    test_values(values);
+    test_parse();
+    test_quantize();
+    test_bound(values);
+    test_round_trip(values, GISTK_LOSSY_LERC);
+    test_round_trip(values, GISTK_LOSSY_QUANT);
+    CPLFree(values);
+    return test_done("test-lossy");
+}
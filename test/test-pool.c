@@ -0,0 +1,111 @@
+// =====================================================================
+// Tests of the worker pool
+// =====================================================================
+
+#include <string.h>
+#include <cpl_conv.h>
+#include "ifgdv/pipe.h"
+#include "test.h"
+
+// Items of the test runs
+#define TEST_ITEMS 1000
+
+// ----------------------------------------------------------------
+// Context of the test workers
+typedef struct {
+  gistk_pool_t * pool;
+  int seen[TEST_ITEMS];
+  int fail_at;          // item failing the run, -1 for none
+  int done;             // items done, guarded by the pool lock
+} test_ctx_t;
+
+// ----------------------------------------------------------------
+static void test_work(void * arg) {
+    test_ctx_t * ctx = arg;
+    int item;
+    while ( (item = gistk_pool_next(ctx->pool)) >= 0 ) {
+        ctx->seen[item]++;
+        pthread_mutex_lock(&ctx->pool->lock);
+        ctx->done++;
+        pthread_mutex_unlock(&ctx->pool->lock);
+        if ( item == ctx->fail_at ) gistk_pool_fail(ctx->pool);
+    }
+}
+
+// ----------------------------------------------------------------
+// Every item is taken exactly once, also on a reused pool
+static void test_items(gistk_pool_t * pool, test_ctx_t * ctx) {
+    for (int run=0; run < 2; run++) {
+        memset(ctx, 0, sizeof(test_ctx_t));
+        ctx->pool = pool;
+        ctx->fail_at = -1;
+        CHECK(gistk_pool_run(pool, TEST_ITEMS, 8, test_work, ctx));
+        CHECK(ctx->done == TEST_ITEMS);
+        int once = 0;
+        for (int i=0; i < TEST_ITEMS; i++) once += ctx->seen[i] == 1;
+        CHECK(once == TEST_ITEMS);
+        CHECK(pool->threads == NULL && pool->num_threads == 0);
+    }
+}
+
+// ----------------------------------------------------------------
+// A failed worker stops the run at the next item
+static void test_fail(gistk_pool_t * pool, test_ctx_t * ctx) {
+    memset(ctx, 0, sizeof(test_ctx_t));
+    ctx->pool = pool;
+    ctx->fail_at = 10;
+    CHECK(gistk_pool_run(pool, TEST_ITEMS, 1, test_work, ctx));
+    CHECK(ctx->done == 11);
+    CHECK(ctx->seen[10] == 1 && ctx->seen[11] == 0);
+    CHECK(pool->failed);
+    CHECK(gistk_pool_next(pool) < 0);
+
+    memset(ctx, 0, sizeof(test_ctx_t));
+    ctx->pool = pool;
+    ctx->fail_at = 10;
+    CHECK(gistk_pool_run(pool, TEST_ITEMS, 8, test_work, ctx));
+    CHECK(ctx->seen[10] == 1);
+    CHECK(ctx->done >= 11 && ctx->done < TEST_ITEMS);
+
+    // The next run starts over
+    memset(ctx, 0, sizeof(test_ctx_t));
+    ctx->pool = pool;
+    ctx->fail_at = -1;
+    CHECK(gistk_pool_run(pool, TEST_ITEMS, 4, test_work, ctx));
+    CHECK(! pool->failed);
+    CHECK(ctx->done == TEST_ITEMS);
+}
+
+// ----------------------------------------------------------------
+// At most one thread per item, a missing dataset fails the run
+static void test_limits(gistk_pool_t * pool, test_ctx_t * ctx) {
+    memset(ctx, 0, sizeof(test_ctx_t));
+    ctx->pool = pool;
+    ctx->fail_at = -1;
+    CHECK(gistk_pool_start(pool, 2, 16, test_work, ctx));
+    CHECK(pool->num_threads == 2);
+    gistk_pool_join(pool);
+    CHECK(ctx->done == 2);
+
+    CHECK(gistk_pool_threads("3") == 3);
+    CHECK(gistk_pool_threads(NULL) >= 1);
+
+    CPLPushErrorHandler(CPLQuietErrorHandler);
+    CHECK(gistk_pool_open(pool, "/nonexistent/test-pool.tif") == NULL);
+    CPLPopErrorHandler();
+    CHECK(pool->failed);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    GDALAllRegister();
+    gistk_pool_t pool;
+    gistk_pool_init(&pool);
+    test_ctx_t * ctx = CPLMalloc(sizeof(test_ctx_t));
+    test_items(&pool, ctx);
+    test_fail(&pool, ctx);
+    test_limits(&pool, ctx);
+    CPLFree(ctx);
+    gistk_pool_free(&pool);
+    return test_done("test-pool");
+}
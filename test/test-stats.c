@@ -0,0 +1,149 @@
+// =====================================================================
+// Tests of the band statistics
+// =====================================================================
+
+#include <string.h>
+#include <stdbool.h>
+#include "ifgdv/stats.h"
+#include "test.h"
+
+// Pixels and strips of the test band
+#define TEST_PIXELS 10000
+#define TEST_STRIPS 7
+
+// ----------------------------------------------------------------
+static void test_fill(double * values) {
+    srand(42);
+    for (int i=0; i < TEST_PIXELS; i++)
+        values[i] = (rand() / (double) RAND_MAX - 0.3) * 1000.0 * (i % 5 + 1);
+    values[17] = INFINITY;
+    values[18] = -INFINITY;
+    values[19] = NAN;
+    values[20] = -9999.0;
+}
+
+// ----------------------------------------------------------------
+// Strip j of the band in a strip split like the one of gtif-stats
+static void test_strip(int j, int * first, int * num) {
+    *first = (int) ((long) TEST_PIXELS * j / TEST_STRIPS);
+    *num = (int) ((long) TEST_PIXELS * (j + 1) / TEST_STRIPS) - *first;
+}
+
+// ----------------------------------------------------------------
+// The histogram holds each valid value in the bin of its range
+static bool test_binned(const gistk_stats_t * stats,
+                        const double * values, int n, double nodata) {
+    GUIntBig hist[GISTK_STATS_BINS];
+    memset(hist, 0, sizeof(hist));
+    for (int i=0; i < n; i++) {
+        double v = values[i];
+        if ( ! isfinite(v) || v == nodata ) continue;
+        if ( v < stats->lo || v >= stats->lo + stats->width ) return false;
+        hist[(int) ((v - stats->lo) * GISTK_STATS_BINS / stats->width)]++;
+    }
+    return memcmp(hist, stats->hist, sizeof(hist)) == 0;
+}
+
+// ----------------------------------------------------------------
+// Infinite values, NaN and nodata are no valid pixels
+static void test_invalid(const double * values) {
+    gistk_stats_t stats;
+    gistk_stats_init(&stats);
+    gistk_stats_add(&stats, values, TEST_PIXELS, true, -9999.0);
+    CHECK(stats.total == TEST_PIXELS);
+    CHECK(stats.count == TEST_PIXELS - 4);
+    CHECK(isfinite(stats.min) && isfinite(stats.max));
+    CHECK(isfinite(stats.mean) && isfinite(stats.m2));
+    CHECK(test_binned(&stats, values, TEST_PIXELS, -9999.0));
+}
+
+// ----------------------------------------------------------------
+// The strips merged in order match one pass over the band and give
+// the same bits on every run, the histogram spans zero
+static void test_merge(const double * values) {
+    gistk_stats_t whole;
+    gistk_stats_init(&whole);
+    gistk_stats_add(&whole, values, TEST_PIXELS, true, -9999.0);
+
+    gistk_stats_t merged[2];
+    for (int run=0; run < 2; run++) {
+        gistk_stats_init(&merged[run]);
+        for (int j=0; j < TEST_STRIPS; j++) {
+            int first, num;
+            test_strip(j, &first, &num);
+            gistk_stats_t strip;
+            gistk_stats_init(&strip);
+            gistk_stats_add(&strip, values + first, num, true, -9999.0);
+            gistk_stats_merge(&merged[run], &strip);
+        }
+    }
+    CHECK(memcmp(&merged[0], &merged[1], sizeof(gistk_stats_t)) == 0);
+
+    gistk_stats_t * stats = &merged[0];
+    CHECK(stats->total == whole.total);
+    CHECK(stats->count == whole.count);
+    CHECK(stats->min == whole.min);
+    CHECK(stats->max == whole.max);
+    CHECK_NEAR(stats->mean, whole.mean, 1e-9 * fabs(whole.mean) + 1e-9);
+    CHECK_NEAR(stats->m2, whole.m2, 1e-9 * whole.m2);
+    CHECK(stats->lo < 0.0 && stats->lo + stats->width > 0.0);
+    CHECK(test_binned(stats, values, TEST_PIXELS, -9999.0));
+    CHECK_NEAR(gistk_stats_percentile(stats, 50.0),
+               gistk_stats_percentile(&whole, 50.0),
+               stats->width / GISTK_STATS_BINS);
+}
+
+// ----------------------------------------------------------------
+// Strips far apart on both sides of zero, merged from either end
+static void test_apart(void) {
+    const double values[] = { -0.75, -0.5, 3.0, 1000.0, 1001.5,
+                              -70000.0, 0.0, 2.5e6, 1e-3 };
+    int n = sizeof(values) / sizeof(double);
+    for (int dir=0; dir < 2; dir++) {
+        gistk_stats_t stats;
+        gistk_stats_init(&stats);
+        for (int i=0; i < n; i++) {
+            gistk_stats_t single;
+            gistk_stats_init(&single);
+            gistk_stats_add(&single, values + (dir ? n - 1 - i : i), 1,
+                            false, 0.0);
+            gistk_stats_merge(&stats, &single);
+        }
+        CHECK(stats.count == (GUIntBig) n);
+        CHECK(stats.min == -70000.0 && stats.max == 2.5e6);
+        CHECK(test_binned(&stats, values, n, NAN));
+    }
+}
+
+// ----------------------------------------------------------------
+// Empty accumulators merge without changing the other side
+static void test_empty(void) {
+    gistk_stats_t stats, empty;
+    gistk_stats_init(&stats);
+    gistk_stats_init(&empty);
+    const double values[] = { 1.0, 2.0, 3.0, NAN };
+    gistk_stats_add(&empty, values + 3, 1, false, 0.0);
+    gistk_stats_merge(&stats, &empty);
+    CHECK(stats.count == 0);
+    CHECK(stats.total == 1);
+    CHECK_NAN(gistk_stats_percentile(&stats, 50.0));
+
+    gistk_stats_add(&empty, values, 3, false, 0.0);
+    gistk_stats_merge(&stats, &empty);
+    CHECK(stats.count == 3);
+    CHECK(stats.total == 5);
+    CHECK(stats.min == 1.0 && stats.max == 3.0);
+    CHECK(stats.mean == 2.0);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    double * values = malloc(TEST_PIXELS * sizeof(double));
+    test_fill(values);
+    test_invalid(values);
+    test_merge(values);
+    test_apart();
+    test_empty();
+    free(values);
+    return test_done("test-stats");
+}
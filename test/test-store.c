@@ -0,0 +1,165 @@
+// =====================================================================
+// Tests of the result store
+// =====================================================================
+
+#define _XOPEN_SOURCE 700
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ifgdv/store.h"
+#include "test.h"
+
+// Size of a test result [bytes]
+#define TEST_SIZE 1000
+
+// Process id of no process, above any pid_max
+#define TEST_DEAD_PID 2147483646L
+
+// Directory of the test files
+static char test_dir[] = "/tmp/test-store.XXXXXX";
+
+// ----------------------------------------------------------------
+// Name of a file in the test directory
+static const char * test_path(const char * name) {
+    static char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+    return path;
+}
+
+// ----------------------------------------------------------------
+// Path of a stored result, laid out like the store does
+static const char * test_result(uint64_t key) {
+    static char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/store/%02x/%016llx", test_dir,
+             (unsigned) (key >> 56), (unsigned long long) key);
+    return path;
+}
+
+// ----------------------------------------------------------------
+static void test_write(const char * path, char fill, size_t size) {
+    FILE * fp = fopen(path, "wb");
+    if ( fp == NULL ) return;
+    for (size_t i=0; i < size; i++) fputc(fill, fp);
+    fclose(fp);
+}
+
+// ----------------------------------------------------------------
+// First byte of a file, 0 if it is missing or empty
+static char test_read(const char * path) {
+    FILE * fp = fopen(path, "rb");
+    if ( fp == NULL ) return 0;
+    int c = fgetc(fp);
+    fclose(fp);
+    return c == EOF ? 0 : (char) c;
+}
+
+// ----------------------------------------------------------------
+// Number of entries of the index
+static long test_index(void) {
+    struct stat info;
+    if ( stat(test_path("store/" GISTK_STORE_INDEX), &info) != 0 ) return -1;
+    return (long) ((info.st_size - 8) / sizeof(gistk_store_entry_t));
+}
+
+// ----------------------------------------------------------------
+static void test_open(const char * source, const gistk_cut_opts_t * opts,
+                      uint64_t max_bytes, gistk_store_t * store) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", test_path("store"));
+    gistk_store_open(dir, test_path(source), opts, "tif",
+                     max_bytes, false, store);
+}
+
+// ----------------------------------------------------------------
+int main(void) {
+    if ( mkdtemp(test_dir) == NULL ) {
+        perror("test-store");
+        return EXIT_FAILURE;
+    }
+    test_write(test_path("source.tif"), 's', 64);
+    gistk_cut_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.conv.scale = 1.0;
+
+    // Stored results are served and survive the run
+    gistk_store_t store;
+    test_open("source.tif", &opts, GISTK_STORE_BUDGET, &store);
+    uint64_t keys[4];
+    for (int k=0; k < 4; k++)
+        keys[k] = gistk_store_key(&store, 100 * k, 0, 64, 64, 64, 64, 1);
+    CHECK(keys[0] != keys[1]);
+    char out[PATH_MAX];
+    snprintf(out, sizeof(out), "%s", test_path("out.tif"));
+    for (int k=0; k < 3; k++) {
+        CHECK(! gistk_store_get(&store, keys[k], out));
+        test_write(out, (char) ('a' + k), TEST_SIZE);
+        gistk_store_put(&store, keys[k], out);
+    }
+    CHECK(store.misses == 3 && store.stores == 3);
+    gistk_store_close(&store);
+    CHECK(test_index() == 3);
+    CHECK(store.num_bytes == 3 * TEST_SIZE);
+
+    test_open("source.tif", &opts, GISTK_STORE_BUDGET, &store);
+    CHECK(gistk_store_get(&store, keys[1], out));
+    CHECK(test_read(out) == 'b');
+    CHECK(! gistk_store_get(&store, keys[3], out));
+    CHECK(access(out, F_OK) != 0);
+    CHECK(gistk_store_get(&store, keys[2], out));
+    gistk_store_unget(&store, out);
+    CHECK(access(out, F_OK) != 0);
+    CHECK(store.hits == 1 && store.misses == 2);
+    gistk_store_close(&store);
+
+    // Other options or another source never hit
+    gistk_cut_opts_t other = opts;
+    other.conv.scale = 2.0;
+    test_open("source.tif", &other, GISTK_STORE_BUDGET, &store);
+    CHECK(gistk_store_key(&store, 0, 0, 64, 64, 64, 64, 1) != keys[0]);
+    gistk_store_close(&store);
+    test_write(test_path("other.tif"), 's', 64);
+    test_open("other.tif", &opts, GISTK_STORE_BUDGET, &store);
+    CHECK(gistk_store_key(&store, 0, 0, 64, 64, 64, 64, 1) != keys[0]);
+    gistk_store_close(&store);
+
+    // A killed run left a result outside the index, a temporary file
+    // of its own and one of a running process; a result is gone
+    test_open("source.tif", &opts, GISTK_STORE_BUDGET, &store);
+    uint64_t orphan = gistk_store_key(&store, 300, 0, 64, 64, 64, 64, 1);
+    gistk_store_close(&store);
+    char sub[PATH_MAX], stale[PATH_MAX], live[PATH_MAX];
+    snprintf(sub, sizeof(sub), "%s/store/%02x", test_dir,
+             (unsigned) (orphan >> 56));
+    mkdir(sub, 0775);
+    test_write(test_result(orphan), 'd', TEST_SIZE);
+    snprintf(stale, sizeof(stale), "%s/tmp.%ld.0", sub, TEST_DEAD_PID);
+    snprintf(live, sizeof(live), "%s/tmp.%ld.0", sub, (long) getpid());
+    test_write(stale, 'x', 10);
+    test_write(live, 'y', 10);
+    unlink(test_result(keys[0]));
+    CHECK(test_index() == 3);
+
+    test_open("source.tif", &opts, GISTK_STORE_BUDGET, &store);
+    CHECK(test_index() == 3);
+    CHECK(access(stale, F_OK) != 0);
+    CHECK(access(live, F_OK) == 0);
+    CHECK(gistk_store_get(&store, orphan, out));
+    CHECK(test_read(out) == 'd');
+    CHECK(! gistk_store_get(&store, keys[0], out));
+    gistk_store_close(&store);
+    CHECK(test_index() == 3);
+    unlink(live);
+
+    // The size cap evicts down to the budget
+    test_open("source.tif", &opts, 2 * TEST_SIZE + TEST_SIZE / 2, &store);
+    gistk_store_close(&store);
+    CHECK(store.evictions == 1);
+    CHECK(store.num_bytes == 2 * TEST_SIZE);
+    CHECK(test_index() == 2);
+
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    CHECK(system(cmd) == 0);
+    return test_done("test-store");
+}
@@ -0,0 +1,48 @@
+/* test.h --- Minimal checks of the C tests
+ */
+
+#ifndef INCLUDED_TEST_H
+#define INCLUDED_TEST_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Number of failed checks of the test program
+static int test_failures = 0;
+
+// ---------------------------------------------------------------
+/**
+ * Checks a condition, a failure is reported with its position and
+ * the test goes on
+ */
+#define CHECK(cond) do {                                          \
+    if ( ! (cond) ) {                                             \
+        fprintf(stderr, "%s:%d: check failed: %s\n",              \
+                __FILE__, __LINE__, #cond);                       \
+        test_failures++;                                          \
+    }                                                             \
+  } while (0)
+
+// Checks two doubles within a tolerance
+#define CHECK_NEAR(a, b, eps) CHECK(fabs((a) - (b)) <= (eps))
+
+// Checks a NaN
+#define CHECK_NAN(a) CHECK(isnan(a))
+
+// ---------------------------------------------------------------
+/**
+ * Reports the result of the test program, use as its return value
+ * @param name name of the test
+ * @return the exit code, 0 if all checks passed
+ */
+static inline int test_done(const char * name) {
+    if ( test_failures > 0 ) {
+        fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("%s: ok\n", name);
+    return EXIT_SUCCESS;
+}
+
+#endif /* INCLUDED_TEST_H */